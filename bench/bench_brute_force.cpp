@@ -0,0 +1,117 @@
+// Compare the pair-at-a-time brute force query with the tiled inner product
+// search, and check that both find the same neighbors. This is done for
+// N(0, 1) data, and again for the same data shrunk and moved far from the
+// origin (1000 + 0.01 * N(0, 1)), where the norms are much larger than the
+// distances between items.
+//
+// Build and run from this directory:
+//
+// g++ -std=c++17 -O2 -I../inst/include bench_brute_force.cpp -pthread
+// ./a.out [n_ref] [n_query] [ndim] [n_nbrs] [n_threads]
+
+#include <iomanip>
+#include <string>
+
+#include "bench_common.h"
+#include "tdoann/bruteforce.h"
+#include "tdoann/distancebase.h"
+#include "tdoann/distancesimd.h"
+
+using bench::Idx;
+using In = float;
+using Out = float;
+using It = tdoann::DataIt<In>;
+
+// fraction of neighbors in graph that are also in the reference graph
+auto overlap(const tdoann::NNGraph<Out, Idx> &graph,
+             const tdoann::NNGraph<Out, Idx> &ref_graph) -> double {
+  std::size_t n_found = 0;
+  for (std::size_t i = 0; i < graph.n_points; i++) {
+    for (std::size_t j = 0; j < graph.n_nbrs; j++) {
+      const auto idx = graph.idx[i * graph.n_nbrs + j];
+      for (std::size_t k = 0; k < ref_graph.n_nbrs; k++) {
+        if (ref_graph.idx[i * ref_graph.n_nbrs + k] == idx) {
+          ++n_found;
+          break;
+        }
+      }
+    }
+  }
+  return static_cast<double>(n_found) / graph.idx.size();
+}
+
+void run(const std::string &label, tdoann::DistanceFunc<In, Out> distance_func,
+         tdoann::PreprocessFunc<In> preprocess_func,
+         tdoann::InnerProductMetric metric, const std::vector<In> &ref,
+         const std::vector<In> &query, std::size_t ndim, Idx n_nbrs,
+         std::size_t n_threads) {
+  const tdoann::QueryDistanceCalculator<In, Out, Idx> distance(
+      std::vector<In>(ref), std::vector<In>(query), ndim, distance_func,
+      preprocess_func);
+  tdoann::NullProgress progress;
+  bench::ThreadExecutor executor;
+
+  bench::Timer timer;
+  auto pair_graph = tdoann::brute_force_query(distance, n_nbrs, n_threads,
+                                              progress, executor);
+  const double pair_elapsed = timer.elapsed();
+
+  timer = bench::Timer();
+  auto tiled_graph = tdoann::tiled_brute_force_query(
+      distance, ndim, metric, n_nbrs, n_threads, progress, executor);
+  const double tiled_elapsed = timer.elapsed();
+
+  std::cout << std::left << std::setw(20) << label << std::fixed
+            << std::setprecision(3) << " pairwise " << pair_elapsed
+            << "s tiled " << tiled_elapsed << "s overlap "
+            << overlap(tiled_graph, pair_graph) << std::endl;
+}
+
+void run_all(const std::vector<In> &ref, const std::vector<In> &query,
+             std::size_t ndim, Idx n_nbrs, std::size_t n_threads) {
+  using tdoann::InnerProductMetric;
+  run("sqeuclidean", tdoann::simd_squared_euclidean<Out, It>, nullptr,
+      InnerProductMetric::SquaredEuclidean, ref, query, ndim, n_nbrs,
+      n_threads);
+  run("euclidean", tdoann::simd_euclidean<Out, It>, nullptr,
+      InnerProductMetric::Euclidean, ref, query, ndim, n_nbrs, n_threads);
+  run("cosine", tdoann::simd_cosine<Out, It>, nullptr,
+      InnerProductMetric::Cosine, ref, query, ndim, n_nbrs, n_threads);
+  run("alternative-cosine", tdoann::simd_alternative_cosine<Out, It>, nullptr,
+      InnerProductMetric::AlternativeCosine, ref, query, ndim, n_nbrs,
+      n_threads);
+  run("cosine-preprocess", tdoann::simd_inner_product<Out, It>,
+      tdoann::normalize<In>, InnerProductMetric::InnerProduct, ref, query,
+      ndim, n_nbrs, n_threads);
+  run("dot", tdoann::simd_dot<Out, It>, tdoann::normalize<In>,
+      InnerProductMetric::Dot, ref, query, ndim, n_nbrs, n_threads);
+  run("alternative-dot", tdoann::simd_alternative_dot<Out, It>,
+      tdoann::normalize<In>, InnerProductMetric::AlternativeDot, ref, query,
+      ndim, n_nbrs, n_threads);
+}
+
+int main(int argc, char **argv) {
+  const std::size_t n_ref = bench::arg_or(argc, argv, 1, 10000);
+  const std::size_t n_query = bench::arg_or(argc, argv, 2, 2000);
+  const std::size_t ndim = bench::arg_or(argc, argv, 3, 128);
+  const auto n_nbrs = static_cast<Idx>(bench::arg_or(argc, argv, 4, 15));
+  const std::size_t n_threads = bench::arg_or(argc, argv, 5, 0);
+
+  std::cout << "n_ref = " << n_ref << " n_query = " << n_query
+            << " ndim = " << ndim << " n_nbrs = " << n_nbrs
+            << " n_threads = " << n_threads << std::endl;
+
+  auto ref = bench::random_data(n_ref, ndim);
+  auto query = bench::random_data(n_query, ndim, 1337);
+  run_all(ref, query, ndim, n_nbrs, n_threads);
+
+  std::cout << "offset data" << std::endl;
+  for (auto *data : {&ref, &query}) {
+    for (auto &x : *data) {
+      x = 1000.0F + 0.01F * x;
+    }
+  }
+  run_all(ref, query, ndim, n_nbrs, n_threads);
+
+  return 0;
+}
@@ -0,0 +1,131 @@
+// Speed of the parallel build_candidates with the previous implementation,
+// where every push onto the candidate heaps took one of ten mutexes, against
+// the current one, which writes candidates into per-block buckets and then
+// fills each partition of the heaps from one thread. Also checks that the
+// bucketed version gives the same candidates for every number of threads.
+//
+// Build and run from this directory:
+//
+// g++ -std=c++17 -O2 -I../inst/include bench_build_candidates.cpp -pthread
+// ./a.out [n_points] [n_nbrs] [max_threads]
+
+#include <array>
+#include <iomanip>
+#include <mutex>
+
+#include "bench_common.h"
+#include "tdoann/nndparallel.h"
+
+using bench::Idx;
+using Out = float;
+
+void locking_build_candidates(const tdoann::NNDHeap<Out, Idx> &current_graph,
+                              tdoann::NNHeap<Out, Idx> &new_nbrs,
+                              tdoann::NNHeap<Out, Idx> &old_nbrs,
+                              tdoann::ParallelRandomProvider &parallel_rand,
+                              std::size_t n_threads,
+                              const tdoann::Executor &executor) {
+  constexpr auto npos = static_cast<Idx>(-1);
+  const std::size_t n_nbrs = current_graph.n_nbrs;
+  std::array<std::mutex, 10> mutexes;
+  auto push = [&](tdoann::NNHeap<Out, Idx> &nbrs, Idx row, Out weight,
+                  Idx idx) {
+    std::lock_guard<std::mutex> guard(mutexes[row % mutexes.size()]);
+    nbrs.checked_push(row, weight, idx);
+  };
+
+  parallel_rand.initialize();
+  auto worker = [&](std::size_t begin, std::size_t end) {
+    auto rand = parallel_rand.get_parallel_instance(end);
+    for (auto i = begin, idx_offset = begin * n_nbrs; i < end;
+         i++, idx_offset += n_nbrs) {
+      for (auto idx_ij = idx_offset; idx_ij < idx_offset + n_nbrs; idx_ij++) {
+        const auto nbr = current_graph.idx[idx_ij];
+        if (nbr == npos) {
+          continue;
+        }
+        auto &nbrs = current_graph.flags[idx_ij] == 1 ? new_nbrs : old_nbrs;
+        auto rand_weight = rand->unif();
+        push(nbrs, i, rand_weight, nbr);
+        if (i != nbr) {
+          push(nbrs, nbr, rand_weight, i);
+        }
+      }
+    }
+  };
+  tdoann::dispatch_work(worker, current_graph.n_points, n_threads, executor);
+}
+
+auto same_candidates(const tdoann::NNHeap<Out, Idx> &heap1,
+                     const tdoann::NNHeap<Out, Idx> &heap2) -> bool {
+  return heap1.idx == heap2.idx && heap1.dist == heap2.dist;
+}
+
+int main(int argc, char **argv) {
+  const std::size_t n_points = bench::arg_or(argc, argv, 1, 1000000);
+  const std::size_t n_nbrs = bench::arg_or(argc, argv, 2, 15);
+  const std::size_t max_threads = bench::arg_or(argc, argv, 3, 64);
+  constexpr std::size_t n_reps = 5;
+
+  std::cout << "n_points = " << n_points << " n_nbrs = " << n_nbrs
+            << " max_threads = " << max_threads << std::endl;
+
+  // a random graph with half the neighbors flagged as new
+  tdoann::NNDHeap<Out, Idx> current_graph(n_points, n_nbrs);
+  std::mt19937_64 prng(42);
+  std::uniform_int_distribution<Idx> unif(0, n_points - 1);
+  for (Idx i = 0; i < n_points; i++) {
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      current_graph.checked_push(i, static_cast<Out>(j), unif(prng));
+    }
+  }
+  for (std::size_t ij = 0; ij < current_graph.flags.size(); ij++) {
+    current_graph.flags[ij] = ij % 2;
+  }
+
+  bench::ThreadExecutor executor;
+  tdoann::NNDWorkspace<Out, Idx> reference(n_points, n_nbrs);
+  {
+    bench::MTParallelRand parallel_rand(42);
+    tdoann::build_candidates(current_graph, reference.new_nbrs,
+                             reference.old_nbrs, false, parallel_rand, 1,
+                             executor);
+  }
+
+  tdoann::NNDWorkspace<Out, Idx> workspace(n_points, n_nbrs);
+  tdoann::CandidateBuckets<Out, Idx> buckets;
+  for (std::size_t n_threads = 1; n_threads <= max_threads; n_threads *= 2) {
+    bench::MTParallelRand locking_rand(42);
+    bench::Timer timer;
+    for (std::size_t rep = 0; rep < n_reps; rep++) {
+      workspace.reset(n_threads, executor);
+      locking_build_candidates(current_graph, workspace.new_nbrs,
+                               workspace.old_nbrs, locking_rand, n_threads,
+                               executor);
+    }
+    const double locking_elapsed = timer.elapsed() / n_reps;
+
+    bench::MTParallelRand parallel_rand(42);
+    timer = bench::Timer();
+    bool deterministic = true;
+    for (std::size_t rep = 0; rep < n_reps; rep++) {
+      workspace.reset(n_threads, executor);
+      tdoann::build_candidates(current_graph, workspace.new_nbrs,
+                               workspace.old_nbrs, false, parallel_rand,
+                               n_threads, executor, buckets);
+      if (rep == 0) {
+        deterministic =
+            same_candidates(workspace.new_nbrs, reference.new_nbrs) &&
+            same_candidates(workspace.old_nbrs, reference.old_nbrs);
+      }
+    }
+    const double bucket_elapsed = timer.elapsed() / n_reps;
+
+    std::cout << std::left << std::setw(4) << n_threads << std::fixed
+              << std::setprecision(3) << " locking " << locking_elapsed
+              << "s buckets " << bucket_elapsed << "s same as 1 thread "
+              << (deterministic ? "yes" : "no") << std::endl;
+  }
+
+  return 0;
+}
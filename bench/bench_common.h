@@ -0,0 +1,184 @@
+// Shared helpers for the standalone C++ benchmarks in this directory. These
+// only depend on the header-only tdoann library and the standard library, so
+// they can be built without R, e.g.:
+//
+// g++ -std=c++17 -O2 -I../inst/include bench_static_distance.cpp -pthread
+//
+// None of this is part of the R package.
+
+#ifndef RNN_BENCH_COMMON_H
+#define RNN_BENCH_COMMON_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "pforr.h"
+#include "tdoann/heap.h"
+#include "tdoann/nndcommon.h"
+#include "tdoann/parallel.h"
+#include "tdoann/random.h"
+
+namespace bench {
+
+using Idx = uint32_t;
+
+class Timer {
+  std::chrono::steady_clock::time_point start{
+      std::chrono::steady_clock::now()};
+
+public:
+  auto elapsed() const -> double {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+  }
+};
+
+class MTRand : public tdoann::RandomGenerator {
+  std::mt19937_64 prng;
+  std::uniform_real_distribution<double> dist{0.0, 1.0};
+
+public:
+  explicit MTRand(uint64_t seed) : prng(seed) {}
+  double unif() override { return dist(prng); }
+};
+
+class MTParallelRand : public tdoann::ParallelRandomProvider {
+  uint64_t seed;
+
+public:
+  explicit MTParallelRand(uint64_t seed) : seed(seed) {}
+  void initialize() override { seed++; }
+  std::unique_ptr<tdoann::RandomGenerator>
+  get_parallel_instance(uint64_t seed2) override {
+    return std::make_unique<MTRand>(seed * 1000003ULL + seed2);
+  }
+};
+
+class MTIntRand : public tdoann::RandomIntGenerator<Idx> {
+  std::mt19937_64 prng;
+
+public:
+  explicit MTIntRand(uint64_t seed) : prng(seed) {}
+  Idx rand_int(Idx n) override {
+    return std::uniform_int_distribution<Idx>(0, n - 1)(prng);
+  }
+  // n_ints distinct integers, by Floyd's algorithm
+  std::vector<Idx> sample(int max_val, int n_ints) override {
+    std::vector<Idx> result;
+    for (int j = max_val - n_ints; j < max_val; j++) {
+      const Idx t = rand_int(static_cast<Idx>(j + 1));
+      if (std::find(result.begin(), result.end(), t) == result.end()) {
+        result.push_back(t);
+      } else {
+        result.push_back(static_cast<Idx>(j));
+      }
+    }
+    return result;
+  }
+};
+
+class MTParallelIntRand : public tdoann::ParallelRandomIntProvider<Idx> {
+  uint64_t seed;
+
+public:
+  explicit MTParallelIntRand(uint64_t seed) : seed(seed) {}
+  void initialize() override { seed++; }
+  std::unique_ptr<tdoann::RandomIntGenerator<Idx>>
+  get_parallel_instance(uint64_t seed2) override {
+    return std::make_unique<MTIntRand>(seed * 1000003ULL + seed2);
+  }
+};
+
+// Uses a persistent thread pool, like the package's RParallelExecutor
+class ThreadExecutor : public tdoann::Executor {
+public:
+  void parallel_for(std::size_t begin, std::size_t end,
+                    std::function<void(std::size_t, std::size_t)> worker,
+                    std::size_t n_threads,
+                    std::size_t grain_size) const override {
+    static pforr::ThreadPool pool;
+    pool.parallel_for(begin, end, worker, n_threads, grain_size);
+  }
+};
+
+// Silent progress for NN-descent: never interrupts or stops early except on
+// convergence
+class QuietNNDProgress : public tdoann::NNDProgressBase {
+  tdoann::NullProgress progress;
+
+public:
+  tdoann::ProgressBase &get_base_progress() override { return progress; }
+  void set_n_batches(uint32_t) override {}
+  void batch_finished() override {}
+  void iter_finished() override {}
+  void stopping_early() override {}
+  bool check_interrupt() override { return false; }
+  void log(const std::string &) override {}
+  void converged(std::size_t, double) override {}
+  tdoann::ReportingAction get_reporting_action() const override {
+    return tdoann::ReportingAction::DoNothing;
+  }
+};
+
+inline auto random_data(std::size_t n_points, std::size_t ndim,
+                        uint64_t seed = 42) -> std::vector<float> {
+  std::mt19937_64 prng(seed);
+  std::normal_distribution<float> dist;
+  std::vector<float> data(n_points * ndim);
+  for (auto &x : data) {
+    x = dist(prng);
+  }
+  return data;
+}
+
+// fill each row of the heap with k random neighbors
+template <typename Distance, typename NbrHeap>
+void random_init(const Distance &distance, NbrHeap &heap, uint64_t seed = 42) {
+  std::mt19937_64 prng(seed);
+  std::uniform_int_distribution<Idx> unif(0, heap.n_points - 1);
+  for (Idx i = 0; i < heap.n_points; i++) {
+    for (std::size_t j = 0; j < heap.n_nbrs; j++) {
+      const Idx nbr = unif(prng);
+      heap.checked_push(i, distance.calculate(i, nbr), nbr);
+    }
+  }
+}
+
+// fraction of the neighbors in heap that are in the exact neighbors
+template <typename NbrHeap, typename Distance>
+auto recall(const NbrHeap &heap, const Distance &distance,
+            std::size_t n_sample = 200) -> double {
+  const std::size_t n_points = heap.n_points;
+  const std::size_t k = heap.n_nbrs;
+  std::size_t n_found = 0;
+  for (std::size_t s = 0; s < n_sample; s++) {
+    const Idx i = static_cast<Idx>((s * 7919) % n_points);
+    tdoann::NNHeap<float, Idx> exact(1, k);
+    for (Idx j = 0; j < n_points; j++) {
+      exact.checked_push(0, distance.calculate(i, j), j);
+    }
+    for (std::size_t a = 0; a < k; a++) {
+      if (exact.contains(0, heap.index(i, a))) {
+        n_found++;
+      }
+    }
+  }
+  return static_cast<double>(n_found) / (n_sample * k);
+}
+
+inline auto arg_or(int argc, char **argv, int i, std::size_t default_value)
+    -> std::size_t {
+  return argc > i ? std::strtoul(argv[i], nullptr, 10) : default_value;
+}
+
+} // namespace bench
+
+#endif // RNN_BENCH_COMMON_H
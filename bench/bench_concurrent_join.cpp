@@ -0,0 +1,78 @@
+// Thread scaling of the parallel low memory local join: the two-phase join
+// (parallel generation of updates, followed by applying them with one shard
+// of rows per thread) versus the concurrent join, where each thread pushes its
+// updates straight into the graph under per-row locks. The number of threads doubles from 1 up to
+// max_threads.
+//
+// Build and run from this directory:
+//
+// g++ -std=c++17 -O2 -I../inst/include bench_concurrent_join.cpp -pthread
+// ./a.out [n_points] [ndim] [n_nbrs] [max_threads]
+
+#include <iomanip>
+#include <memory>
+
+#include "bench_common.h"
+#include "tdoann/distancebase.h"
+#include "tdoann/distancesimd.h"
+#include "tdoann/nndparallel.h"
+
+using bench::Idx;
+using In = float;
+using Out = float;
+using It = tdoann::DataIt<In>;
+using Distance =
+    tdoann::StaticSelfDistanceCalculator<In, Out, Idx,
+                                         tdoann::simd_squared_euclidean<Out, It>>;
+
+auto run(const Distance &distance, std::size_t n_nbrs, std::size_t n_threads,
+         bool concurrent) -> void {
+  tdoann::NNDHeap<Out, Idx> heap(distance.get_nx(), n_nbrs);
+  bench::random_init(distance, heap);
+  bench::QuietNNDProgress progress;
+  constexpr uint32_t n_iters = 10;
+  constexpr double delta = 0.001;
+  const std::size_t max_candidates = n_nbrs;
+
+  bench::Timer timer;
+  std::unique_ptr<tdoann::ParallelLocalJoin<Out, Idx>> local_join;
+  if (concurrent) {
+    local_join = std::make_unique<
+        tdoann::ConcurrentLowMemParallelLocalJoin<Out, Idx, Distance>>(
+        heap, distance);
+  } else {
+    local_join =
+        std::make_unique<tdoann::LowMemParallelLocalJoin<Out, Idx, Distance>>(
+            distance, n_threads);
+  }
+  bench::MTParallelRand parallel_rand(42);
+  bench::ThreadExecutor executor;
+  tdoann::nnd_build(heap, *local_join, max_candidates, n_iters, delta, false,
+                    progress, parallel_rand, n_threads, executor);
+  const double elapsed = timer.elapsed();
+
+  std::cout << std::left << std::setw(4) << n_threads
+            << (concurrent ? " concurrent " : " two-phase  ") << std::fixed
+            << std::setprecision(3) << elapsed << "s recall "
+            << bench::recall(heap, distance) << std::endl;
+}
+
+int main(int argc, char **argv) {
+  const std::size_t n_points = bench::arg_or(argc, argv, 1, 100000);
+  const std::size_t ndim = bench::arg_or(argc, argv, 2, 32);
+  const std::size_t n_nbrs = bench::arg_or(argc, argv, 3, 15);
+  const std::size_t max_threads = bench::arg_or(argc, argv, 4, 64);
+
+  std::cout << "n_points = " << n_points << " ndim = " << ndim
+            << " n_nbrs = " << n_nbrs << " max_threads = " << max_threads
+            << std::endl;
+
+  const Distance distance(bench::random_data(n_points, ndim), ndim);
+
+  for (std::size_t n_threads = 1; n_threads <= max_threads; n_threads *= 2) {
+    run(distance, n_nbrs, n_threads, false);
+    run(distance, n_nbrs, n_threads, true);
+  }
+
+  return 0;
+}
@@ -0,0 +1,138 @@
+// Memory use and speed of the open addressing EdgeCache compared to the
+// previous implementation (a std::unordered_set per item). The set version
+// uses a counting allocator so its memory use can be measured. The workload
+// is the initial cache built from a random k-nearest neighbor graph, followed
+// by a mix of lookups and inserts of random pairs, like the cache local join.
+//
+// Build and run from this directory:
+//
+// g++ -std=c++17 -O2 -I../inst/include bench_edge_cache.cpp -pthread
+// ./a.out [n_points] [n_nbrs] [n_ops]
+
+#include <iomanip>
+#include <unordered_set>
+
+#include "bench_common.h"
+#include "tdoann/nndcommon.h"
+
+using bench::Idx;
+
+std::size_t allocated_bytes = 0;
+
+template <typename T> struct CountingAllocator {
+  using value_type = T;
+
+  CountingAllocator() = default;
+  template <typename U> CountingAllocator(const CountingAllocator<U> &) {}
+
+  auto allocate(std::size_t n) -> T * {
+    allocated_bytes += n * sizeof(T);
+    return std::allocator<T>().allocate(n);
+  }
+  void deallocate(T *p, std::size_t n) {
+    allocated_bytes -= n * sizeof(T);
+    std::allocator<T>().deallocate(p, n);
+  }
+  template <typename U> auto operator==(const CountingAllocator<U> &) const {
+    return true;
+  }
+  template <typename U> auto operator!=(const CountingAllocator<U> &) const {
+    return false;
+  }
+};
+
+struct SetEdgeCache {
+  using Set = std::unordered_set<Idx, std::hash<Idx>, std::equal_to<Idx>,
+                                 CountingAllocator<Idx>>;
+  std::vector<Set> seen;
+
+  SetEdgeCache(std::size_t n_points, std::size_t n_nbrs,
+               const std::vector<Idx> &idx_data)
+      : seen(n_points) {
+    for (Idx i = 0, innbrs = 0; i < n_points; i++, innbrs += n_nbrs) {
+      for (std::size_t j = 0, idx_ij = innbrs; j < n_nbrs; j++, idx_ij++) {
+        auto idx_p = idx_data[idx_ij];
+        if (i > idx_p) {
+          seen[idx_p].emplace(i);
+        } else {
+          seen[i].emplace(idx_p);
+        }
+      }
+    }
+  }
+
+  auto contains(const Idx &idx_p, const Idx &idx_q) const -> bool {
+    return seen[idx_p].find(idx_q) != seen[idx_p].end();
+  }
+
+  auto insert(Idx idx_p, Idx idx_q) -> bool {
+    return !seen[idx_p].emplace(idx_q).second;
+  }
+
+  auto memory_size() const -> std::size_t {
+    return seen.size() * sizeof(Set) + allocated_bytes;
+  }
+};
+
+// pairs in the neighborhood of each other, so some are already cached
+auto random_pairs(std::size_t n_points, std::size_t n_ops)
+    -> std::vector<std::pair<Idx, Idx>> {
+  std::mt19937_64 prng(1337);
+  std::uniform_int_distribution<Idx> unif(0, n_points - 1);
+  std::vector<std::pair<Idx, Idx>> pairs(n_ops);
+  for (auto &pair : pairs) {
+    pair = std::minmax(unif(prng), unif(prng));
+  }
+  return pairs;
+}
+
+template <typename Cache>
+void run(const std::string &label, std::size_t n_points, std::size_t n_nbrs,
+         const std::vector<Idx> &idx,
+         const std::vector<std::pair<Idx, Idx>> &pairs) {
+  bench::Timer timer;
+  Cache cache(n_points, n_nbrs, idx);
+  const double build_elapsed = timer.elapsed();
+  const std::size_t build_bytes = cache.memory_size();
+
+  timer = bench::Timer();
+  std::size_t n_found = 0;
+  for (const auto &[p, q] : pairs) {
+    if (cache.contains(p, q)) {
+      ++n_found;
+    } else {
+      cache.insert(p, q);
+    }
+  }
+  const double ops_elapsed = timer.elapsed();
+
+  std::cout << std::left << std::setw(16) << label << std::fixed
+            << std::setprecision(3) << " build " << build_elapsed << "s "
+            << std::setprecision(1) << build_bytes / 1048576.0 << " MB ops "
+            << std::setprecision(3) << ops_elapsed << "s "
+            << std::setprecision(1) << cache.memory_size() / 1048576.0
+            << " MB found " << n_found << std::endl;
+}
+
+int main(int argc, char **argv) {
+  const std::size_t n_points = bench::arg_or(argc, argv, 1, 1000000);
+  const std::size_t n_nbrs = bench::arg_or(argc, argv, 2, 15);
+  const std::size_t n_ops = bench::arg_or(argc, argv, 3, 10000000);
+
+  std::cout << "n_points = " << n_points << " n_nbrs = " << n_nbrs
+            << " n_ops = " << n_ops << std::endl;
+
+  std::mt19937_64 prng(42);
+  std::uniform_int_distribution<Idx> unif(0, n_points - 1);
+  std::vector<Idx> idx(n_points * n_nbrs);
+  for (auto &nbr : idx) {
+    nbr = unif(prng);
+  }
+  const auto pairs = random_pairs(n_points, n_ops);
+
+  run<SetEdgeCache>("unordered_set", n_points, n_nbrs, idx, pairs);
+  run<tdoann::EdgeCache<Idx>>("open addressing", n_points, n_nbrs, idx,
+                              pairs);
+
+  return 0;
+}
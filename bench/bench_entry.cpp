@@ -0,0 +1,172 @@
+// Graph search seeded with entry points from a small hierarchy of sampled
+// items (see tdoann/entry.h) compared with random seeds. Each query is
+// searched for with the same graph either way. The report shows the distances
+// calculated to find the seeds and during the search, and the recall. Good
+// seeds matter most when the number of distance calculations in the search is
+// limited, and when the data is clustered (n_clusters > 0), where the kNN graph
+// may not connect the clusters.
+//
+// Build and run from this directory:
+//
+// g++ -std=c++17 -O2 -I../inst/include bench_entry.cpp -pthread
+// ./a.out [n_points] [n_queries] [ndim] [n_nbrs] [max_distance_calculations]
+//         [n_clusters]
+
+#include <iomanip>
+#include <numeric>
+
+#include "bench_common.h"
+#include "tdoann/distancebase.h"
+#include "tdoann/distancesimd.h"
+#include "tdoann/entry.h"
+#include "tdoann/nndescent.h"
+#include "tdoann/search.h"
+
+using bench::Idx;
+using In = float;
+using Out = float;
+using It = tdoann::DataIt<In>;
+using Distance = tdoann::SelfDistanceCalculator<In, Out, Idx>;
+using QueryDistance = tdoann::QueryDistanceCalculator<In, Out, Idx>;
+
+auto build(const Distance &distance, std::size_t n_nbrs)
+    -> tdoann::NNDHeap<Out, Idx> {
+  tdoann::NNDHeap<Out, Idx> heap(distance.get_nx(), n_nbrs);
+  bench::random_init(distance, heap);
+  bench::QuietNNDProgress progress;
+  bench::MTRand rand(42);
+  tdoann::LowMemSerialLocalJoin<Out, Idx, Distance> local_join(distance);
+  constexpr uint32_t n_iters = 10;
+  constexpr double delta = 0.001;
+  tdoann::nnd_build(heap, local_join, n_nbrs, n_iters, delta, false, rand,
+                    progress);
+  return heap;
+}
+
+// n_points items around n_clusters random centers, or plain normally
+// distributed items if n_clusters is 0
+auto clustered_data(std::size_t n_points, std::size_t ndim,
+                    std::size_t n_clusters, uint64_t seed)
+    -> std::vector<float> {
+  auto data = bench::random_data(n_points, ndim, seed);
+  if (n_clusters == 0) {
+    return data;
+  }
+  // the same centers for the reference and query data
+  auto centers = bench::random_data(n_clusters, ndim, 7);
+  std::mt19937_64 prng(seed);
+  std::uniform_int_distribution<std::size_t> cluster(0, n_clusters - 1);
+  constexpr float center_scale = 10.0F;
+  for (std::size_t i = 0; i < n_points; i++) {
+    const std::size_t c = cluster(prng);
+    for (std::size_t d = 0; d < ndim; d++) {
+      data[i * ndim + d] += center_scale * centers[c * ndim + d];
+    }
+  }
+  return data;
+}
+
+auto mean(const std::vector<std::size_t> &counts) -> double {
+  return static_cast<double>(
+             std::accumulate(counts.begin(), counts.end(), std::size_t{0})) /
+         counts.size();
+}
+
+auto recall(const tdoann::NNHeap<Out, Idx> &result,
+            const tdoann::NNHeap<Out, Idx> &exact) -> double {
+  std::size_t n_found = 0;
+  for (Idx i = 0; i < result.n_points; i++) {
+    for (std::size_t j = 0; j < result.n_nbrs; j++) {
+      if (exact.contains(i, result.index(i, j))) {
+        n_found++;
+      }
+    }
+  }
+  return static_cast<double>(n_found) / (result.n_points * result.n_nbrs);
+}
+
+int main(int argc, char **argv) {
+  const std::size_t n_points = bench::arg_or(argc, argv, 1, 200000);
+  const std::size_t n_queries = bench::arg_or(argc, argv, 2, 1000);
+  const std::size_t ndim = bench::arg_or(argc, argv, 3, 16);
+  const std::size_t n_nbrs = bench::arg_or(argc, argv, 4, 15);
+  const std::size_t max_distance_calculations =
+      bench::arg_or(argc, argv, 5, n_points);
+  const std::size_t n_clusters = bench::arg_or(argc, argv, 6, 0);
+
+  std::cout << "n_points = " << n_points << " n_queries = " << n_queries
+            << " ndim = " << ndim << " n_nbrs = " << n_nbrs
+            << " max_distance_calculations = " << max_distance_calculations
+            << " n_clusters = " << n_clusters << std::endl;
+
+  const auto data = clustered_data(n_points, ndim, n_clusters, 42);
+  const auto queries = clustered_data(n_queries, ndim, n_clusters, 1337);
+  const auto distance_func = tdoann::simd_squared_euclidean<Out, It>;
+  const Distance distance(std::vector<In>(data), ndim, distance_func);
+  const QueryDistance query_distance(data, queries, ndim, distance_func);
+  const auto heap = build(distance, n_nbrs);
+  std::vector<std::size_t> row_ptr(n_points + 1);
+  for (std::size_t i = 0; i <= n_points; i++) {
+    row_ptr[i] = i * n_nbrs;
+  }
+  const tdoann::SparseNNGraph<Out, Idx> search_graph(row_ptr, heap.idx,
+                                                     heap.dist);
+
+  tdoann::NNHeap<Out, Idx> exact(n_queries, n_nbrs);
+  for (Idx i = 0; i < n_queries; i++) {
+    for (Idx j = 0; j < n_points; j++) {
+      exact.checked_push(i, query_distance.calculate(j, i), j);
+    }
+  }
+
+  tdoann::NullProgress progress;
+  tdoann::SerialExecutor executor;
+  bench::MTRand rand(42);
+  bench::Timer timer;
+  const auto layers = tdoann::build_entry_layers(distance, n_nbrs, rand, 0,
+                                                 progress, executor);
+  const double layers_elapsed = timer.elapsed();
+  std::cout << "levels";
+  for (auto size : layers.level_sizes) {
+    std::cout << " " << size;
+  }
+  std::cout << std::fixed << std::setprecision(3) << " built in "
+            << layers_elapsed << "s" << std::endl;
+
+  auto search = [&](const std::string &label, tdoann::NNHeap<Out, Idx> &result,
+                    const std::vector<std::size_t> &init_counts) {
+    std::vector<std::size_t> distance_counts(n_queries);
+    bench::Timer search_timer;
+    tdoann::nn_query(search_graph, result, query_distance, 0.1,
+                     max_distance_calculations, distance_counts, 0, progress,
+                     executor);
+    const double elapsed = search_timer.elapsed();
+    std::cout << std::left << std::setw(8) << label << std::setprecision(1)
+              << " seed distances " << mean(init_counts)
+              << " search distances " << mean(distance_counts) << " recall "
+              << std::setprecision(3) << recall(result, exact) << " time "
+              << std::setprecision(4) << elapsed << "s" << std::endl;
+  };
+
+  std::mt19937_64 prng(1337);
+  std::uniform_int_distribution<Idx> unif(0, n_points - 1);
+  tdoann::NNHeap<Out, Idx> random_result(n_queries, n_nbrs);
+  for (Idx i = 0; i < n_queries; i++) {
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      const Idx nbr = unif(prng);
+      random_result.checked_push(i, query_distance.calculate(nbr, i), nbr);
+    }
+  }
+  search("random", random_result,
+         std::vector<std::size_t>(n_queries, n_nbrs));
+
+  for (std::size_t n_entries : {std::size_t{1}, std::size_t{4}, n_nbrs}) {
+    tdoann::NNHeap<Out, Idx> entry_result(n_queries, n_nbrs);
+    std::vector<std::size_t> entry_counts(n_queries);
+    tdoann::find_entry_points(layers, query_distance, n_entries, entry_result,
+                              entry_counts, 0, progress, executor);
+    search("entry " + std::to_string(n_entries), entry_result, entry_counts);
+  }
+
+  return 0;
+}
@@ -0,0 +1,182 @@
+// Start-up cost of a search index stored in the binary index file format
+// (tdoann/indexfile.h). An index (reference data, search graph and an explicit
+// margin search forest) is built and written to a file. Opening it maps the
+// file and copies only the forest out of it: the data and graph are searched
+// in place, and pages are read from disk as the search touches them. This is
+// compared with reading the whole file into memory, which is the least any
+// loader that copies the index has to do, and the results of querying the
+// mapped index are checked against querying the index in memory.
+//
+// Build and run from this directory:
+//
+// g++ -std=c++17 -O2 -I../inst/include bench_indexfile.cpp -pthread
+// ./a.out [n_points] [n_queries] [ndim] [n_nbrs] [n_trees] [filename]
+//
+// If a filename is given, the index file is kept afterwards, e.g. for use with
+// query_server.cpp. The file is dropped from the page cache before it is read
+// and before it is opened, so both are cold starts (on a file system which
+// keeps its files in memory, like tmpfs, they can't be).
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bench_common.h"
+#include "tdoann/distancebase.h"
+#include "tdoann/distancesimd.h"
+#include "tdoann/forestsearch.h"
+#include "tdoann/indexfile.h"
+#include "tdoann/nndescent.h"
+#include "tdoann/rptree.h"
+
+using bench::Idx;
+using In = float;
+using Out = float;
+using It = tdoann::DataIt<In>;
+using Distance =
+    tdoann::StaticSelfDistanceCalculator<In, Out, Idx,
+                                         tdoann::simd_squared_euclidean<Out, It>>;
+using Forest = std::vector<tdoann::SearchTree<In, Idx>>;
+
+auto build_graph(const Distance &distance, std::size_t n_nbrs)
+    -> tdoann::SparseNNGraph<Out, Idx> {
+  tdoann::NNDHeap<Out, Idx> heap(distance.get_nx(), n_nbrs);
+  bench::random_init(distance, heap);
+  bench::QuietNNDProgress progress;
+  bench::MTRand rand(42);
+  tdoann::LowMemSerialLocalJoin<Out, Idx, Distance> local_join(distance);
+  constexpr uint32_t n_iters = 10;
+  constexpr double delta = 0.001;
+  tdoann::nnd_build(heap, local_join, n_nbrs, n_iters, delta, false, rand,
+                    progress);
+  tdoann::sort_heap(heap);
+
+  std::vector<std::size_t> row_ptr(heap.n_points + 1);
+  for (std::size_t i = 0; i <= heap.n_points; i++) {
+    row_ptr[i] = i * n_nbrs;
+  }
+  return tdoann::SparseNNGraph<Out, Idx>(row_ptr, heap.idx, heap.dist);
+}
+
+// write any changes to the file to disk and evict it from the page cache, so
+// the next reads of it come from disk
+void drop_from_cache(const std::string &filename) {
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  ::fdatasync(fd);
+  ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  ::close(fd);
+}
+
+template <typename Graph, typename QueryDistance>
+auto query(const Forest &forest, const Graph &search_graph,
+           const QueryDistance &distance, std::size_t n_nbrs)
+    -> tdoann::NNHeap<Out, Idx> {
+  std::vector<std::size_t> distance_counts(distance.get_ny());
+  bench::MTParallelIntRand rng_provider(1337);
+  tdoann::NullProgress progress;
+  tdoann::SerialExecutor executor;
+  return tdoann::forest_nn_query(forest, search_graph, distance, n_nbrs, true,
+                                 0.1, search_graph.n_points, distance_counts,
+                                 rng_provider, 0, progress, executor);
+}
+
+int main(int argc, char **argv) {
+  const std::size_t n_points = bench::arg_or(argc, argv, 1, 100000);
+  const std::size_t n_queries = bench::arg_or(argc, argv, 2, 1000);
+  const std::size_t ndim = bench::arg_or(argc, argv, 3, 64);
+  const std::size_t n_nbrs = bench::arg_or(argc, argv, 4, 15);
+  const std::size_t n_trees = bench::arg_or(argc, argv, 5, 4);
+  const std::string filename = argc > 6 ? argv[6] : "bench_index.bin";
+
+  std::cout << "n_points = " << n_points << " n_queries = " << n_queries
+            << " ndim = " << ndim << " n_nbrs = " << n_nbrs
+            << " n_trees = " << n_trees << std::endl;
+
+  const auto data = bench::random_data(n_points, ndim);
+  const auto query_data = bench::random_data(n_queries, ndim, 1337);
+  const Distance self_distance(std::vector<In>(data), ndim);
+  const auto search_graph = build_graph(self_distance, n_nbrs);
+
+  bench::MTParallelIntRand forest_rand(42);
+  tdoann::NullProgress progress;
+  tdoann::SerialExecutor executor;
+  constexpr uint32_t leaf_size = 30;
+  constexpr uint32_t max_tree_depth = 200;
+  auto rp_forest = tdoann::make_forest(data, ndim, n_trees, leaf_size,
+                                       max_tree_depth, forest_rand, false, 0,
+                                       progress, executor);
+  const Forest forest = tdoann::convert_rp_forest(rp_forest, n_points, ndim);
+
+  bench::Timer timer;
+  tdoann::IndexFileWriter writer(filename);
+  writer.write("metric", "sqeuclidean");
+  writer.write("actual_metric", "sqeuclidean");
+  writer.write("use_alt_metric", std::vector<uint8_t>{0});
+  tdoann::save_data(writer, "data", data.data(), n_points, ndim);
+  tdoann::save_graph(writer, "graph", search_graph);
+  tdoann::save_forest(writer, "forest", forest);
+  writer.close();
+  const double write_elapsed = timer.elapsed();
+
+  // reference: everything in memory
+  const tdoann::IndexQueryDistanceCalculator<In, Out, Idx> memory_distance(
+      tdoann::DataView<In>::row_major(data.data(), n_points, ndim),
+      std::vector<In>(query_data), tdoann::simd_squared_euclidean<Out, const In *>);
+  const auto expected = query(forest, search_graph, memory_distance, n_nbrs);
+
+  drop_from_cache(filename);
+  timer = bench::Timer();
+  std::ifstream in(filename, std::ios::binary | std::ios::ate);
+  std::vector<char> contents(static_cast<std::size_t>(in.tellg()));
+  in.seekg(0);
+  in.read(contents.data(), static_cast<std::streamsize>(contents.size()));
+  const double read_elapsed = timer.elapsed();
+
+  drop_from_cache(filename);
+  timer = bench::Timer();
+  const tdoann::IndexFile index(filename);
+  // as when querying from R: a search only touches a small part of the file
+  index.advise(tdoann::MappedFile<char>::Advice::Random);
+  const auto mapped_data = tdoann::load_data<In>(index, "data");
+  const auto mapped_graph = tdoann::load_graph<Out, Idx>(index, "graph");
+  Forest mapped_forest;
+  tdoann::load_forest(index, "forest", mapped_data.n_items, mapped_data.ndim,
+                      mapped_forest);
+  const double open_elapsed = timer.elapsed();
+
+  timer = bench::Timer();
+  const tdoann::IndexQueryDistanceCalculator<In, Out, Idx> mapped_distance(
+      mapped_data, std::vector<In>(query_data),
+      tdoann::simd_squared_euclidean<Out, const In *>);
+  const auto result = query(mapped_forest, mapped_graph, mapped_distance,
+                            n_nbrs);
+  const double query_elapsed = timer.elapsed();
+
+  std::size_t n_same = 0;
+  for (std::size_t i = 0; i < expected.idx.size(); i++) {
+    if (expected.idx[i] == result.idx[i]) {
+      n_same++;
+    }
+  }
+
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << "file size " << contents.size() / (1024.0 * 1024.0) << " MB"
+            << std::endl;
+  std::cout << "write " << write_elapsed << "s" << std::endl;
+  std::cout << "read whole file " << read_elapsed << "s" << std::endl;
+  std::cout << "open mapped index " << open_elapsed << "s" << std::endl;
+  std::cout << "first query batch " << query_elapsed << "s" << std::endl;
+  std::cout << "same neighbors as in-memory index "
+            << static_cast<double>(n_same) / expected.idx.size() << std::endl;
+
+  if (argc <= 6) {
+    std::remove(filename.c_str());
+  }
+  return 0;
+}
@@ -0,0 +1,96 @@
+// Nearest neighbor descent with the data in memory (as in the R package, where
+// it is copied from the R matrix into a std::vector) compared to reading it
+// through a memory-mapped file. The data is written to a temporary file of
+// row-major float32 values. When the file fits in the page cache, the two
+// should take about the same time and give the same graph, while the mapped
+// version does not need its own copy of the data.
+//
+// Build and run from this directory:
+//
+// g++ -std=c++17 -O2 -I../inst/include bench_mmap.cpp -pthread
+// ./a.out [n_points] [ndim] [n_nbrs]
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+
+#include "bench_common.h"
+#include "tdoann/distancebase.h"
+#include "tdoann/distancesimd.h"
+#include "tdoann/mmap.h"
+#include "tdoann/nndescent.h"
+
+using bench::Idx;
+using In = float;
+using Out = float;
+using It = tdoann::DataIt<In>;
+using Distance = tdoann::SelfDistanceCalculator<In, Out, Idx>;
+using MappedDistance = tdoann::MappedSelfDistanceCalculator<In, Out, Idx>;
+
+template <typename D>
+auto build(const D &distance, std::size_t n_nbrs) -> tdoann::NNDHeap<Out, Idx> {
+  tdoann::NNDHeap<Out, Idx> heap(distance.get_nx(), n_nbrs);
+  bench::random_init(distance, heap);
+  bench::QuietNNDProgress progress;
+  bench::MTRand rand(42);
+  tdoann::LowMemSerialLocalJoin<Out, Idx, D> local_join(distance);
+  constexpr uint32_t n_iters = 20;
+  constexpr double delta = 0.001;
+  tdoann::nnd_build(heap, local_join, n_nbrs, n_iters, delta, false, rand,
+                    progress);
+  return heap;
+}
+
+int main(int argc, char **argv) {
+  const std::size_t n_points = bench::arg_or(argc, argv, 1, 100000);
+  const std::size_t ndim = bench::arg_or(argc, argv, 2, 16);
+  const std::size_t n_nbrs = bench::arg_or(argc, argv, 3, 15);
+
+  std::cout << "n_points = " << n_points << " ndim = " << ndim
+            << " n_nbrs = " << n_nbrs << std::endl;
+
+  const std::string filename = "bench_mmap.f32";
+  {
+    const auto data = bench::random_data(n_points, ndim);
+    std::ofstream out(filename, std::ios::binary);
+    out.write(reinterpret_cast<const char *>(data.data()),
+              static_cast<std::streamsize>(data.size() * sizeof(In)));
+  }
+
+  bench::Timer timer;
+  std::vector<In> data(n_points * ndim);
+  {
+    std::ifstream in(filename, std::ios::binary);
+    in.read(reinterpret_cast<char *>(data.data()),
+            static_cast<std::streamsize>(data.size() * sizeof(In)));
+  }
+  const Distance distance(std::move(data), ndim,
+                          tdoann::simd_squared_euclidean<Out, It>);
+  const double read_elapsed = timer.elapsed();
+  timer = bench::Timer();
+  const auto heap = build(distance, n_nbrs);
+  const double build_elapsed = timer.elapsed();
+
+  timer = bench::Timer();
+  const MappedDistance mapped_distance(
+      tdoann::MappedFile<In>(filename), ndim,
+      tdoann::simd_squared_euclidean<Out, const In *>);
+  const double map_elapsed = timer.elapsed();
+  timer = bench::Timer();
+  const auto mapped_heap = build(mapped_distance, n_nbrs);
+  const double mapped_build_elapsed = timer.elapsed();
+
+  std::remove(filename.c_str());
+
+  const double data_mb = n_points * ndim * sizeof(In) / 1048576.0;
+  std::cout << std::fixed << std::setprecision(3) << "in memory load "
+            << read_elapsed << "s build " << build_elapsed << "s recall "
+            << bench::recall(heap, distance) << " data " << std::setprecision(1)
+            << data_mb << " MB" << std::endl;
+  std::cout << std::setprecision(3) << "mapped    load " << map_elapsed
+            << "s build " << mapped_build_elapsed << "s recall "
+            << bench::recall(mapped_heap, distance) << " same graph "
+            << (heap.idx == mapped_heap.idx ? "yes" : "no") << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,149 @@
+// Cost of adding new points to an existing nearest neighbor graph compared to
+// rebuilding the graph from scratch. The graph of the first n_points items is
+// built with nearest neighbor descent, then n_new items are added: like
+// nnd_knn_insert in the R package, their initial neighbors are found by
+// searching the existing graph, and the neighbors of the original items are
+// marked as old, so that only pairs involving the new items are tried. As in
+// nnd_knn_insert, the search uses epsilon = 0.3 and the convergence threshold
+// is relative to the neighbors of the new items only.
+//
+// Build and run from this directory:
+//
+// g++ -std=c++17 -O2 -I../inst/include bench_nnd_insert.cpp -pthread
+// ./a.out [n_points] [n_new] [ndim] [n_nbrs]
+
+#include <iomanip>
+
+#include "bench_common.h"
+#include "tdoann/distancebase.h"
+#include "tdoann/distancesimd.h"
+#include "tdoann/nndescent.h"
+#include "tdoann/search.h"
+
+using bench::Idx;
+using In = float;
+using Out = float;
+using It = tdoann::DataIt<In>;
+using Distance =
+    tdoann::StaticSelfDistanceCalculator<In, Out, Idx,
+                                         tdoann::simd_squared_euclidean<Out, It>>;
+
+// distances from the first n_ref items (the reference) to the rest (the query)
+class InsertQueryDistance : public tdoann::BaseDistance<Out, Idx> {
+  const Distance &distance;
+  std::size_t n_ref;
+
+public:
+  InsertQueryDistance(const Distance &distance, std::size_t n_ref)
+      : distance(distance), n_ref(n_ref) {}
+  Out calculate(const Idx &i, const Idx &j) const override {
+    return distance.calculate(i, static_cast<Idx>(n_ref + j));
+  }
+  std::size_t get_nx() const override { return n_ref; }
+  std::size_t get_ny() const override { return distance.get_nx() - n_ref; }
+};
+
+void build(tdoann::NNDHeap<Out, Idx> &heap, const Distance &distance,
+           std::size_t n_nbrs, double delta) {
+  bench::QuietNNDProgress progress;
+  bench::MTRand rand(42);
+  tdoann::LowMemSerialLocalJoin<Out, Idx, Distance> local_join(distance);
+  constexpr uint32_t n_iters = 20;
+  tdoann::nnd_build(heap, local_join, n_nbrs, n_iters, delta, false, rand,
+                    progress);
+}
+
+// fraction of the neighbors of items begin to end that are exact neighbors
+auto recall(const tdoann::NNDHeap<Out, Idx> &heap, const Distance &distance,
+            std::size_t begin, std::size_t end, std::size_t n_sample = 200)
+    -> double {
+  const std::size_t k = heap.n_nbrs;
+  std::size_t n_found = 0;
+  for (std::size_t s = 0; s < n_sample; s++) {
+    const auto i = static_cast<Idx>(begin + (s * 7919) % (end - begin));
+    tdoann::NNHeap<Out, Idx> exact(1, k);
+    for (Idx j = 0; j < heap.n_points; j++) {
+      exact.checked_push(0, distance.calculate(i, j), j);
+    }
+    for (std::size_t a = 0; a < k; a++) {
+      if (exact.contains(0, heap.index(i, a))) {
+        n_found++;
+      }
+    }
+  }
+  return static_cast<double>(n_found) / (n_sample * k);
+}
+
+int main(int argc, char **argv) {
+  const std::size_t n_points = bench::arg_or(argc, argv, 1, 100000);
+  const std::size_t n_new = bench::arg_or(argc, argv, 2, 1000);
+  const std::size_t ndim = bench::arg_or(argc, argv, 3, 16);
+  const std::size_t n_nbrs = bench::arg_or(argc, argv, 4, 15);
+  const std::size_t n_total = n_points + n_new;
+  constexpr double delta = 0.001;
+  constexpr double epsilon = 0.3;
+
+  std::cout << "n_points = " << n_points << " n_new = " << n_new
+            << " ndim = " << ndim << " n_nbrs = " << n_nbrs << std::endl;
+
+  const auto data = bench::random_data(n_total, ndim);
+  const Distance old_distance(
+      std::vector<In>(data.begin(), data.begin() + n_points * ndim), ndim);
+  const Distance distance(std::vector<In>(data), ndim);
+
+  tdoann::NNDHeap<Out, Idx> old_heap(n_points, n_nbrs);
+  bench::random_init(old_distance, old_heap);
+  build(old_heap, old_distance, n_nbrs, delta);
+
+  bench::Timer timer;
+  tdoann::NNDHeap<Out, Idx> full_heap(n_total, n_nbrs);
+  bench::random_init(distance, full_heap);
+  build(full_heap, distance, n_nbrs, delta);
+  const double full_elapsed = timer.elapsed();
+
+  timer = bench::Timer();
+  tdoann::NNDHeap<Out, Idx> heap(n_total, n_nbrs);
+  for (Idx i = 0; i < n_points; i++) {
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      heap.checked_push(i, old_heap.distance(i, j), old_heap.index(i, j));
+    }
+  }
+  std::fill(heap.flags.begin(), heap.flags.begin() + n_points * n_nbrs, 0);
+  tdoann::NNHeap<Out, Idx> query_heap(n_new, n_nbrs);
+  const InsertQueryDistance query_distance(distance, n_points);
+  std::mt19937_64 prng(1337);
+  std::uniform_int_distribution<Idx> unif(0, n_points - 1);
+  for (Idx i = 0; i < n_new; i++) {
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      const Idx nbr = unif(prng);
+      query_heap.checked_push(i, query_distance.calculate(nbr, i), nbr);
+    }
+  }
+  std::vector<std::size_t> row_ptr(n_points + 1);
+  for (std::size_t i = 0; i <= n_points; i++) {
+    row_ptr[i] = i * n_nbrs;
+  }
+  const tdoann::SparseNNGraph<Out, Idx> search_graph(row_ptr, old_heap.idx,
+                                                     old_heap.dist);
+  std::vector<std::size_t> distance_counts(n_new);
+  tdoann::non_search_query(query_heap, query_distance, search_graph, epsilon,
+                           n_points, distance_counts, 0, n_new);
+  for (Idx i = 0; i < n_new; i++) {
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      heap.checked_push(static_cast<Idx>(n_points + i),
+                        query_heap.distance(i, j), query_heap.index(i, j));
+    }
+  }
+  build(heap, distance, n_nbrs, delta * n_new / n_total);
+  const double insert_elapsed = timer.elapsed();
+
+  std::cout << std::fixed << std::setprecision(3) << "rebuild " << full_elapsed
+            << "s recall old " << recall(full_heap, distance, 0, n_points)
+            << " new " << recall(full_heap, distance, n_points, n_total)
+            << std::endl;
+  std::cout << "insert  " << insert_elapsed << "s recall old "
+            << recall(heap, distance, 0, n_points) << " new "
+            << recall(heap, distance, n_points, n_total) << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,180 @@
+// Graph search against product quantized (PQ) reference data, for squared
+// Euclidean and cosine distances. The kNN graph of the reference data is built
+// with nearest neighbor descent, then queries are run with exact distances,
+// and with asymmetric distances to the PQ codes, searching for n_nbrs and for
+// rerank_factor times as many neighbors, which are reranked with the exact
+// distances to keep the nearest n_nbrs (as rnnd_query does). Recall is
+// measured against brute force exact neighbors of the queries.
+//
+// Build and run from this directory:
+//
+// g++ -std=c++17 -O2 -I../inst/include bench_pq.cpp -pthread
+// ./a.out [n_points] [n_queries] [ndim] [n_nbrs] [n_subspaces] [rerank_factor]
+
+#include <iomanip>
+
+#include "bench_common.h"
+#include "tdoann/distancebase.h"
+#include "tdoann/distancesimd.h"
+#include "tdoann/nndescent.h"
+#include "tdoann/pq.h"
+#include "tdoann/quantize.h"
+#include "tdoann/search.h"
+
+using bench::Idx;
+using In = float;
+using Out = float;
+using It = tdoann::DataIt<In>;
+using Distance = tdoann::SelfDistanceCalculator<In, Out, Idx>;
+using QueryDistance = tdoann::QueryDistanceCalculator<In, Out, Idx>;
+
+auto build(const Distance &distance, std::size_t n_nbrs)
+    -> tdoann::NNDHeap<Out, Idx> {
+  tdoann::NNDHeap<Out, Idx> heap(distance.get_nx(), n_nbrs);
+  bench::random_init(distance, heap);
+  bench::QuietNNDProgress progress;
+  bench::MTRand rand(42);
+  tdoann::LowMemSerialLocalJoin<Out, Idx, Distance> local_join(distance);
+  constexpr uint32_t n_iters = 20;
+  constexpr double delta = 0.001;
+  tdoann::nnd_build(heap, local_join, n_nbrs, n_iters, delta, false, rand,
+                    progress);
+  return heap;
+}
+
+// search the graph for the neighbors of each query item, starting from random
+// reference items
+auto query(const tdoann::BaseDistance<Out, Idx> &distance,
+           const tdoann::SparseNNGraph<Out, Idx> &search_graph,
+           std::size_t n_nbrs) -> tdoann::NNHeap<Out, Idx> {
+  const std::size_t n_ref = distance.get_nx();
+  const std::size_t n_queries = distance.get_ny();
+  tdoann::NNHeap<Out, Idx> result(n_queries, n_nbrs);
+  std::mt19937_64 prng(1337);
+  std::uniform_int_distribution<Idx> unif(0, n_ref - 1);
+  for (Idx i = 0; i < n_queries; i++) {
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      const Idx nbr = unif(prng);
+      result.checked_push(i, distance.calculate(nbr, i), nbr);
+    }
+  }
+  std::vector<std::size_t> distance_counts(n_queries);
+  tdoann::non_search_query(result, distance, search_graph, 0.1, n_ref,
+                           distance_counts, 0, n_queries);
+  return result;
+}
+
+// the fraction of the exact neighbors of each query found in the nearest n_nbrs
+// of result (whose rows must be sorted)
+auto recall(const tdoann::NNHeap<Out, Idx> &result,
+            const tdoann::NNHeap<Out, Idx> &exact) -> double {
+  std::size_t n_found = 0;
+  for (Idx i = 0; i < result.n_points; i++) {
+    for (std::size_t j = 0; j < exact.n_nbrs; j++) {
+      if (exact.contains(i, result.index(i, j))) {
+        n_found++;
+      }
+    }
+  }
+  return static_cast<double>(n_found) / (result.n_points * exact.n_nbrs);
+}
+
+void run_metric(const std::string &name, const std::vector<In> &data,
+                const std::vector<In> &queries, std::size_t ndim,
+                std::size_t n_nbrs, std::size_t n_subspaces,
+                std::size_t rerank_factor, Distance::DistanceFunc distance_func,
+                tdoann::QuantizedMetric metric,
+                tdoann::PreprocessFunc<In> preprocess_func) {
+  std::cout << name << std::endl;
+  const std::size_t n_points = data.size() / ndim;
+  const std::size_t n_queries = queries.size() / ndim;
+  const Distance distance(std::vector<In>(data), ndim, distance_func,
+                          preprocess_func);
+  const QueryDistance query_distance(data, queries, ndim, distance_func,
+                                     preprocess_func);
+
+  auto heap = build(distance, n_nbrs);
+  tdoann::sort_heap(heap);
+  std::vector<std::size_t> row_ptr(n_points + 1);
+  for (std::size_t i = 0; i <= n_points; i++) {
+    row_ptr[i] = i * n_nbrs;
+  }
+  const tdoann::SparseNNGraph<Out, Idx> search_graph(row_ptr, heap.idx,
+                                                     heap.dist);
+
+  tdoann::NNHeap<Out, Idx> exact(n_queries, n_nbrs);
+  for (Idx i = 0; i < n_queries; i++) {
+    for (Idx j = 0; j < n_points; j++) {
+      exact.checked_push(i, query_distance.calculate(j, i), j);
+    }
+  }
+
+  bench::Timer timer;
+  auto exact_result = query(query_distance, search_graph, n_nbrs);
+  const double exact_elapsed = timer.elapsed();
+  tdoann::sort_heap(exact_result);
+
+  tdoann::SerialExecutor executor;
+  timer = bench::Timer();
+  std::vector<In> pq_data(data);
+  if (preprocess_func != nullptr) {
+    preprocess_func(pq_data, ndim);
+  }
+  bench::MTRand rand(42);
+  const auto pq =
+      tdoann::train_pq(pq_data, ndim, n_subspaces, 15, rand, 0, executor);
+  const double train_elapsed = timer.elapsed();
+  timer = bench::Timer();
+  const tdoann::PQQueryDistanceCalculator<Out, Idx> pq_distance(
+      pq, pq.encode(pq_data, 0, executor), queries, metric, preprocess_func);
+  const double encode_elapsed = timer.elapsed();
+
+  timer = bench::Timer();
+  auto pq_result = query(pq_distance, search_graph, n_nbrs);
+  const double pq_elapsed = timer.elapsed();
+  tdoann::sort_heap(pq_result);
+
+  tdoann::NullProgress progress;
+  timer = bench::Timer();
+  auto reranked = query(pq_distance, search_graph, rerank_factor * n_nbrs);
+  tdoann::rerank(reranked, query_distance, 0, progress, executor);
+  const double rerank_elapsed = timer.elapsed();
+  tdoann::sort_heap(reranked);
+
+  std::cout << std::fixed << std::setprecision(3) << "train " << train_elapsed
+            << "s encode " << encode_elapsed << "s" << std::endl;
+  std::cout << "exact       search " << exact_elapsed << "s recall "
+            << recall(exact_result, exact) << " | " << std::setprecision(1)
+            << n_points * ndim * sizeof(In) / 1048576.0 << " MB" << std::endl;
+  std::cout << std::setprecision(3) << "pq          search " << pq_elapsed
+            << "s recall " << recall(pq_result, exact) << " | "
+            << std::setprecision(1) << pq_distance.data_size() / 1048576.0
+            << " MB" << std::endl;
+  std::cout << std::setprecision(3) << "pq + rerank search " << rerank_elapsed
+            << "s recall " << recall(reranked, exact) << std::endl;
+}
+
+int main(int argc, char **argv) {
+  const std::size_t n_points = bench::arg_or(argc, argv, 1, 100000);
+  const std::size_t n_queries = bench::arg_or(argc, argv, 2, 1000);
+  const std::size_t ndim = bench::arg_or(argc, argv, 3, 32);
+  const std::size_t n_nbrs = bench::arg_or(argc, argv, 4, 15);
+  const std::size_t n_subspaces = bench::arg_or(argc, argv, 5, 8);
+  const std::size_t rerank_factor = bench::arg_or(argc, argv, 6, 4);
+
+  std::cout << "n_points = " << n_points << " n_queries = " << n_queries
+            << " ndim = " << ndim << " n_nbrs = " << n_nbrs
+            << " n_subspaces = " << n_subspaces
+            << " rerank_factor = " << rerank_factor << std::endl;
+
+  const auto data = bench::random_data(n_points, ndim);
+  const auto queries = bench::random_data(n_queries, ndim, 1337);
+  run_metric("sqeuclidean", data, queries, ndim, n_nbrs, n_subspaces,
+             rerank_factor, tdoann::simd_squared_euclidean<Out, It>,
+             tdoann::QuantizedMetric::SquaredEuclidean, nullptr);
+  run_metric("cosine", data, queries, ndim, n_nbrs, n_subspaces, rerank_factor,
+             tdoann::simd_inner_product<Out, It>,
+             tdoann::QuantizedMetric::InnerProduct, tdoann::normalize<In>);
+
+  return 0;
+}
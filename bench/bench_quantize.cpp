@@ -0,0 +1,153 @@
+// Nearest neighbor descent on data stored with reduced precision: IEEE half
+// precision (fp16), bfloat16 (bf16) and 8-bit scalar quantization (int8),
+// compared with the usual float data, for squared Euclidean and cosine
+// distances. The graph built from the reduced precision data is reranked with
+// the exact distances, as the R functions do, so the distances returned are
+// exact: only the recall depends on the precision. Recall is measured against
+// the exact neighbors of the float data. The distance time is for calculating
+// the distances of each item to 200 others, without the rest of the build.
+//
+// Build and run from this directory:
+//
+// g++ -std=c++17 -O2 -I../inst/include bench_quantize.cpp -pthread
+// ./a.out [n_points] [ndim] [n_nbrs]
+
+#include <iomanip>
+
+#include "bench_common.h"
+#include "tdoann/distance.h"
+#include "tdoann/distancebase.h"
+#include "tdoann/distancesimd.h"
+#include "tdoann/nndescent.h"
+#include "tdoann/quantize.h"
+
+using bench::Idx;
+using In = float;
+using Out = float;
+using It = tdoann::DataIt<In>;
+using Distance = tdoann::SelfDistanceCalculator<In, Out, Idx>;
+
+template <typename D>
+auto build(const D &distance, std::size_t n_nbrs) -> tdoann::NNDHeap<Out, Idx> {
+  tdoann::NNDHeap<Out, Idx> heap(distance.get_nx(), n_nbrs);
+  bench::random_init(distance, heap);
+  bench::QuietNNDProgress progress;
+  bench::MTRand rand(42);
+  tdoann::LowMemSerialLocalJoin<Out, Idx, D> local_join(distance);
+  constexpr uint32_t n_iters = 20;
+  constexpr double delta = 0.001;
+  tdoann::nnd_build(heap, local_join, n_nbrs, n_iters, delta, false, rand,
+                    progress);
+  return heap;
+}
+
+template <typename D> auto time_distances(const D &distance) -> double {
+  constexpr std::size_t n_others = 200;
+  const auto n_points = static_cast<Idx>(distance.get_nx());
+  bench::Timer timer;
+  volatile Out sink = 0;
+  for (Idx i = 0; i < n_points; i++) {
+    Out sum = 0;
+    for (std::size_t j = 1; j <= n_others; j++) {
+      sum += distance.calculate((i + j * 7919) % n_points, i);
+    }
+    sink = sink + sum;
+  }
+  return timer.elapsed();
+}
+
+// largest relative difference between the quantized and exact distances
+template <typename D>
+auto max_relative_error(const D &distance, const Distance &exact_distance)
+    -> double {
+  const auto n_points = static_cast<Idx>(distance.get_nx());
+  double max_error = 0.0;
+  for (Idx i = 0; i < std::min(n_points, Idx{1000}); i++) {
+    const Idx j = (i * 7919 + 1) % n_points;
+    const double exact = exact_distance.calculate(i, j);
+    const double approx = distance.calculate(i, j);
+    max_error = std::max(max_error, std::abs(approx - exact) /
+                                        std::max(std::abs(exact), 1e-6));
+  }
+  return max_error;
+}
+
+template <typename Codec>
+void run(const std::string &label, const std::vector<In> &data,
+         std::size_t ndim, std::size_t n_nbrs, tdoann::QuantizedMetric metric,
+         tdoann::PreprocessFunc<In> preprocess_func,
+         const Distance &exact_distance) {
+  bench::Timer timer;
+  const tdoann::QuantizedDistanceCalculator<Codec, Out, Idx> distance(
+      data, ndim, metric, preprocess_func);
+  const double encode_elapsed = timer.elapsed();
+
+  const double distance_elapsed = time_distances(distance);
+
+  timer = bench::Timer();
+  auto heap = build(distance, n_nbrs);
+  tdoann::NullProgress progress;
+  tdoann::SerialExecutor executor;
+  tdoann::rerank(heap, exact_distance, 0, progress, executor);
+  const double build_elapsed = timer.elapsed();
+
+  std::cout << std::left << std::setw(6) << label << std::fixed
+            << std::setprecision(3) << " encode " << encode_elapsed
+            << "s distances " << distance_elapsed << "s build + rerank "
+            << build_elapsed << "s recall "
+            << bench::recall(heap, exact_distance) << " | max rel error "
+            << std::setprecision(4)
+            << max_relative_error(distance, exact_distance) << " | "
+            << std::setprecision(1) << distance.data_size() / 1048576.0
+            << " MB" << std::endl;
+}
+
+void run_metric(const std::string &name, const std::vector<In> &data,
+                std::size_t ndim, std::size_t n_nbrs,
+                Distance::DistanceFunc distance_func,
+                tdoann::QuantizedMetric metric,
+                tdoann::PreprocessFunc<In> preprocess_func) {
+  std::cout << name << std::endl;
+  const Distance distance(std::vector<In>(data), ndim, distance_func,
+                          preprocess_func);
+
+  const double distance_elapsed = time_distances(distance);
+  bench::Timer timer;
+  const auto heap = build(distance, n_nbrs);
+  const double build_elapsed = timer.elapsed();
+  std::cout << std::left << std::setw(6) << "float" << std::fixed
+            << std::setprecision(3) << " encode -----s distances "
+            << distance_elapsed << "s build          " << build_elapsed
+            << "s recall " << bench::recall(heap, distance) << " | "
+            << std::setprecision(1)
+            << data.size() * sizeof(In) / 1048576.0 << " MB" << std::endl;
+
+  run<tdoann::Float16Codec>("fp16", data, ndim, n_nbrs, metric,
+                            preprocess_func, distance);
+  run<tdoann::BFloat16Codec>("bf16", data, ndim, n_nbrs, metric,
+                             preprocess_func, distance);
+  run<tdoann::Int8Codec>("int8", data, ndim, n_nbrs, metric, preprocess_func,
+                         distance);
+}
+
+int main(int argc, char **argv) {
+  const std::size_t n_points = bench::arg_or(argc, argv, 1, 50000);
+  const std::size_t ndim = bench::arg_or(argc, argv, 2, 128);
+  const std::size_t n_nbrs = bench::arg_or(argc, argv, 3, 15);
+
+  std::cout << "n_points = " << n_points << " ndim = " << ndim
+            << " n_nbrs = " << n_nbrs << std::endl;
+#if defined(TDOANN_SIMD_X86)
+  std::cout << "AVX2 + F16C " << (tdoann::has_avx2_f16c() ? "yes" : "no")
+            << std::endl;
+#endif
+
+  const auto data = bench::random_data(n_points, ndim);
+  run_metric("sqeuclidean", data, ndim, n_nbrs,
+             tdoann::simd_squared_euclidean<Out, It>,
+             tdoann::QuantizedMetric::SquaredEuclidean, nullptr);
+  run_metric("cosine", data, ndim, n_nbrs, tdoann::simd_inner_product<Out, It>,
+             tdoann::QuantizedMetric::InnerProduct, tdoann::normalize<In>);
+
+  return 0;
+}
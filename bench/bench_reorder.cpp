@@ -0,0 +1,150 @@
+// Graph search before and after relabelling the items in reverse
+// Cuthill-McKee (RCM) order. The kNN graph of the reference data is built
+// with nearest neighbor descent on data in random order, then the graph and
+// the data are permuted so that neighbors have nearby ids, and the same
+// queries are run against both. The results are mapped back to the original
+// ids, so they should be the same. The bandwidth is the mean difference
+// between the id of an item and the ids of its neighbors.
+//
+// Build and run from this directory:
+//
+// g++ -std=c++17 -O2 -I../inst/include bench_reorder.cpp -pthread
+// ./a.out [n_points] [n_queries] [ndim] [n_nbrs]
+
+#include <iomanip>
+
+#include "bench_common.h"
+#include "tdoann/distancebase.h"
+#include "tdoann/distancesimd.h"
+#include "tdoann/nndescent.h"
+#include "tdoann/reorder.h"
+#include "tdoann/search.h"
+
+using bench::Idx;
+using In = float;
+using Out = float;
+using It = tdoann::DataIt<In>;
+using Distance = tdoann::SelfDistanceCalculator<In, Out, Idx>;
+using QueryDistance = tdoann::QueryDistanceCalculator<In, Out, Idx>;
+using SearchGraph = tdoann::SparseNNGraph<Out, Idx>;
+
+auto build(const Distance &distance, std::size_t n_nbrs)
+    -> tdoann::NNDHeap<Out, Idx> {
+  tdoann::NNDHeap<Out, Idx> heap(distance.get_nx(), n_nbrs);
+  bench::random_init(distance, heap);
+  bench::QuietNNDProgress progress;
+  bench::MTRand rand(42);
+  tdoann::LowMemSerialLocalJoin<Out, Idx, Distance> local_join(distance);
+  constexpr uint32_t n_iters = 10;
+  constexpr double delta = 0.001;
+  tdoann::nnd_build(heap, local_join, n_nbrs, n_iters, delta, false, rand,
+                    progress);
+  return heap;
+}
+
+// search the graph for the neighbors of each query item, starting from the
+// items in seeds, returning the time taken
+auto query(const tdoann::BaseDistance<Out, Idx> &distance,
+           const SearchGraph &search_graph, const std::vector<Idx> &seeds,
+           tdoann::NNHeap<Out, Idx> &result) -> double {
+  const std::size_t n_queries = distance.get_ny();
+  for (Idx i = 0; i < n_queries; i++) {
+    for (std::size_t j = 0; j < result.n_nbrs; j++) {
+      const Idx nbr = seeds[i * result.n_nbrs + j];
+      result.checked_push(i, distance.calculate(nbr, i), nbr);
+    }
+  }
+  std::vector<std::size_t> distance_counts(n_queries);
+  bench::Timer timer;
+  tdoann::non_search_query(result, distance, search_graph, 0.1,
+                           distance.get_nx(), distance_counts, 0, n_queries);
+  return timer.elapsed();
+}
+
+auto bandwidth(const SearchGraph &graph) -> double {
+  double sum = 0.0;
+  for (std::size_t i = 0; i < graph.n_points; i++) {
+    for (auto j = graph.row_ptr[i]; j < graph.row_ptr[i + 1]; j++) {
+      const auto nbr = static_cast<double>(graph.col_idx[j]);
+      sum += std::abs(nbr - static_cast<double>(i));
+    }
+  }
+  return sum / static_cast<double>(graph.col_idx.size());
+}
+
+int main(int argc, char **argv) {
+  const std::size_t n_points = bench::arg_or(argc, argv, 1, 200000);
+  const std::size_t n_queries = bench::arg_or(argc, argv, 2, 2000);
+  const std::size_t ndim = bench::arg_or(argc, argv, 3, 64);
+  const std::size_t n_nbrs = bench::arg_or(argc, argv, 4, 15);
+
+  std::cout << "n_points = " << n_points << " n_queries = " << n_queries
+            << " ndim = " << ndim << " n_nbrs = " << n_nbrs << std::endl;
+
+  const auto data = bench::random_data(n_points, ndim);
+  const auto queries = bench::random_data(n_queries, ndim, 1337);
+  const auto distance_func = tdoann::simd_squared_euclidean<Out, It>;
+  const Distance distance(std::vector<In>(data), ndim, distance_func);
+  auto heap = build(distance, n_nbrs);
+  tdoann::sort_heap(heap);
+  std::vector<std::size_t> row_ptr(n_points + 1);
+  for (std::size_t i = 0; i <= n_points; i++) {
+    row_ptr[i] = i * n_nbrs;
+  }
+  const SearchGraph search_graph(row_ptr, heap.idx, heap.dist);
+
+  bench::Timer timer;
+  const auto perm = tdoann::rcm_order(search_graph);
+  const auto reordered_graph = tdoann::permute(search_graph, perm);
+  const auto reordered_data = tdoann::permute_rows(data, ndim, perm);
+  const double reorder_elapsed = timer.elapsed();
+
+  std::mt19937_64 prng(1337);
+  std::uniform_int_distribution<Idx> unif(0, n_points - 1);
+  std::vector<Idx> seeds(n_queries * n_nbrs);
+  std::vector<Idx> reordered_seeds(seeds.size());
+  for (std::size_t i = 0; i < seeds.size(); i++) {
+    seeds[i] = unif(prng);
+    reordered_seeds[i] = perm.to_new(seeds[i]);
+  }
+
+  // the reordered search goes first so it doesn't benefit from the data cached
+  // by the other
+  const QueryDistance reordered_distance(reordered_data, queries, ndim,
+                                         distance_func);
+  tdoann::NNHeap<Out, Idx> reordered_result(n_queries, n_nbrs);
+  const double reordered_elapsed = query(reordered_distance, reordered_graph,
+                                         reordered_seeds, reordered_result);
+  const QueryDistance query_distance(data, queries, ndim, distance_func);
+  tdoann::NNHeap<Out, Idx> result(n_queries, n_nbrs);
+  const double elapsed = query(query_distance, search_graph, seeds, result);
+
+  tdoann::sort_heap(result);
+  tdoann::sort_heap(reordered_result);
+  tdoann::restore_ids(reordered_result.idx, perm.order);
+  std::size_t n_same = 0;
+  for (Idx i = 0; i < n_queries; i++) {
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      if (result.contains(i, reordered_result.index(i, j))) {
+        n_same++;
+      }
+    }
+  }
+
+  std::cout << std::fixed << std::setprecision(0) << "bandwidth original "
+            << bandwidth(search_graph) << " reordered "
+            << bandwidth(reordered_graph) << std::endl;
+  std::cout << std::setprecision(3) << "reorder " << reorder_elapsed << "s"
+            << std::endl;
+  std::cout << std::setprecision(4) << "original  search " << elapsed << "s ("
+            << std::setprecision(1) << 1e6 * elapsed / n_queries
+            << " us/query)" << std::endl;
+  std::cout << std::setprecision(4) << "reordered search " << reordered_elapsed
+            << "s (" << std::setprecision(1)
+            << 1e6 * reordered_elapsed / n_queries << " us/query)"
+            << std::endl;
+  std::cout << std::setprecision(3) << "same neighbors "
+            << static_cast<double>(n_same) / (n_queries * n_nbrs) << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,134 @@
+// Graph search with neighbors evaluated one at a time compared to in a batch.
+// non_search_query gathers the unvisited neighbors of each vertex, prefetches
+// their data and calculates their distances to the query with calculate_block.
+// Wrapping the distance calculator in a class which only forwards calculate
+// turns both the prefetching and the block kernel off, which is how the
+// search used to work. The two should return the same neighbors (up to ties
+// from differences in rounding between the kernels). The effect is largest
+// when the data doesn't fit in cache and has many features.
+//
+// Build and run from this directory:
+//
+// g++ -std=c++17 -O2 -I../inst/include bench_search_batch.cpp -pthread
+// ./a.out [n_points] [n_queries] [ndim] [n_nbrs]
+
+#include <iomanip>
+
+#include "bench_common.h"
+#include "tdoann/distancebase.h"
+#include "tdoann/distancesimd.h"
+#include "tdoann/nndescent.h"
+#include "tdoann/search.h"
+
+using bench::Idx;
+using In = float;
+using Out = float;
+using It = tdoann::DataIt<In>;
+using Distance = tdoann::SelfDistanceCalculator<In, Out, Idx>;
+using QueryDistance = tdoann::QueryDistanceCalculator<In, Out, Idx>;
+
+// forwards calculate only, so calculate_block is the one-at-a-time default
+// and prefetch does nothing
+class OneAtATimeDistance : public tdoann::BaseDistance<Out, Idx> {
+  const QueryDistance &distance;
+
+public:
+  explicit OneAtATimeDistance(const QueryDistance &distance)
+      : distance(distance) {}
+  Out calculate(const Idx &i, const Idx &j) const override {
+    return distance.calculate(i, j);
+  }
+  std::size_t get_nx() const override { return distance.get_nx(); }
+  std::size_t get_ny() const override { return distance.get_ny(); }
+};
+
+auto build(const Distance &distance, std::size_t n_nbrs)
+    -> tdoann::NNDHeap<Out, Idx> {
+  tdoann::NNDHeap<Out, Idx> heap(distance.get_nx(), n_nbrs);
+  bench::random_init(distance, heap);
+  bench::QuietNNDProgress progress;
+  bench::MTRand rand(42);
+  tdoann::LowMemSerialLocalJoin<Out, Idx, Distance> local_join(distance);
+  constexpr uint32_t n_iters = 10;
+  constexpr double delta = 0.001;
+  tdoann::nnd_build(heap, local_join, n_nbrs, n_iters, delta, false, rand,
+                    progress);
+  return heap;
+}
+
+// search the graph for the neighbors of each query item, starting from random
+// reference items, returning the time taken
+auto query(const tdoann::BaseDistance<Out, Idx> &distance,
+           const tdoann::SparseNNGraph<Out, Idx> &search_graph,
+           std::size_t n_nbrs, tdoann::NNHeap<Out, Idx> &result) -> double {
+  const std::size_t n_ref = distance.get_nx();
+  const std::size_t n_queries = distance.get_ny();
+  std::mt19937_64 prng(1337);
+  std::uniform_int_distribution<Idx> unif(0, n_ref - 1);
+  for (Idx i = 0; i < n_queries; i++) {
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      const Idx nbr = unif(prng);
+      result.checked_push(i, distance.calculate(nbr, i), nbr);
+    }
+  }
+  std::vector<std::size_t> distance_counts(n_queries);
+  bench::Timer timer;
+  tdoann::non_search_query(result, distance, search_graph, 0.1, n_ref,
+                           distance_counts, 0, n_queries);
+  return timer.elapsed();
+}
+
+int main(int argc, char **argv) {
+  const std::size_t n_points = bench::arg_or(argc, argv, 1, 100000);
+  const std::size_t n_queries = bench::arg_or(argc, argv, 2, 1000);
+  const std::size_t ndim = bench::arg_or(argc, argv, 3, 128);
+  const std::size_t n_nbrs = bench::arg_or(argc, argv, 4, 15);
+
+  std::cout << "n_points = " << n_points << " n_queries = " << n_queries
+            << " ndim = " << ndim << " n_nbrs = " << n_nbrs << std::endl;
+
+  const auto data = bench::random_data(n_points, ndim);
+  const auto queries = bench::random_data(n_queries, ndim, 1337);
+  const auto distance_func = tdoann::simd_squared_euclidean<Out, It>;
+  const Distance distance(std::vector<In>(data), ndim, distance_func);
+  const QueryDistance query_distance(data, queries, ndim, distance_func);
+
+  const auto heap = build(distance, n_nbrs);
+  std::vector<std::size_t> row_ptr(n_points + 1);
+  for (std::size_t i = 0; i <= n_points; i++) {
+    row_ptr[i] = i * n_nbrs;
+  }
+  const tdoann::SparseNNGraph<Out, Idx> search_graph(row_ptr, heap.idx,
+                                                     heap.dist);
+
+  // the batch search goes first so it doesn't benefit from the data cached by
+  // the other
+  tdoann::NNHeap<Out, Idx> batch_result(n_queries, n_nbrs);
+  const double batch_elapsed =
+      query(query_distance, search_graph, n_nbrs, batch_result);
+  const OneAtATimeDistance one_at_a_time(query_distance);
+  tdoann::NNHeap<Out, Idx> single_result(n_queries, n_nbrs);
+  const double single_elapsed =
+      query(one_at_a_time, search_graph, n_nbrs, single_result);
+
+  tdoann::sort_heap(single_result);
+  tdoann::sort_heap(batch_result);
+  std::size_t n_same = 0;
+  for (Idx i = 0; i < n_queries; i++) {
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      if (single_result.contains(i, batch_result.index(i, j))) {
+        n_same++;
+      }
+    }
+  }
+
+  std::cout << std::fixed << std::setprecision(4) << "one at a time "
+            << single_elapsed << "s (" << 1e6 * single_elapsed / n_queries
+            << " us/query)" << std::endl;
+  std::cout << "batch         " << batch_elapsed << "s ("
+            << 1e6 * batch_elapsed / n_queries << " us/query)" << std::endl;
+  std::cout << std::setprecision(3) << "same neighbors "
+            << static_cast<double>(n_same) / (n_queries * n_nbrs) << std::endl;
+
+  return 0;
+}
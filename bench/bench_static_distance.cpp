@@ -0,0 +1,102 @@
+// Compare NN-descent using the polymorphic distance calculator (a virtual call
+// to calculate followed by an indirect call through a function pointer for
+// each candidate pair) with the compile-time specialized calculator, where the
+// local join is templated on the concrete distance type.
+//
+// Build and run from this directory:
+//
+// g++ -std=c++17 -O2 -I../inst/include bench_static_distance.cpp -pthread
+// ./a.out [n_points] [ndim] [n_nbrs] [n_threads]
+
+#include <iomanip>
+#include <memory>
+
+#include "bench_common.h"
+#include "tdoann/distancebase.h"
+#include "tdoann/distancesimd.h"
+#include "tdoann/nndescent.h"
+#include "tdoann/nndparallel.h"
+
+using bench::Idx;
+using In = float;
+using Out = float;
+using It = tdoann::DataIt<In>;
+
+template <typename Distance>
+auto run(const std::string &label, const Distance &distance, std::size_t n_nbrs,
+         std::size_t n_threads, bool low_memory) -> void {
+  tdoann::NNDHeap<Out, Idx> heap(distance.get_nx(), n_nbrs);
+  bench::random_init(distance, heap);
+  bench::QuietNNDProgress progress;
+  constexpr uint32_t n_iters = 10;
+  constexpr double delta = 0.001;
+  const std::size_t max_candidates = n_nbrs;
+
+  bench::Timer timer;
+  if (n_threads > 0) {
+    std::unique_ptr<tdoann::ParallelLocalJoin<Out, Idx>> local_join;
+    if (low_memory) {
+      local_join = std::make_unique<
+          tdoann::LowMemParallelLocalJoin<Out, Idx, Distance>>(distance,
+                                                               n_threads);
+    } else {
+      local_join = std::make_unique<
+          tdoann::CacheParallelLocalJoin<Out, Idx, Distance>>(
+          heap, distance, n_threads, false);
+    }
+    bench::MTParallelRand parallel_rand(42);
+    bench::ThreadExecutor executor;
+    tdoann::nnd_build(heap, *local_join, max_candidates, n_iters, delta, false,
+                      progress, parallel_rand, n_threads, executor);
+  } else {
+    std::unique_ptr<tdoann::SerialLocalJoin<Out, Idx>> local_join;
+    if (low_memory) {
+      local_join = std::make_unique<
+          tdoann::LowMemSerialLocalJoin<Out, Idx, Distance>>(distance);
+    } else {
+      local_join = std::make_unique<
+          tdoann::CacheSerialLocalJoin<Out, Idx, Distance>>(heap, distance);
+    }
+    bench::MTRand rand(42);
+    tdoann::nnd_build(heap, *local_join, max_candidates, n_iters, delta, false,
+                      rand, progress);
+  }
+  const double elapsed = timer.elapsed();
+
+  std::cout << std::left << std::setw(30) << label
+            << (low_memory ? " low-memory " : " cache      ") << std::fixed
+            << std::setprecision(3) << elapsed << "s recall "
+            << bench::recall(heap, distance) << std::endl;
+}
+
+int main(int argc, char **argv) {
+  const std::size_t n_points = bench::arg_or(argc, argv, 1, 20000);
+  const std::size_t ndim = bench::arg_or(argc, argv, 2, 32);
+  const std::size_t n_nbrs = bench::arg_or(argc, argv, 3, 15);
+  const std::size_t n_threads = bench::arg_or(argc, argv, 4, 0);
+
+  std::cout << "n_points = " << n_points << " ndim = " << ndim
+            << " n_nbrs = " << n_nbrs << " n_threads = " << n_threads
+            << std::endl;
+
+  const auto data = bench::random_data(n_points, ndim);
+
+  const tdoann::SelfDistanceCalculator<In, Out, Idx> dynamic_distance(
+      data, ndim, tdoann::squared_euclidean<Out, It>);
+  const tdoann::StaticSelfDistanceCalculator<
+      In, Out, Idx, tdoann::squared_euclidean<Out, It>>
+      static_distance(data, ndim);
+  const tdoann::StaticSelfDistanceCalculator<
+      In, Out, Idx, tdoann::simd_squared_euclidean<Out, It>>
+      static_simd_distance(data, ndim);
+
+  for (bool low_memory : {true, false}) {
+    // use the base class reference to get the virtual call path
+    run<tdoann::BaseDistance<Out, Idx>>("virtual", dynamic_distance, n_nbrs,
+                                        n_threads, low_memory);
+    run("static", static_distance, n_nbrs, n_threads, low_memory);
+    run("static + simd", static_simd_distance, n_nbrs, n_threads, low_memory);
+  }
+
+  return 0;
+}
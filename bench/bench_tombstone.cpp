@@ -0,0 +1,179 @@
+// Query accuracy and cost after deleting points from a nearest neighbor graph.
+// A fraction of the points is marked as deleted, and queries are run against
+// the graph with the tombstones alone (deleted points are searched through but
+// never returned), then again after the 2-hop repair of the kNN and search
+// graphs. The time for the repair is compared with rebuilding the graph of the
+// remaining points from scratch.
+//
+// Build and run from this directory:
+//
+// g++ -std=c++17 -O2 -I../inst/include bench_tombstone.cpp -pthread
+// ./a.out [n_points] [n_queries] [ndim] [n_nbrs] [delete_percent]
+
+#include <iomanip>
+
+#include "bench_common.h"
+#include "tdoann/distancebase.h"
+#include "tdoann/distancesimd.h"
+#include "tdoann/nndescent.h"
+#include "tdoann/search.h"
+#include "tdoann/tombstone.h"
+
+using bench::Idx;
+using In = float;
+using Out = float;
+using It = tdoann::DataIt<In>;
+using Distance =
+    tdoann::StaticSelfDistanceCalculator<In, Out, Idx,
+                                         tdoann::simd_squared_euclidean<Out, It>>;
+
+// distances from the first n_ref items (the reference) to the rest (the query)
+class QueryDistance : public tdoann::BaseDistance<Out, Idx> {
+  const Distance &distance;
+  std::size_t n_ref;
+
+public:
+  QueryDistance(const Distance &distance, std::size_t n_ref)
+      : distance(distance), n_ref(n_ref) {}
+  Out calculate(const Idx &i, const Idx &j) const override {
+    return distance.calculate(i, static_cast<Idx>(n_ref + j));
+  }
+  std::size_t get_nx() const override { return n_ref; }
+  std::size_t get_ny() const override { return distance.get_nx() - n_ref; }
+};
+
+void build(tdoann::NNDHeap<Out, Idx> &heap, const Distance &distance,
+           std::size_t n_nbrs) {
+  bench::QuietNNDProgress progress;
+  bench::MTRand rand(42);
+  tdoann::LowMemSerialLocalJoin<Out, Idx, Distance> local_join(distance);
+  constexpr uint32_t n_iters = 20;
+  constexpr double delta = 0.001;
+  tdoann::nnd_build(heap, local_join, n_nbrs, n_iters, delta, false, rand,
+                    progress);
+}
+
+auto to_search_graph(const tdoann::NNGraph<Out, Idx> &graph)
+    -> tdoann::SparseNNGraph<Out, Idx> {
+  std::vector<std::size_t> row_ptr(graph.n_points + 1);
+  for (std::size_t i = 0; i <= graph.n_points; i++) {
+    row_ptr[i] = i * graph.n_nbrs;
+  }
+  return tdoann::SparseNNGraph<Out, Idx>(row_ptr, graph.idx, graph.dist);
+}
+
+struct QueryResult {
+  double recall;
+  double n_dist_calcs;
+};
+
+// seeds each query with random (possibly deleted) reference points, then
+// compares the result with the exact neighbors among the remaining points
+auto query(const tdoann::SparseNNGraph<Out, Idx> &search_graph,
+           const QueryDistance &distance, std::size_t n_nbrs) -> QueryResult {
+  const std::size_t n_ref = distance.get_nx();
+  const std::size_t n_queries = distance.get_ny();
+  tdoann::NNHeap<Out, Idx> heap(n_queries, n_nbrs);
+  std::mt19937_64 prng(1337);
+  std::uniform_int_distribution<Idx> unif(0, n_ref - 1);
+  for (Idx i = 0; i < n_queries; i++) {
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      const Idx nbr = unif(prng);
+      heap.checked_push(i, distance.calculate(nbr, i), nbr);
+    }
+  }
+  std::vector<std::size_t> distance_counts(n_queries);
+  tdoann::non_search_query(heap, distance, search_graph, 0.1, n_ref,
+                           distance_counts, 0, n_queries);
+
+  std::size_t n_found = 0;
+  std::size_t n_dist_calcs = 0;
+  for (Idx i = 0; i < n_queries; i++) {
+    tdoann::NNHeap<Out, Idx> exact(1, n_nbrs);
+    for (Idx j = 0; j < n_ref; j++) {
+      if (!search_graph.is_deleted(j)) {
+        exact.checked_push(0, distance.calculate(j, i), j);
+      }
+    }
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      if (exact.contains(0, heap.index(i, j))) {
+        n_found++;
+      }
+    }
+    n_dist_calcs += distance_counts[i];
+  }
+  return {static_cast<double>(n_found) / (n_queries * n_nbrs),
+          static_cast<double>(n_dist_calcs) / n_queries};
+}
+
+int main(int argc, char **argv) {
+  const std::size_t n_points = bench::arg_or(argc, argv, 1, 50000);
+  const std::size_t n_queries = bench::arg_or(argc, argv, 2, 500);
+  const std::size_t ndim = bench::arg_or(argc, argv, 3, 16);
+  const std::size_t n_nbrs = bench::arg_or(argc, argv, 4, 15);
+  const std::size_t delete_percent = bench::arg_or(argc, argv, 5, 10);
+
+  std::cout << "n_points = " << n_points << " n_queries = " << n_queries
+            << " ndim = " << ndim << " n_nbrs = " << n_nbrs
+            << " delete_percent = " << delete_percent << std::endl;
+
+  const auto data = bench::random_data(n_points + n_queries, ndim);
+  const Distance ref_distance(
+      std::vector<In>(data.begin(), data.begin() + n_points * ndim), ndim);
+  const Distance distance(std::vector<In>(data), ndim);
+  const QueryDistance query_distance(distance, n_points);
+
+  tdoann::NNDHeap<Out, Idx> heap(n_points, n_nbrs);
+  bench::random_init(ref_distance, heap);
+  build(heap, ref_distance, n_nbrs);
+  tdoann::sort_heap(heap);
+  auto graph = tdoann::heap_to_graph(heap);
+  auto search_graph = to_search_graph(graph);
+
+  auto before = query(search_graph, query_distance, n_nbrs);
+
+  std::mt19937_64 prng(42);
+  std::uniform_int_distribution<std::size_t> percent(0, 99);
+  std::vector<In> live_data;
+  for (Idx i = 0; i < n_points; i++) {
+    if (percent(prng) < delete_percent) {
+      graph.mark_deleted(i);
+      search_graph.mark_deleted(i);
+    } else {
+      live_data.insert(live_data.end(), data.begin() + i * ndim,
+                       data.begin() + (i + 1) * ndim);
+    }
+  }
+  auto tombstoned = query(search_graph, query_distance, n_nbrs);
+
+  tdoann::NullProgress progress;
+  tdoann::SerialExecutor executor;
+  bench::Timer timer;
+  const auto repaired_graph =
+      tdoann::repair_knn_graph(graph, ref_distance, 0, progress, executor);
+  const auto repaired_search_graph = tdoann::repair_search_graph(
+      search_graph, ref_distance, 0, progress, executor);
+  const double repair_elapsed = timer.elapsed();
+  auto repaired = query(repaired_search_graph, query_distance, n_nbrs);
+
+  timer = bench::Timer();
+  const Distance live_distance(std::move(live_data), ndim);
+  tdoann::NNDHeap<Out, Idx> live_heap(live_distance.get_nx(), n_nbrs);
+  bench::random_init(live_distance, live_heap);
+  build(live_heap, live_distance, n_nbrs);
+  const double rebuild_elapsed = timer.elapsed();
+
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << "no deletions recall " << before.recall << " distances "
+            << std::setprecision(0) << before.n_dist_calcs << std::endl;
+  std::cout << std::setprecision(3) << "tombstones   recall "
+            << tombstoned.recall << " distances " << std::setprecision(0)
+            << tombstoned.n_dist_calcs << std::endl;
+  std::cout << std::setprecision(3) << "repaired     recall "
+            << repaired.recall << " distances " << std::setprecision(0)
+            << repaired.n_dist_calcs << std::endl;
+  std::cout << std::setprecision(3) << "repair " << repair_elapsed
+            << "s rebuild " << rebuild_elapsed << "s" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,167 @@
+// Nearest neighbor descent on double precision data owned by the caller (like
+// an R matrix), using float distance calculations. The current approach copies
+// the data into a std::vector<float> before starting; the view calculators
+// read the caller's data in place, converting each item to float when it is
+// needed. The views are tested on packed data (each item contiguous, like an
+// R matrix with the observations in the columns) and on column-major data
+// (the observations in the rows), which is also transposed on the fly. All
+// three should give the same graph. Then a small batch of queries is run
+// against the graph, where copying the reference data takes longer than the
+// search itself.
+//
+// Build and run from this directory:
+//
+// g++ -std=c++17 -O2 -I../inst/include bench_view.cpp -pthread
+// ./a.out [n_points] [ndim] [n_nbrs] [n_queries]
+
+#include <iomanip>
+
+#include "bench_common.h"
+#include "tdoann/distancebase.h"
+#include "tdoann/distancesimd.h"
+#include "tdoann/nndescent.h"
+#include "tdoann/search.h"
+
+using bench::Idx;
+using In = float;
+using Out = float;
+using It = tdoann::DataIt<In>;
+using Distance = tdoann::SelfDistanceCalculator<In, Out, Idx>;
+using ViewDistance = tdoann::ViewDistanceCalculator<double, In, Out, Idx>;
+using QueryDistance = tdoann::QueryDistanceCalculator<In, Out, Idx>;
+
+template <typename D>
+auto build(const D &distance, std::size_t n_nbrs) -> tdoann::NNDHeap<Out, Idx> {
+  tdoann::NNDHeap<Out, Idx> heap(distance.get_nx(), n_nbrs);
+  bench::random_init(distance, heap);
+  bench::QuietNNDProgress progress;
+  bench::MTRand rand(42);
+  tdoann::LowMemSerialLocalJoin<Out, Idx, D> local_join(distance);
+  constexpr uint32_t n_iters = 20;
+  constexpr double delta = 0.001;
+  tdoann::nnd_build(heap, local_join, n_nbrs, n_iters, delta, false, rand,
+                    progress);
+  return heap;
+}
+
+template <typename D>
+void run(const std::string &label, const D &distance, double setup_elapsed,
+         std::size_t n_nbrs, const tdoann::NNDHeap<Out, Idx> *reference,
+         const Distance &exact_distance) {
+  bench::Timer timer;
+  const auto heap = build(distance, n_nbrs);
+  const double build_elapsed = timer.elapsed();
+  std::cout << std::left << std::setw(12) << label << std::fixed
+            << std::setprecision(3) << " setup " << setup_elapsed
+            << "s build " << build_elapsed << "s recall "
+            << bench::recall(heap, exact_distance);
+  if (reference != nullptr) {
+    std::cout << " same graph " << (heap.idx == reference->idx ? "yes" : "no");
+  }
+  std::cout << std::endl;
+}
+
+// search the graph for the neighbors of each query item, starting from random
+// reference items, returning the time taken
+auto query(const tdoann::BaseDistance<Out, Idx> &distance,
+           const tdoann::NNDHeap<Out, Idx> &graph, std::size_t n_nbrs,
+           tdoann::NNHeap<Out, Idx> &result) -> double {
+  bench::Timer timer;
+  const std::size_t n_ref = distance.get_nx();
+  const std::size_t n_queries = distance.get_ny();
+  std::vector<std::size_t> row_ptr(n_ref + 1);
+  for (std::size_t i = 0; i <= n_ref; i++) {
+    row_ptr[i] = i * graph.n_nbrs;
+  }
+  const tdoann::SparseNNGraph<Out, Idx> search_graph(row_ptr, graph.idx,
+                                                     graph.dist);
+  std::mt19937_64 prng(1337);
+  std::uniform_int_distribution<Idx> unif(0, n_ref - 1);
+  for (Idx i = 0; i < n_queries; i++) {
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      const Idx nbr = unif(prng);
+      result.checked_push(i, distance.calculate(nbr, i), nbr);
+    }
+  }
+  std::vector<std::size_t> distance_counts(n_queries);
+  tdoann::non_search_query(result, distance, search_graph, 0.1, n_ref,
+                           distance_counts, 0, n_queries);
+  return timer.elapsed();
+}
+
+int main(int argc, char **argv) {
+  const std::size_t n_points = bench::arg_or(argc, argv, 1, 100000);
+  const std::size_t ndim = bench::arg_or(argc, argv, 2, 16);
+  const std::size_t n_nbrs = bench::arg_or(argc, argv, 3, 15);
+  const std::size_t n_queries = bench::arg_or(argc, argv, 4, 10);
+
+  std::cout << "n_points = " << n_points << " ndim = " << ndim
+            << " n_nbrs = " << n_nbrs << " n_queries = " << n_queries
+            << std::endl;
+
+  const auto random_data = bench::random_data(n_points, ndim);
+  const std::vector<double> packed(random_data.begin(), random_data.end());
+  std::vector<double> col_major(n_points * ndim);
+  for (std::size_t i = 0; i < n_points; i++) {
+    for (std::size_t d = 0; d < ndim; d++) {
+      col_major[i + d * n_points] = packed[i * ndim + d];
+    }
+  }
+
+  bench::Timer timer;
+  const Distance distance(std::vector<In>(packed.begin(), packed.end()), ndim,
+                          tdoann::simd_squared_euclidean<Out, It>);
+  const double copy_elapsed = timer.elapsed();
+  const auto reference = build(distance, n_nbrs);
+
+  const auto distance_func = tdoann::simd_squared_euclidean<Out, const In *>;
+  timer = bench::Timer();
+  const ViewDistance packed_view(
+      tdoann::DataView<double>::row_major(packed.data(), n_points, ndim),
+      distance_func);
+  const double packed_elapsed = timer.elapsed();
+  timer = bench::Timer();
+  const ViewDistance col_major_view(
+      tdoann::DataView<double>::col_major(col_major.data(), n_points, ndim),
+      distance_func);
+  const double col_major_elapsed = timer.elapsed();
+
+  run("copy", distance, copy_elapsed, n_nbrs, nullptr, distance);
+  run("view", packed_view, packed_elapsed, n_nbrs, &reference, distance);
+  run("view (cols)", col_major_view, col_major_elapsed, n_nbrs, &reference,
+      distance);
+  std::cout << std::setprecision(1) << "copy of the data "
+            << n_points * ndim * sizeof(In) / 1048576.0 << " MB" << std::endl;
+
+  const auto query_random = bench::random_data(n_queries, ndim, 1337);
+  const std::vector<double> queries(query_random.begin(), query_random.end());
+
+  timer = bench::Timer();
+  const QueryDistance query_distance(
+      std::vector<In>(packed.begin(), packed.end()),
+      std::vector<In>(queries.begin(), queries.end()), ndim,
+      tdoann::simd_squared_euclidean<Out, It>);
+  const double query_copy_elapsed = timer.elapsed();
+  tdoann::NNHeap<Out, Idx> copy_result(n_queries, n_nbrs);
+  const double copy_query_elapsed =
+      query(query_distance, reference, n_nbrs, copy_result);
+
+  timer = bench::Timer();
+  const ViewDistance query_view(
+      tdoann::DataView<double>::row_major(packed.data(), n_points, ndim),
+      tdoann::DataView<double>::row_major(queries.data(), n_queries, ndim),
+      distance_func);
+  const double query_view_elapsed = timer.elapsed();
+  tdoann::NNHeap<Out, Idx> view_result(n_queries, n_nbrs);
+  const double view_query_elapsed =
+      query(query_view, reference, n_nbrs, view_result);
+
+  std::cout << std::setprecision(4) << "query copy setup " << query_copy_elapsed
+            << "s search " << copy_query_elapsed << "s" << std::endl;
+  std::cout << "query view setup " << query_view_elapsed << "s search "
+            << view_query_elapsed << "s same result "
+            << (view_result.idx == copy_result.idx ? "yes" : "no")
+            << std::endl;
+
+  return 0;
+}
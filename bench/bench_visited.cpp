@@ -0,0 +1,107 @@
+// Per-query setup cost of the visited set in graph search. non_search_query
+// used to allocate and zero a BitVec with one bit per reference item for each
+// query; it now reuses an EpochSet for all the queries of a chunk, which is
+// cleared by starting a new epoch (nn_query takes the sets from a pool which
+// is freed when the search is done). For a search for a few neighbors of a
+// large reference set, the BitVec setup was a large part of the cost of each
+// query. This reports the time for the searches and, for comparison, the time
+// it takes to create one BitVec per query (the old overhead) and to clear an
+// EpochSet per query.
+//
+// Build and run from this directory:
+//
+// g++ -std=c++17 -O2 -I../inst/include bench_visited.cpp -pthread
+// ./a.out [n_points] [n_queries] [ndim] [n_nbrs]
+
+#include <iomanip>
+
+#include "bench_common.h"
+#include "tdoann/bvset.h"
+#include "tdoann/distancebase.h"
+#include "tdoann/distancesimd.h"
+#include "tdoann/nndescent.h"
+#include "tdoann/search.h"
+
+using bench::Idx;
+using In = float;
+using Out = float;
+using It = tdoann::DataIt<In>;
+using Distance = tdoann::SelfDistanceCalculator<In, Out, Idx>;
+using QueryDistance = tdoann::QueryDistanceCalculator<In, Out, Idx>;
+
+auto build(const Distance &distance, std::size_t n_nbrs)
+    -> tdoann::NNDHeap<Out, Idx> {
+  tdoann::NNDHeap<Out, Idx> heap(distance.get_nx(), n_nbrs);
+  bench::random_init(distance, heap);
+  bench::QuietNNDProgress progress;
+  bench::MTRand rand(42);
+  tdoann::LowMemSerialLocalJoin<Out, Idx, Distance> local_join(distance);
+  constexpr uint32_t n_iters = 5;
+  constexpr double delta = 0.001;
+  tdoann::nnd_build(heap, local_join, n_nbrs, n_iters, delta, false, rand,
+                    progress);
+  return heap;
+}
+
+int main(int argc, char **argv) {
+  const std::size_t n_points = bench::arg_or(argc, argv, 1, 1000000);
+  const std::size_t n_queries = bench::arg_or(argc, argv, 2, 10000);
+  const std::size_t ndim = bench::arg_or(argc, argv, 3, 4);
+  const std::size_t n_nbrs = bench::arg_or(argc, argv, 4, 5);
+
+  std::cout << "n_points = " << n_points << " n_queries = " << n_queries
+            << " ndim = " << ndim << " n_nbrs = " << n_nbrs << std::endl;
+
+  const auto data = bench::random_data(n_points, ndim);
+  const auto queries = bench::random_data(n_queries, ndim, 1337);
+  const auto distance_func = tdoann::simd_squared_euclidean<Out, It>;
+  const Distance distance(std::vector<In>(data), ndim, distance_func);
+  const auto heap = build(distance, n_nbrs);
+  std::vector<std::size_t> row_ptr(n_points + 1);
+  for (std::size_t i = 0; i <= n_points; i++) {
+    row_ptr[i] = i * n_nbrs;
+  }
+  const tdoann::SparseNNGraph<Out, Idx> search_graph(row_ptr, heap.idx,
+                                                     heap.dist);
+
+  const QueryDistance query_distance(data, queries, ndim, distance_func);
+  tdoann::NNHeap<Out, Idx> result(n_queries, n_nbrs);
+  std::mt19937_64 prng(1337);
+  std::uniform_int_distribution<Idx> unif(0, n_points - 1);
+  for (Idx i = 0; i < n_queries; i++) {
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      const Idx nbr = unif(prng);
+      result.checked_push(i, query_distance.calculate(nbr, i), nbr);
+    }
+  }
+  std::vector<std::size_t> distance_counts(n_queries);
+  bench::Timer timer;
+  tdoann::non_search_query(result, query_distance, search_graph, 0.1, n_points,
+                           distance_counts, 0, n_queries);
+  const double search_elapsed = timer.elapsed();
+
+  // touch one item in each set so the allocations aren't optimized away
+  std::size_t n_marked = 0;
+  timer = bench::Timer();
+  for (std::size_t i = 0; i < n_queries; i++) {
+    auto visited = tdoann::create_set(n_points);
+    n_marked += tdoann::has_been_and_mark_visited(visited, i) ? 0 : 1;
+  }
+  const double bitvec_elapsed = timer.elapsed();
+
+  tdoann::EpochSet<> epoch_set;
+  timer = bench::Timer();
+  for (std::size_t i = 0; i < n_queries; i++) {
+    epoch_set.clear(n_points);
+    n_marked += tdoann::has_been_and_mark_visited(epoch_set, i) ? 0 : 1;
+  }
+  const double epoch_elapsed = timer.elapsed();
+
+  std::cout << std::fixed << std::setprecision(2) << "search "
+            << 1e6 * search_elapsed / n_queries << " us/query" << std::endl;
+  std::cout << "set up per query: BitVec " << 1e6 * bitvec_elapsed / n_queries
+            << " us EpochSet " << 1e6 * epoch_elapsed / n_queries << " us"
+            << " (" << n_marked << " marked)" << std::endl;
+
+  return 0;
+}
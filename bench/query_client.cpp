@@ -0,0 +1,159 @@
+// A client for query_server.cpp, for testing the server and measuring its
+// latency. It connects to the server's socket and sends n_requests batches of
+// batch_size random normal query vectors, one at a time, waiting for each
+// response before sending the next. The p50 and p99 of the round-trip time of
+// the requests are reported, along with the server's own service time for them
+// since it started (which excludes the time spent in the socket).
+//
+// Build and run from this directory:
+//
+// g++ -std=c++17 -O2 -I../inst/include query_client.cpp -o query_client -pthread
+// ./query_client socket_path [n_requests] [batch_size] [n_nbrs]
+
+#include <iomanip>
+
+#include "bench_common.h"
+#include "query_protocol.h"
+
+class QueryClient {
+public:
+  explicit QueryClient(const std::string &socket_path) {
+    const auto address = bench::make_address(socket_path);
+    fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 ||
+        ::connect(fd, reinterpret_cast<const sockaddr *>(&address),
+                  sizeof(address)) != 0) {
+      throw std::runtime_error("Can't connect to " + socket_path + ": " +
+                               std::strerror(errno));
+    }
+    if (!bench::read_all(fd, &hello, sizeof(hello)) ||
+        hello.magic != bench::query_protocol_magic) {
+      throw std::runtime_error(socket_path + " is not a query server");
+    }
+    if (hello.version != bench::query_protocol_version) {
+      throw std::runtime_error("Unsupported protocol version " +
+                               std::to_string(hello.version));
+    }
+  }
+
+  QueryClient(const QueryClient &) = delete;
+  auto operator=(const QueryClient &) -> QueryClient & = delete;
+
+  ~QueryClient() { ::close(fd); }
+
+  auto n_items() const -> std::size_t { return hello.n_items; }
+  auto ndim() const -> std::size_t { return hello.ndim; }
+
+  // queries are n_queries * ndim floats, one query after the other. Returns
+  // the neighbor indices, and fills dist with the distances
+  auto query(const std::vector<float> &queries, uint32_t n_nbrs,
+             std::vector<float> &dist) -> std::vector<bench::Idx> {
+    const bench::RequestHeader request{
+        static_cast<uint32_t>(queries.size() / hello.ndim), n_nbrs};
+    bench::write_all(fd, &request, sizeof(request));
+    bench::write_all(fd, queries.data(), queries.size() * sizeof(float));
+
+    bench::ResponseHeader response{};
+    read(&response, sizeof(response));
+    if (response.status != bench::ResponseStatus::OK) {
+      uint32_t length = 0;
+      read(&length, sizeof(length));
+      std::string message(length, '\0');
+      read(&message[0], length);
+      throw std::runtime_error("Server error: " + message);
+    }
+    const std::size_t n_results =
+        static_cast<std::size_t>(response.n_queries) * response.n_nbrs;
+    std::vector<bench::Idx> idx(n_results);
+    dist.resize(n_results);
+    read(idx.data(), idx.size() * sizeof(bench::Idx));
+    read(dist.data(), dist.size() * sizeof(float));
+    return idx;
+  }
+
+  auto stats() -> bench::Stats {
+    const bench::RequestHeader request{0, 0};
+    bench::write_all(fd, &request, sizeof(request));
+    bench::ResponseHeader response{};
+    read(&response, sizeof(response));
+    if (response.status != bench::ResponseStatus::OK) {
+      throw std::runtime_error("Server error getting statistics");
+    }
+    bench::Stats server_stats{};
+    read(&server_stats, sizeof(server_stats));
+    return server_stats;
+  }
+
+private:
+  void read(void *data, std::size_t n_bytes) {
+    if (!bench::read_all(fd, data, n_bytes)) {
+      throw std::runtime_error("Server closed the connection");
+    }
+  }
+
+  int fd{-1};
+  bench::Hello hello{};
+};
+
+void print_stats(const std::string &name, const bench::Stats &stats) {
+  std::cout << name << " p50 " << stats.p50 * 1000.0 << "ms p99 "
+            << stats.p99 * 1000.0 << "ms mean " << stats.mean * 1000.0 << "ms"
+            << std::endl;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0]
+              << " socket_path [n_requests] [batch_size] [n_nbrs]" << std::endl;
+    return 1;
+  }
+  const std::string socket_path = argv[1];
+  const std::size_t n_requests = bench::arg_or(argc, argv, 2, 1000);
+  const std::size_t batch_size = bench::arg_or(argc, argv, 3, 1);
+  const auto n_nbrs = static_cast<uint32_t>(bench::arg_or(argc, argv, 4, 15));
+
+  try {
+    QueryClient client(socket_path);
+    std::cout << "Server has " << client.n_items() << " items with "
+              << client.ndim() << " features" << std::endl;
+    std::cout << "n_requests = " << n_requests
+              << " batch_size = " << batch_size << " n_nbrs = " << n_nbrs
+              << std::endl;
+    const auto queries = bench::random_data(n_requests * batch_size,
+                                            client.ndim(), 1337);
+    const std::size_t batch_values = batch_size * client.ndim();
+
+    std::vector<double> latencies;
+    std::vector<float> dist;
+    bench::Timer total_timer;
+    for (std::size_t i = 0; i < n_requests; i++) {
+      const std::vector<float> batch(queries.begin() + i * batch_values,
+                                     queries.begin() + (i + 1) * batch_values);
+      bench::Timer timer;
+      const auto idx = client.query(batch, n_nbrs, dist);
+      latencies.push_back(timer.elapsed());
+      if (i == 0) {
+        std::cout << "first query neighbors:";
+        for (std::size_t j = 0; j < std::min<std::size_t>(n_nbrs, 5); j++) {
+          std::cout << " " << idx[j] << " (" << dist[j] << ")";
+        }
+        std::cout << (n_nbrs > 5 ? " ..." : "") << std::endl;
+      }
+    }
+    const double total_elapsed = total_timer.elapsed();
+    const auto stats_after = client.stats();
+
+    std::cout << std::fixed << std::setprecision(3);
+    print_stats("round trip", bench::latency_stats(
+                                  latencies, n_requests * batch_size));
+    // the server's statistics include the requests of any earlier clients
+    print_stats("server    ", stats_after);
+    std::cout << "queries per second "
+              << static_cast<double>(n_requests * batch_size) / total_elapsed
+              << std::endl;
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
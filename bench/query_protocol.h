@@ -0,0 +1,219 @@
+// Wire protocol shared by query_server.cpp and query_client.cpp. Messages are
+// fixed-size headers followed by arrays, all in the native byte order: the
+// server only listens on a Unix domain socket, so both ends are always on the
+// same machine.
+//
+// On connecting, the server sends a Hello. The client then sends any number of
+// requests, each a RequestHeader followed by n_queries * ndim floats (one query
+// after the other). The server answers each request in order with a
+// ResponseHeader, followed by:
+//
+//  * status OK: n_queries * n_nbrs neighbor indices (uint32, 0-based), then the
+//    same number of distances (float), each query's neighbors sorted by
+//    distance.
+//  * status ERROR: a uint32 length and that many bytes of error message. The
+//    connection can still be used.
+//
+// A request with n_queries = 0 asks for the server's latency statistics, and
+// is answered with a ResponseHeader (status OK, n_queries and n_nbrs zero)
+// followed by a Stats.
+//
+// None of this is part of the R package.
+
+#ifndef RNN_BENCH_QUERY_PROTOCOL_H
+#define RNN_BENCH_QUERY_PROTOCOL_H
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace bench {
+
+constexpr uint32_t query_protocol_magic = 0x514e4e52; // "RNNQ"
+constexpr uint32_t query_protocol_version = 2;
+
+struct Hello {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t n_items;
+  uint32_t ndim;
+};
+
+struct RequestHeader {
+  uint32_t n_queries;
+  uint32_t n_nbrs;
+};
+
+enum class ResponseStatus : uint32_t { OK = 0, ERROR = 1 };
+
+struct ResponseHeader {
+  ResponseStatus status;
+  uint32_t n_queries;
+  uint32_t n_nbrs;
+};
+
+// time in seconds between the server receiving the last byte of a request and
+// its response being ready to send
+struct Stats {
+  uint64_t n_requests;
+  uint64_t n_queries;
+  double p50;
+  double p99;
+  double mean;
+};
+
+inline auto make_address(const std::string &path) -> sockaddr_un {
+  sockaddr_un address{};
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw std::runtime_error("Socket path is too long: " + path);
+  }
+  address.sun_family = AF_UNIX;
+  std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  return address;
+}
+
+// read exactly n_bytes: returns false if the other end closed the connection
+// before sending anything, throws if it closed part way through
+inline auto read_all(int fd, void *data, std::size_t n_bytes) -> bool {
+  auto *ptr = static_cast<char *>(data);
+  std::size_t n_read = 0;
+  while (n_read < n_bytes) {
+    const ssize_t n = ::read(fd, ptr + n_read, n_bytes - n_read);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      throw std::runtime_error(std::string("Read failed: ") +
+                               std::strerror(errno));
+    }
+    if (n == 0) {
+      if (n_read == 0) {
+        return false;
+      }
+      throw std::runtime_error("Connection closed in the middle of a message");
+    }
+    n_read += static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+inline void write_all(int fd, const void *data, std::size_t n_bytes) {
+  const auto *ptr = static_cast<const char *>(data);
+  std::size_t n_written = 0;
+  while (n_written < n_bytes) {
+    // MSG_NOSIGNAL: a client going away is an error, not a SIGPIPE
+    const ssize_t n =
+        ::send(fd, ptr + n_written, n_bytes - n_written, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      throw std::runtime_error(std::string("Write failed: ") +
+                               std::strerror(errno));
+    }
+    n_written += static_cast<std::size_t>(n);
+  }
+}
+
+// nearest rank percentile, p in [0, 100]
+inline auto percentile(std::vector<double> values, double p) -> double {
+  if (values.empty()) {
+    return 0.0;
+  }
+  std::sort(values.begin(), values.end());
+  const auto rank = static_cast<std::size_t>(
+      std::ceil(p / 100.0 * static_cast<double>(values.size())));
+  return values[rank == 0 ? 0 : rank - 1];
+}
+
+inline auto latency_stats(const std::vector<double> &latencies,
+                          uint64_t n_queries) -> Stats {
+  double total = 0.0;
+  for (const auto latency : latencies) {
+    total += latency;
+  }
+  const double mean =
+      latencies.empty() ? 0.0 : total / static_cast<double>(latencies.size());
+  return {latencies.size(), n_queries, percentile(latencies, 50.0),
+          percentile(latencies, 99.0), mean};
+}
+
+// Latencies binned on a log scale, for a server which records one per request
+// for as long as it runs: the memory used is fixed and a percentile only needs
+// a pass over the bins. Bins are 1/8 of a doubling wide starting at 1 us, so a
+// percentile is within 9% of the nearest rank latency. The mean is exact.
+class LatencyHistogram {
+public:
+  void add(double latency) {
+    counts[bin(latency)] += 1;
+    total += latency;
+    max_latency = std::max(max_latency, latency);
+    n += 1;
+  }
+
+  // nearest rank percentile, p in [0, 100], reported as the upper edge of the
+  // bin it falls into (or the largest latency seen, if that's smaller)
+  auto percentile(double p) const -> double {
+    if (n == 0) {
+      return 0.0;
+    }
+    auto rank =
+        static_cast<uint64_t>(std::ceil(p / 100.0 * static_cast<double>(n)));
+    rank = std::max(rank, uint64_t{1});
+    uint64_t seen = 0;
+    for (std::size_t i = 0; i < n_bins; i++) {
+      seen += counts[i];
+      if (seen >= rank) {
+        // the last bin also holds everything longer
+        return i + 1 == n_bins ? max_latency
+                               : std::min(upper_edge(i), max_latency);
+      }
+    }
+    return max_latency;
+  }
+
+  auto stats(uint64_t n_queries) const -> Stats {
+    const double mean = n == 0 ? 0.0 : total / static_cast<double>(n);
+    return {n, n_queries, percentile(50.0), percentile(99.0), mean};
+  }
+
+private:
+  static constexpr double min_latency = 1e-6;
+  static constexpr double bins_per_doubling = 8.0;
+  // 1 us to about 18 minutes
+  static constexpr std::size_t n_bins = 8 * 30;
+
+  static auto bin(double latency) -> std::size_t {
+    if (!(latency > min_latency)) {
+      return 0;
+    }
+    const double b =
+        std::ceil(std::log2(latency / min_latency) * bins_per_doubling);
+    return b >= static_cast<double>(n_bins - 1) ? n_bins - 1
+                                                : static_cast<std::size_t>(b);
+  }
+
+  static auto upper_edge(std::size_t i) -> double {
+    return min_latency *
+           std::exp2(static_cast<double>(i) / bins_per_doubling);
+  }
+
+  std::array<uint64_t, n_bins> counts{};
+  uint64_t n{0};
+  double total{0.0};
+  double max_latency{0.0};
+};
+
+} // namespace bench
+
+#endif // RNN_BENCH_QUERY_PROTOCOL_H
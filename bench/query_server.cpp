@@ -0,0 +1,551 @@
+// A standalone nearest neighbor query server, built directly on the tdoann
+// headers with no R involved. It memory-maps an index file written by
+// rnnd_save in the R package (or bench_indexfile.cpp), listens on a Unix domain
+// socket, and answers batches of query vectors with a graph search seeded from
+// the index's search forest (or randomly if it doesn't have one). The search
+// for each batch runs on a thread pool which lives as long as the server, so
+// a request pays for neither the R interpreter nor starting threads. See
+// query_protocol.h for the messages, and query_client.cpp for a client.
+//
+// Connections are served from a single event loop and a batch is searched
+// with all the threads, so requests from different clients are answered one
+// at a time. A slow or stalled client doesn't hold up the others: the server
+// only searches once a whole request has arrived, and sends the response as
+// fast as the client reads it. The service time of each request (from having
+// all of it to its response being ready to send) is binned into a fixed size
+// histogram, so memory use doesn't grow with the number of requests: clients
+// can ask for the p50 and p99, and they are printed when the server is stopped
+// with Ctrl-C (or SIGTERM).
+//
+// Build and run from this directory:
+//
+// g++ -std=c++17 -O2 -I../inst/include query_server.cpp -o query_server -pthread
+// ./query_server index_file socket_path [n_threads] [epsilon]
+
+#include <csignal>
+#include <iomanip>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <poll.h>
+
+#include "bench_common.h"
+#include "query_protocol.h"
+#include "tdoann/distance.h"
+#include "tdoann/distancesimd.h"
+#include "tdoann/forestsearch.h"
+#include "tdoann/indexfile.h"
+#include "tdoann/randnbrs.h"
+#include "tdoann/reorder.h"
+#include "tdoann/search.h"
+
+using bench::Idx;
+using In = float;
+using Out = float;
+using QueryDistance = tdoann::IndexQueryDistanceCalculator<In, Out, Idx>;
+using GraphView = tdoann::SparseNNGraphView<Out, Idx>;
+
+// the dense metrics with vectorized implementations, by the name stored as the
+// "actual_metric" of the index file
+auto get_metric_map()
+    -> const std::unordered_map<std::string, tdoann::PtrDistanceFunc<In, Out>> & {
+  using It = const In *;
+  static const std::unordered_map<std::string,
+                                  tdoann::PtrDistanceFunc<In, Out>>
+      metric_map = {
+          {"correlation", tdoann::simd_correlation<Out, It>},
+          {"correlation-preprocess", tdoann::simd_inner_product<Out, It>},
+          {"cosine", tdoann::simd_cosine<Out, It>},
+          {"alternative-cosine", tdoann::simd_alternative_cosine<Out, It>},
+          {"cosine-preprocess", tdoann::simd_inner_product<Out, It>},
+          {"dot", tdoann::simd_dot<Out, It>},
+          {"alternative-dot", tdoann::simd_alternative_dot<Out, It>},
+          {"euclidean", tdoann::simd_euclidean<Out, It>},
+          {"manhattan", tdoann::simd_manhattan<Out, It>},
+          {"sqeuclidean", tdoann::simd_squared_euclidean<Out, It>}};
+  return metric_map;
+}
+
+// the reference data of these metrics is stored preprocessed, so the queries
+// must be too
+auto get_preprocess_map()
+    -> const std::unordered_map<std::string, tdoann::PreprocessFunc<In>> & {
+  static const std::unordered_map<std::string, tdoann::PreprocessFunc<In>>
+      preprocess_map = {
+          {"cosine-preprocess", tdoann::normalize<In>},
+          {"correlation-preprocess", tdoann::mean_center_and_normalize<In>},
+          {"dot", tdoann::normalize<In>},
+          {"alternative-dot", tdoann::normalize<In>}};
+  return preprocess_map;
+}
+
+// The same corrections as apply_alt_metric_correction in the R package, by
+// the name of the metric the index was built for
+auto alt_metric_correction(const std::string &metric) -> Out (*)(Out) {
+  if (metric == "euclidean") {
+    return [](Out dist) { return std::sqrt(dist); };
+  }
+  if (metric == "cosine") {
+    return [](Out dist) { return std::max(Out(1) - std::exp2(-dist), Out(0)); };
+  }
+  if (metric == "dot") {
+    return [](Out dist) { return Out(1) - std::exp2(-dist); };
+  }
+  if (metric == "trueangular") {
+    return [](Out dist) {
+      const Out res = std::clamp(std::exp2(-dist), Out(-1), Out(1));
+      return Out(1) - std::acos(res) / Out(M_PI);
+    };
+  }
+  return nullptr;
+}
+
+class QueryIndex {
+public:
+  QueryIndex(const std::string &filename, std::size_t n_threads,
+             double epsilon)
+      : file(filename), data(tdoann::load_data<In>(file, "data")),
+        graph(tdoann::load_graph<Out, Idx>(file, "graph")),
+        n_threads(n_threads), epsilon(epsilon), rng_provider(42) {
+    if (graph.n_points != data.n_items) {
+      throw std::runtime_error(
+          "Search graph and data have different numbers of items");
+    }
+    const std::string actual_metric = file.get_string("actual_metric");
+    const auto &metric_map = get_metric_map();
+    if (metric_map.count(actual_metric) == 0) {
+      throw std::runtime_error("Unsupported metric '" + actual_metric + "'");
+    }
+    distance_func = metric_map.at(actual_metric);
+    const auto &preprocess_map = get_preprocess_map();
+    if (preprocess_map.count(actual_metric) > 0) {
+      preprocess_func = preprocess_map.at(actual_metric);
+    }
+    if (file.get<uint8_t>("use_alt_metric")[0] != 0) {
+      correction = alt_metric_correction(file.get_string("metric"));
+    }
+    metric = file.get_string("metric");
+    order = tdoann::load_order<Idx>(file, "order", data.n_items);
+
+    forest_type = file.contains("forest/type") ? file.get_string("forest/type")
+                                               : std::string("none");
+    if (forest_type == "explicit") {
+      tdoann::load_forest(file, "forest", data.n_items, data.ndim,
+                          explicit_forest);
+    } else if (forest_type == "implicit") {
+      tdoann::load_forest(file, "forest", data.n_items, data.ndim,
+                          implicit_forest);
+    } else if (forest_type != "none") {
+      throw std::runtime_error("Unsupported search forest type '" +
+                               forest_type + "'");
+    }
+    file.advise(tdoann::MappedFile<char>::Advice::Random);
+  }
+
+  auto n_items() const -> std::size_t { return data.n_items; }
+  auto ndim() const -> std::size_t { return data.ndim; }
+
+  auto describe() const -> std::string {
+    return std::to_string(data.n_items) + " items with " +
+           std::to_string(data.ndim) + " features, metric " + metric +
+           ", search forest " + forest_type;
+  }
+
+  // queries are n_queries * ndim floats, one query after the other: the result
+  // is sorted by distance
+  auto query(std::vector<In> &&queries, uint32_t n_nbrs)
+      -> tdoann::NNHeap<Out, Idx> {
+    if (preprocess_func != nullptr) {
+      preprocess_func(queries, data.ndim);
+    }
+    const QueryDistance distance(data, std::move(queries), distance_func);
+    std::vector<std::size_t> distance_counts(distance.get_ny(), 0);
+    const std::size_t max_distance_calculations = data.n_items;
+
+    tdoann::NNHeap<Out, Idx> nn_heap(0, 0);
+    if (forest_type == "explicit") {
+      nn_heap = tdoann::forest_nn_query(
+          explicit_forest, graph, distance, n_nbrs, true, epsilon,
+          max_distance_calculations, distance_counts, rng_provider, n_threads,
+          progress, executor);
+    } else if (forest_type == "implicit") {
+      nn_heap = tdoann::forest_nn_query(
+          implicit_forest, graph, distance, n_nbrs, true, epsilon,
+          max_distance_calculations, distance_counts, rng_provider, n_threads,
+          progress, executor);
+    } else {
+      nn_heap = tdoann::NNHeap<Out, Idx>(distance.get_ny(), n_nbrs);
+      tdoann::fill_random(nn_heap, distance, rng_provider, n_threads, progress,
+                          executor);
+      tdoann::nn_query(graph, nn_heap, distance, epsilon,
+                       max_distance_calculations, distance_counts, n_threads,
+                       progress, executor);
+    }
+    // the items may have been reordered when the index was saved
+    if (!order.empty()) {
+      tdoann::restore_ids(nn_heap.idx, order);
+    }
+    tdoann::sort_heap(nn_heap, n_threads, progress, executor);
+
+    if (correction != nullptr) {
+      for (auto &dist : nn_heap.dist) {
+        dist = correction(dist);
+      }
+    }
+    return nn_heap;
+  }
+
+private:
+  // declared first: data and graph point into the mapped file
+  tdoann::IndexFile file;
+  tdoann::DataView<In> data;
+  GraphView graph;
+  tdoann::ConstSpan<Idx> order;
+  std::string metric;
+  std::string forest_type;
+  std::vector<tdoann::SearchTree<In, Idx>> explicit_forest;
+  std::vector<tdoann::SearchTreeImplicit<Idx>> implicit_forest;
+  tdoann::PtrDistanceFunc<In, Out> distance_func{nullptr};
+  tdoann::PreprocessFunc<In> preprocess_func{nullptr};
+  Out (*correction)(Out){nullptr};
+  std::size_t n_threads;
+  double epsilon;
+  bench::MTParallelIntRand rng_provider;
+  tdoann::NullProgress progress;
+  bench::ThreadExecutor executor;
+};
+
+volatile std::sig_atomic_t stop_requested = 0;
+
+extern "C" void request_stop(int /* signal */) { stop_requested = 1; }
+
+// Clients are served from a single poll loop. Their sockets are non-blocking:
+// whatever has arrived is appended to the client's input buffer, and a request
+// is only answered once all of it is there, so a client that stops part way
+// through a message only holds up itself. Responses go to an output buffer
+// which is written out as the socket accepts it. A client that doesn't read
+// its responses isn't read from until its output buffer has drained.
+class QueryServer {
+public:
+  QueryServer(QueryIndex &index, std::string socket_path)
+      : index(index), socket_path(std::move(socket_path)) {}
+
+  QueryServer(const QueryServer &) = delete;
+  auto operator=(const QueryServer &) -> QueryServer & = delete;
+
+  ~QueryServer() {
+    for (const auto &client : clients) {
+      ::close(client.fd);
+    }
+    if (listen_fd >= 0) {
+      ::close(listen_fd);
+      ::unlink(socket_path.c_str());
+    }
+  }
+
+  void listen() {
+    const auto address = bench::make_address(socket_path);
+    listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+      throw std::runtime_error(std::string("Can't create socket: ") +
+                               std::strerror(errno));
+    }
+    // a socket file left behind by a server that didn't shut down cleanly
+    ::unlink(socket_path.c_str());
+    if (::bind(listen_fd, reinterpret_cast<const sockaddr *>(&address),
+               sizeof(address)) != 0 ||
+        ::listen(listen_fd, SOMAXCONN) != 0 || !set_non_blocking(listen_fd)) {
+      throw std::runtime_error("Can't listen on " + socket_path + ": " +
+                               std::strerror(errno));
+    }
+  }
+
+  void run() {
+    while (stop_requested == 0) {
+      std::vector<pollfd> fds{{listen_fd, POLLIN, 0}};
+      for (const auto &client : clients) {
+        short events = 0;
+        if (!client.closing && client.pending() < max_pending_bytes) {
+          events |= POLLIN;
+        }
+        if (client.pending() > 0) {
+          events |= POLLOUT;
+        }
+        fds.push_back({client.fd, events, 0});
+      }
+      if (::poll(fds.data(), fds.size(), -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error(std::string("poll failed: ") +
+                                 std::strerror(errno));
+      }
+      // clients whose connections are closed are removed after the loop, so
+      // fds[i + 1] stays in step with clients[i]
+      for (std::size_t i = 0; i < clients.size(); i++) {
+        auto &client = clients[i];
+        const short revents = fds[i + 1].revents;
+        if (revents == 0) {
+          continue;
+        }
+        bool open = true;
+        try {
+          if ((revents & (POLLIN | POLLHUP | POLLERR)) != 0 &&
+              !client.closing) {
+            open = receive(client);
+          }
+          open = flush(client) && open;
+        } catch (const std::exception &e) {
+          std::cerr << e.what() << std::endl;
+          open = false;
+        }
+        if (!open || (client.closing && client.pending() == 0)) {
+          ::close(client.fd);
+          client.fd = -1;
+        }
+      }
+      clients.erase(std::remove_if(clients.begin(), clients.end(),
+                                   [](const Client &c) { return c.fd < 0; }),
+                    clients.end());
+      if ((fds[0].revents & POLLIN) != 0) {
+        accept();
+      }
+    }
+  }
+
+  auto stats() const -> bench::Stats {
+    return latencies.stats(n_queries);
+  }
+
+private:
+  struct Client {
+    int fd{-1};
+    // bytes received but not yet used: the start of the next request
+    std::vector<char> in;
+    // bytes of responses not yet sent, starting at out_pos
+    std::vector<char> out;
+    std::size_t out_pos{0};
+    // close the connection once out has been sent
+    bool closing{false};
+
+    auto pending() const -> std::size_t { return out.size() - out_pos; }
+
+    void send(const void *data, std::size_t n_bytes) {
+      const auto *bytes = static_cast<const char *>(data);
+      out.insert(out.end(), bytes, bytes + n_bytes);
+    }
+  };
+
+  static auto set_non_blocking(int fd) -> bool {
+    const int flags = ::fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+  }
+
+  void accept() {
+    while (true) {
+      const int fd = ::accept(listen_fd, nullptr, nullptr);
+      if (fd < 0) {
+        return;
+      }
+      if (!set_non_blocking(fd)) {
+        std::cerr << "Can't make client socket non-blocking: "
+                  << std::strerror(errno) << std::endl;
+        ::close(fd);
+        continue;
+      }
+      const bench::Hello hello{bench::query_protocol_magic,
+                               bench::query_protocol_version,
+                               static_cast<uint32_t>(index.n_items()),
+                               static_cast<uint32_t>(index.ndim())};
+      Client client{};
+      client.fd = fd;
+      client.send(&hello, sizeof(hello));
+      clients.push_back(std::move(client));
+      if (!flush(clients.back())) {
+        ::close(fd);
+        clients.pop_back();
+      }
+    }
+  }
+
+  // Read whatever client has sent and answer any requests that are now
+  // complete. Returns false if the connection should be closed at once.
+  auto receive(Client &client) -> bool {
+    char buffer[64 * 1024];
+    while (true) {
+      const ssize_t n = ::read(client.fd, buffer, sizeof(buffer));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        break;
+      }
+      if (n < 0) {
+        std::cerr << "Read failed: " << std::strerror(errno) << std::endl;
+        return false;
+      }
+      if (n == 0) {
+        if (!client.in.empty()) {
+          std::cerr << "Connection closed in the middle of a message"
+                    << std::endl;
+        }
+        return false;
+      }
+      client.in.insert(client.in.end(), buffer, buffer + n);
+      // leave anything further until the client has caught up with reading
+      if (client.in.size() >= max_pending_bytes) {
+        break;
+      }
+    }
+
+    std::size_t pos = 0;
+    while (!client.closing && serve(client, pos)) {
+    }
+    client.in.erase(client.in.begin(),
+                    client.in.begin() + static_cast<std::ptrdiff_t>(pos));
+    return true;
+  }
+
+  // If the request starting at client.in[pos] has been received in full,
+  // answer it, advance pos past it and return true
+  auto serve(Client &client, std::size_t &pos) -> bool {
+    const std::size_t available = client.in.size() - pos;
+    bench::RequestHeader request{};
+    if (available < sizeof(request)) {
+      return false;
+    }
+    std::memcpy(&request, client.in.data() + pos, sizeof(request));
+    if (request.n_queries == 0) {
+      const auto server_stats = stats();
+      const bench::ResponseHeader response{bench::ResponseStatus::OK, 0, 0};
+      client.send(&response, sizeof(response));
+      client.send(&server_stats, sizeof(server_stats));
+      pos += sizeof(request);
+      return true;
+    }
+    const std::size_t n_values =
+        static_cast<std::size_t>(request.n_queries) * index.ndim();
+    if (n_values > max_request_values) {
+      // the rest of the request isn't read, so the connection can't be used
+      // any more
+      send_error(client, "Too many queries in one request");
+      client.closing = true;
+      pos = client.in.size();
+      return false;
+    }
+    const std::size_t n_bytes = sizeof(request) + n_values * sizeof(In);
+    if (available < n_bytes) {
+      return false;
+    }
+    std::vector<In> queries(n_values);
+    std::memcpy(queries.data(), client.in.data() + pos + sizeof(request),
+                n_values * sizeof(In));
+    pos += n_bytes;
+
+    bench::Timer timer;
+    if (request.n_nbrs == 0 || request.n_nbrs > index.n_items()) {
+      send_error(client, "n_nbrs must be between 1 and " +
+                             std::to_string(index.n_items()));
+      return true;
+    }
+    const auto nn_heap = index.query(std::move(queries), request.n_nbrs);
+    const bench::ResponseHeader response{bench::ResponseStatus::OK,
+                                         request.n_queries, request.n_nbrs};
+    client.send(&response, sizeof(response));
+    client.send(nn_heap.idx.data(), nn_heap.idx.size() * sizeof(Idx));
+    client.send(nn_heap.dist.data(), nn_heap.dist.size() * sizeof(Out));
+    latencies.add(timer.elapsed());
+    n_queries += request.n_queries;
+    return true;
+  }
+
+  // Send as much of client's output as the socket will take. Returns false if
+  // the connection should be closed.
+  static auto flush(Client &client) -> bool {
+    while (client.pending() > 0) {
+      // MSG_NOSIGNAL: a client going away is an error, not a SIGPIPE
+      const ssize_t n =
+          ::send(client.fd, client.out.data() + client.out_pos,
+                 client.pending(), MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return true;
+      }
+      if (n < 0) {
+        std::cerr << "Write failed: " << std::strerror(errno) << std::endl;
+        return false;
+      }
+      client.out_pos += static_cast<std::size_t>(n);
+    }
+    client.out.clear();
+    client.out_pos = 0;
+    return true;
+  }
+
+  static void send_error(Client &client, const std::string &message) {
+    const bench::ResponseHeader response{bench::ResponseStatus::ERROR, 0, 0};
+    const auto length = static_cast<uint32_t>(message.size());
+    client.send(&response, sizeof(response));
+    client.send(&length, sizeof(length));
+    client.send(message.data(), message.size());
+  }
+
+  // 1 GB of floats
+  static constexpr std::size_t max_request_values = 1ULL << 28;
+  // stop reading from a client with this many bytes of responses it hasn't
+  // read yet
+  static constexpr std::size_t max_pending_bytes = 16 * 1024 * 1024;
+
+  QueryIndex &index;
+  std::string socket_path;
+  int listen_fd{-1};
+  std::vector<Client> clients;
+  bench::LatencyHistogram latencies;
+  uint64_t n_queries{0};
+};
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0]
+              << " index_file socket_path [n_threads] [epsilon]" << std::endl;
+    return 1;
+  }
+  const std::string index_file = argv[1];
+  const std::string socket_path = argv[2];
+  const std::size_t n_threads = bench::arg_or(
+      argc, argv, 3, std::max(std::thread::hardware_concurrency(), 1U));
+  const double epsilon = argc > 4 ? std::strtod(argv[4], nullptr) : 0.1;
+
+  // no SA_RESTART, so a signal interrupts poll
+  struct sigaction action {};
+  action.sa_handler = request_stop;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+
+  try {
+    bench::Timer timer;
+    QueryIndex index(index_file, n_threads, epsilon);
+    QueryServer server(index, socket_path);
+    server.listen();
+    std::cout << "Loaded " << index.describe() << " in " << std::fixed
+              << std::setprecision(3) << timer.elapsed() << "s" << std::endl;
+    std::cout << "Listening on " << socket_path << " with " << n_threads
+              << " threads" << std::endl;
+    server.run();
+
+    const auto stats = server.stats();
+    std::cout << "\nServed " << stats.n_requests << " requests ("
+              << stats.n_queries << " queries): latency p50 "
+              << stats.p50 * 1000.0 << "ms p99 " << stats.p99 * 1000.0
+              << "ms mean " << stats.mean * 1000.0 << "ms" << std::endl;
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
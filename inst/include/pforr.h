@@ -23,6 +23,12 @@
 #ifndef PFORR
 #define PFORR
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <utility>
 #include <vector>
@@ -92,6 +98,172 @@ inline void parallel_for(std::size_t begin, std::size_t end, Worker &worker,
   return;
 }
 
+// A persistent pool of worker threads. parallel_for splits the input range in
+// the same way as the free function above, but the ranges are run by threads
+// which are created once and then reused, rather than creating and joining a
+// new thread for each range on each call. Each worker has its own queue of
+// ranges and takes work from the front of it. When its queue is empty it
+// steals from the back of the other workers' queues. The pool grows (by
+// restarting) if a call asks for more threads than it has.
+class ThreadPool {
+public:
+  using Worker = std::function<void(std::size_t, std::size_t)>;
+
+  ThreadPool() = default;
+  explicit ThreadPool(std::size_t n_threads) { start(n_threads); }
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ~ThreadPool() { shutdown(); }
+
+  auto size() const -> std::size_t { return threads.size(); }
+
+  void parallel_for(std::size_t begin, std::size_t end, const Worker &worker,
+                    std::size_t n_threads, std::size_t grain_size = 1) {
+    // a worker calling parallel_for would wait on work that can only be
+    // run by the pool, so nested calls are run serially
+    if (n_threads == 0 || in_pool_thread() || begin >= end) {
+      worker(begin, end);
+      return;
+    }
+    std::lock_guard<std::mutex> call_guard(call_mutex);
+    if (threads.size() < n_threads) {
+      shutdown();
+      start(n_threads);
+    }
+
+    IndexRange input_range(begin, end);
+    std::vector<IndexRange> ranges =
+      split_input_range(input_range, n_threads, grain_size);
+
+    Batch batch(worker, ranges.size());
+    for (std::size_t i = 0; i < ranges.size(); i++) {
+      auto &queue = *queues[i % queues.size()];
+      std::lock_guard<std::mutex> queue_guard(queue.mutex);
+      queue.tasks.push_back(Task{ranges[i], &batch});
+    }
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      n_queued += ranges.size();
+    }
+    work_available.notify_all();
+
+    std::unique_lock<std::mutex> batch_lock(batch.mutex);
+    batch.done.wait(batch_lock, [&batch] { return batch.remaining == 0; });
+  }
+
+  // Stop and join all the worker threads. Any calls to parallel_for must
+  // have returned.
+  void shutdown() {
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      stopping = true;
+    }
+    work_available.notify_all();
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    threads.clear();
+    queues.clear();
+    stopping = false;
+  }
+
+private:
+  struct Batch {
+    const Worker &worker;
+    std::size_t remaining;
+    std::mutex mutex;
+    std::condition_variable done;
+
+    Batch(const Worker &worker, std::size_t n_tasks)
+      : worker(worker), remaining(n_tasks) {}
+  };
+
+  struct Task {
+    IndexRange range;
+    Batch *batch;
+  };
+
+  struct TaskQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::thread> threads;
+  std::vector<std::unique_ptr<TaskQueue>> queues;
+  std::mutex mutex;
+  std::condition_variable work_available;
+  std::size_t n_queued{0};
+  bool stopping{false};
+  std::mutex call_mutex;
+
+  static auto in_pool_thread() -> bool & {
+    thread_local bool in_pool = false;
+    return in_pool;
+  }
+
+  void start(std::size_t n_threads) {
+    queues.reserve(n_threads);
+    for (std::size_t i = 0; i < n_threads; i++) {
+      queues.push_back(std::make_unique<TaskQueue>());
+    }
+    threads.reserve(n_threads);
+    for (std::size_t i = 0; i < n_threads; i++) {
+      threads.emplace_back(&ThreadPool::run, this, i);
+    }
+  }
+
+  auto try_pop(std::size_t id, Task &task) -> bool {
+    {
+      auto &own = *queues[id];
+      std::lock_guard<std::mutex> guard(own.mutex);
+      if (!own.tasks.empty()) {
+        task = own.tasks.front();
+        own.tasks.pop_front();
+        return true;
+      }
+    }
+    for (std::size_t i = 1; i < queues.size(); i++) {
+      auto &other = *queues[(id + i) % queues.size()];
+      std::lock_guard<std::mutex> guard(other.mutex);
+      if (!other.tasks.empty()) {
+        task = other.tasks.back();
+        other.tasks.pop_back();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void run(std::size_t id) {
+    in_pool_thread() = true;
+    Task task{};
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        work_available.wait(lock, [this] { return stopping || n_queued > 0; });
+        if (stopping) {
+          return;
+        }
+      }
+      if (!try_pop(id, task)) {
+        // another worker got there first
+        continue;
+      }
+      {
+        std::lock_guard<std::mutex> guard(mutex);
+        --n_queued;
+      }
+      worker_thread(task.batch->worker, task.range);
+
+      Batch &batch = *task.batch;
+      std::lock_guard<std::mutex> guard(batch.mutex);
+      if (--batch.remaining == 0) {
+        batch.done.notify_one();
+      }
+    }
+  }
+};
+
 } // namespace pforr
 
 #endif // PFORR
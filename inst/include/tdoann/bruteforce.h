@@ -27,7 +27,10 @@
 #ifndef TDOANN_BRUTE_FORCE_H
 #define TDOANN_BRUTE_FORCE_H
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
+#include <type_traits>
 #include <vector>
 
 #include "distancebase.h"
@@ -142,5 +145,413 @@ auto brute_force_query(const BaseDistance<Out, Idx> &distance, Idx n_nbrs,
   return nnbf_query(distance, n_nbrs, n_threads, progress, executor);
 }
 
+// Tiled brute force for metrics that can be calculated from inner products
+//
+// The distances between a block of queries and a tile of reference items are
+// calculated from the inner products and the (squared) norms of the vectors,
+// e.g. for squared Euclidean: ||x||^2 + ||y||^2 - 2x'y. The inner products are
+// calculated four queries at a time, so each reference vector is read once
+// per four queries, and the reference tile stays in cache while the query
+// block is processed. Each thread works on its own block of queries, so no
+// locking is needed.
+//
+// These distances are only used to choose 2k candidates for each query, and
+// the final neighbors are chosen by recalculating the distances exactly. The
+// norm expansion suffers from cancellation error when the distances are small
+// compared to the norms, which for data far from the origin can swamp the
+// differences between the distances entirely. Euclidean distances don't
+// change if all the data is shifted, so for those metrics the data is centered
+// on the mean of the reference data first. That doesn't help the angular
+// metrics, so for each query the gap between the kth and the last candidate
+// is checked against a bound on the error: if it is too small to be sure
+// that the true neighbors are among the candidates, the distances to all the
+// reference items are calculated exactly for that query.
+//
+// Doing that for most of the queries is slower than never tiling at all, so
+// the check is first made on a sample of the queries. If it fails for too
+// many of them, the data is centered if that could help (the centered copy is
+// only made then), and otherwise the pairwise brute force search is used from
+// the start.
+
+enum class InnerProductMetric {
+  SquaredEuclidean,
+  Euclidean,
+  Cosine,
+  AlternativeCosine,
+  InnerProduct,
+  Dot,
+  AlternativeDot
+};
+
+// The metric used to choose the candidates: each metric is ranked by the
+// simplest of squared Euclidean, cosine and inner product distance which puts
+// the items in the same order. The dot metrics are used with normalized data,
+// for which 1 - x'y orders the items the same way as the dot distance.
+constexpr auto candidate_metric(InnerProductMetric metric)
+    -> InnerProductMetric {
+  switch (metric) {
+  case InnerProductMetric::SquaredEuclidean:
+  case InnerProductMetric::Euclidean:
+    return InnerProductMetric::SquaredEuclidean;
+  case InnerProductMetric::Cosine:
+  case InnerProductMetric::AlternativeCosine:
+    return InnerProductMetric::Cosine;
+  default:
+    return InnerProductMetric::InnerProduct;
+  }
+}
+
+constexpr auto uses_norms(InnerProductMetric metric) -> bool {
+  return candidate_metric(metric) != InnerProductMetric::InnerProduct;
+}
+
+constexpr auto is_translation_invariant(InnerProductMetric metric) -> bool {
+  return candidate_metric(metric) == InnerProductMetric::SquaredEuclidean;
+}
+
+// Convert the inner product xy of two vectors with squared norms xx and yy to
+// a candidate distance
+template <InnerProductMetric metric, typename Out>
+auto inner_product_distance(Out xy, Out xx, Out yy) -> Out {
+  constexpr Out zero = 0.0;
+  constexpr Out one = 1.0;
+  if constexpr (metric == InnerProductMetric::SquaredEuclidean) {
+    return std::max(xx + yy - 2 * xy, zero);
+  } else if constexpr (metric == InnerProductMetric::Cosine) {
+    if (xx == zero && yy == zero) {
+      return zero;
+    }
+    if (xx == zero || yy == zero) {
+      return one;
+    }
+    return one - xy / std::sqrt(xx * yy);
+  } else {
+    return one - xy;
+  }
+}
+
+// A bound on the difference between a candidate distance and the same
+// distance calculated exactly, for a query with squared norm query_norm and
+// reference items with squared norms no larger than max_ref_norm. Each is a
+// sum of ndim terms, so its rounding error is at most around ndim * epsilon
+// times the sum of the magnitudes of the terms: for squared Euclidean that is
+// the norms, and for the angular distances (which are scaled by the norms, or
+// use normalized data) it is one.
+template <typename T>
+auto candidate_tolerance(InnerProductMetric metric, T query_norm,
+                         T max_ref_norm, std::size_t ndim) -> T {
+  const T n_eps = static_cast<T>(2 * ndim) * std::numeric_limits<T>::epsilon();
+  if (candidate_metric(metric) == InnerProductMetric::SquaredEuclidean) {
+    return n_eps * (query_norm + max_ref_norm);
+  }
+  return n_eps;
+}
+
+// subtract the mean of the reference data from the reference and query data:
+// the mean is accumulated in double so it is accurate for large datasets
+template <typename T>
+void center_on_mean(std::vector<T> &ref, std::vector<T> &query,
+                    std::size_t ndim) {
+  const std::size_t n_ref = ref.size() / ndim;
+  std::vector<double> mean(ndim, 0.0);
+  for (std::size_t i = 0; i < n_ref; i++) {
+    for (std::size_t d = 0; d < ndim; d++) {
+      mean[d] += ref[i * ndim + d];
+    }
+  }
+  for (auto &m : mean) {
+    m /= static_cast<double>(n_ref);
+  }
+  auto center = [&](std::vector<T> &data) {
+    for (std::size_t i = 0; i < data.size(); i++) {
+      data[i] = static_cast<T>(data[i] - mean[i % ndim]);
+    }
+  };
+  center(ref);
+  center(query);
+}
+
+template <typename T>
+auto squared_norms(const T *data, std::size_t n_points, std::size_t ndim)
+    -> std::vector<T> {
+  std::vector<T> norms(n_points);
+  for (std::size_t i = 0; i < n_points; i++) {
+    const T *x = data + i * ndim;
+    norms[i] = sum_product(x, x, ndim);
+  }
+  return norms;
+}
+
+// Fill the rows begin to end of candidates with the nearest reference items of
+// queries begin to end, based on the candidate distance. The metric is a
+// template parameter so the conversion of inner products to distances in the
+// innermost loop doesn't need to branch on it.
+template <InnerProductMetric metric, typename T, typename Idx>
+void tiled_nnbf_query_impl(const T *ref, const std::vector<T> &ref_norms,
+                           std::size_t n_ref, const T *query,
+                           const std::vector<T> &query_norms, std::size_t ndim,
+                           NNHeap<T, Idx> &candidates, std::size_t begin,
+                           std::size_t end) {
+  constexpr std::size_t query_block_size = 64;
+  constexpr std::size_t n_rows = 4; // queries per kernel call
+  constexpr bool need_norms = uses_norms(metric);
+  // aim for a reference tile of around 128 KB so it stays in L2 cache while
+  // the query block is processed
+  constexpr std::size_t tile_bytes = 128 * 1024;
+  const std::size_t ref_tile_size =
+      std::clamp(tile_bytes / (ndim * sizeof(T)), std::size_t{16},
+                 std::size_t{1024});
+
+  const T *query_rows[n_rows];
+  // inner products of each of the n_rows queries with the reference tile
+  std::vector<T> inner_products(n_rows * ref_tile_size);
+  T row_products[n_rows];
+  for (std::size_t q_begin = begin; q_begin < end;
+       q_begin += query_block_size) {
+    const std::size_t q_end = std::min(end, q_begin + query_block_size);
+    for (std::size_t r_begin = 0; r_begin < n_ref; r_begin += ref_tile_size) {
+      const std::size_t n_tile = std::min(n_ref - r_begin, ref_tile_size);
+      for (std::size_t q = q_begin; q < q_end; q += n_rows) {
+        const std::size_t n_queries = std::min(n_rows, q_end - q);
+        for (std::size_t b = 0; b < n_rows; b++) {
+          // pad a partial block by repeating the last query
+          query_rows[b] = query + ndim * (q + std::min(b, n_queries - 1));
+        }
+        for (std::size_t t = 0; t < n_tile; t++) {
+          block_kernel_x4(BlockKernel::Product, query_rows,
+                          ref + ndim * (r_begin + t), ndim, row_products);
+          for (std::size_t b = 0; b < n_rows; b++) {
+            inner_products[b * ref_tile_size + t] = row_products[b];
+          }
+        }
+        for (std::size_t b = 0; b < n_queries; b++) {
+          const Idx query_idx = q + b;
+          const T query_norm = need_norms ? query_norms[query_idx] : T{0};
+          const T *products = inner_products.data() + b * ref_tile_size;
+          for (std::size_t t = 0; t < n_tile; t++) {
+            const std::size_t ref_idx = r_begin + t;
+            const T ref_norm = need_norms ? ref_norms[ref_idx] : T{0};
+            const T dist = inner_product_distance<metric>(products[t],
+                                                          ref_norm, query_norm);
+            if (candidates.accepts(query_idx, dist)) {
+              candidates.unchecked_push(query_idx, dist,
+                                        static_cast<Idx>(ref_idx));
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename T, typename Idx>
+void tiled_nnbf_query_impl(InnerProductMetric metric, const T *ref,
+                           const std::vector<T> &ref_norms, std::size_t n_ref,
+                           const T *query, const std::vector<T> &query_norms,
+                           std::size_t ndim, NNHeap<T, Idx> &candidates,
+                           std::size_t begin, std::size_t end) {
+  switch (candidate_metric(metric)) {
+  case InnerProductMetric::SquaredEuclidean:
+    tiled_nnbf_query_impl<InnerProductMetric::SquaredEuclidean>(
+        ref, ref_norms, n_ref, query, query_norms, ndim, candidates, begin,
+        end);
+    break;
+  case InnerProductMetric::Cosine:
+    tiled_nnbf_query_impl<InnerProductMetric::Cosine>(
+        ref, ref_norms, n_ref, query, query_norms, ndim, candidates, begin,
+        end);
+    break;
+  default:
+    tiled_nnbf_query_impl<InnerProductMetric::InnerProduct>(
+        ref, ref_norms, n_ref, query, query_norms, ndim, candidates, begin,
+        end);
+    break;
+  }
+}
+
+// Whether the candidates of query can be trusted to include its n_nbrs
+// nearest neighbors: the gap between the candidate distances of the n_nbrs-th
+// and the last candidate must be more than twice tolerance. candidate_dist is
+// scratch space for the candidate distances.
+template <typename Out, typename Idx>
+auto candidates_trusted(const NNHeap<Out, Idx> &candidates, std::size_t query,
+                        std::size_t n_nbrs, Out tolerance,
+                        std::vector<Out> &candidate_dist) -> bool {
+  candidate_dist.resize(candidates.n_nbrs);
+  for (std::size_t j = 0; j < candidates.n_nbrs; j++) {
+    candidate_dist[j] = candidates.distance(query, j);
+  }
+  std::nth_element(candidate_dist.begin(),
+                   candidate_dist.begin() + (n_nbrs - 1), candidate_dist.end());
+  // the candidate heap is a max heap, so the last candidate is the root
+  const Out gap = candidates.distance(query, 0) - candidate_dist[n_nbrs - 1];
+  return gap > 2 * tolerance;
+}
+
+// Recalculate the distances to the candidates of queries begin to end with
+// distance and keep the nearest. If the candidates of a query can't be
+// trusted, the distances to all the reference items are calculated instead.
+template <typename Out, typename Idx, typename Tolerance>
+void rerank_candidates(const BaseDistance<Out, Idx> &distance,
+                       const NNHeap<Out, Idx> &candidates,
+                       NNHeap<Out, Idx> &neighbor_heap, Tolerance tolerance,
+                       std::size_t begin, std::size_t end) {
+  constexpr auto npos = static_cast<Idx>(-1);
+  const std::size_t n_ref = distance.get_nx();
+  const std::size_t n_nbrs = neighbor_heap.n_nbrs;
+  // if every reference item is a candidate, there is nothing to miss
+  const bool all_candidates = candidates.n_nbrs >= n_ref;
+  std::vector<Out> candidate_dist;
+  for (auto query = begin; query < end; query++) {
+    if (!all_candidates && !candidates_trusted(candidates, query, n_nbrs,
+                                               tolerance(query),
+                                               candidate_dist)) {
+      for (std::size_t ref = 0; ref < n_ref; ref++) {
+        const auto dist_rq = distance.calculate(ref, query);
+        if (neighbor_heap.accepts(query, dist_rq)) {
+          neighbor_heap.unchecked_push(query, dist_rq, static_cast<Idx>(ref));
+        }
+      }
+      continue;
+    }
+    for (std::size_t j = 0; j < candidates.n_nbrs; j++) {
+      const auto ref = candidates.index(query, j);
+      if (ref == npos) {
+        continue;
+      }
+      const auto dist_rq = distance.calculate(ref, query);
+      if (neighbor_heap.accepts(query, dist_rq)) {
+        neighbor_heap.unchecked_push(query, dist_rq, ref);
+      }
+    }
+  }
+}
+
+// Whether the candidates found by tiling can be trusted for at least half of
+// an evenly spaced sample of the queries. Small query sets aren't sampled:
+// checking them would cost as much as the search.
+template <typename T, typename Idx, typename Tolerance>
+auto tiling_is_accurate(InnerProductMetric metric, const T *ref,
+                        const std::vector<T> &ref_norms, std::size_t n_ref,
+                        const T *query, const std::vector<T> &query_norms,
+                        std::size_t n_query, std::size_t ndim,
+                        std::size_t n_candidates, std::size_t n_nbrs,
+                        Tolerance tolerance) -> bool {
+  constexpr std::size_t n_sample = 64;
+  if (n_query <= n_sample || n_candidates >= n_ref) {
+    return true;
+  }
+  std::vector<T> sample(n_sample * ndim);
+  std::vector<T> sample_norms;
+  std::vector<std::size_t> sample_idx(n_sample);
+  for (std::size_t i = 0; i < n_sample; i++) {
+    sample_idx[i] = i * n_query / n_sample;
+    std::copy(query + sample_idx[i] * ndim, query + (sample_idx[i] + 1) * ndim,
+              sample.begin() + i * ndim);
+    if (!query_norms.empty()) {
+      sample_norms.push_back(query_norms[sample_idx[i]]);
+    }
+  }
+  NNHeap<T, Idx> candidates(n_sample, static_cast<Idx>(n_candidates));
+  tiled_nnbf_query_impl(metric, ref, ref_norms, n_ref, sample.data(),
+                        sample_norms, ndim, candidates, 0, n_sample);
+  std::vector<T> candidate_dist;
+  std::size_t n_trusted = 0;
+  for (std::size_t i = 0; i < n_sample; i++) {
+    if (candidates_trusted(candidates, i, n_nbrs, tolerance(sample_idx[i]),
+                           candidate_dist)) {
+      ++n_trusted;
+    }
+  }
+  return 2 * n_trusted >= n_sample;
+}
+
+// distance is used for the final exact distances and must be consistent with
+// metric. Its (possibly pre-processed) data is used directly, so In and Out
+// must be the same floating point type.
+template <typename In, typename Out, typename Idx>
+auto tiled_brute_force_query(const VectorDistance<In, Out, Idx> &distance,
+                             std::size_t ndim, InnerProductMetric metric,
+                             Idx n_nbrs, std::size_t n_threads,
+                             ProgressBase &progress, const Executor &executor)
+    -> NNGraph<Out, Idx> {
+  static_assert(std::is_same_v<In, Out>,
+                "Tiled brute force needs the same input and output types");
+  const std::size_t n_ref = distance.get_nx();
+  const std::size_t n_query = distance.get_ny();
+  const In *ref = &*distance.get_x(0);
+  const In *query = &*distance.get_y(0);
+
+  const bool is_self = ref == query;
+
+  std::vector<Out> ref_norms;
+  std::vector<Out> query_norms;
+  Out max_ref_norm = 0;
+  auto calculate_norms = [&]() {
+    if (uses_norms(metric)) {
+      ref_norms = squared_norms(ref, n_ref, ndim);
+      query_norms = is_self ? ref_norms : squared_norms(query, n_query, ndim);
+      max_ref_norm = *std::max_element(ref_norms.begin(), ref_norms.end());
+    }
+  };
+  calculate_norms();
+  auto tolerance = [&](std::size_t query_idx) {
+    const Out query_norm = query_norms.empty() ? Out{0} : query_norms[query_idx];
+    return candidate_tolerance(metric, query_norm, max_ref_norm, ndim);
+  };
+
+  // extra candidates guard against the candidate distances being ordered
+  // differently to the exact distances
+  const auto n_candidates = static_cast<Idx>(
+      std::min(n_ref, static_cast<std::size_t>(2 * n_nbrs)));
+  auto is_accurate = [&]() {
+    return tiling_is_accurate<In, Idx>(metric, ref, ref_norms, n_ref, query,
+                                       query_norms, n_query, ndim,
+                                       n_candidates, n_nbrs, tolerance);
+  };
+
+  // the centered copies of the data are only used to find the candidates:
+  // their distances are recalculated from the original data
+  std::vector<In> centered_ref;
+  std::vector<In> centered_query;
+  if (!is_accurate()) {
+    bool accurate = false;
+    if (is_translation_invariant(metric)) {
+      centered_ref.assign(ref, ref + n_ref * ndim);
+      if (!is_self) {
+        centered_query.assign(query, query + n_query * ndim);
+      }
+      center_on_mean(centered_ref, centered_query, ndim);
+      ref = centered_ref.data();
+      query = is_self ? ref : centered_query.data();
+      calculate_norms();
+      accurate = is_accurate();
+    }
+    if (!accurate) {
+      // free the centered data before the search
+      centered_ref = std::vector<In>();
+      centered_query = std::vector<In>();
+      return is_self ? brute_force_build(distance, n_nbrs, n_threads, progress,
+                                         executor)
+                     : brute_force_query(distance, n_nbrs, n_threads, progress,
+                                         executor);
+    }
+  }
+
+  NNHeap<Out, Idx> candidates(n_query, std::max(n_candidates, n_nbrs));
+  NNHeap<Out, Idx> neighbor_heap(n_query, n_nbrs);
+  auto worker = [&](std::size_t begin, std::size_t end) {
+    tiled_nnbf_query_impl(metric, ref, ref_norms, n_ref, query, query_norms,
+                          ndim, candidates, begin, end);
+    rerank_candidates(distance, candidates, neighbor_heap, tolerance, begin,
+                      end);
+  };
+  progress.set_n_iters(1);
+  ExecutionParams exec_params{1024, 64};
+  dispatch_work(worker, n_query, n_threads, exec_params, progress, executor);
+  sort_heap(neighbor_heap, n_threads, progress, executor);
+  return heap_to_graph(neighbor_heap);
+}
+
 } // namespace tdoann
 #endif // TDOANN_BRUTE_FORCE_H
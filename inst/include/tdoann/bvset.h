@@ -27,6 +27,13 @@
 #ifndef TDOANN_BVSET_H
 #define TDOANN_BVSET_H
 
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include "bitvec.h"
 
 namespace tdoann {
@@ -50,6 +57,76 @@ auto has_been_and_mark_visited(BitVec &table, T candidate) -> bool {
   return is_visited;
 }
 
+// A visited set which is cleared in constant time, for reuse across many
+// searches: an item has been visited if its stamp is the current epoch, so
+// clearing the set only needs a new epoch. The stamps are zeroed only when the
+// epoch wraps around. This uses more memory than a BitVec (Stamp per item
+// rather than one bit), but avoids allocating and zeroing a set for each
+// search, which dominates the cost of a search for a few neighbors of a large
+// dataset.
+template <typename Stamp = uint16_t> class EpochSet {
+  std::vector<Stamp> stamps;
+  Stamp epoch{0};
+
+public:
+  // empty the set, making sure it can hold items 0 to n_points - 1
+  void clear(std::size_t n_points) {
+    if (stamps.size() < n_points) {
+      stamps.assign(n_points, 0);
+      epoch = 0;
+    }
+    if (epoch == (std::numeric_limits<Stamp>::max)()) {
+      std::fill(stamps.begin(), stamps.end(), 0);
+      epoch = 0;
+    }
+    ++epoch;
+  }
+
+  template <typename T> void mark(T candidate) { stamps[candidate] = epoch; }
+
+  template <typename T> auto contains(T candidate) const -> bool {
+    return stamps[candidate] == epoch;
+  }
+};
+
+template <typename Stamp, typename T>
+void mark_visited(EpochSet<Stamp> &table, T candidate) {
+  table.mark(candidate);
+}
+
+template <typename Stamp, typename T>
+auto has_been_and_mark_visited(EpochSet<Stamp> &table, T candidate) -> bool {
+  const bool is_visited = table.contains(candidate);
+  table.mark(candidate);
+  return is_visited;
+}
+
+// EpochSets shared by the workers of one search, so a set can be reused for
+// all the queries a worker handles without outliving the search: a worker
+// takes a set for each chunk of queries and gives it back when done. No more
+// sets are created than there are workers running at once, and they are all
+// freed with the pool.
+template <typename Stamp = uint16_t> class EpochSetPool {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<EpochSet<Stamp>>> available;
+
+public:
+  auto acquire() -> std::unique_ptr<EpochSet<Stamp>> {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (available.empty()) {
+      return std::make_unique<EpochSet<Stamp>>();
+    }
+    auto set = std::move(available.back());
+    available.pop_back();
+    return set;
+  }
+
+  void release(std::unique_ptr<EpochSet<Stamp>> set) {
+    std::lock_guard<std::mutex> guard(mutex);
+    available.push_back(std::move(set));
+  }
+};
+
 } // namespace tdoann
 
 #endif // TDOANN_BVSET_H
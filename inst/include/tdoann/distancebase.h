@@ -27,11 +27,15 @@
 #ifndef TDOANN_DISTANCEBASE_H
 #define TDOANN_DISTANCEBASE_H
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <memory>
+#include <type_traits>
 #include <vector>
 
 #include "distance.h"
+#include "distancesimd.h"
 
 // Pointer-based polymorphic classes for calculating distances. This is all
 // boilerplate: the actual calculations take place in functions defined in
@@ -39,6 +43,20 @@
 
 namespace tdoann {
 
+// Hint to the CPU that the n_bytes starting at ptr will be read soon
+inline void prefetch_bytes(const void *ptr, std::size_t n_bytes) {
+#if defined(__GNUC__) || defined(__clang__)
+  constexpr std::size_t cache_line = 64;
+  const auto *bytes = static_cast<const char *>(ptr);
+  for (std::size_t b = 0; b < n_bytes; b += cache_line) {
+    __builtin_prefetch(bytes + b);
+  }
+#else
+  (void)ptr;
+  (void)n_bytes;
+#endif
+}
+
 template <typename Out, typename Idx = uint32_t> class BaseDistance {
 public:
   using Output = Out;
@@ -48,6 +66,46 @@ public:
   virtual Out calculate(const Idx &i, const Idx &j) const = 0;
   virtual std::size_t get_nx() const = 0;
   virtual std::size_t get_ny() const = 0;
+
+  // Calculate the distances between the n_rows items in rows and the n_cols
+  // items in cols, writing them to out in row-major order. Override this if
+  // the distances for a block can be calculated faster than one at a time.
+  virtual void calculate_block(const Idx *rows, std::size_t n_rows,
+                               const Idx *cols, std::size_t n_cols,
+                               Out *out) const {
+    for (std::size_t r = 0; r < n_rows; r++) {
+      for (std::size_t c = 0; c < n_cols; c++) {
+        out[r * n_cols + c] = calculate(rows[r], cols[c]);
+      }
+    }
+  }
+
+  // True if calculate_block is faster than calculating the same distances one
+  // at a time, i.e. it has been overridden with a block kernel. If not, callers
+  // which only need part of a block (e.g. the pairs on or above its diagonal)
+  // should call calculate for those pairs instead.
+  virtual bool prefers_block() const { return false; }
+
+  // Hint that the distances involving x item i will be calculated soon, e.g.
+  // by prefetching its data. Callers which know several items ahead of time
+  // (like graph search) can call this for each one before calculating the
+  // distances, so that fetching the items from memory overlaps.
+  virtual void prefetch(const Idx & /* i */) const {}
+};
+
+// Distance calculators which can return an iterator pointing to a contiguous
+// region of memory holding the ith query point. This is all that searching an
+// RPTree needs, so it is enough for calculators whose reference data isn't
+// stored in a vector.
+template <typename In, typename Out, typename Idx = uint32_t>
+class QueryVectorDistance : public BaseDistance<Out, Idx> {
+public:
+  using Iterator = typename std::vector<In>::const_iterator;
+
+  virtual ~QueryVectorDistance() = default;
+
+  // return iterator pointing at the ith query point
+  virtual auto get_y(Idx i) const -> Iterator = 0;
 };
 
 // Distance calculators which can return an iterator pointing to a contiguous
@@ -58,15 +116,14 @@ public:
 // only for something like RPTrees where the distance between items and a
 // hyperplane is needed.
 template <typename In, typename Out, typename Idx = uint32_t>
-class VectorDistance : public BaseDistance<Out, Idx> {
+class VectorDistance : public QueryVectorDistance<In, Out, Idx> {
 public:
-  using Iterator = typename std::vector<In>::const_iterator;
+  using Iterator = typename QueryVectorDistance<In, Out, Idx>::Iterator;
 
   virtual ~VectorDistance() = default;
 
   // return iterator pointing at the ith data point
   virtual auto get_x(Idx i) const -> Iterator = 0;
-  virtual auto get_y(Idx i) const -> Iterator = 0;
 };
 
 // these traits are used to extract the types for the template parameters of
@@ -93,6 +150,10 @@ template <typename In, typename Out>
 using DistanceFunc = Out (*)(DataIt<In>, DataIt<In>, DataIt<In>);
 template <typename In>
 using PreprocessFunc = void (*)(std::vector<In> &, std::size_t);
+// distance functions for data which isn't stored in a std::vector, e.g. a
+// memory-mapped file
+template <typename In, typename Out>
+using PtrDistanceFunc = Out (*)(const In *, const In *, const In *);
 
 template <typename In, typename Out, typename Idx>
 class SelfDistanceCalculator : public VectorDistance<In, Out, Idx> {
@@ -107,7 +168,8 @@ public:
                          DistanceFunc distance_func,
                          PreprocessFunc<In> preprocess_func = nullptr)
       : x(std::move(data)), nx(x.size() / ndim), ndim(ndim),
-        distance_func(distance_func) {
+        distance_func(distance_func),
+        block_metric(get_block_metric(distance_func)) {
     if (preprocess_func) {
       preprocess_func(x, ndim);
     }
@@ -127,11 +189,32 @@ public:
                          this->x.begin() + this->ndim * j);
   }
 
+  void calculate_block(const Idx *rows, std::size_t n_rows, const Idx *cols,
+                       std::size_t n_cols, Out *out) const override {
+    if constexpr (std::is_same_v<In, Out>) {
+      if (block_metric.kernel != BlockKernel::None) {
+        block_distance(block_metric, x.data(), x.data(), ndim, rows, n_rows,
+                       cols, n_cols, out);
+        return;
+      }
+    }
+    BaseDistance<Out, Idx>::calculate_block(rows, n_rows, cols, n_cols, out);
+  }
+
+  bool prefers_block() const override {
+    return std::is_same_v<In, Out> && block_metric.kernel != BlockKernel::None;
+  }
+
+  void prefetch(const Idx &i) const override {
+    prefetch_bytes(x.data() + ndim * i, ndim * sizeof(In));
+  }
+
 protected:
   std::vector<In> x;
   std::size_t nx;
   std::size_t ndim;
   DistanceFunc distance_func;
+  BlockMetric block_metric;
 };
 
 template <typename In, typename Out, typename Idx>
@@ -148,7 +231,8 @@ public:
                           PreprocessFunc<In> preprocess_func = nullptr)
       : x(std::forward<VecIn>(xdata)), y(std::forward<VecIn>(ydata)),
         nx(x.size() / ndim), ny(y.size() / ndim), ndim(ndim),
-        distance_func(distance_func) {
+        distance_func(distance_func),
+        block_metric(get_block_metric(distance_func)) {
     if (preprocess_func) {
       preprocess_func(x, ndim);
       preprocess_func(y, ndim);
@@ -167,6 +251,26 @@ public:
                          this->y.begin() + this->ndim * j);
   }
 
+  void calculate_block(const Idx *rows, std::size_t n_rows, const Idx *cols,
+                       std::size_t n_cols, Out *out) const override {
+    if constexpr (std::is_same_v<In, Out>) {
+      if (block_metric.kernel != BlockKernel::None) {
+        block_distance(block_metric, x.data(), y.data(), ndim, rows, n_rows,
+                       cols, n_cols, out);
+        return;
+      }
+    }
+    BaseDistance<Out, Idx>::calculate_block(rows, n_rows, cols, n_cols, out);
+  }
+
+  bool prefers_block() const override {
+    return std::is_same_v<In, Out> && block_metric.kernel != BlockKernel::None;
+  }
+
+  void prefetch(const Idx &i) const override {
+    prefetch_bytes(x.data() + ndim * i, ndim * sizeof(In));
+  }
+
 protected:
   std::vector<In> x;
   std::vector<In> y;
@@ -174,6 +278,276 @@ protected:
   std::size_t ny;
   std::size_t ndim;
   DistanceFunc distance_func;
+  BlockMetric block_metric;
+};
+
+// Like SelfDistanceCalculator, but the distance function is a template
+// parameter rather than a function pointer member, and the class is final.
+// Code which is templated on this type (rather than using a BaseDistance
+// reference) can inline the distance calculation: there is neither a virtual
+// call to calculate nor an indirect call to the distance function.
+template <typename In, typename Out, typename Idx,
+          DistanceFunc<In, Out> distance_func>
+class StaticSelfDistanceCalculator final : public VectorDistance<In, Out, Idx> {
+public:
+  using Iterator = typename std::vector<In>::const_iterator;
+
+  template <typename VecIn>
+  StaticSelfDistanceCalculator(VecIn &&data, std::size_t ndim,
+                               PreprocessFunc<In> preprocess_func = nullptr)
+      : x(std::forward<VecIn>(data)), nx(x.size() / ndim), ndim(ndim) {
+    if (preprocess_func) {
+      preprocess_func(x, ndim);
+    }
+  }
+
+  std::size_t get_nx() const override { return nx; }
+  std::size_t get_ny() const override { return nx; }
+  Iterator get_x(Idx i) const override { return x.begin() + ndim * i; }
+  Iterator get_y(Idx i) const override { return get_x(i); }
+
+  Out calculate(const Idx &i, const Idx &j) const override {
+    const std::size_t di = this->ndim * i;
+    return distance_func(this->x.begin() + di,
+                         this->x.begin() + di + this->ndim,
+                         this->x.begin() + this->ndim * j);
+  }
+
+  void calculate_block(const Idx *rows, std::size_t n_rows, const Idx *cols,
+                       std::size_t n_cols, Out *out) const override {
+    constexpr BlockMetric block_metric = get_block_metric(distance_func);
+    if constexpr (block_metric.kernel == BlockKernel::None) {
+      BaseDistance<Out, Idx>::calculate_block(rows, n_rows, cols, n_cols, out);
+    } else {
+      block_distance(block_metric, x.data(), x.data(), ndim, rows, n_rows,
+                     cols, n_cols, out);
+    }
+  }
+
+  bool prefers_block() const override {
+    return get_block_metric(distance_func).kernel != BlockKernel::None;
+  }
+
+  void prefetch(const Idx &i) const override {
+    prefetch_bytes(x.data() + ndim * i, ndim * sizeof(In));
+  }
+
+private:
+  std::vector<In> x;
+  std::size_t nx;
+  std::size_t ndim;
+};
+
+// A non-owning view of n_items items with ndim features each, in memory owned
+// by someone else, e.g. an R matrix or a memory-mapped file. Feature d of item
+// i is at data[i * item_stride + d * feature_stride]: in row-major storage
+// each item is contiguous (item_stride = ndim, feature_stride = 1), in
+// column-major storage each feature is (item_stride = 1,
+// feature_stride = n_items).
+template <typename T> struct DataView {
+  const T *data{nullptr};
+  std::size_t n_items{0};
+  std::size_t ndim{0};
+  std::size_t item_stride{0};
+  std::size_t feature_stride{1};
+
+  static auto row_major(const T *data, std::size_t n_items, std::size_t ndim)
+      -> DataView {
+    return {data, n_items, ndim, ndim, 1};
+  }
+
+  static auto col_major(const T *data, std::size_t n_items, std::size_t ndim)
+      -> DataView {
+    return {data, n_items, ndim, 1, n_items};
+  }
+
+  // true if items are contiguous and packed one after the other
+  auto is_packed() const -> bool {
+    return feature_stride == 1 && item_stride == ndim;
+  }
+
+  auto item(std::size_t i) const -> const T * { return data + i * item_stride; }
+
+  // only contiguous items are worth prefetching
+  void prefetch(std::size_t i) const {
+    if (feature_stride == 1) {
+      prefetch_bytes(item(i), ndim * sizeof(T));
+    }
+  }
+
+  // copy the features of item i to out, converting them to U
+  template <typename U> void copy_item(std::size_t i, U *out) const {
+    const T *src = item(i);
+    if (feature_stride == 1) {
+      for (std::size_t d = 0; d < ndim; d++) {
+        out[d] = static_cast<U>(src[d]);
+      }
+      return;
+    }
+    for (std::size_t d = 0; d < ndim; d++) {
+      out[d] = static_cast<U>(src[d * feature_stride]);
+    }
+  }
+};
+
+// Distance calculator over data it doesn't own: the data of type Src is
+// accessed through DataViews, and distances are calculated by a function on
+// data of type In. The views must stay valid for the lifetime of the
+// calculator. If Src is In and the data is packed, the distance function reads
+// the data in place. Otherwise items are converted (and for column-major data,
+// transposed) into a per-thread buffer as they are needed: calculate_block
+// converts each item in the block once, so the cost of the conversion is
+// small compared to the distance calculations. Unlike the owning calculators,
+// the data can't be preprocessed.
+template <typename Src, typename In, typename Out, typename Idx = uint32_t>
+class ViewDistanceCalculator : public BaseDistance<Out, Idx> {
+public:
+  using DistanceFunc = PtrDistanceFunc<In, Out>;
+
+  // self-distance
+  ViewDistanceCalculator(const DataView<Src> &x, DistanceFunc distance_func)
+      : ViewDistanceCalculator(x, x, distance_func) {}
+
+  ViewDistanceCalculator(const DataView<Src> &x, const DataView<Src> &y,
+                         DistanceFunc distance_func)
+      : x(x), y(y), ndim(x.ndim), distance_func(distance_func),
+        block_metric(get_block_metric(distance_func)),
+        in_place(std::is_same_v<Src, In> && x.is_packed() && y.is_packed()) {}
+
+  std::size_t get_nx() const override { return x.n_items; }
+  std::size_t get_ny() const override { return y.n_items; }
+
+  Out calculate(const Idx &i, const Idx &j) const override {
+    if constexpr (std::is_same_v<Src, In>) {
+      if (in_place) {
+        const In *xi = x.item(i);
+        return distance_func(xi, xi + ndim, y.item(j));
+      }
+    }
+    auto &cache = item_cache();
+    if (cache.owner != id) {
+      cache.owner = id;
+      cache.x_item = npos;
+      cache.y_item = npos;
+      cache.x.resize(ndim);
+      cache.y.resize(ndim);
+    }
+    if (cache.x_item != i) {
+      x.copy_item(i, cache.x.data());
+      cache.x_item = i;
+    }
+    if (cache.y_item != j) {
+      y.copy_item(j, cache.y.data());
+      cache.y_item = j;
+    }
+    return distance_func(cache.x.data(), cache.x.data() + ndim,
+                         cache.y.data());
+  }
+
+  void prefetch(const Idx &i) const override { x.prefetch(i); }
+
+  // gathering a block converts each of its items once rather than once per
+  // distance, which is worth doing even without a block kernel
+  bool prefers_block() const override {
+    if (!in_place) {
+      return true;
+    }
+    return std::is_same_v<In, Out> && block_metric.kernel != BlockKernel::None;
+  }
+
+  void calculate_block(const Idx *rows, std::size_t n_rows, const Idx *cols,
+                       std::size_t n_cols, Out *out) const override {
+    if constexpr (std::is_same_v<Src, In>) {
+      if (in_place) {
+        if constexpr (std::is_same_v<In, Out>) {
+          if (block_metric.kernel != BlockKernel::None) {
+            block_distance(block_metric, x.data, y.data, ndim, rows, n_rows,
+                           cols, n_cols, out);
+            return;
+          }
+        }
+        BaseDistance<Out, Idx>::calculate_block(rows, n_rows, cols, n_cols,
+                                                out);
+        return;
+      }
+    }
+
+    // gather the block into the buffer, then calculate on the copies
+    auto &buffer = scratch();
+    buffer.resize((n_rows + n_cols) * ndim);
+    In *xblock = buffer.data();
+    In *yblock = xblock + n_rows * ndim;
+    for (std::size_t r = 0; r < n_rows; r++) {
+      x.copy_item(rows[r], xblock + r * ndim);
+    }
+    for (std::size_t c = 0; c < n_cols; c++) {
+      y.copy_item(cols[c], yblock + c * ndim);
+    }
+
+    if constexpr (std::is_same_v<In, Out>) {
+      if (block_metric.kernel != BlockKernel::None) {
+        auto &positions = scratch_positions();
+        const std::size_t n_positions = std::max(n_rows, n_cols);
+        for (std::size_t p = positions.size(); p < n_positions; p++) {
+          positions.push_back(static_cast<Idx>(p));
+        }
+        block_distance(block_metric, xblock, yblock, ndim, positions.data(),
+                       n_rows, positions.data(), n_cols, out);
+        return;
+      }
+    }
+    for (std::size_t r = 0; r < n_rows; r++) {
+      const In *xr = xblock + r * ndim;
+      for (std::size_t c = 0; c < n_cols; c++) {
+        out[r * n_cols + c] = distance_func(xr, xr + ndim, yblock + c * ndim);
+      }
+    }
+  }
+
+private:
+  static constexpr auto npos = static_cast<Idx>(-1);
+
+  DataView<Src> x;
+  DataView<Src> y;
+  std::size_t ndim;
+  DistanceFunc distance_func;
+  BlockMetric block_metric;
+  bool in_place;
+  // identifies this calculator in the per-thread item cache
+  uint64_t id{next_id()};
+
+  // Callers of calculate usually calculate many distances in a row with one
+  // item in common (e.g. a query item in a graph search, or the item whose
+  // neighbors are being initialized), so the last x and y items converted by
+  // each thread are kept.
+  struct ItemCache {
+    uint64_t owner{0};
+    Idx x_item{npos};
+    Idx y_item{npos};
+    std::vector<In> x;
+    std::vector<In> y;
+  };
+
+  static auto item_cache() -> ItemCache & {
+    thread_local ItemCache cache;
+    return cache;
+  }
+
+  static auto next_id() -> uint64_t {
+    static std::atomic<uint64_t> counter{0};
+    return ++counter;
+  }
+
+  static auto scratch() -> std::vector<In> & {
+    thread_local std::vector<In> buffer;
+    return buffer;
+  }
+
+  // 0, 1, 2... for indexing into the gathered block
+  static auto scratch_positions() -> std::vector<Idx> & {
+    thread_local std::vector<Idx> positions;
+    return positions;
+  }
 };
 
 } // namespace tdoann
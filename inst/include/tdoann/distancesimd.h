@@ -0,0 +1,1099 @@
+// BSD 2-Clause License
+//
+// Copyright 2024 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_DISTANCESIMD_H
+#define TDOANN_DISTANCESIMD_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+
+#include "distance.h"
+
+// Vectorized versions of the most commonly used dense distance functions. The
+// instruction set is chosen at runtime (AVX-512F, then AVX2 + FMA, then a
+// portable scalar loop), so no special compiler flags are needed: the
+// intrinsics are only compiled into functions marked with the relevant target
+// attribute and are only called if the CPU supports them. Define
+// TDOANN_NO_SIMD to disable the vectorized code paths entirely.
+//
+// The functions have the same signature as those in distance.h, so they can be
+// used wherever a DistanceFunc is expected. Only contiguous float or double
+// data with the same input and output type is vectorized: anything else falls
+// back to the generic version in distance.h. Results can differ from the
+// generic versions in the last few bits because the order of summation is
+// different.
+
+#if !defined(TDOANN_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) &&   \
+    (defined(__x86_64__) || defined(__i386__))
+#define TDOANN_SIMD_X86 1
+#include <immintrin.h>
+#define TDOANN_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define TDOANN_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+// NOLINTBEGIN(readability-identifier-length)
+
+namespace tdoann {
+
+enum class SimdLevel { Scalar, Avx2, Avx512 };
+
+inline auto detect_simd_level() -> SimdLevel {
+#if defined(TDOANN_SIMD_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return SimdLevel::Avx512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return SimdLevel::Avx2;
+  }
+#endif
+  return SimdLevel::Scalar;
+}
+
+// CPU detection is only carried out once
+inline auto simd_level() -> SimdLevel {
+  static const SimdLevel level = detect_simd_level();
+  return level;
+}
+
+// Accumulated sums needed for cosine and correlation-style distances
+template <typename T> struct DotNorms {
+  T xy{0};
+  T xx{0};
+  T yy{0};
+};
+
+#if defined(TDOANN_SIMD_X86)
+
+// AVX2 float
+
+TDOANN_TARGET_AVX2 inline auto hsum_avx2(__m256 v) -> float {
+  alignas(32) float buf[8];
+  _mm256_store_ps(buf, v);
+  return ((buf[0] + buf[1]) + (buf[2] + buf[3])) +
+         ((buf[4] + buf[5]) + (buf[6] + buf[7]));
+}
+
+TDOANN_TARGET_AVX2 inline auto hsum_avx2(__m256d v) -> double {
+  alignas(32) double buf[4];
+  _mm256_store_pd(buf, v);
+  return (buf[0] + buf[1]) + (buf[2] + buf[3]);
+}
+
+TDOANN_TARGET_AVX2 inline auto sum_squared_diff_avx2(const float *x,
+                                                      const float *y,
+                                                      std::size_t n) -> float {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m256 d0 =
+        _mm256_sub_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i));
+    const __m256 d1 =
+        _mm256_sub_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8));
+    acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+    acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+  }
+  for (; i + 8 <= n; i += 8) {
+    const __m256 d0 =
+        _mm256_sub_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i));
+    acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+  }
+  float sum = hsum_avx2(_mm256_add_ps(acc0, acc1));
+  for (; i < n; ++i) {
+    const float diff = x[i] - y[i];
+    sum += diff * diff;
+  }
+  return sum;
+}
+
+TDOANN_TARGET_AVX2 inline auto sum_abs_diff_avx2(const float *x, const float *y,
+                                                  std::size_t n) -> float {
+  const __m256 sign_mask = _mm256_set1_ps(-0.0F);
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m256 d0 =
+        _mm256_sub_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i));
+    const __m256 d1 =
+        _mm256_sub_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8));
+    acc0 = _mm256_add_ps(acc0, _mm256_andnot_ps(sign_mask, d0));
+    acc1 = _mm256_add_ps(acc1, _mm256_andnot_ps(sign_mask, d1));
+  }
+  for (; i + 8 <= n; i += 8) {
+    const __m256 d0 =
+        _mm256_sub_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i));
+    acc0 = _mm256_add_ps(acc0, _mm256_andnot_ps(sign_mask, d0));
+  }
+  float sum = hsum_avx2(_mm256_add_ps(acc0, acc1));
+  for (; i < n; ++i) {
+    sum += std::abs(x[i] - y[i]);
+  }
+  return sum;
+}
+
+TDOANN_TARGET_AVX2 inline auto sum_product_avx2(const float *x, const float *y,
+                                                 std::size_t n) -> float {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i),
+                           _mm256_loadu_ps(y + i), acc0);
+    acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8),
+                           _mm256_loadu_ps(y + i + 8), acc1);
+  }
+  for (; i + 8 <= n; i += 8) {
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i),
+                           _mm256_loadu_ps(y + i), acc0);
+  }
+  float sum = hsum_avx2(_mm256_add_ps(acc0, acc1));
+  for (; i < n; ++i) {
+    sum += x[i] * y[i];
+  }
+  return sum;
+}
+
+TDOANN_TARGET_AVX2 inline auto sum_avx2(const float *x, std::size_t n)
+    -> float {
+  __m256 acc = _mm256_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    acc = _mm256_add_ps(acc, _mm256_loadu_ps(x + i));
+  }
+  float sum = hsum_avx2(acc);
+  for (; i < n; ++i) {
+    sum += x[i];
+  }
+  return sum;
+}
+
+// x and y are centered by subtracting xmu and ymu respectively
+TDOANN_TARGET_AVX2 inline auto dot_norms_avx2(const float *x, const float *y,
+                                               std::size_t n, float xmu,
+                                               float ymu) -> DotNorms<float> {
+  const __m256 vxmu = _mm256_set1_ps(xmu);
+  const __m256 vymu = _mm256_set1_ps(ymu);
+  __m256 xy = _mm256_setzero_ps();
+  __m256 xx = _mm256_setzero_ps();
+  __m256 yy = _mm256_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 xi = _mm256_sub_ps(_mm256_loadu_ps(x + i), vxmu);
+    const __m256 yi = _mm256_sub_ps(_mm256_loadu_ps(y + i), vymu);
+    xy = _mm256_fmadd_ps(xi, yi, xy);
+    xx = _mm256_fmadd_ps(xi, xi, xx);
+    yy = _mm256_fmadd_ps(yi, yi, yy);
+  }
+  DotNorms<float> res{hsum_avx2(xy), hsum_avx2(xx), hsum_avx2(yy)};
+  for (; i < n; ++i) {
+    const float xi = x[i] - xmu;
+    const float yi = y[i] - ymu;
+    res.xy += xi * yi;
+    res.xx += xi * xi;
+    res.yy += yi * yi;
+  }
+  return res;
+}
+
+// AVX2 double
+
+TDOANN_TARGET_AVX2 inline auto sum_squared_diff_avx2(const double *x,
+                                                      const double *y,
+                                                      std::size_t n) -> double {
+  __m256d acc0 = _mm256_setzero_pd();
+  __m256d acc1 = _mm256_setzero_pd();
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256d d0 =
+        _mm256_sub_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i));
+    const __m256d d1 =
+        _mm256_sub_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4));
+    acc0 = _mm256_fmadd_pd(d0, d0, acc0);
+    acc1 = _mm256_fmadd_pd(d1, d1, acc1);
+  }
+  for (; i + 4 <= n; i += 4) {
+    const __m256d d0 =
+        _mm256_sub_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i));
+    acc0 = _mm256_fmadd_pd(d0, d0, acc0);
+  }
+  double sum = hsum_avx2(_mm256_add_pd(acc0, acc1));
+  for (; i < n; ++i) {
+    const double diff = x[i] - y[i];
+    sum += diff * diff;
+  }
+  return sum;
+}
+
+TDOANN_TARGET_AVX2 inline auto sum_abs_diff_avx2(const double *x,
+                                                  const double *y,
+                                                  std::size_t n) -> double {
+  const __m256d sign_mask = _mm256_set1_pd(-0.0);
+  __m256d acc0 = _mm256_setzero_pd();
+  __m256d acc1 = _mm256_setzero_pd();
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256d d0 =
+        _mm256_sub_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i));
+    const __m256d d1 =
+        _mm256_sub_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4));
+    acc0 = _mm256_add_pd(acc0, _mm256_andnot_pd(sign_mask, d0));
+    acc1 = _mm256_add_pd(acc1, _mm256_andnot_pd(sign_mask, d1));
+  }
+  for (; i + 4 <= n; i += 4) {
+    const __m256d d0 =
+        _mm256_sub_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i));
+    acc0 = _mm256_add_pd(acc0, _mm256_andnot_pd(sign_mask, d0));
+  }
+  double sum = hsum_avx2(_mm256_add_pd(acc0, acc1));
+  for (; i < n; ++i) {
+    sum += std::abs(x[i] - y[i]);
+  }
+  return sum;
+}
+
+TDOANN_TARGET_AVX2 inline auto sum_product_avx2(const double *x,
+                                                 const double *y,
+                                                 std::size_t n) -> double {
+  __m256d acc0 = _mm256_setzero_pd();
+  __m256d acc1 = _mm256_setzero_pd();
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i),
+                           _mm256_loadu_pd(y + i), acc0);
+    acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 4),
+                           _mm256_loadu_pd(y + i + 4), acc1);
+  }
+  for (; i + 4 <= n; i += 4) {
+    acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i),
+                           _mm256_loadu_pd(y + i), acc0);
+  }
+  double sum = hsum_avx2(_mm256_add_pd(acc0, acc1));
+  for (; i < n; ++i) {
+    sum += x[i] * y[i];
+  }
+  return sum;
+}
+
+TDOANN_TARGET_AVX2 inline auto sum_avx2(const double *x, std::size_t n)
+    -> double {
+  __m256d acc = _mm256_setzero_pd();
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    acc = _mm256_add_pd(acc, _mm256_loadu_pd(x + i));
+  }
+  double sum = hsum_avx2(acc);
+  for (; i < n; ++i) {
+    sum += x[i];
+  }
+  return sum;
+}
+
+TDOANN_TARGET_AVX2 inline auto dot_norms_avx2(const double *x, const double *y,
+                                               std::size_t n, double xmu,
+                                               double ymu) -> DotNorms<double> {
+  const __m256d vxmu = _mm256_set1_pd(xmu);
+  const __m256d vymu = _mm256_set1_pd(ymu);
+  __m256d xy = _mm256_setzero_pd();
+  __m256d xx = _mm256_setzero_pd();
+  __m256d yy = _mm256_setzero_pd();
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m256d xi = _mm256_sub_pd(_mm256_loadu_pd(x + i), vxmu);
+    const __m256d yi = _mm256_sub_pd(_mm256_loadu_pd(y + i), vymu);
+    xy = _mm256_fmadd_pd(xi, yi, xy);
+    xx = _mm256_fmadd_pd(xi, xi, xx);
+    yy = _mm256_fmadd_pd(yi, yi, yy);
+  }
+  DotNorms<double> res{hsum_avx2(xy), hsum_avx2(xx), hsum_avx2(yy)};
+  for (; i < n; ++i) {
+    const double xi = x[i] - xmu;
+    const double yi = y[i] - ymu;
+    res.xy += xi * yi;
+    res.xx += xi * xi;
+    res.yy += yi * yi;
+  }
+  return res;
+}
+
+// AVX-512 float
+// The remainder is handled with a masked load rather than a scalar loop
+
+// _mm512_reduce_add_ps triggers spurious -Wuninitialized warnings with some
+// versions of GCC so the horizontal sums are done by hand
+TDOANN_TARGET_AVX512 inline auto hsum_avx512(__m512 v) -> float {
+  alignas(64) float buf[16];
+  _mm512_store_ps(buf, v);
+  float sum = 0.0F;
+  for (std::size_t i = 0; i < 16; i += 2) {
+    sum += buf[i] + buf[i + 1];
+  }
+  return sum;
+}
+
+TDOANN_TARGET_AVX512 inline auto hsum_avx512(__m512d v) -> double {
+  alignas(64) double buf[8];
+  _mm512_store_pd(buf, v);
+  return ((buf[0] + buf[1]) + (buf[2] + buf[3])) +
+         ((buf[4] + buf[5]) + (buf[6] + buf[7]));
+}
+
+TDOANN_TARGET_AVX512 inline auto tail_mask_avx512(std::size_t n) -> __mmask16 {
+  return static_cast<__mmask16>((1U << n) - 1U);
+}
+
+TDOANN_TARGET_AVX512 inline auto sum_squared_diff_avx512(const float *x,
+                                                          const float *y,
+                                                          std::size_t n)
+    -> float {
+  __m512 acc0 = _mm512_setzero_ps();
+  __m512 acc1 = _mm512_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    const __m512 d0 =
+        _mm512_sub_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i));
+    const __m512 d1 =
+        _mm512_sub_ps(_mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(y + i + 16));
+    acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+    acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+  }
+  for (; i + 16 <= n; i += 16) {
+    const __m512 d0 =
+        _mm512_sub_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i));
+    acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+  }
+  if (i < n) {
+    const __mmask16 mask = tail_mask_avx512(n - i);
+    const __m512 d0 = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, x + i),
+                                    _mm512_maskz_loadu_ps(mask, y + i));
+    acc1 = _mm512_fmadd_ps(d0, d0, acc1);
+  }
+  return hsum_avx512(_mm512_add_ps(acc0, acc1));
+}
+
+TDOANN_TARGET_AVX512 inline auto sum_abs_diff_avx512(const float *x,
+                                                      const float *y,
+                                                      std::size_t n) -> float {
+  __m512 acc0 = _mm512_setzero_ps();
+  __m512 acc1 = _mm512_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    const __m512 d0 =
+        _mm512_sub_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i));
+    const __m512 d1 =
+        _mm512_sub_ps(_mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(y + i + 16));
+    acc0 = _mm512_add_ps(acc0, _mm512_abs_ps(d0));
+    acc1 = _mm512_add_ps(acc1, _mm512_abs_ps(d1));
+  }
+  for (; i + 16 <= n; i += 16) {
+    const __m512 d0 =
+        _mm512_sub_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i));
+    acc0 = _mm512_add_ps(acc0, _mm512_abs_ps(d0));
+  }
+  if (i < n) {
+    const __mmask16 mask = tail_mask_avx512(n - i);
+    const __m512 d0 = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, x + i),
+                                    _mm512_maskz_loadu_ps(mask, y + i));
+    acc1 = _mm512_add_ps(acc1, _mm512_abs_ps(d0));
+  }
+  return hsum_avx512(_mm512_add_ps(acc0, acc1));
+}
+
+TDOANN_TARGET_AVX512 inline auto sum_product_avx512(const float *x,
+                                                     const float *y,
+                                                     std::size_t n) -> float {
+  __m512 acc0 = _mm512_setzero_ps();
+  __m512 acc1 = _mm512_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i),
+                           _mm512_loadu_ps(y + i), acc0);
+    acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 16),
+                           _mm512_loadu_ps(y + i + 16), acc1);
+  }
+  for (; i + 16 <= n; i += 16) {
+    acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i),
+                           _mm512_loadu_ps(y + i), acc0);
+  }
+  if (i < n) {
+    const __mmask16 mask = tail_mask_avx512(n - i);
+    acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, x + i),
+                           _mm512_maskz_loadu_ps(mask, y + i), acc1);
+  }
+  return hsum_avx512(_mm512_add_ps(acc0, acc1));
+}
+
+TDOANN_TARGET_AVX512 inline auto sum_avx512(const float *x, std::size_t n)
+    -> float {
+  __m512 acc = _mm512_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    acc = _mm512_add_ps(acc, _mm512_loadu_ps(x + i));
+  }
+  if (i < n) {
+    acc = _mm512_add_ps(acc,
+                        _mm512_maskz_loadu_ps(tail_mask_avx512(n - i), x + i));
+  }
+  return hsum_avx512(acc);
+}
+
+TDOANN_TARGET_AVX512 inline auto dot_norms_avx512(const float *x,
+                                                   const float *y,
+                                                   std::size_t n, float xmu,
+                                                   float ymu)
+    -> DotNorms<float> {
+  const __m512 vxmu = _mm512_set1_ps(xmu);
+  const __m512 vymu = _mm512_set1_ps(ymu);
+  __m512 xy = _mm512_setzero_ps();
+  __m512 xx = _mm512_setzero_ps();
+  __m512 yy = _mm512_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m512 xi = _mm512_sub_ps(_mm512_loadu_ps(x + i), vxmu);
+    const __m512 yi = _mm512_sub_ps(_mm512_loadu_ps(y + i), vymu);
+    xy = _mm512_fmadd_ps(xi, yi, xy);
+    xx = _mm512_fmadd_ps(xi, xi, xx);
+    yy = _mm512_fmadd_ps(yi, yi, yy);
+  }
+  if (i < n) {
+    // masked-out lanes must stay zero after centering
+    const __mmask16 mask = tail_mask_avx512(n - i);
+    const __m512 xi =
+        _mm512_maskz_sub_ps(mask, _mm512_maskz_loadu_ps(mask, x + i), vxmu);
+    const __m512 yi =
+        _mm512_maskz_sub_ps(mask, _mm512_maskz_loadu_ps(mask, y + i), vymu);
+    xy = _mm512_fmadd_ps(xi, yi, xy);
+    xx = _mm512_fmadd_ps(xi, xi, xx);
+    yy = _mm512_fmadd_ps(yi, yi, yy);
+  }
+  return {hsum_avx512(xy), hsum_avx512(xx),
+          hsum_avx512(yy)};
+}
+
+// AVX-512 double
+
+TDOANN_TARGET_AVX512 inline auto tail_mask8_avx512(std::size_t n) -> __mmask8 {
+  return static_cast<__mmask8>((1U << n) - 1U);
+}
+
+TDOANN_TARGET_AVX512 inline auto sum_squared_diff_avx512(const double *x,
+                                                          const double *y,
+                                                          std::size_t n)
+    -> double {
+  __m512d acc0 = _mm512_setzero_pd();
+  __m512d acc1 = _mm512_setzero_pd();
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m512d d0 =
+        _mm512_sub_pd(_mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i));
+    const __m512d d1 =
+        _mm512_sub_pd(_mm512_loadu_pd(x + i + 8), _mm512_loadu_pd(y + i + 8));
+    acc0 = _mm512_fmadd_pd(d0, d0, acc0);
+    acc1 = _mm512_fmadd_pd(d1, d1, acc1);
+  }
+  for (; i + 8 <= n; i += 8) {
+    const __m512d d0 =
+        _mm512_sub_pd(_mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i));
+    acc0 = _mm512_fmadd_pd(d0, d0, acc0);
+  }
+  if (i < n) {
+    const __mmask8 mask = tail_mask8_avx512(n - i);
+    const __m512d d0 = _mm512_sub_pd(_mm512_maskz_loadu_pd(mask, x + i),
+                                     _mm512_maskz_loadu_pd(mask, y + i));
+    acc1 = _mm512_fmadd_pd(d0, d0, acc1);
+  }
+  return hsum_avx512(_mm512_add_pd(acc0, acc1));
+}
+
+TDOANN_TARGET_AVX512 inline auto sum_abs_diff_avx512(const double *x,
+                                                      const double *y,
+                                                      std::size_t n) -> double {
+  __m512d acc0 = _mm512_setzero_pd();
+  __m512d acc1 = _mm512_setzero_pd();
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m512d d0 =
+        _mm512_sub_pd(_mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i));
+    const __m512d d1 =
+        _mm512_sub_pd(_mm512_loadu_pd(x + i + 8), _mm512_loadu_pd(y + i + 8));
+    acc0 = _mm512_add_pd(acc0, _mm512_abs_pd(d0));
+    acc1 = _mm512_add_pd(acc1, _mm512_abs_pd(d1));
+  }
+  for (; i + 8 <= n; i += 8) {
+    const __m512d d0 =
+        _mm512_sub_pd(_mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i));
+    acc0 = _mm512_add_pd(acc0, _mm512_abs_pd(d0));
+  }
+  if (i < n) {
+    const __mmask8 mask = tail_mask8_avx512(n - i);
+    const __m512d d0 = _mm512_sub_pd(_mm512_maskz_loadu_pd(mask, x + i),
+                                     _mm512_maskz_loadu_pd(mask, y + i));
+    acc1 = _mm512_add_pd(acc1, _mm512_abs_pd(d0));
+  }
+  return hsum_avx512(_mm512_add_pd(acc0, acc1));
+}
+
+TDOANN_TARGET_AVX512 inline auto sum_product_avx512(const double *x,
+                                                     const double *y,
+                                                     std::size_t n) -> double {
+  __m512d acc0 = _mm512_setzero_pd();
+  __m512d acc1 = _mm512_setzero_pd();
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    acc0 = _mm512_fmadd_pd(_mm512_loadu_pd(x + i),
+                           _mm512_loadu_pd(y + i), acc0);
+    acc1 = _mm512_fmadd_pd(_mm512_loadu_pd(x + i + 8),
+                           _mm512_loadu_pd(y + i + 8), acc1);
+  }
+  for (; i + 8 <= n; i += 8) {
+    acc0 = _mm512_fmadd_pd(_mm512_loadu_pd(x + i),
+                           _mm512_loadu_pd(y + i), acc0);
+  }
+  if (i < n) {
+    const __mmask8 mask = tail_mask8_avx512(n - i);
+    acc1 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, x + i),
+                           _mm512_maskz_loadu_pd(mask, y + i), acc1);
+  }
+  return hsum_avx512(_mm512_add_pd(acc0, acc1));
+}
+
+TDOANN_TARGET_AVX512 inline auto sum_avx512(const double *x, std::size_t n)
+    -> double {
+  __m512d acc = _mm512_setzero_pd();
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    acc = _mm512_add_pd(acc, _mm512_loadu_pd(x + i));
+  }
+  if (i < n) {
+    acc = _mm512_add_pd(
+        acc, _mm512_maskz_loadu_pd(tail_mask8_avx512(n - i), x + i));
+  }
+  return hsum_avx512(acc);
+}
+
+TDOANN_TARGET_AVX512 inline auto dot_norms_avx512(const double *x,
+                                                   const double *y,
+                                                   std::size_t n, double xmu,
+                                                   double ymu)
+    -> DotNorms<double> {
+  const __m512d vxmu = _mm512_set1_pd(xmu);
+  const __m512d vymu = _mm512_set1_pd(ymu);
+  __m512d xy = _mm512_setzero_pd();
+  __m512d xx = _mm512_setzero_pd();
+  __m512d yy = _mm512_setzero_pd();
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m512d xi = _mm512_sub_pd(_mm512_loadu_pd(x + i), vxmu);
+    const __m512d yi = _mm512_sub_pd(_mm512_loadu_pd(y + i), vymu);
+    xy = _mm512_fmadd_pd(xi, yi, xy);
+    xx = _mm512_fmadd_pd(xi, xi, xx);
+    yy = _mm512_fmadd_pd(yi, yi, yy);
+  }
+  if (i < n) {
+    const __mmask8 mask = tail_mask8_avx512(n - i);
+    const __m512d xi =
+        _mm512_maskz_sub_pd(mask, _mm512_maskz_loadu_pd(mask, x + i), vxmu);
+    const __m512d yi =
+        _mm512_maskz_sub_pd(mask, _mm512_maskz_loadu_pd(mask, y + i), vymu);
+    xy = _mm512_fmadd_pd(xi, yi, xy);
+    xx = _mm512_fmadd_pd(xi, xi, xx);
+    yy = _mm512_fmadd_pd(yi, yi, yy);
+  }
+  return {hsum_avx512(xy), hsum_avx512(xx),
+          hsum_avx512(yy)};
+}
+
+// AVX2 four-row kernels used for blocks of distances: each element of y is
+// loaded once and used for all four rows of x
+
+TDOANN_TARGET_AVX2 inline void sum_squared_diff_x4_avx2(const float *const *x,
+                                                         const float *y,
+                                                         std::size_t n,
+                                                         float *out) {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  __m256 acc2 = _mm256_setzero_ps();
+  __m256 acc3 = _mm256_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 yi = _mm256_loadu_ps(y + i);
+    const __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(x[0] + i), yi);
+    const __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(x[1] + i), yi);
+    const __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(x[2] + i), yi);
+    const __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(x[3] + i), yi);
+    acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+    acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+    acc2 = _mm256_fmadd_ps(d2, d2, acc2);
+    acc3 = _mm256_fmadd_ps(d3, d3, acc3);
+  }
+  out[0] = hsum_avx2(acc0);
+  out[1] = hsum_avx2(acc1);
+  out[2] = hsum_avx2(acc2);
+  out[3] = hsum_avx2(acc3);
+  for (; i < n; ++i) {
+    for (std::size_t r = 0; r < 4; r++) {
+      const float diff = x[r][i] - y[i];
+      out[r] += diff * diff;
+    }
+  }
+}
+
+TDOANN_TARGET_AVX2 inline void sum_product_x4_avx2(const float *const *x,
+                                                    const float *y,
+                                                    std::size_t n,
+                                                    float *out) {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  __m256 acc2 = _mm256_setzero_ps();
+  __m256 acc3 = _mm256_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 yi = _mm256_loadu_ps(y + i);
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x[0] + i), yi, acc0);
+    acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x[1] + i), yi, acc1);
+    acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(x[2] + i), yi, acc2);
+    acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(x[3] + i), yi, acc3);
+  }
+  out[0] = hsum_avx2(acc0);
+  out[1] = hsum_avx2(acc1);
+  out[2] = hsum_avx2(acc2);
+  out[3] = hsum_avx2(acc3);
+  for (; i < n; ++i) {
+    for (std::size_t r = 0; r < 4; r++) {
+      out[r] += x[r][i] * y[i];
+    }
+  }
+}
+
+TDOANN_TARGET_AVX2 inline void sum_squared_diff_x4_avx2(const double *const *x,
+                                                         const double *y,
+                                                         std::size_t n,
+                                                         double *out) {
+  __m256d acc0 = _mm256_setzero_pd();
+  __m256d acc1 = _mm256_setzero_pd();
+  __m256d acc2 = _mm256_setzero_pd();
+  __m256d acc3 = _mm256_setzero_pd();
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m256d yi = _mm256_loadu_pd(y + i);
+    const __m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(x[0] + i), yi);
+    const __m256d d1 = _mm256_sub_pd(_mm256_loadu_pd(x[1] + i), yi);
+    const __m256d d2 = _mm256_sub_pd(_mm256_loadu_pd(x[2] + i), yi);
+    const __m256d d3 = _mm256_sub_pd(_mm256_loadu_pd(x[3] + i), yi);
+    acc0 = _mm256_fmadd_pd(d0, d0, acc0);
+    acc1 = _mm256_fmadd_pd(d1, d1, acc1);
+    acc2 = _mm256_fmadd_pd(d2, d2, acc2);
+    acc3 = _mm256_fmadd_pd(d3, d3, acc3);
+  }
+  out[0] = hsum_avx2(acc0);
+  out[1] = hsum_avx2(acc1);
+  out[2] = hsum_avx2(acc2);
+  out[3] = hsum_avx2(acc3);
+  for (; i < n; ++i) {
+    for (std::size_t r = 0; r < 4; r++) {
+      const double diff = x[r][i] - y[i];
+      out[r] += diff * diff;
+    }
+  }
+}
+
+TDOANN_TARGET_AVX2 inline void sum_product_x4_avx2(const double *const *x,
+                                                    const double *y,
+                                                    std::size_t n,
+                                                    double *out) {
+  __m256d acc0 = _mm256_setzero_pd();
+  __m256d acc1 = _mm256_setzero_pd();
+  __m256d acc2 = _mm256_setzero_pd();
+  __m256d acc3 = _mm256_setzero_pd();
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m256d yi = _mm256_loadu_pd(y + i);
+    acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(x[0] + i), yi, acc0);
+    acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(x[1] + i), yi, acc1);
+    acc2 = _mm256_fmadd_pd(_mm256_loadu_pd(x[2] + i), yi, acc2);
+    acc3 = _mm256_fmadd_pd(_mm256_loadu_pd(x[3] + i), yi, acc3);
+  }
+  out[0] = hsum_avx2(acc0);
+  out[1] = hsum_avx2(acc1);
+  out[2] = hsum_avx2(acc2);
+  out[3] = hsum_avx2(acc3);
+  for (; i < n; ++i) {
+    for (std::size_t r = 0; r < 4; r++) {
+      out[r] += x[r][i] * y[i];
+    }
+  }
+}
+
+#endif // TDOANN_SIMD_X86
+
+// Dispatching kernels: T must be float or double
+
+template <typename T>
+auto sum_squared_diff(const T *x, const T *y, std::size_t n) -> T {
+#if defined(TDOANN_SIMD_X86)
+  switch (simd_level()) {
+  case SimdLevel::Avx512:
+    return sum_squared_diff_avx512(x, y, n);
+  case SimdLevel::Avx2:
+    return sum_squared_diff_avx2(x, y, n);
+  default:
+    break;
+  }
+#endif
+  T sum{0};
+  for (std::size_t i = 0; i < n; ++i) {
+    const T diff = x[i] - y[i];
+    sum += diff * diff;
+  }
+  return sum;
+}
+
+template <typename T>
+auto sum_abs_diff(const T *x, const T *y, std::size_t n) -> T {
+#if defined(TDOANN_SIMD_X86)
+  switch (simd_level()) {
+  case SimdLevel::Avx512:
+    return sum_abs_diff_avx512(x, y, n);
+  case SimdLevel::Avx2:
+    return sum_abs_diff_avx2(x, y, n);
+  default:
+    break;
+  }
+#endif
+  T sum{0};
+  for (std::size_t i = 0; i < n; ++i) {
+    sum += std::abs(x[i] - y[i]);
+  }
+  return sum;
+}
+
+template <typename T>
+auto sum_product(const T *x, const T *y, std::size_t n) -> T {
+#if defined(TDOANN_SIMD_X86)
+  switch (simd_level()) {
+  case SimdLevel::Avx512:
+    return sum_product_avx512(x, y, n);
+  case SimdLevel::Avx2:
+    return sum_product_avx2(x, y, n);
+  default:
+    break;
+  }
+#endif
+  T sum{0};
+  for (std::size_t i = 0; i < n; ++i) {
+    sum += x[i] * y[i];
+  }
+  return sum;
+}
+
+template <typename T> auto sum_values(const T *x, std::size_t n) -> T {
+#if defined(TDOANN_SIMD_X86)
+  switch (simd_level()) {
+  case SimdLevel::Avx512:
+    return sum_avx512(x, n);
+  case SimdLevel::Avx2:
+    return sum_avx2(x, n);
+  default:
+    break;
+  }
+#endif
+  T sum{0};
+  for (std::size_t i = 0; i < n; ++i) {
+    sum += x[i];
+  }
+  return sum;
+}
+
+template <typename T>
+auto dot_norms(const T *x, const T *y, std::size_t n, T xmu, T ymu)
+    -> DotNorms<T> {
+#if defined(TDOANN_SIMD_X86)
+  switch (simd_level()) {
+  case SimdLevel::Avx512:
+    return dot_norms_avx512(x, y, n, xmu, ymu);
+  case SimdLevel::Avx2:
+    return dot_norms_avx2(x, y, n, xmu, ymu);
+  default:
+    break;
+  }
+#endif
+  DotNorms<T> res;
+  for (std::size_t i = 0; i < n; ++i) {
+    const T xi = x[i] - xmu;
+    const T yi = y[i] - ymu;
+    res.xy += xi * yi;
+    res.xx += xi * xi;
+    res.yy += yi * yi;
+  }
+  return res;
+}
+
+// true if the iterator points to contiguous float or double data and the
+// output type is the same as the input type
+template <typename Out, typename It>
+constexpr bool is_simd_compatible =
+    std::is_same_v<typename std::iterator_traits<It>::value_type, Out> &&
+    (std::is_same_v<Out, float> || std::is_same_v<Out, double>);
+
+// distance functions
+
+template <typename Out, typename It>
+Out simd_squared_euclidean(const It xbegin, const It xend, const It ybegin) {
+  if constexpr (is_simd_compatible<Out, It>) {
+    return sum_squared_diff(&*xbegin, &*ybegin, std::distance(xbegin, xend));
+  } else {
+    return squared_euclidean<Out>(xbegin, xend, ybegin);
+  }
+}
+
+template <typename Out, typename It>
+Out simd_euclidean(const It xbegin, const It xend, const It ybegin) {
+  return std::sqrt(simd_squared_euclidean<Out>(xbegin, xend, ybegin));
+}
+
+template <typename Out, typename It>
+Out simd_manhattan(const It xbegin, const It xend, const It ybegin) {
+  if constexpr (is_simd_compatible<Out, It>) {
+    return sum_abs_diff(&*xbegin, &*ybegin, std::distance(xbegin, xend));
+  } else {
+    return manhattan<Out>(xbegin, xend, ybegin);
+  }
+}
+
+template <typename Out, typename It>
+Out simd_inner_product(const It xbegin, const It xend, const It ybegin) {
+  if constexpr (is_simd_compatible<Out, It>) {
+    const Out sum =
+        sum_product(&*xbegin, &*ybegin, std::distance(xbegin, xend));
+    return std::max(1 - sum, Out{0});
+  } else {
+    return inner_product<Out>(xbegin, xend, ybegin);
+  }
+}
+
+template <typename Out, typename It>
+Out simd_dot(const It xbegin, const It xend, const It ybegin) {
+  if constexpr (is_simd_compatible<Out, It>) {
+    const Out result =
+        sum_product(&*xbegin, &*ybegin, std::distance(xbegin, xend));
+    if (result <= 0.0) {
+      return static_cast<Out>(1.0);
+    }
+    return static_cast<Out>(1.0) - result;
+  } else {
+    return dot<Out>(xbegin, xend, ybegin);
+  }
+}
+
+template <typename Out, typename It>
+Out simd_alternative_dot(const It xbegin, const It xend, const It ybegin) {
+  if constexpr (is_simd_compatible<Out, It>) {
+    const Out result =
+        sum_product(&*xbegin, &*ybegin, std::distance(xbegin, xend));
+    if (result <= 0.0) {
+      return std::numeric_limits<Out>::max();
+    }
+    return -std::log2(result);
+  } else {
+    return alternative_dot<Out>(xbegin, xend, ybegin);
+  }
+}
+
+template <typename Out, typename It>
+Out simd_cosine(const It xbegin, const It xend, const It ybegin) {
+  if constexpr (is_simd_compatible<Out, It>) {
+    const auto dn = dot_norms(&*xbegin, &*ybegin, std::distance(xbegin, xend),
+                              Out{0}, Out{0});
+    if (dn.xx == 0.0 && dn.yy == 0.0) {
+      return 0.0;
+    }
+    if (dn.xx == 0.0 || dn.yy == 0.0) {
+      return 1.0;
+    }
+    return 1.0 - (dn.xy / std::sqrt(dn.xx * dn.yy));
+  } else {
+    return cosine<Out>(xbegin, xend, ybegin);
+  }
+}
+
+template <typename Out, typename It>
+Out simd_alternative_cosine(const It xbegin, const It xend, const It ybegin) {
+  if constexpr (is_simd_compatible<Out, It>) {
+    const auto dn = dot_norms(&*xbegin, &*ybegin, std::distance(xbegin, xend),
+                              Out{0}, Out{0});
+    if (dn.xx == 0.0 && dn.yy == 0.0) {
+      return 0.0;
+    }
+    if (dn.xx == 0.0 || dn.yy == 0.0 || dn.xy <= 0.0) {
+      return std::numeric_limits<Out>::max();
+    }
+    return std::log2(std::sqrt(dn.xx * dn.yy) / dn.xy);
+  } else {
+    return alternative_cosine<Out>(xbegin, xend, ybegin);
+  }
+}
+
+template <typename Out, typename It>
+Out simd_correlation(const It xbegin, const It xend, const It ybegin) {
+  if constexpr (is_simd_compatible<Out, It>) {
+    const std::size_t n = std::distance(xbegin, xend);
+    const Out *x = &*xbegin;
+    const Out *y = &*ybegin;
+    const Out xmu = sum_values(x, n) / n;
+    const Out ymu = sum_values(y, n) / n;
+    const auto dn = dot_norms(x, y, n, xmu, ymu);
+
+    constexpr Out zero = 0.0;
+    if (dn.xx == zero && dn.yy == zero) {
+      return zero;
+    }
+    constexpr Out one = 1.0;
+    if (dn.xx == zero || dn.yy == zero) {
+      return one;
+    }
+    return one - (dn.xy / std::sqrt(dn.xx * dn.yy));
+  } else {
+    return correlation<Out>(xbegin, xend, ybegin);
+  }
+}
+
+// Blocks of distances
+//
+// For some metrics, the distances between a block of rows and columns can be
+// calculated more efficiently than one pair at a time: rows are processed four
+// at a time, so each column vector is read from memory once per four rows
+// rather than once per row. The AVX2 kernels are also used on AVX-512 CPUs.
+
+enum class BlockKernel { None, SquaredDiff, Product };
+
+// How the per-pair sum from a block kernel is turned into a distance
+enum class BlockTransform { None, Sqrt, InnerProduct, Dot, AlternativeDot };
+
+struct BlockMetric {
+  BlockKernel kernel{BlockKernel::None};
+  BlockTransform transform{BlockTransform::None};
+};
+
+// Returns the block kernel for distance_func or BlockKernel::None if there
+// isn't one
+template <typename Out, typename It>
+constexpr auto get_block_metric(Out (*distance_func)(It, It, It))
+    -> BlockMetric {
+  if constexpr (is_simd_compatible<Out, It>) {
+    if (distance_func == simd_squared_euclidean<Out, It> ||
+        distance_func == squared_euclidean<Out, It>) {
+      return {BlockKernel::SquaredDiff, BlockTransform::None};
+    }
+    if (distance_func == simd_euclidean<Out, It> ||
+        distance_func == euclidean<Out, It>) {
+      return {BlockKernel::SquaredDiff, BlockTransform::Sqrt};
+    }
+    if (distance_func == simd_inner_product<Out, It> ||
+        distance_func == inner_product<Out, It>) {
+      return {BlockKernel::Product, BlockTransform::InnerProduct};
+    }
+    if (distance_func == simd_dot<Out, It> || distance_func == dot<Out, It>) {
+      return {BlockKernel::Product, BlockTransform::Dot};
+    }
+    if (distance_func == simd_alternative_dot<Out, It> ||
+        distance_func == alternative_dot<Out, It>) {
+      return {BlockKernel::Product, BlockTransform::AlternativeDot};
+    }
+  }
+  return {};
+}
+
+template <typename T>
+void block_kernel_x4(BlockKernel kernel, const T *const *x, const T *y,
+                     std::size_t n, T *out) {
+#if defined(TDOANN_SIMD_X86)
+  if (simd_level() != SimdLevel::Scalar) {
+    if (kernel == BlockKernel::SquaredDiff) {
+      sum_squared_diff_x4_avx2(x, y, n, out);
+    } else {
+      sum_product_x4_avx2(x, y, n, out);
+    }
+    return;
+  }
+#endif
+  for (std::size_t r = 0; r < 4; r++) {
+    out[r] = kernel == BlockKernel::SquaredDiff ? sum_squared_diff(x[r], y, n)
+                                                : sum_product(x[r], y, n);
+  }
+}
+
+template <typename T>
+auto block_transform(BlockTransform transform, T sum) -> T {
+  switch (transform) {
+  case BlockTransform::Sqrt:
+    return std::sqrt(sum);
+  case BlockTransform::InnerProduct:
+    return std::max(1 - sum, T{0});
+  case BlockTransform::Dot:
+    return sum <= 0.0 ? static_cast<T>(1.0) : static_cast<T>(1.0) - sum;
+  case BlockTransform::AlternativeDot:
+    return sum <= 0.0 ? std::numeric_limits<T>::max() : -std::log2(sum);
+  default:
+    return sum;
+  }
+}
+
+// Calculate the distances between the n_rows items with indices in rows of the
+// x data, and the n_cols items with indices in cols of the y data. Items are
+// stored contiguously with ndim features each. Distances are written to out in
+// row-major order (n_rows x n_cols). metric must have a kernel.
+template <typename T, typename Idx>
+void block_distance(const BlockMetric &metric, const T *x, const T *y,
+                    std::size_t ndim, const Idx *rows, std::size_t n_rows,
+                    const Idx *cols, std::size_t n_cols, T *out) {
+  const T *xr[4];
+  T sums[4];
+  for (std::size_t r = 0; r < n_rows; r += 4) {
+    const std::size_t n_block_rows = std::min<std::size_t>(4, n_rows - r);
+    for (std::size_t b = 0; b < 4; b++) {
+      // pad a partial block by repeating the last row
+      const std::size_t row = r + std::min(b, n_block_rows - 1);
+      xr[b] = x + ndim * rows[row];
+    }
+    for (std::size_t c = 0; c < n_cols; c++) {
+      block_kernel_x4(metric.kernel, xr, y + ndim * cols[c], ndim, sums);
+      for (std::size_t b = 0; b < n_block_rows; b++) {
+        out[(r + b) * n_cols + c] = block_transform(metric.transform, sums[b]);
+      }
+    }
+  }
+}
+
+} // namespace tdoann
+
+// NOLINTEND(readability-identifier-length)
+
+#endif // TDOANN_DISTANCESIMD_H
@@ -0,0 +1,277 @@
+// BSD 2-Clause License
+//
+// Copyright 2024 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_ENTRY_H
+#define TDOANN_ENTRY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "bvset.h"
+#include "distancebase.h"
+#include "heap.h"
+#include "nbrqueue.h"
+#include "nngraph.h"
+#include "parallel.h"
+#include "progressbase.h"
+#include "random.h"
+
+namespace tdoann {
+
+// A coarse, HNSW-like hierarchy of small graphs used to find good starting
+// points for a graph search, in place of random neighbors. Each level is a
+// random sample of the level below it (the lowest sample is taken from the
+// reference data), with its own k-nearest neighbor graph, and each level is
+// about size_ratio times smaller than the one below. A query is compared with
+// every item in the top level, then a beam search descends through the levels
+// using the nearest items found in each level as the start of the search in
+// the next one. The nearest items found in the lowest level are the entry
+// points for the search of the full graph (nn_query).
+//
+// The levels are nested: the items of a level are the first items of the
+// level below, so an item has the same local id in every level it belongs to.
+// The graphs are built by brute force, so the largest level is limited to
+// max_level_size items.
+template <typename Out, typename Idx> struct EntryLayers {
+  // ids of the items of the lowest level in the reference data: the first
+  // level_sizes[l] of them are the items of level l
+  std::vector<Idx> ids;
+  // largest first
+  std::vector<std::size_t> level_sizes;
+  // graphs[l] is the kNN graph of level l with local ids; the top level has
+  // none, it is searched by brute force
+  std::vector<SparseNNGraph<Out, Idx>> graphs;
+
+  auto n_levels() const -> std::size_t { return level_sizes.size(); }
+};
+
+// The k-nearest neighbor graph of the first n_items of ids, by brute force
+template <typename Out, typename Idx>
+auto build_level_graph(const BaseDistance<Out, Idx> &distance,
+                       const std::vector<Idx> &ids, std::size_t n_items,
+                       std::size_t n_nbrs, std::size_t n_threads,
+                       ProgressBase &progress, const Executor &executor)
+    -> SparseNNGraph<Out, Idx> {
+  constexpr auto npos = static_cast<Idx>(-1);
+  n_nbrs = std::min(n_nbrs, n_items - 1);
+  NNHeap<Out, Idx> heap(static_cast<Idx>(n_items), static_cast<Idx>(n_nbrs));
+  auto worker = [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; i++) {
+      const auto local_i = static_cast<Idx>(i);
+      for (std::size_t j = 0; j < n_items; j++) {
+        if (j == i) {
+          continue;
+        }
+        heap.checked_push(local_i, distance.calculate(ids[j], ids[i]),
+                          static_cast<Idx>(j));
+      }
+    }
+  };
+  dispatch_work(worker, n_items, n_threads, progress, executor);
+  sort_heap(heap, n_threads, progress, executor);
+
+  std::vector<std::size_t> row_ptr(n_items + 1, 0);
+  std::vector<Idx> col_idx;
+  std::vector<Out> dist;
+  col_idx.reserve(n_items * n_nbrs);
+  dist.reserve(n_items * n_nbrs);
+  for (std::size_t i = 0; i < n_items; i++) {
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      const auto nbr = heap.index(static_cast<Idx>(i), static_cast<Idx>(j));
+      if (nbr != npos) {
+        col_idx.push_back(nbr);
+        dist.push_back(
+            heap.distance(static_cast<Idx>(i), static_cast<Idx>(j)));
+      }
+    }
+    row_ptr[i + 1] = col_idx.size();
+  }
+  return SparseNNGraph<Out, Idx>(row_ptr, col_idx, dist);
+}
+
+// Build the levels over the items of the self distance calculator distance.
+// There are no levels if there are fewer than size_ratio items.
+template <typename Out, typename Idx>
+auto build_entry_layers(const BaseDistance<Out, Idx> &distance,
+                        std::size_t n_nbrs, RandomGenerator &rand,
+                        std::size_t n_threads, ProgressBase &progress,
+                        const Executor &executor, std::size_t size_ratio = 16,
+                        std::size_t max_level_size = 4096)
+    -> EntryLayers<Out, Idx> {
+  EntryLayers<Out, Idx> layers;
+  const std::size_t n_points = distance.get_nx();
+  size_ratio = std::max(size_ratio, std::size_t{2});
+
+  std::size_t level_size = std::min(n_points / size_ratio, max_level_size);
+  if (level_size < 2) {
+    return layers;
+  }
+  while (level_size >= 2) {
+    layers.level_sizes.push_back(level_size);
+    if (level_size <= size_ratio) {
+      break;
+    }
+    level_size /= size_ratio;
+  }
+
+  // a random sample of the reference items (partial Fisher-Yates shuffle)
+  std::vector<Idx> order(n_points);
+  std::iota(order.begin(), order.end(), 0);
+  const std::size_t n_sample = layers.level_sizes.front();
+  for (std::size_t i = 0; i < n_sample; i++) {
+    const auto j = i + std::min(static_cast<std::size_t>(
+                                    rand.unif() * (n_points - i)),
+                                n_points - i - 1);
+    std::swap(order[i], order[j]);
+  }
+  layers.ids.assign(order.begin(), order.begin() + n_sample);
+
+  progress.set_n_iters(layers.n_levels() - 1);
+  for (std::size_t l = 0; l + 1 < layers.n_levels(); l++) {
+    layers.graphs.push_back(build_level_graph(distance, layers.ids,
+                                              layers.level_sizes[l], n_nbrs,
+                                              n_threads, progress, executor));
+    progress.iter_finished();
+  }
+  return layers;
+}
+
+// Find up to n_entries entry points for the query item query by descending
+// through the levels, pushing them onto row query of nn_heap. visited is
+// cleared for each level, so it can be reused for any number of queries.
+// Returns the number of distances calculated.
+template <typename Out, typename Idx>
+auto find_entry_points(const EntryLayers<Out, Idx> &layers,
+                       const BaseDistance<Out, Idx> &distance, Idx query,
+                       std::size_t n_entries, NNHeap<Out, Idx> &nn_heap,
+                       EpochSet<> &visited) -> std::size_t {
+  constexpr auto npos = static_cast<Idx>(-1);
+  if (layers.n_levels() == 0) {
+    return 0;
+  }
+  std::size_t n_dist_calcs = 0;
+  auto dist_to = [&](Idx local) {
+    n_dist_calcs++;
+    return distance.calculate(layers.ids[local], query);
+  };
+
+  // As in HNSW, only the nearest item is kept while descending through the
+  // upper levels: the search of the lowest level keeps n_entries.
+  const std::size_t top = layers.n_levels() - 1;
+  NNHeap<Out, Idx> best(1, static_cast<Idx>(top == 0 ? n_entries : 1));
+  for (std::size_t i = 0; i < layers.level_sizes[top]; i++) {
+    best.checked_push(0, dist_to(static_cast<Idx>(i)), static_cast<Idx>(i));
+  }
+
+  for (std::size_t l = top; l-- > 0;) {
+    const auto &graph = layers.graphs[l];
+    NbrQueue<Out, Idx> seed_set;
+    for (std::size_t j = 0; j < best.n_nbrs; j++) {
+      const auto local = best.index(0, static_cast<Idx>(j));
+      if (local != npos) {
+        seed_set.emplace(best.distance(0, static_cast<Idx>(j)), local);
+      }
+    }
+    if (l == 0 && best.n_nbrs != n_entries) {
+      NNHeap<Out, Idx> widened(1, static_cast<Idx>(n_entries));
+      for (std::size_t j = 0; j < best.n_nbrs; j++) {
+        widened.checked_push(0, best.distance(0, static_cast<Idx>(j)),
+                             best.index(0, static_cast<Idx>(j)));
+      }
+      best = std::move(widened);
+    }
+    visited.clear(layers.level_sizes[l]);
+    for (std::size_t j = 0; j < best.n_nbrs; j++) {
+      const auto local = best.index(0, static_cast<Idx>(j));
+      if (local != npos) {
+        mark_visited(visited, local);
+      }
+    }
+    while (!seed_set.empty()) {
+      const auto vertex = seed_set.pop();
+      if (vertex.first > best.max_distance(0)) {
+        break;
+      }
+      for (std::size_t k = 0; k < graph.n_nbrs(vertex.second); k++) {
+        const auto nbr = graph.index(vertex.second, static_cast<Idx>(k));
+        if (has_been_and_mark_visited(visited, nbr)) {
+          continue;
+        }
+        const auto dist = dist_to(nbr);
+        if (best.checked_push(0, dist, nbr) > 0) {
+          seed_set.emplace(dist, nbr);
+        }
+      }
+    }
+  }
+
+  for (std::size_t j = 0; j < best.n_nbrs; j++) {
+    const auto local = best.index(0, static_cast<Idx>(j));
+    if (local != npos) {
+      nn_heap.checked_push(query, best.distance(0, static_cast<Idx>(j)),
+                           layers.ids[local]);
+    }
+  }
+  return n_dist_calcs;
+}
+
+// Add n_entries entry points for nn_query to each row of nn_heap.
+// distance_counts gets the number of distances calculated for each query. A
+// few entry points are enough: the search fills the rest of the heap, and
+// each extra entry point widens the search of the lowest level. n_entries is
+// capped at the number of neighbors in nn_heap.
+template <typename Out, typename Idx>
+void find_entry_points(const EntryLayers<Out, Idx> &layers,
+                       const BaseDistance<Out, Idx> &distance,
+                       std::size_t n_entries, NNHeap<Out, Idx> &nn_heap,
+                       std::vector<std::size_t> &distance_counts,
+                       std::size_t n_threads, ProgressBase &progress,
+                       const Executor &executor) {
+  if (n_entries == 0) {
+    throw std::invalid_argument("Number of entry points must be at least 1");
+  }
+  n_entries = std::min(n_entries, static_cast<std::size_t>(nn_heap.n_nbrs));
+  EpochSetPool<> visited_sets;
+  auto worker = [&](std::size_t begin, std::size_t end) {
+    auto visited = visited_sets.acquire();
+    for (std::size_t i = begin; i < end; i++) {
+      distance_counts[i] =
+          find_entry_points(layers, distance, static_cast<Idx>(i), n_entries,
+                            nn_heap, *visited);
+    }
+    visited_sets.release(std::move(visited));
+  };
+  progress.set_n_iters(1);
+  dispatch_work(worker, nn_heap.n_points, n_threads, progress, executor);
+}
+
+} // namespace tdoann
+
+#endif // TDOANN_ENTRY_H
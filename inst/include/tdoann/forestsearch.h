@@ -0,0 +1,98 @@
+// BSD 2-Clause License
+//
+// Copyright 2024 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_FORESTSEARCH_H
+#define TDOANN_FORESTSEARCH_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "bvset.h"
+#include "distancebase.h"
+#include "heap.h"
+#include "nngraph.h"
+#include "parallel.h"
+#include "progressbase.h"
+#include "random.h"
+#include "randnbrs.h"
+#include "rptree.h"
+#include "rptreeimplicit.h"
+#include "rptreesparse.h"
+#include "search.h"
+
+namespace tdoann {
+
+// Query the reference data in one pass: each query is seeded from the leaves of
+// the forest it falls into, topped up with random neighbors if the leaves held
+// fewer than n_nbrs items, then refined by searching search_graph. A chunk of
+// queries is seeded and searched by the same thread, so the query data and its
+// heap are still in cache when the graph search starts. Forest is a vector of
+// search trees of any type that has a search_forest overload, with Distance the
+// distance type that overload expects. Graph is as for nn_query.
+template <typename Forest, typename Graph, typename Distance,
+          typename Out = typename Distance::Output,
+          typename Idx = typename Distance::Index>
+auto forest_nn_query(const Forest &forest, const Graph &search_graph,
+                     const Distance &distance, uint32_t n_nbrs, bool cache,
+                     double epsilon, std::size_t max_distance_calculations,
+                     std::vector<std::size_t> &distance_counts,
+                     ParallelRandomIntProvider<Idx> &rng_provider,
+                     std::size_t n_threads, ProgressBase &progress,
+                     const Executor &executor) -> NNHeap<Out, Idx> {
+  const auto n_queries = distance.get_ny();
+  const auto n_ref_points = static_cast<Idx>(distance.get_nx());
+  NNHeap<Out, Idx> nn_heap(n_queries, n_nbrs);
+
+  rng_provider.initialize();
+  EpochSetPool<> visited_sets;
+  auto worker = [&](std::size_t begin, std::size_t end) {
+    auto rng_ptr = rng_provider.get_parallel_instance(end);
+    for (auto i = begin; i < end; ++i) {
+      const auto query = static_cast<Idx>(i);
+      if (cache) {
+        search_forest_cache(forest, distance, query, *rng_ptr, nn_heap);
+      } else {
+        search_forest(forest, distance, query, *rng_ptr, nn_heap);
+      }
+      fill_random(nn_heap, distance, *rng_ptr, query, n_ref_points);
+    }
+    auto visited = visited_sets.acquire();
+    non_search_query(nn_heap, distance, search_graph, epsilon,
+                     max_distance_calculations, distance_counts, begin, end,
+                     *visited);
+    visited_sets.release(std::move(visited));
+  };
+  progress.set_n_iters(1);
+  ExecutionParams exec_params{100 * n_threads};
+  dispatch_work(worker, n_queries, n_threads, exec_params, progress, executor);
+
+  return nn_heap;
+}
+
+} // namespace tdoann
+
+#endif // TDOANN_FORESTSEARCH_H
@@ -333,6 +333,16 @@ struct NNHeap {
   auto operator=(NNHeap &&) noexcept -> NNHeap & = default;
   ~NNHeap() = default;
 
+  // empty rows begin to end, keeping the allocated memory
+  void reset(std::size_t begin, std::size_t end) {
+    std::fill(idx.begin() + begin * n_nbrs, idx.begin() + end * n_nbrs,
+              npos());
+    std::fill(dist.begin() + begin * n_nbrs, dist.begin() + end * n_nbrs,
+              max_dist_func());
+  }
+
+  void reset() { reset(0, n_points); }
+
   auto contains(Idx row, Idx index) const -> bool {
     auto start = idx.begin() + row * n_nbrs;
     auto end = start + n_nbrs;
@@ -0,0 +1,849 @@
+// BSD 2-Clause License
+//
+// Copyright 2024 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_INDEXFILE_H
+#define TDOANN_INDEXFILE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "distancebase.h"
+#include "mmap.h"
+#include "nngraph.h"
+#include "rptree.h"
+#include "rptreeimplicit.h"
+#include "rptreesparse.h"
+
+// A binary file holding the parts of a search index (reference data, search
+// graph, search forest) as named arrays, so that it can be memory-mapped and
+// used without any parsing. The layout is:
+//
+// * a 64-byte header: magic string, byte order mark, format version, number
+//   of arrays and the offset of the array table.
+// * the arrays, each starting on a 64-byte boundary, so the data is aligned
+//   for SIMD loads.
+// * the array table: one 64-byte entry per array with its name, element type,
+//   offset and length.
+//
+// Data is written in the byte order of the machine, and a file written on a
+// machine with a different byte order is rejected rather than converted.
+
+namespace tdoann {
+
+constexpr std::size_t index_file_alignment = 64;
+constexpr uint32_t index_file_version = 1;
+constexpr char index_file_magic[8] = {'T', 'D', 'O', 'A', 'N', 'N', 'I', 'X'};
+constexpr uint32_t index_file_byte_order = 0x01020304;
+
+struct IndexFileHeader {
+  char magic[8];
+  uint32_t byte_order;
+  uint32_t version;
+  uint64_t n_arrays;
+  uint64_t table_offset;
+  uint8_t reserved[32];
+};
+static_assert(sizeof(IndexFileHeader) == index_file_alignment,
+              "index file header must be 64 bytes");
+
+struct IndexFileArray {
+  static constexpr std::size_t max_name_length = 39;
+
+  char name[max_name_length + 1];
+  uint32_t type;
+  uint32_t element_size;
+  uint64_t offset;
+  uint64_t length;
+};
+static_assert(sizeof(IndexFileArray) == 64,
+              "index file array table entry must be 64 bytes");
+
+// Element type codes stored in the array table, so that reading an array as
+// the wrong type is an error rather than garbage
+template <typename T> constexpr auto index_file_type() -> uint32_t {
+  if constexpr (std::is_same_v<T, uint8_t>) {
+    return 1;
+  } else if constexpr (std::is_same_v<T, int32_t>) {
+    return 2;
+  } else if constexpr (std::is_same_v<T, uint32_t>) {
+    return 3;
+  } else if constexpr (std::is_same_v<T, uint64_t>) {
+    return 4;
+  } else if constexpr (std::is_same_v<T, float>) {
+    return 5;
+  } else if constexpr (std::is_same_v<T, double>) {
+    return 6;
+  } else {
+    static_assert(sizeof(T) == 0, "unsupported index file element type");
+    return 0;
+  }
+}
+
+// Read-only view of a contiguous array, e.g. inside a memory-mapped file
+template <typename T> class ConstSpan {
+public:
+  ConstSpan() = default;
+  ConstSpan(const T *ptr, std::size_t n) : ptr(ptr), n(n) {}
+
+  auto data() const -> const T * { return ptr; }
+  auto size() const -> std::size_t { return n; }
+  auto empty() const -> bool { return n == 0; }
+  auto operator[](std::size_t i) const -> const T & { return ptr[i]; }
+  auto begin() const -> const T * { return ptr; }
+  auto end() const -> const T * { return ptr + n; }
+
+private:
+  const T *ptr{nullptr};
+  std::size_t n{0};
+};
+
+// The read-only part of the SparseNNGraph interface over arrays it doesn't
+// own, so a search graph in an index file can be searched in place.
+//
+// Checking every offset and neighbor index of a large graph when it is loaded
+// would read all of it from disk, when a search only touches a few pages.
+// Instead they are checked as they are used: a row whose offsets are out of
+// order or out of range has no neighbors, and a neighbor index out of range is
+// returned as missing (npos), which the searches already skip. A graph is
+// checked in full when it is saved, so this only matters if the file has been
+// damaged since.
+template <typename Out = float, typename Idx = uint32_t>
+struct SparseNNGraphView {
+  ConstSpan<uint64_t> row_ptr;
+  ConstSpan<Idx> col_idx;
+  ConstSpan<Out> dist;
+  ConstSpan<uint8_t> deleted;
+  std::size_t n_points{0};
+
+  using DistanceOut = Out;
+  using Index = Idx;
+
+  static constexpr auto npos() -> Idx { return static_cast<Idx>(-1); }
+
+  auto n_nbrs(Idx idx) const -> std::size_t {
+    const uint64_t begin = row_ptr[idx];
+    const uint64_t end = row_ptr[idx + 1];
+    if (end < begin || end > col_idx.size()) {
+      return 0;
+    }
+    return static_cast<std::size_t>(end - begin);
+  }
+
+  // i must be less than n_nbrs(idx)
+  auto index(Idx idx, Idx i) const -> Idx {
+    const Idx nbr = col_idx[row_ptr[idx] + static_cast<std::size_t>(i)];
+    return static_cast<std::size_t>(nbr) < n_points ? nbr : npos();
+  }
+
+  auto distance(Idx idx, Idx i) const -> Out {
+    return dist[row_ptr[idx] + static_cast<std::size_t>(i)];
+  }
+
+  auto is_deleted(Idx idx) const -> bool {
+    return !deleted.empty() && deleted[idx] != 0;
+  }
+};
+
+class IndexFileWriter {
+public:
+  explicit IndexFileWriter(const std::string &path)
+      : path(path), out(path, std::ios::binary | std::ios::trunc) {
+    if (!out) {
+      throw std::runtime_error("Can't open file '" + path + "' for writing");
+    }
+    // the header is written last, when the table offset is known
+    pad_to(sizeof(IndexFileHeader));
+  }
+
+  IndexFileWriter(const IndexFileWriter &) = delete;
+  auto operator=(const IndexFileWriter &) -> IndexFileWriter & = delete;
+
+  template <typename T>
+  void write(const std::string &name, const T *data, std::size_t n) {
+    if (name.empty() || name.size() > IndexFileArray::max_name_length) {
+      throw std::runtime_error("Bad array name '" + name + "'");
+    }
+    if (std::any_of(arrays.begin(), arrays.end(), [&](const auto &array) {
+          return name == array.name;
+        })) {
+      throw std::runtime_error("Duplicate array name '" + name + "'");
+    }
+    pad_to(aligned(pos));
+
+    IndexFileArray array{};
+    std::copy(name.begin(), name.end(), array.name);
+    array.type = index_file_type<T>();
+    array.element_size = static_cast<uint32_t>(sizeof(T));
+    array.offset = pos;
+    array.length = n;
+    arrays.push_back(array);
+
+    write_bytes(data, n * sizeof(T));
+  }
+
+  template <typename T>
+  void write(const std::string &name, const std::vector<T> &data) {
+    write(name, data.data(), data.size());
+  }
+
+  void write(const std::string &name, const std::string &value) {
+    write(name, reinterpret_cast<const uint8_t *>(value.data()), value.size());
+  }
+
+  // Write the array table and the header. The file is not valid until this
+  // has been called.
+  void close() {
+    if (closed) {
+      return;
+    }
+    pad_to(aligned(pos));
+    const uint64_t table_offset = pos;
+    write_bytes(arrays.data(), arrays.size() * sizeof(IndexFileArray));
+
+    IndexFileHeader header{};
+    std::copy(std::begin(index_file_magic), std::end(index_file_magic),
+              header.magic);
+    header.byte_order = index_file_byte_order;
+    header.version = index_file_version;
+    header.n_arrays = arrays.size();
+    header.table_offset = table_offset;
+    out.seekp(0);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.close();
+    if (!out) {
+      throw std::runtime_error("Error writing to file '" + path + "'");
+    }
+    closed = true;
+  }
+
+private:
+  std::string path;
+  std::ofstream out;
+  std::vector<IndexFileArray> arrays;
+  uint64_t pos{0};
+  bool closed{false};
+
+  static auto aligned(uint64_t offset) -> uint64_t {
+    return (offset + index_file_alignment - 1) / index_file_alignment *
+           index_file_alignment;
+  }
+
+  void write_bytes(const void *data, std::size_t n_bytes) {
+    out.write(static_cast<const char *>(data),
+              static_cast<std::streamsize>(n_bytes));
+    if (!out) {
+      throw std::runtime_error("Error writing to file '" + path + "'");
+    }
+    pos += n_bytes;
+  }
+
+  void pad_to(uint64_t offset) {
+    static const char zeros[index_file_alignment] = {};
+    while (pos < offset) {
+      write_bytes(zeros, std::min<uint64_t>(offset - pos, sizeof(zeros)));
+    }
+  }
+};
+
+// A memory-mapped index file. Opening it only reads the header and the array
+// table: the arrays themselves are read from disk as they are accessed, and
+// the pointers returned by get point into the mapping, so they are only valid
+// as long as the IndexFile is.
+class IndexFile {
+public:
+  explicit IndexFile(const std::string &path) : file(path) {
+    const std::size_t n_bytes = file.size();
+    if (n_bytes < sizeof(IndexFileHeader)) {
+      throw std::runtime_error("File '" + path + "' is not an index file");
+    }
+    IndexFileHeader header{};
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (!std::equal(std::begin(index_file_magic), std::end(index_file_magic),
+                    header.magic)) {
+      throw std::runtime_error("File '" + path + "' is not an index file");
+    }
+    if (header.byte_order != index_file_byte_order) {
+      throw std::runtime_error("Index file '" + path +
+                               "' was written with a different byte order");
+    }
+    if (header.version != index_file_version) {
+      throw std::runtime_error("Index file '" + path + "' has version " +
+                               std::to_string(header.version) +
+                               ", expected " +
+                               std::to_string(index_file_version));
+    }
+    if (header.table_offset > n_bytes ||
+        header.n_arrays >
+            (n_bytes - header.table_offset) / sizeof(IndexFileArray)) {
+      throw std::runtime_error("Index file '" + path + "' is truncated");
+    }
+    arrays.resize(header.n_arrays);
+    std::memcpy(arrays.data(), file.data() + header.table_offset,
+                arrays.size() * sizeof(IndexFileArray));
+    for (auto &array : arrays) {
+      array.name[IndexFileArray::max_name_length] = '\0';
+      if (array.offset % index_file_alignment != 0 || array.offset > n_bytes ||
+          array.element_size == 0 ||
+          array.length > (n_bytes - array.offset) / array.element_size) {
+        throw std::runtime_error("Index file '" + path + "' is corrupt");
+      }
+    }
+  }
+
+  auto contains(const std::string &name) const -> bool {
+    return find(name) != nullptr;
+  }
+
+  template <typename T> auto get(const std::string &name) const -> ConstSpan<T> {
+    const IndexFileArray *array = find(name);
+    if (array == nullptr) {
+      throw std::runtime_error("No array '" + name + "' in index file");
+    }
+    if (array->type != index_file_type<T>() ||
+        array->element_size != sizeof(T)) {
+      throw std::runtime_error("Array '" + name +
+                               "' in index file has the wrong type");
+    }
+    return {reinterpret_cast<const T *>(file.data() + array->offset),
+            static_cast<std::size_t>(array->length)};
+  }
+
+  auto get_string(const std::string &name) const -> std::string {
+    const auto chars = get<uint8_t>(name);
+    return {chars.begin(), chars.end()};
+  }
+
+  void advise(MappedFile<char>::Advice advice) const { file.advise(advice); }
+
+private:
+  MappedFile<char> file;
+  std::vector<IndexFileArray> arrays;
+
+  auto find(const std::string &name) const -> const IndexFileArray * {
+    for (const auto &array : arrays) {
+      if (name == array.name) {
+        return &array;
+      }
+    }
+    return nullptr;
+  }
+};
+
+// Reference data: n_items rows of ndim features, stored row-major
+
+template <typename In>
+void save_data(IndexFileWriter &writer, const std::string &name,
+               const In *data, std::size_t n_items, std::size_t ndim) {
+  writer.write(name, data, n_items * ndim);
+  const std::vector<uint64_t> shape{n_items, ndim};
+  writer.write(name + "/shape", shape);
+}
+
+template <typename In>
+auto load_data(const IndexFile &file, const std::string &name) -> DataView<In> {
+  const auto shape = file.get<uint64_t>(name + "/shape");
+  const auto data = file.get<In>(name);
+  if (shape.size() != 2 || shape[0] * shape[1] != data.size()) {
+    throw std::runtime_error("Bad shape for data '" + name + "'");
+  }
+  return DataView<In>::row_major(data.data(), shape[0], shape[1]);
+}
+
+// Item order: if the items were relabelled before they were saved (see
+// reorder.h), the original id of item i is order[i]. Files without an order
+// are in the original order, and an empty span is returned.
+template <typename Idx>
+auto load_order(const IndexFile &file, const std::string &name,
+                std::size_t n_points) -> ConstSpan<Idx> {
+  if (!file.contains(name)) {
+    return {};
+  }
+  const auto order = file.get<Idx>(name);
+  if (order.size() != n_points) {
+    throw std::runtime_error("Bad order '" + name + "': expected " +
+                             std::to_string(n_points) + " items");
+  }
+  return order;
+}
+
+// Distances from reference items read in place (e.g. the data of an
+// IndexFile) to query items held in memory. It is a QueryVectorDistance so
+// that it can search an explicit margin forest, which only needs the query
+// items as vectors.
+template <typename In, typename Out, typename Idx = uint32_t>
+class IndexQueryDistanceCalculator : public QueryVectorDistance<In, Out, Idx> {
+public:
+  using DistanceFunc = PtrDistanceFunc<In, Out>;
+  using Iterator = typename QueryVectorDistance<In, Out, Idx>::Iterator;
+
+  IndexQueryDistanceCalculator(const DataView<In> &x, std::vector<In> &&y,
+                               DistanceFunc distance_func)
+      : y(std::move(y)),
+        distance(x,
+                 DataView<In>::row_major(this->y.data(),
+                                         this->y.size() / x.ndim, x.ndim),
+                 distance_func),
+        ndim(x.ndim) {}
+
+  std::size_t get_nx() const override { return distance.get_nx(); }
+  std::size_t get_ny() const override { return distance.get_ny(); }
+
+  Out calculate(const Idx &i, const Idx &j) const override {
+    return distance.calculate(i, j);
+  }
+
+  void calculate_block(const Idx *rows, std::size_t n_rows, const Idx *cols,
+                       std::size_t n_cols, Out *out) const override {
+    distance.calculate_block(rows, n_rows, cols, n_cols, out);
+  }
+
+  bool prefers_block() const override { return distance.prefers_block(); }
+
+  void prefetch(const Idx &i) const override { distance.prefetch(i); }
+
+  auto get_y(Idx i) const -> Iterator override {
+    return y.begin() + static_cast<std::size_t>(i) * ndim;
+  }
+
+private:
+  // declared first: it must outlive the view in distance
+  std::vector<In> y;
+  ViewDistanceCalculator<In, In, Out, Idx> distance;
+  std::size_t ndim;
+};
+
+// Checks on the arrays read from an index file. The forest searches index
+// into other arrays with their values without checking them, so a corrupt
+// forest must be rejected when it is loaded.
+
+namespace detail {
+// ptr is an offset array like the row_ptr of a CSR matrix: it starts at zero,
+// never decreases and ends at n_values, so every range it defines is valid
+inline auto is_valid_ptr(const ConstSpan<uint64_t> &ptr, std::size_t n_values)
+    -> bool {
+  if (ptr.empty() || ptr[0] != 0 || ptr[ptr.size() - 1] != n_values) {
+    return false;
+  }
+  return std::is_sorted(ptr.begin(), ptr.end());
+}
+
+// every value is an index less than n_points, or (if allow_npos) missing
+template <typename Idx, typename Values>
+auto is_valid_index(const Values &values, std::size_t n_points,
+                    bool allow_npos) -> bool {
+  constexpr auto npos = static_cast<Idx>(-1);
+  return std::all_of(values.begin(), values.end(), [&](Idx idx) {
+    return (allow_npos && idx == npos) ||
+           static_cast<std::size_t>(idx) < n_points;
+  });
+}
+} // namespace detail
+
+// Search graphs: the CSR arrays of SparseNNGraph, plus the deleted items if
+// there are any
+
+// The graph is checked when it is saved rather than when it is loaded (see
+// SparseNNGraphView)
+template <typename Out, typename Idx>
+void check_graph(const SparseNNGraph<Out, Idx> &graph,
+                 const std::string &prefix) {
+  if (!std::is_sorted(graph.row_ptr.begin(), graph.row_ptr.end()) ||
+      graph.row_ptr.empty() || graph.row_ptr.size() != graph.n_points + 1 ||
+      graph.row_ptr.front() != 0 ||
+      graph.row_ptr.back() != graph.col_idx.size()) {
+    throw std::runtime_error("Bad search graph '" + prefix +
+                             "': row_ptr is not a valid offset array for " +
+                             std::to_string(graph.col_idx.size()) +
+                             " neighbors");
+  }
+  if (!detail::is_valid_index<Idx>(graph.col_idx, graph.n_points, true)) {
+    throw std::runtime_error("Bad search graph '" + prefix +
+                             "': neighbor index out of range for " +
+                             std::to_string(graph.n_points) + " items");
+  }
+  if (!graph.deleted.empty() && graph.deleted.size() != graph.n_points) {
+    throw std::runtime_error("Bad search graph '" + prefix +
+                             "': deleted has the wrong length");
+  }
+}
+
+template <typename Out, typename Idx>
+void save_graph(IndexFileWriter &writer, const std::string &prefix,
+                const SparseNNGraph<Out, Idx> &graph) {
+  check_graph(graph, prefix);
+  writer.write(prefix + "/row_ptr",
+               std::vector<uint64_t>(graph.row_ptr.begin(),
+                                     graph.row_ptr.end()));
+  writer.write(prefix + "/col_idx", graph.col_idx);
+  writer.write(prefix + "/dist", graph.dist);
+  if (!graph.deleted.empty()) {
+    writer.write(prefix + "/deleted", graph.deleted);
+  }
+}
+
+template <typename Out, typename Idx>
+auto load_graph(const IndexFile &file, const std::string &prefix)
+    -> SparseNNGraphView<Out, Idx> {
+  SparseNNGraphView<Out, Idx> graph;
+  graph.row_ptr = file.get<uint64_t>(prefix + "/row_ptr");
+  graph.col_idx = file.get<Idx>(prefix + "/col_idx");
+  graph.dist = file.get<Out>(prefix + "/dist");
+  if (file.contains(prefix + "/deleted")) {
+    graph.deleted = file.get<uint8_t>(prefix + "/deleted");
+  }
+  if (graph.col_idx.size() != graph.dist.size()) {
+    throw std::runtime_error("Bad search graph '" + prefix +
+                             "': different numbers of neighbors and distances");
+  }
+  // only the ends of row_ptr are checked: the rest of it and col_idx are
+  // checked as the search reads them
+  if (graph.row_ptr.empty() || graph.row_ptr[0] != 0 ||
+      graph.row_ptr[graph.row_ptr.size() - 1] != graph.col_idx.size()) {
+    throw std::runtime_error("Bad search graph '" + prefix +
+                             "': row_ptr is not a valid offset array for " +
+                             std::to_string(graph.col_idx.size()) +
+                             " neighbors");
+  }
+  graph.n_points = graph.row_ptr.size() - 1;
+  if (!graph.deleted.empty() && graph.deleted.size() != graph.n_points) {
+    throw std::runtime_error("Bad search graph '" + prefix +
+                             "': deleted has the wrong length");
+  }
+  return graph;
+}
+
+// Search forests. The trees are concatenated: node_ptr and index_ptr give the
+// range of nodes and of leaf indices that belong to each tree. The search
+// trees hold their nodes as vectors of vectors, so unlike the graph and the
+// data they are copied out of the file rather than used in place, but this is
+// a few bulk copies per tree, with no parsing.
+
+namespace detail {
+template <typename Tree>
+void save_forest_common(IndexFileWriter &writer, const std::string &prefix,
+                        const std::vector<Tree> &forest,
+                        const std::string &type) {
+  using Idx = typename Tree::Index;
+  std::vector<uint64_t> node_ptr{0};
+  std::vector<uint64_t> index_ptr{0};
+  std::vector<Idx> leaf_sizes;
+  std::vector<uint64_t> children;
+  std::vector<Idx> indices;
+  for (const auto &tree : forest) {
+    node_ptr.push_back(node_ptr.back() + tree.children.size());
+    index_ptr.push_back(index_ptr.back() + tree.indices.size());
+    leaf_sizes.push_back(tree.leaf_size);
+    for (const auto &[left, right] : tree.children) {
+      children.push_back(left);
+      children.push_back(right);
+    }
+    indices.insert(indices.end(), tree.indices.begin(), tree.indices.end());
+  }
+  writer.write(prefix + "/type", type);
+  writer.write(prefix + "/node_ptr", node_ptr);
+  writer.write(prefix + "/index_ptr", index_ptr);
+  writer.write(prefix + "/leaf_size", leaf_sizes);
+  writer.write(prefix + "/children", children);
+  writer.write(prefix + "/indices", indices);
+}
+
+// Fill in the parts common to all tree types and return node_ptr, which the
+// caller needs to find the nodes of each tree in the type-specific arrays.
+// Whether a node is a leaf depends on those arrays, so once they are filled in
+// the caller must also call check_forest.
+template <typename Tree>
+auto load_forest_common(const IndexFile &file, const std::string &prefix,
+                        std::vector<Tree> &forest, const std::string &type,
+                        std::size_t n_points) -> ConstSpan<uint64_t> {
+  using Idx = typename Tree::Index;
+  if (file.get_string(prefix + "/type") != type) {
+    throw std::runtime_error("Forest '" + prefix + "' is not of type '" +
+                             type + "'");
+  }
+  const auto node_ptr = file.get<uint64_t>(prefix + "/node_ptr");
+  const auto index_ptr = file.get<uint64_t>(prefix + "/index_ptr");
+  const auto leaf_sizes = file.get<Idx>(prefix + "/leaf_size");
+  const auto children = file.get<uint64_t>(prefix + "/children");
+  const auto indices = file.get<Idx>(prefix + "/indices");
+
+  const std::size_t n_trees = leaf_sizes.size();
+  if (node_ptr.size() != n_trees + 1 || index_ptr.size() != n_trees + 1) {
+    throw std::runtime_error("Bad forest '" + prefix +
+                             "': node_ptr and index_ptr must have one more "
+                             "entry than the number of trees");
+  }
+  if (children.size() % 2 != 0 ||
+      !detail::is_valid_ptr(node_ptr, children.size() / 2)) {
+    throw std::runtime_error("Bad forest '" + prefix +
+                             "': node_ptr is not a valid offset array for " +
+                             std::to_string(children.size() / 2) + " nodes");
+  }
+  if (!detail::is_valid_ptr(index_ptr, indices.size())) {
+    throw std::runtime_error("Bad forest '" + prefix +
+                             "': index_ptr is not a valid offset array for " +
+                             std::to_string(indices.size()) + " indices");
+  }
+  if (!detail::is_valid_index<Idx>(indices, n_points, false)) {
+    throw std::runtime_error("Bad forest '" + prefix +
+                             "': leaf index out of range for " +
+                             std::to_string(n_points) + " items");
+  }
+
+  forest.resize(n_trees);
+  for (std::size_t t = 0; t < n_trees; t++) {
+    auto &tree = forest[t];
+    tree.leaf_size = leaf_sizes[t];
+    tree.children.resize(node_ptr[t + 1] - node_ptr[t]);
+    for (std::size_t i = 0, j = 2 * node_ptr[t]; i < tree.children.size();
+         i++, j += 2) {
+      tree.children[i] = std::make_pair(children[j], children[j + 1]);
+    }
+    tree.indices.assign(indices.begin() + index_ptr[t],
+                        indices.begin() + index_ptr[t + 1]);
+  }
+  return node_ptr;
+}
+
+// Check that searching each tree can only visit valid nodes and leaf ranges.
+// Nodes are stored in depth-first order, so the children of a node always come
+// after it: insisting on that also rules out cycles.
+template <typename Tree>
+void check_forest(const std::vector<Tree> &forest, const std::string &prefix) {
+  for (std::size_t t = 0; t < forest.size(); t++) {
+    const auto &tree = forest[t];
+    const std::size_t n_nodes = tree.children.size();
+    const std::string bad_tree =
+        "Bad forest '" + prefix + "': tree " + std::to_string(t);
+    if (n_nodes == 0) {
+      throw std::runtime_error(bad_tree + " has no nodes");
+    }
+    for (std::size_t i = 0; i < n_nodes; i++) {
+      const auto [first, second] = tree.children[i];
+      if (tree.is_leaf(i)) {
+        if (first > second || second > tree.indices.size()) {
+          throw std::runtime_error(bad_tree + " has an invalid leaf range at "
+                                              "node " +
+                                   std::to_string(i));
+        }
+      } else if (first <= i || second <= i || first >= n_nodes ||
+                 second >= n_nodes) {
+        throw std::runtime_error(bad_tree + " has an invalid child at node " +
+                                 std::to_string(i));
+      }
+    }
+  }
+}
+} // namespace detail
+
+template <typename In, typename Idx>
+void save_forest(IndexFileWriter &writer, const std::string &prefix,
+                 const std::vector<SearchTree<In, Idx>> &forest) {
+  detail::save_forest_common(writer, prefix, forest, "explicit");
+  std::vector<In> hyperplanes;
+  std::vector<In> offsets;
+  const std::size_t ndim = forest.empty() || forest[0].hyperplanes.empty()
+                               ? 0
+                               : forest[0].hyperplanes[0].size();
+  for (const auto &tree : forest) {
+    for (const auto &hyperplane : tree.hyperplanes) {
+      hyperplanes.insert(hyperplanes.end(), hyperplane.begin(),
+                         hyperplane.end());
+    }
+    offsets.insert(offsets.end(), tree.offsets.begin(), tree.offsets.end());
+  }
+  writer.write(prefix + "/ndim", std::vector<uint64_t>{ndim});
+  writer.write(prefix + "/hyperplanes", hyperplanes);
+  writer.write(prefix + "/offsets", offsets);
+}
+
+// n_points and ndim are the number of items the forest indexes and their
+// number of features: every leaf index must be less than n_points and the
+// hyperplanes must have ndim features
+
+template <typename In, typename Idx>
+void load_forest(const IndexFile &file, const std::string &prefix,
+                 std::size_t n_points, std::size_t ndim,
+                 std::vector<SearchTree<In, Idx>> &forest) {
+  const auto node_ptr =
+      detail::load_forest_common(file, prefix, forest, "explicit", n_points);
+  const auto ndim_array = file.get<uint64_t>(prefix + "/ndim");
+  const auto hyperplanes = file.get<In>(prefix + "/hyperplanes");
+  const auto offsets = file.get<In>(prefix + "/offsets");
+  const std::size_t n_nodes = node_ptr[node_ptr.size() - 1];
+  // a forest with no nodes has no hyperplanes to take ndim from
+  const std::size_t file_ndim = ndim_array.empty() ? 0 : ndim_array[0];
+  if (ndim_array.size() != 1 || hyperplanes.size() != n_nodes * file_ndim ||
+      offsets.size() != n_nodes) {
+    throw std::runtime_error("Bad forest '" + prefix + "'");
+  }
+  if (n_nodes > 0 && file_ndim != ndim) {
+    throw std::runtime_error("Bad forest '" + prefix + "': hyperplanes have " +
+                             std::to_string(file_ndim) +
+                             " features, expected " + std::to_string(ndim));
+  }
+
+  for (std::size_t t = 0; t < forest.size(); t++) {
+    auto &tree = forest[t];
+    tree.hyperplanes.resize(node_ptr[t + 1] - node_ptr[t]);
+    for (std::size_t i = 0; i < tree.hyperplanes.size(); i++) {
+      const In *hyperplane = hyperplanes.data() + (node_ptr[t] + i) * ndim;
+      tree.hyperplanes[i].assign(hyperplane, hyperplane + ndim);
+    }
+    tree.offsets.assign(offsets.begin() + node_ptr[t],
+                        offsets.begin() + node_ptr[t + 1]);
+  }
+  detail::check_forest(forest, prefix);
+}
+
+template <typename Idx>
+void save_forest(IndexFileWriter &writer, const std::string &prefix,
+                 const std::vector<SearchTreeImplicit<Idx>> &forest) {
+  detail::save_forest_common(writer, prefix, forest, "implicit");
+  std::vector<Idx> normal_indices;
+  for (const auto &tree : forest) {
+    for (const auto &[left, right] : tree.normal_indices) {
+      normal_indices.push_back(left);
+      normal_indices.push_back(right);
+    }
+  }
+  writer.write(prefix + "/normal_indices", normal_indices);
+}
+
+template <typename Idx>
+void load_forest(const IndexFile &file, const std::string &prefix,
+                 std::size_t n_points, std::size_t /* ndim */,
+                 std::vector<SearchTreeImplicit<Idx>> &forest) {
+  const auto node_ptr =
+      detail::load_forest_common(file, prefix, forest, "implicit", n_points);
+  const auto normal_indices = file.get<Idx>(prefix + "/normal_indices");
+  if (normal_indices.size() != 2 * node_ptr[node_ptr.size() - 1]) {
+    throw std::runtime_error("Bad forest '" + prefix + "'");
+  }
+
+  for (std::size_t t = 0; t < forest.size(); t++) {
+    auto &tree = forest[t];
+    tree.normal_indices.resize(node_ptr[t + 1] - node_ptr[t]);
+    for (std::size_t i = 0, j = 2 * node_ptr[t];
+         i < tree.normal_indices.size(); i++, j += 2) {
+      tree.normal_indices[i] =
+          std::make_pair(normal_indices[j], normal_indices[j + 1]);
+    }
+  }
+  // the normal of a split node is defined by two items: at a leaf both are
+  // missing
+  constexpr auto npos = static_cast<Idx>(-1);
+  for (std::size_t i = 0; i < normal_indices.size(); i += 2) {
+    if (normal_indices[i] != npos &&
+        !detail::is_valid_index<Idx>(
+            ConstSpan<Idx>(normal_indices.data() + i, 2), n_points, false)) {
+      throw std::runtime_error("Bad forest '" + prefix +
+                               "': normal index out of range for " +
+                               std::to_string(n_points) + " items");
+    }
+  }
+  detail::check_forest(forest, prefix);
+}
+
+// the hyperplanes of a sparse tree have a different number of non-zeros at each
+// node, so they are stored in CSR format, with one row per node
+template <typename In, typename Idx>
+void save_forest(IndexFileWriter &writer, const std::string &prefix,
+                 const std::vector<SparseSearchTree<In, Idx>> &forest) {
+  detail::save_forest_common(writer, prefix, forest, "sparse");
+  std::vector<uint64_t> hyperplane_ptr{0};
+  std::vector<uint64_t> hyperplane_ind;
+  std::vector<In> hyperplane_data;
+  std::vector<In> offsets;
+  for (const auto &tree : forest) {
+    for (std::size_t i = 0; i < tree.hyperplanes_ind.size(); i++) {
+      hyperplane_ind.insert(hyperplane_ind.end(),
+                            tree.hyperplanes_ind[i].begin(),
+                            tree.hyperplanes_ind[i].end());
+      hyperplane_data.insert(hyperplane_data.end(),
+                             tree.hyperplanes_data[i].begin(),
+                             tree.hyperplanes_data[i].end());
+      hyperplane_ptr.push_back(hyperplane_ind.size());
+    }
+    offsets.insert(offsets.end(), tree.offsets.begin(), tree.offsets.end());
+  }
+  writer.write(prefix + "/hyperplane_ptr", hyperplane_ptr);
+  writer.write(prefix + "/hyperplane_ind", hyperplane_ind);
+  writer.write(prefix + "/hyperplane_data", hyperplane_data);
+  writer.write(prefix + "/offsets", offsets);
+}
+
+template <typename In, typename Idx>
+void load_forest(const IndexFile &file, const std::string &prefix,
+                 std::size_t n_points, std::size_t ndim,
+                 std::vector<SparseSearchTree<In, Idx>> &forest) {
+  const auto node_ptr =
+      detail::load_forest_common(file, prefix, forest, "sparse", n_points);
+  const auto hyperplane_ptr = file.get<uint64_t>(prefix + "/hyperplane_ptr");
+  const auto hyperplane_ind = file.get<uint64_t>(prefix + "/hyperplane_ind");
+  const auto hyperplane_data = file.get<In>(prefix + "/hyperplane_data");
+  const auto offsets = file.get<In>(prefix + "/offsets");
+  const std::size_t n_nodes = node_ptr[node_ptr.size() - 1];
+  if (hyperplane_ptr.size() != n_nodes + 1 ||
+      !detail::is_valid_ptr(hyperplane_ptr, hyperplane_ind.size()) ||
+      hyperplane_data.size() != hyperplane_ind.size() ||
+      offsets.size() != n_nodes) {
+    throw std::runtime_error("Bad forest '" + prefix + "'");
+  }
+  if (!detail::is_valid_index<uint64_t>(hyperplane_ind, ndim, false)) {
+    throw std::runtime_error("Bad forest '" + prefix +
+                             "': hyperplane feature index out of range for " +
+                             std::to_string(ndim) + " features");
+  }
+
+  for (std::size_t t = 0; t < forest.size(); t++) {
+    auto &tree = forest[t];
+    const std::size_t tree_n_nodes = node_ptr[t + 1] - node_ptr[t];
+    tree.hyperplanes_ind.resize(tree_n_nodes);
+    tree.hyperplanes_data.resize(tree_n_nodes);
+    for (std::size_t i = 0; i < tree_n_nodes; i++) {
+      const auto begin = hyperplane_ptr[node_ptr[t] + i];
+      const auto end = hyperplane_ptr[node_ptr[t] + i + 1];
+      tree.hyperplanes_ind[i].assign(hyperplane_ind.begin() + begin,
+                                     hyperplane_ind.begin() + end);
+      tree.hyperplanes_data[i].assign(hyperplane_data.begin() + begin,
+                                      hyperplane_data.begin() + end);
+    }
+    tree.offsets.assign(offsets.begin() + node_ptr[t],
+                        offsets.begin() + node_ptr[t + 1]);
+  }
+  detail::check_forest(forest, prefix);
+}
+
+} // namespace tdoann
+
+#endif // TDOANN_INDEXFILE_H
@@ -0,0 +1,297 @@
+// BSD 2-Clause License
+//
+// Copyright 2024 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_MMAP_H
+#define TDOANN_MMAP_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "distancebase.h"
+#include "distancesimd.h"
+
+namespace tdoann {
+
+// Read-only memory map of a file of T values, e.g. a row-major float32 matrix
+// written out with numpy's tofile or R's writeBin. Pages are read from disk as
+// they are accessed, and the operating system can drop them again under memory
+// pressure, so the data doesn't need to fit in RAM. Only available on
+// POSIX systems: on other platforms the constructor throws.
+template <typename T> class MappedFile {
+public:
+  enum class Advice { Normal, Random, Sequential, WillNeed };
+
+  explicit MappedFile(const std::string &path) {
+#if defined(_WIN32)
+    throw std::runtime_error("Can't map file '" + path +
+                             "': memory-mapped files are not supported on "
+                             "Windows");
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+      throw std::runtime_error("Can't open file '" + path + "'");
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) == -1) {
+      ::close(fd);
+      throw std::runtime_error("Can't get size of file '" + path + "'");
+    }
+    n_bytes = static_cast<std::size_t>(st.st_size);
+    if (n_bytes % sizeof(T) != 0) {
+      ::close(fd);
+      throw std::runtime_error("Size of file '" + path +
+                               "' is not a multiple of the data type size");
+    }
+    if (n_bytes > 0) {
+      void *addr = ::mmap(nullptr, n_bytes, PROT_READ, MAP_SHARED, fd, 0);
+      if (addr == MAP_FAILED) {
+        ::close(fd);
+        throw std::runtime_error("Can't map file '" + path + "'");
+      }
+      ptr = static_cast<const T *>(addr);
+    }
+    // the mapping keeps its own reference to the file
+    ::close(fd);
+#endif
+  }
+
+  ~MappedFile() { unmap(); }
+
+  MappedFile(const MappedFile &) = delete;
+  auto operator=(const MappedFile &) -> MappedFile & = delete;
+
+  MappedFile(MappedFile &&other) noexcept
+      : ptr(std::exchange(other.ptr, nullptr)),
+        n_bytes(std::exchange(other.n_bytes, 0)) {}
+
+  auto operator=(MappedFile &&other) noexcept -> MappedFile & {
+    if (this != &other) {
+      unmap();
+      ptr = std::exchange(other.ptr, nullptr);
+      n_bytes = std::exchange(other.n_bytes, 0);
+    }
+    return *this;
+  }
+
+  auto data() const -> const T * { return ptr; }
+  // number of T values in the file
+  auto size() const -> std::size_t { return n_bytes / sizeof(T); }
+
+  // Tell the OS how the data will be accessed. During nearest neighbor descent
+  // the access pattern is random, and the default read-ahead mostly fetches
+  // pages which are never used.
+  void advise(Advice advice) const {
+#if defined(_WIN32)
+    (void)advice;
+#else
+    if (ptr == nullptr) {
+      return;
+    }
+    int flag = MADV_NORMAL;
+    switch (advice) {
+    case Advice::Random:
+      flag = MADV_RANDOM;
+      break;
+    case Advice::Sequential:
+      flag = MADV_SEQUENTIAL;
+      break;
+    case Advice::WillNeed:
+      flag = MADV_WILLNEED;
+      break;
+    default:
+      break;
+    }
+    // this is only a hint, so failure isn't an error
+    ::madvise(const_cast<T *>(ptr), n_bytes, flag);
+#endif
+  }
+
+private:
+  const T *ptr{nullptr};
+  std::size_t n_bytes{0};
+
+  void unmap() {
+#if !defined(_WIN32)
+    if (ptr != nullptr) {
+      ::munmap(const_cast<T *>(ptr), n_bytes);
+    }
+#endif
+    ptr = nullptr;
+    n_bytes = 0;
+  }
+};
+
+// A temporary file for data which doesn't fit in memory, read and written at
+// explicit offsets. The file is created in directory dir and removed from it
+// straight away, so it disappears when it is closed, even if the process
+// doesn't exit normally. Only available on POSIX systems: on other platforms
+// the constructor throws.
+class ScratchFile {
+public:
+  explicit ScratchFile(const std::string &dir) {
+#if defined(_WIN32)
+    throw std::runtime_error("Can't create a scratch file in '" + dir +
+                             "': scratch files are not supported on Windows");
+#else
+    std::string path = dir + "/rnndescent-XXXXXX";
+    fd = ::mkstemp(&path[0]);
+    if (fd == -1) {
+      throw std::runtime_error("Can't create a scratch file in '" + dir + "'");
+    }
+    ::unlink(path.c_str());
+#endif
+  }
+
+  ~ScratchFile() { close(); }
+
+  ScratchFile(const ScratchFile &) = delete;
+  auto operator=(const ScratchFile &) -> ScratchFile & = delete;
+
+  ScratchFile(ScratchFile &&other) noexcept
+      : fd(std::exchange(other.fd, -1)) {}
+
+  auto operator=(ScratchFile &&other) noexcept -> ScratchFile & {
+    if (this != &other) {
+      close();
+      fd = std::exchange(other.fd, -1);
+    }
+    return *this;
+  }
+
+  void read(std::size_t offset, void *data, std::size_t n_bytes) const {
+#if !defined(_WIN32)
+    auto *ptr = static_cast<char *>(data);
+    while (n_bytes > 0) {
+      const ssize_t n = ::pread(fd, ptr, n_bytes, static_cast<off_t>(offset));
+      if (n <= 0) {
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error("Can't read from scratch file");
+      }
+      ptr += n;
+      offset += static_cast<std::size_t>(n);
+      n_bytes -= static_cast<std::size_t>(n);
+    }
+#endif
+  }
+
+  void write(std::size_t offset, const void *data, std::size_t n_bytes) {
+#if !defined(_WIN32)
+    const auto *ptr = static_cast<const char *>(data);
+    while (n_bytes > 0) {
+      const ssize_t n = ::pwrite(fd, ptr, n_bytes, static_cast<off_t>(offset));
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error("Can't write to scratch file (is the disk "
+                                 "full?)");
+      }
+      ptr += n;
+      offset += static_cast<std::size_t>(n);
+      n_bytes -= static_cast<std::size_t>(n);
+    }
+#endif
+  }
+
+  // discard the contents, giving the disk space back
+  void clear() {
+#if !defined(_WIN32)
+    if (::ftruncate(fd, 0) != 0) {
+      throw std::runtime_error("Can't truncate scratch file");
+    }
+#endif
+  }
+
+private:
+  int fd{-1};
+
+  void close() {
+#if !defined(_WIN32)
+    if (fd != -1) {
+      ::close(fd);
+    }
+#endif
+    fd = -1;
+  }
+};
+
+// Self-distance calculator over a memory-mapped file of row-major data with
+// ndim features per item. Unlike SelfDistanceCalculator, the data isn't copied
+// into memory, which means it also can't be preprocessed: metrics such as
+// "dot" which need normalized data aren't supported unless the data in the
+// file has already been normalized.
+template <typename In, typename Out, typename Idx = uint32_t>
+class MappedSelfDistanceCalculator : public BaseDistance<Out, Idx> {
+public:
+  using DistanceFunc = PtrDistanceFunc<In, Out>;
+
+  MappedSelfDistanceCalculator(MappedFile<In> &&file, std::size_t ndim,
+                               DistanceFunc distance_func)
+      : file(std::move(file)),
+        distance(DataView<In>::row_major(this->file.data(),
+                                         this->file.size() / ndim, ndim),
+                 distance_func) {
+    this->file.advise(MappedFile<In>::Advice::Random);
+  }
+
+  std::size_t get_nx() const override { return distance.get_nx(); }
+  std::size_t get_ny() const override { return distance.get_ny(); }
+
+  Out calculate(const Idx &i, const Idx &j) const override {
+    return distance.calculate(i, j);
+  }
+
+  void calculate_block(const Idx *rows, std::size_t n_rows, const Idx *cols,
+                       std::size_t n_cols, Out *out) const override {
+    distance.calculate_block(rows, n_rows, cols, n_cols, out);
+  }
+
+  bool prefers_block() const override { return distance.prefers_block(); }
+
+  void prefetch(const Idx &i) const override { distance.prefetch(i); }
+
+private:
+  // declared first: it must outlive the view in distance
+  MappedFile<In> file;
+  ViewDistanceCalculator<In, In, Out, Idx> distance;
+};
+
+} // namespace tdoann
+
+#endif // TDOANN_MMAP_H
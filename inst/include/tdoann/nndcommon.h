@@ -27,11 +27,15 @@
 #ifndef TDOANN_NNDPROGRESS_H
 #define TDOANN_NNDPROGRESS_H
 
+#include <algorithm>
+#include <cstdint>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "heap.h"
+#include "parallel.h"
 #include "progressbase.h"
 
 namespace tdoann {
@@ -173,21 +177,95 @@ auto nnd_should_stop(NNDProgressBase &progress, const NbrHeap &current_graph,
 
 // A cache of previously seen edges (potential neighbors) used in caching
 // variants of the local join process
+// Stores the pairs (p, q) with p <= q that have already been considered, in a
+// separate open addressing hash table (with linear probing) for each p. The
+// tables start with space for twice the number of pairs from the initial
+// graph and double in size when they become half full. Compared to a hash set
+// for each row, there is one allocation per row rather than per pair, and
+// looking up a pair usually reads a single cache line.
 template <typename Idx> struct EdgeCache {
 private:
-  std::vector<std::unordered_set<Idx>> seen;
+  static constexpr Idx empty = static_cast<Idx>(-1);
+  static constexpr std::size_t min_capacity = 8;
+
+  std::vector<std::vector<Idx>> tables;
+  std::vector<Idx> sizes;
+
+  static auto slot_for(Idx idx, std::size_t capacity) -> std::size_t {
+    // Fibonacci hashing: consecutive indices are spread across the table
+    return static_cast<std::size_t>(static_cast<uint64_t>(idx) *
+                                    11400714819323198485ULL >> 32) &
+           (capacity - 1);
+  }
+
+  static auto capacity_for(std::size_t n) -> std::size_t {
+    std::size_t capacity = min_capacity;
+    while (capacity < 2 * n) {
+      capacity *= 2;
+    }
+    return capacity;
+  }
+
+  // insert idx into table, which must not be full: returns true if idx was
+  // already in table
+  static auto insert_into(std::vector<Idx> &table, Idx idx) -> bool {
+    const std::size_t mask = table.size() - 1;
+    for (std::size_t slot = slot_for(idx, table.size());;
+         slot = (slot + 1) & mask) {
+      if (table[slot] == idx) {
+        return true;
+      }
+      if (table[slot] == empty) {
+        table[slot] = idx;
+        return false;
+      }
+    }
+  }
+
+  void grow(Idx idx_p) {
+    auto &table = tables[idx_p];
+    std::vector<Idx> larger(std::max(min_capacity, 2 * table.size()), empty);
+    for (const auto &idx : table) {
+      if (idx != empty) {
+        insert_into(larger, idx);
+      }
+    }
+    table = std::move(larger);
+  }
 
 public:
+  // an empty cache: the table for each p is only allocated when a pair is
+  // inserted into it
+  explicit EdgeCache(std::size_t n_points)
+      : tables(n_points), sizes(n_points, 0) {}
+
   EdgeCache(std::size_t n_points, std::size_t n_nbrs,
             const std::vector<Idx> &idx_data)
-      : seen(n_points) {
+      : tables(n_points), sizes(n_points, 0) {
+    constexpr auto npos = static_cast<Idx>(-1);
+    std::vector<std::size_t> counts(n_points, 0);
+    for (std::size_t i = 0, idx_ij = 0; i < n_points; i++) {
+      for (std::size_t j = 0; j < n_nbrs; j++, idx_ij++) {
+        const auto idx_p = idx_data[idx_ij];
+        if (idx_p != npos) {
+          counts[std::min(static_cast<std::size_t>(idx_p), i)]++;
+        }
+      }
+    }
+    for (std::size_t i = 0; i < n_points; i++) {
+      tables[i].assign(capacity_for(counts[i]), empty);
+    }
+
     for (Idx i = 0, innbrs = 0; i < n_points; i++, innbrs += n_nbrs) {
       for (std::size_t j = 0, idx_ij = innbrs; j < n_nbrs; j++, idx_ij++) {
         auto idx_p = idx_data[idx_ij];
+        if (idx_p == npos) {
+          continue;
+        }
         if (i > idx_p) {
-          seen[idx_p].emplace(i);
+          insert(idx_p, i);
         } else {
-          seen[i].emplace(idx_p);
+          insert(i, idx_p);
         }
       }
     }
@@ -200,11 +278,76 @@ public:
   }
 
   auto contains(const Idx &idx_p, const Idx &idx_q) const -> bool {
-    return seen[idx_p].find(idx_q) != seen[idx_p].end();
+    const auto &table = tables[idx_p];
+    if (table.empty()) {
+      return false;
+    }
+    const std::size_t mask = table.size() - 1;
+    for (std::size_t slot = slot_for(idx_q, table.size());;
+         slot = (slot + 1) & mask) {
+      if (table[slot] == idx_q) {
+        return true;
+      }
+      if (table[slot] == empty) {
+        return false;
+      }
+    }
   }
 
+  // returns true if (idx_p, idx_q) was already in the cache
   auto insert(Idx idx_p, Idx idx_q) -> bool {
-    return !seen[idx_p].emplace(idx_q).second;
+    if (2 * (static_cast<std::size_t>(sizes[idx_p]) + 1) >
+        tables[idx_p].size()) {
+      grow(idx_p);
+    }
+    const bool found = insert_into(tables[idx_p], idx_q);
+    if (!found) {
+      ++sizes[idx_p];
+    }
+    return found;
+  }
+
+  auto size(Idx idx_p) const -> std::size_t { return sizes[idx_p]; }
+
+  // remove all the pairs for idx_p, keeping the space allocated for them
+  void clear(Idx idx_p) {
+    std::fill(tables[idx_p].begin(), tables[idx_p].end(), empty);
+    sizes[idx_p] = 0;
+  }
+
+  // approximate number of bytes used
+  auto memory_size() const -> std::size_t {
+    std::size_t bytes = tables.size() * sizeof(std::vector<Idx>) +
+                        sizes.size() * sizeof(Idx);
+    for (const auto &table : tables) {
+      bytes += table.capacity() * sizeof(Idx);
+    }
+    return bytes;
+  }
+};
+
+// The candidate neighbor lists used by each iteration of nearest neighbor
+// descent. These are allocated once and emptied at the start of each
+// iteration, rather than being allocated and freed every iteration.
+template <typename Out, typename Idx> struct NNDWorkspace {
+  NNHeap<Out, Idx> new_nbrs;
+  NNHeap<Out, Idx> old_nbrs;
+
+  NNDWorkspace(std::size_t n_points, std::size_t max_candidates)
+      : new_nbrs(n_points, max_candidates), old_nbrs(n_points, max_candidates) {
+  }
+
+  void reset() {
+    new_nbrs.reset();
+    old_nbrs.reset();
+  }
+
+  void reset(std::size_t n_threads, const Executor &executor) {
+    auto worker = [&](std::size_t begin, std::size_t end) {
+      new_nbrs.reset(begin, end);
+      old_nbrs.reset(begin, end);
+    };
+    dispatch_work(worker, new_nbrs.n_points, n_threads, executor);
   }
 };
 
@@ -231,6 +374,133 @@ void flag_retained_new_candidates(NNDHeap<Out, Idx> &current_graph,
   }
 }
 
+// Local join update: instead of updating item i with the neighbors of the
+// candidates of i, explore pairs (p, q) of candidates and treat q as a
+// candidate for p, and vice versa. This calls pair_func(p, q) for each
+// (new, new) and (new, old) pair of candidates of item i. Templating on the
+// pair function rather than using a virtual call allows the distance
+// calculation and heap update to be inlined into the loop.
+template <typename Out, typename Idx, typename PairFunc>
+void local_join_pairs(const NNHeap<Out, Idx> &new_nbrs,
+                      const NNHeap<Out, Idx> &old_nbrs, std::size_t i,
+                      PairFunc &&pair_func) {
+  constexpr auto npos = static_cast<Idx>(-1);
+  const std::size_t max_new_candidates = new_nbrs.n_nbrs;
+  const std::size_t max_old_candidates = old_nbrs.n_nbrs;
+  const std::size_t new_begin = i * max_new_candidates;
+  const std::size_t old_begin = i * max_old_candidates;
+
+  for (std::size_t j = 0; j < max_new_candidates; j++) {
+    const auto new_j = new_nbrs.idx[new_begin + j];
+    if (new_j == npos) {
+      continue;
+    }
+
+    // (new, new) pairs: loop from j->max_new_candidates
+    for (auto k = j; k < max_new_candidates; k++) {
+      const auto new_k = new_nbrs.idx[new_begin + k];
+      if (new_k == npos) {
+        continue;
+      }
+      pair_func(new_j, new_k);
+    }
+
+    // (new, old) pairs: loop from 0->max_old_candidates
+    for (std::size_t k = 0; k < max_old_candidates; k++) {
+      const auto old_k = old_nbrs.idx[old_begin + k];
+      if (old_k == npos) {
+        continue;
+      }
+      pair_func(new_j, old_k);
+    }
+  }
+}
+
+// Reusable storage for local_join_block
+template <typename Out, typename Idx> struct LocalJoinBlock {
+  std::vector<Idx> new_idx;
+  std::vector<Idx> old_idx;
+  std::vector<Out> dist;
+};
+
+// Block version of local_join_pairs: calls pair_func(p, q, d_pq) for the same
+// pairs, but the distances are calculated with calculate_block, which for
+// some metrics is faster than calculating them one at a time. The
+// (new, new) pairs are done in strips of a few rows, skipping the columns to
+// the left of the strip, and the (new, old) pairs as one block. A strip also
+// covers the few pairs below its diagonal, which a block kernel calculates
+// for free alongside the others: if the distance has no block kernel, the
+// (new, new) pairs are calculated one at a time instead, so that no extra
+// distances are calculated.
+template <typename Out, typename Idx, typename Distance, typename PairFunc>
+void local_join_block(const Distance &distance,
+                      const NNHeap<Out, Idx> &new_nbrs,
+                      const NNHeap<Out, Idx> &old_nbrs, std::size_t i,
+                      LocalJoinBlock<Out, Idx> &block, PairFunc &&pair_func) {
+  constexpr auto npos = static_cast<Idx>(-1);
+  constexpr std::size_t strip_rows = 4;
+
+  auto &new_idx = block.new_idx;
+  new_idx.clear();
+  for (std::size_t j = 0, ij = i * new_nbrs.n_nbrs; j < new_nbrs.n_nbrs;
+       j++, ij++) {
+    if (new_nbrs.idx[ij] != npos) {
+      new_idx.push_back(new_nbrs.idx[ij]);
+    }
+  }
+  const std::size_t n_new = new_idx.size();
+  if (n_new == 0) {
+    return;
+  }
+
+  auto &old_idx = block.old_idx;
+  old_idx.clear();
+  for (std::size_t j = 0, ij = i * old_nbrs.n_nbrs; j < old_nbrs.n_nbrs;
+       j++, ij++) {
+    if (old_nbrs.idx[ij] != npos) {
+      old_idx.push_back(old_nbrs.idx[ij]);
+    }
+  }
+  const std::size_t n_old = old_idx.size();
+
+  auto &dist = block.dist;
+  dist.resize(n_new * std::max(n_new, n_old));
+
+  // (new, new) pairs
+  if (distance.prefers_block()) {
+    for (std::size_t j = 0; j < n_new; j += strip_rows) {
+      const std::size_t n_rows = std::min(strip_rows, n_new - j);
+      const std::size_t n_cols = n_new - j;
+      distance.calculate_block(&new_idx[j], n_rows, &new_idx[j], n_cols,
+                               dist.data());
+      for (std::size_t r = 0; r < n_rows; r++) {
+        for (std::size_t c = r; c < n_cols; c++) {
+          pair_func(new_idx[j + r], new_idx[j + c], dist[r * n_cols + c]);
+        }
+      }
+    }
+  } else {
+    for (std::size_t j = 0; j < n_new; j++) {
+      for (std::size_t k = j; k < n_new; k++) {
+        pair_func(new_idx[j], new_idx[k],
+                  distance.calculate(new_idx[j], new_idx[k]));
+      }
+    }
+  }
+
+  // (new, old) pairs
+  if (n_old == 0) {
+    return;
+  }
+  distance.calculate_block(new_idx.data(), n_new, old_idx.data(), n_old,
+                           dist.data());
+  for (std::size_t r = 0, rc = 0; r < n_new; r++) {
+    for (std::size_t c = 0; c < n_old; c++, rc++) {
+      pair_func(new_idx[r], old_idx[c], dist[rc]);
+    }
+  }
+}
+
 template <typename NbrHeap>
 std::vector<std::size_t> count_reverse_neighbors(const NbrHeap &current_graph) {
   constexpr auto npos = static_cast<typename NbrHeap::Index>(-1);
@@ -247,6 +517,30 @@ std::vector<std::size_t> count_reverse_neighbors(const NbrHeap &current_graph) {
   }
   return counts;
 }
+
+// The local join for item i only does any work if i has new candidates, which
+// happens when i has a neighbor flagged as new, or i is a neighbor flagged as
+// new of another item. Only these items need old candidates: for the others
+// the heap pushes can be skipped. Late in a build, or when only a few items
+// have been added to an existing graph, this is a small fraction of the items.
+template <typename Out, typename Idx>
+auto find_items_with_new_candidates(const NNDHeap<Out, Idx> &current_graph)
+    -> std::vector<uint8_t> {
+  constexpr auto npos = static_cast<Idx>(-1);
+  std::vector<uint8_t> has_new(current_graph.n_points, 0);
+  const std::size_t n_nbrs = current_graph.n_nbrs;
+
+  for (std::size_t i = 0, ij = 0; i < current_graph.n_points; ++i) {
+    for (std::size_t j = 0; j < n_nbrs; ++j, ++ij) {
+      const auto idx = current_graph.idx[ij];
+      if (idx != npos && current_graph.flags[ij] == 1) {
+        has_new[i] = 1;
+        has_new[idx] = 1;
+      }
+    }
+  }
+  return has_new;
+}
 } // namespace tdoann
 
 #endif // TDOANN_NNDPROGRESS_H
@@ -37,89 +37,75 @@
 namespace tdoann {
 
 template <typename Out, typename Idx> class SerialLocalJoin {
-  static constexpr auto npos = static_cast<Idx>(-1);
-
 public:
   virtual ~SerialLocalJoin() = default;
 
-  virtual auto update(NNDHeap<Out, Idx> &current_graph, Idx idx_p, Idx idx_q)
-      -> std::size_t = 0;
+  virtual auto execute(NNDHeap<Out, Idx> &current_graph,
+                       const NNHeap<Out, Idx> &new_nbrs,
+                       decltype(new_nbrs) &old_nbrs, NNDProgressBase &progress)
+      -> unsigned long = 0;
+};
 
-  // Local join update: instead of updating item i with the neighbors of the
-  // candidates of i, explore pairs (p, q) of candidates and treat q as a
-  // candidate for p, and vice versa.
-  auto execute(NNDHeap<Out, Idx> &current_graph,
-               const NNHeap<Out, Idx> &new_nbrs, decltype(new_nbrs) &old_nbrs,
-               NNDProgressBase &progress) -> unsigned long {
-    const auto n_points = new_nbrs.n_points;
-    const auto max_new_candidates = new_nbrs.n_nbrs;
-    const auto max_old_candidates = old_nbrs.n_nbrs;
-    progress.set_n_batches(n_points);
-    unsigned long num_updates = 0UL;
-    for (Idx i = 0; i < n_points; i++) {
-      for (Idx j = 0; j < max_new_candidates; j++) {
-        // (new, new) pairs from j -> max_new_candidates
-        auto new_j = new_nbrs.index(i, j);
-        if (new_j == npos) {
-          continue;
-        }
-        for (auto k = j; k < max_new_candidates; k++) {
-          auto new_k = new_nbrs.index(i, k);
-          if (new_k == npos) {
-            continue;
-          }
-          num_updates += this->update(current_graph, new_j, new_k);
-        }
-
-        // (new, old) pairs from 0 -> max_old_candidates
-        for (Idx k = 0; k < max_old_candidates; k++) {
-          auto old_k = old_nbrs.index(i, k);
-          if (old_k == npos) {
-            continue;
-          }
-          num_updates += this->update(current_graph, new_j, old_k);
-        }
-      }
-      if (progress.check_interrupt()) {
-        break;
-      }
-      progress.batch_finished();
+// Carry out the local join for all items, using join_item(i) to process the
+// candidate pairs of item i and return the number of heap updates
+template <typename JoinItemFunc>
+auto serial_local_join(std::size_t n_points, NNDProgressBase &progress,
+                       JoinItemFunc &&join_item) -> unsigned long {
+  progress.set_n_batches(n_points);
+  unsigned long num_updates = 0UL;
+  for (std::size_t i = 0; i < n_points; i++) {
+    num_updates += join_item(i);
+    if (progress.check_interrupt()) {
+      break;
     }
-    return num_updates;
+    progress.batch_finished();
   }
-};
+  return num_updates;
+}
 
-template <typename Out, typename Idx>
-class LowMemSerialLocalJoin : public SerialLocalJoin<Out, Idx> {
+// The Distance template parameter can be a concrete (final) distance class, in
+// which case the distance calculation in the local join is not a virtual call
+template <typename Out, typename Idx,
+          typename Distance = BaseDistance<Out, Idx>>
+class LowMemSerialLocalJoin final : public SerialLocalJoin<Out, Idx> {
 
 public:
-  const BaseDistance<Out, Idx> &distance;
+  const Distance &distance;
+  LocalJoinBlock<Out, Idx> block;
 
-  LowMemSerialLocalJoin(const BaseDistance<Out, Idx> &dist) : distance(dist) {}
+  LowMemSerialLocalJoin(const Distance &dist) : distance(dist) {}
 
-  std::size_t update(NNDHeap<Out, Idx> &current_graph, Idx idx_p,
-                     Idx idx_q) override {
-    const auto dist_pq = distance.calculate(idx_p, idx_q);
-    if (current_graph.accepts_either(idx_p, idx_q, dist_pq)) {
-      return current_graph.checked_push_pair(idx_p, dist_pq, idx_q);
-    }
-    return 0; // No updates were made.
+  auto execute(NNDHeap<Out, Idx> &current_graph,
+               const NNHeap<Out, Idx> &new_nbrs, decltype(new_nbrs) &old_nbrs,
+               NNDProgressBase &progress) -> unsigned long override {
+    return serial_local_join(new_nbrs.n_points, progress, [&](std::size_t i) {
+      unsigned long num_updates = 0UL;
+      local_join_block(distance, new_nbrs, old_nbrs, i, block,
+                       [&](Idx idx_p, Idx idx_q, Out dist_pq) {
+                         if (current_graph.accepts_either(idx_p, idx_q,
+                                                          dist_pq)) {
+                           num_updates += current_graph.checked_push_pair(
+                               idx_p, dist_pq, idx_q);
+                         }
+                       });
+      return num_updates;
+    });
   }
 };
 
-template <typename Out, typename Idx>
-class CacheSerialLocalJoin : public SerialLocalJoin<Out, Idx> {
+template <typename Out, typename Idx,
+          typename Distance = BaseDistance<Out, Idx>>
+class CacheSerialLocalJoin final : public SerialLocalJoin<Out, Idx> {
 
 public:
-  const BaseDistance<Out, Idx> &distance;
+  const Distance &distance;
   EdgeCache<Idx> cache;
 
-  CacheSerialLocalJoin(const NNDHeap<Out, Idx> &graph,
-                       const BaseDistance<Out, Idx> &dist)
+  CacheSerialLocalJoin(const NNDHeap<Out, Idx> &graph, const Distance &dist)
       : distance(dist), cache(EdgeCache<Idx>::from_graph(graph)) {}
 
-  std::size_t update(NNDHeap<Out, Idx> &current_graph, Idx idx_p,
-                     Idx idx_q) override {
+  auto update(NNDHeap<Out, Idx> &current_graph, Idx idx_p, Idx idx_q)
+      -> std::size_t {
     Idx upd_p, upd_q;
     std::tie(upd_p, upd_q) = std::minmax(idx_p, idx_q);
 
@@ -146,6 +132,18 @@ public:
 
     return updates;
   }
+
+  auto execute(NNDHeap<Out, Idx> &current_graph,
+               const NNHeap<Out, Idx> &new_nbrs, decltype(new_nbrs) &old_nbrs,
+               NNDProgressBase &progress) -> unsigned long override {
+    return serial_local_join(new_nbrs.n_points, progress, [&](std::size_t i) {
+      unsigned long num_updates = 0UL;
+      local_join_pairs(new_nbrs, old_nbrs, i, [&](Idx idx_p, Idx idx_q) {
+        num_updates += this->update(current_graph, idx_p, idx_q);
+      });
+      return num_updates;
+    });
+  }
 };
 
 // This corresponds to the construction of new, old, new' and old' in
@@ -159,6 +157,8 @@ public:
 // of the KNN are assigned into old and new based on their flag value, with the
 // size of the final candidate list controlled by the maximum size of
 // the candidates neighbors lists.
+// 3. Old candidates are only found for items which have new candidates: the
+// old candidates of any other item would never be used.
 template <typename Out, typename Idx>
 void build_candidates(const NNDHeap<Out, Idx> &current_graph,
                       NNHeap<Out, Idx> &new_nbrs, decltype(new_nbrs) &old_nbrs,
@@ -169,6 +169,7 @@ void build_candidates(const NNDHeap<Out, Idx> &current_graph,
 
   auto k_occurrences = weight_by_degree ? count_reverse_neighbors(current_graph)
                                         : std::vector<std::size_t>();
+  const auto has_new = find_items_with_new_candidates(current_graph);
 
   for (std::size_t i = 0, idx_offset = 0; i < n_points;
        i++, idx_offset += n_nbrs) {
@@ -177,15 +178,18 @@ void build_candidates(const NNDHeap<Out, Idx> &current_graph,
       if (nbr == npos) {
         continue;
       }
-      auto &nbrs = current_graph.flags[idx_ij] == 1 ? new_nbrs : old_nbrs;
+      const bool is_new = current_graph.flags[idx_ij] == 1;
+      auto &nbrs = is_new ? new_nbrs : old_nbrs;
       auto rand_weight = rand.unif(); // pairs will be processed in random order
-      if (weight_by_degree) {
-        nbrs.checked_push(i, rand_weight * k_occurrences[nbr], nbr);
-        if (i != nbr) {
-          nbrs.checked_push(nbr, rand_weight * k_occurrences[i], i);
-        }
-      } else {
-        nbrs.checked_push_pair(i, rand_weight, nbr);
+      const Out weight_i =
+          weight_by_degree ? rand_weight * k_occurrences[i] : rand_weight;
+      const Out weight_nbr =
+          weight_by_degree ? rand_weight * k_occurrences[nbr] : rand_weight;
+      if (has_new[i]) {
+        nbrs.checked_push(i, weight_nbr, nbr);
+      }
+      if (i != nbr && has_new[nbr]) {
+        nbrs.checked_push(nbr, weight_i, i);
       }
     }
   }
@@ -206,10 +210,13 @@ void nnd_build(NNDHeap<Out, Idx> &current_graph,
                std::size_t max_candidates, uint32_t n_iters, double delta,
                bool weight_by_degree, RandomGenerator &rand,
                NNDProgressBase &progress) {
-  const std::size_t n_points = current_graph.n_points;
+  NNDWorkspace<Out, Idx> workspace(current_graph.n_points, max_candidates);
+  auto &new_nbrs = workspace.new_nbrs;
+  auto &old_nbrs = workspace.old_nbrs;
   for (auto iter = 0U; iter < n_iters; iter++) {
-    NNHeap<Out, Idx> new_nbrs(n_points, max_candidates);
-    decltype(new_nbrs) old_nbrs(n_points, max_candidates);
+    if (iter > 0) {
+      workspace.reset();
+    }
 
     build_candidates(current_graph, new_nbrs, old_nbrs, weight_by_degree, rand);
 
@@ -0,0 +1,595 @@
+// BSD 2-Clause License
+//
+// Copyright 2024 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_NNDPAGED_H
+#define TDOANN_NNDPAGED_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "distancebase.h"
+#include "heap.h"
+#include "mmap.h"
+#include "nndcommon.h"
+#include "parallel.h"
+#include "progressbase.h"
+#include "random.h"
+
+namespace tdoann {
+
+// Nearest neighbor descent for graphs too large to keep in memory. The current
+// graph is a PagedHeap: blocks of consecutive rows in a scratch file, only one
+// of which is read into memory at a time. Each block is split into a fixed
+// number of pages. Candidates and neighbor updates for a row are never pushed
+// straight onto the heap, but appended to a bucket for the row's page
+// (SpillBuckets) and pushed when that page's block is next in memory, each page
+// by one thread. An iteration reads the blocks in order three times
+// (generating candidates, the local join, applying the updates) and writes
+// them twice, so the graph on disk is only accessed sequentially. What stays
+// in memory is one block of the graph and its candidates, the bucket buffers,
+// and the distance bound of each row (plus its in-degree if candidates are
+// weighted by degree). The data itself is accessed through the distance
+// calculator, e.g. a MappedSelfDistanceCalculator.
+//
+// The updates found in an iteration are only applied at the end of it, so the
+// local join filters them with the bounds from the start of the iteration:
+// more updates are generated than by the in-memory local joins, but the
+// result doesn't depend on the number of threads.
+
+// A neighbor (or candidate) nbr of row, with its distance (or candidate
+// weight) value
+template <typename Out, typename Idx> struct PagedEdge {
+  Idx row;
+  Idx nbr;
+  Out value;
+};
+
+// Records appended to numbered buckets. Each bucket keeps the records in a
+// buffer of up to buffer_size records, which is appended to a scratch file
+// when it is full. Buckets can be added to from one thread at a time, but
+// different buckets can be taken by different threads at once.
+template <typename Record> class SpillBuckets {
+public:
+  SpillBuckets(const std::string &dir, std::size_t n_buckets,
+               std::size_t buffer_size)
+      : file(dir), buffer_size(std::max(buffer_size, std::size_t{1})),
+        buffers(n_buckets), chunks(n_buckets) {}
+
+  void add(std::size_t bucket, const Record &record) {
+    auto &buffer = buffers[bucket];
+    buffer.push_back(record);
+    if (buffer.size() == buffer_size) {
+      chunks[bucket].push_back({file_size, buffer.size()});
+      file.write(file_size, buffer.data(), buffer.size() * sizeof(Record));
+      file_size += buffer.size() * sizeof(Record);
+      buffer.clear();
+    }
+  }
+
+  // replace records with the contents of bucket, in the order they were added,
+  // and empty the bucket
+  void take(std::size_t bucket, std::vector<Record> &records) {
+    std::size_t n_records = buffers[bucket].size();
+    for (const auto &chunk : chunks[bucket]) {
+      n_records += chunk.n_records;
+    }
+    records.resize(n_records);
+    auto *out = records.data();
+    for (const auto &chunk : chunks[bucket]) {
+      file.read(chunk.offset, out, chunk.n_records * sizeof(Record));
+      out += chunk.n_records;
+    }
+    std::copy(buffers[bucket].begin(), buffers[bucket].end(), out);
+    buffers[bucket].clear();
+    chunks[bucket].clear();
+  }
+
+  // give back the disk space of the buckets taken so far: don't call this
+  // while a bucket still holds records which have been spilled
+  void clear() {
+    file.clear();
+    file_size = 0;
+  }
+
+private:
+  struct Chunk {
+    std::size_t offset;
+    std::size_t n_records;
+  };
+
+  ScratchFile file;
+  std::size_t file_size{0};
+  std::size_t buffer_size;
+  std::vector<std::vector<Record>> buffers;
+  std::vector<std::vector<Chunk>> chunks;
+};
+
+// The rows of a neighbor heap, stored in a scratch file in directory dir in
+// blocks of block_size rows (the last block may be smaller). A block is read
+// into an NNDHeap with one row per row of the block, so row i of the graph is
+// row i - begin(block) of the block's heap. Blocks are divided into
+// pages_per_block pages of rows, which are the unit of work within a block.
+template <typename Out, typename Idx> class PagedHeap {
+public:
+  using DistanceOut = Out;
+  using Index = Idx;
+
+  static constexpr std::size_t pages_per_block = 16;
+
+  std::size_t n_points;
+  std::size_t n_nbrs;
+  std::size_t block_size;
+  std::size_t n_blocks;
+  std::size_t page_size;
+  std::size_t n_pages;
+
+  // all rows start empty
+  PagedHeap(const std::string &dir, std::size_t n_points, std::size_t n_nbrs,
+            std::size_t block_size)
+      : n_points(n_points), n_nbrs(n_nbrs),
+        block_size(std::max(std::min(block_size, n_points), std::size_t{1})),
+        n_blocks((n_points + this->block_size - 1) / this->block_size),
+        page_size((this->block_size + pages_per_block - 1) / pages_per_block),
+        n_pages(n_blocks * pages_per_block), file(dir) {
+    for (std::size_t block = 0; block < n_blocks; block++) {
+      store(block, NNDHeap<Out, Idx>(end(block) - begin(block), n_nbrs));
+    }
+  }
+
+  auto begin(std::size_t block) const -> std::size_t {
+    return block * block_size;
+  }
+
+  auto end(std::size_t block) const -> std::size_t {
+    return std::min(begin(block) + block_size, n_points);
+  }
+
+  auto block_of(Idx row) const -> std::size_t { return row / block_size; }
+
+  // pages are numbered across blocks
+  auto page_of(Idx row) const -> std::size_t {
+    const auto block = block_of(row);
+    return block * pages_per_block + (row - begin(block)) / page_size;
+  }
+
+  auto page_begin(std::size_t page) const -> std::size_t {
+    const std::size_t block = page / pages_per_block;
+    return std::min(begin(block) + (page % pages_per_block) * page_size,
+                    end(block));
+  }
+
+  auto page_end(std::size_t page) const -> std::size_t {
+    const std::size_t block = page / pages_per_block;
+    return std::min(page_begin(page) + page_size, end(block));
+  }
+
+  void load(std::size_t block, NNDHeap<Out, Idx> &heap) const {
+    const std::size_t n_rows = end(block) - begin(block);
+    if (heap.n_points != n_rows || heap.n_nbrs != n_nbrs) {
+      heap = NNDHeap<Out, Idx>(n_rows, n_nbrs);
+    }
+    const std::size_t n = n_rows * n_nbrs;
+    std::size_t offset = block_offset(block);
+    file.read(offset, heap.idx.data(), n * sizeof(Idx));
+    offset += n * sizeof(Idx);
+    file.read(offset, heap.dist.data(), n * sizeof(Out));
+    offset += n * sizeof(Out);
+    file.read(offset, heap.flags.data(), n * sizeof(uint8_t));
+  }
+
+  void store(std::size_t block, const NNDHeap<Out, Idx> &heap) {
+    const std::size_t n = (end(block) - begin(block)) * n_nbrs;
+    std::size_t offset = block_offset(block);
+    file.write(offset, heap.idx.data(), n * sizeof(Idx));
+    offset += n * sizeof(Idx);
+    file.write(offset, heap.dist.data(), n * sizeof(Out));
+    offset += n * sizeof(Out);
+    file.write(offset, heap.flags.data(), n * sizeof(uint8_t));
+  }
+
+private:
+  ScratchFile file;
+
+  auto block_offset(std::size_t block) const -> std::size_t {
+    return begin(block) * n_nbrs *
+           (sizeof(Idx) + sizeof(Out) + sizeof(uint8_t));
+  }
+};
+
+template <typename Out, typename Idx>
+auto heap_sum(const PagedHeap<Out, Idx> &graph) -> double {
+  NNDHeap<Out, Idx> heap(0, graph.n_nbrs);
+  double sum = 0.0;
+  for (std::size_t block = 0; block < graph.n_blocks; block++) {
+    graph.load(block, heap);
+    sum += heap_sum(heap);
+  }
+  return sum;
+}
+
+// Candidates are generated for fixed-size chunks of rows, each with its own
+// random number generator, so the random numbers used don't depend on the
+// number of threads
+constexpr std::size_t paged_chunk_size = 1024;
+
+// Fill the graph with random neighbors, as fill_random does for an in-memory
+// heap
+template <typename Out, typename Idx>
+void fill_random(PagedHeap<Out, Idx> &graph,
+                 const BaseDistance<Out, Idx> &distance,
+                 ParallelRandomIntProvider<Idx> &rng_provider,
+                 std::size_t n_threads, ProgressBase &progress,
+                 const Executor &executor) {
+  const auto n_ref_points = static_cast<Idx>(graph.n_points);
+  NNDHeap<Out, Idx> heap(0, graph.n_nbrs);
+  rng_provider.initialize();
+  for (std::size_t block = 0; block < graph.n_blocks; block++) {
+    const std::size_t begin = graph.begin(block);
+    graph.load(block, heap);
+    auto worker = [&](std::size_t chunk_begin, std::size_t chunk_end) {
+      for (auto chunk = chunk_begin; chunk < chunk_end; chunk++) {
+        const std::size_t row_begin = chunk * paged_chunk_size;
+        const std::size_t row_end =
+            std::min(row_begin + paged_chunk_size,
+                     static_cast<std::size_t>(heap.n_points));
+        auto rng_ptr = rng_provider.get_parallel_instance(begin + row_end);
+        for (auto row = row_begin; row < row_end; row++) {
+          const auto query = static_cast<Idx>(begin + row);
+          for (std::size_t j = 0; j < n_ref_points; j++) {
+            if (heap.is_full(row)) {
+              break;
+            }
+            const Idx ref = rng_ptr->rand_int(n_ref_points);
+            heap.checked_push(row, distance.calculate(ref, query), ref);
+          }
+        }
+      }
+    };
+    const std::size_t n_chunks =
+        (heap.n_points + paged_chunk_size - 1) / paged_chunk_size;
+    dispatch_work(worker, n_chunks, n_threads, executor);
+    graph.store(block, heap);
+    if (progress.check_interrupt()) {
+      return;
+    }
+  }
+}
+
+// Memory used between the passes over the graph in an iteration
+template <typename Out, typename Idx> struct PagedNNDWorkspace {
+  using Edge = PagedEdge<Out, Idx>;
+
+  // rows per batch of the local join: the updates found for a batch are held
+  // in memory until the batch is finished
+  static constexpr std::size_t join_batch_size = 1024;
+  static constexpr std::size_t spill_buffer_size = 8192;
+
+  SpillBuckets<Edge> new_candidates;
+  SpillBuckets<Edge> old_candidates;
+  SpillBuckets<Edge> updates;
+  // a row won't accept a neighbor at this distance or further
+  std::vector<Out> bounds;
+  NNDHeap<Out, Idx> block_graph;
+  NNHeap<Out, Idx> new_nbrs;
+  NNHeap<Out, Idx> old_nbrs;
+  std::vector<std::vector<Edge>> generated_new;
+  std::vector<std::vector<Edge>> generated_old;
+  std::vector<std::vector<Edge>> join_updates;
+
+  PagedNNDWorkspace(const std::string &dir, const PagedHeap<Out, Idx> &graph,
+                    std::size_t max_candidates)
+      : new_candidates(dir, graph.n_pages, spill_buffer_size),
+        old_candidates(dir, graph.n_pages, spill_buffer_size),
+        updates(dir, graph.n_pages, spill_buffer_size),
+        bounds(graph.n_points, (std::numeric_limits<Out>::infinity)()),
+        block_graph(0, graph.n_nbrs), new_nbrs(graph.block_size, max_candidates),
+        old_nbrs(graph.block_size, max_candidates),
+        join_updates(join_batch_size) {
+    for (std::size_t block = 0; block < graph.n_blocks; block++) {
+      graph.load(block, block_graph);
+      update_bounds(graph.begin(block));
+    }
+  }
+
+  // copy the bounds of the rows of block_graph, which starts at row begin
+  void update_bounds(std::size_t begin) {
+    for (std::size_t r = 0; r < block_graph.n_points; r++) {
+      bounds[begin + r] = block_graph.max_distance(r);
+    }
+  }
+};
+
+template <typename Out, typename Idx>
+std::vector<std::size_t>
+count_reverse_neighbors(const PagedHeap<Out, Idx> &graph) {
+  constexpr auto npos = static_cast<Idx>(-1);
+  std::vector<std::size_t> counts(graph.n_points, 0);
+  NNDHeap<Out, Idx> heap(0, graph.n_nbrs);
+  for (std::size_t block = 0; block < graph.n_blocks; block++) {
+    graph.load(block, heap);
+    for (const auto &nbr : heap.idx) {
+      if (nbr != npos) {
+        counts[nbr]++;
+      }
+    }
+  }
+  return counts;
+}
+
+// As build_candidates, but the candidates for each row are put in the bucket
+// of its page rather than pushed onto the candidate heaps: they are pushed
+// when the local join reaches the row's block
+template <typename Out, typename Idx>
+auto generate_candidates(PagedHeap<Out, Idx> &graph,
+                         PagedNNDWorkspace<Out, Idx> &workspace,
+                         bool weight_by_degree,
+                         ParallelRandomProvider &parallel_rand,
+                         std::size_t n_threads, NNDProgressBase &progress,
+                         const Executor &executor) -> bool {
+  constexpr auto npos = static_cast<Idx>(-1);
+  const std::size_t n_nbrs = graph.n_nbrs;
+  auto &heap = workspace.block_graph;
+  auto &generated_new = workspace.generated_new;
+  auto &generated_old = workspace.generated_old;
+
+  const auto k_occurrences =
+      weight_by_degree ? count_reverse_neighbors(graph)
+                       : std::vector<std::size_t>();
+  parallel_rand.initialize();
+  for (std::size_t block = 0; block < graph.n_blocks; block++) {
+    const std::size_t begin = graph.begin(block);
+    graph.load(block, heap);
+    const std::size_t n_chunks =
+        (heap.n_points + paged_chunk_size - 1) / paged_chunk_size;
+    generated_new.resize(n_chunks);
+    generated_old.resize(n_chunks);
+
+    auto worker = [&](std::size_t chunk_begin, std::size_t chunk_end) {
+      for (auto chunk = chunk_begin; chunk < chunk_end; chunk++) {
+        const std::size_t row_begin = chunk * paged_chunk_size;
+        const std::size_t row_end =
+            std::min(row_begin + paged_chunk_size,
+                     static_cast<std::size_t>(heap.n_points));
+        auto rand = parallel_rand.get_parallel_instance(begin + row_end);
+        for (auto row = row_begin; row < row_end; row++) {
+          const auto i = static_cast<Idx>(begin + row);
+          for (std::size_t j = 0, ij = row * n_nbrs; j < n_nbrs; j++, ij++) {
+            const auto nbr = heap.idx[ij];
+            if (nbr == npos) {
+              continue;
+            }
+            auto &generated =
+                heap.flags[ij] == 1 ? generated_new[chunk] : generated_old[chunk];
+            const Out rand_weight = rand->unif();
+            if (weight_by_degree) {
+              generated.push_back({i, nbr, rand_weight * k_occurrences[nbr]});
+              if (i != nbr) {
+                generated.push_back({nbr, i, rand_weight * k_occurrences[i]});
+              }
+            } else {
+              generated.push_back({i, nbr, rand_weight});
+              if (i != nbr) {
+                generated.push_back({nbr, i, rand_weight});
+              }
+            }
+          }
+        }
+      }
+    };
+    dispatch_work(worker, n_chunks, n_threads, executor);
+
+    for (std::size_t chunk = 0; chunk < n_chunks; chunk++) {
+      for (const auto &edge : generated_new[chunk]) {
+        workspace.new_candidates.add(graph.page_of(edge.row), edge);
+      }
+      generated_new[chunk].clear();
+      for (const auto &edge : generated_old[chunk]) {
+        workspace.old_candidates.add(graph.page_of(edge.row), edge);
+      }
+      generated_old[chunk].clear();
+    }
+    if (progress.check_interrupt()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Push the candidates of the rows of block onto the candidate heaps. Old
+// candidates are only needed for rows with a new candidate (see
+// find_items_with_new_candidates)
+template <typename Out, typename Idx>
+void push_candidates(const PagedHeap<Out, Idx> &graph, std::size_t block,
+                     PagedNNDWorkspace<Out, Idx> &workspace,
+                     std::size_t n_threads, const Executor &executor) {
+  const std::size_t begin = graph.begin(block);
+  const std::size_t first_page = block * graph.pages_per_block;
+  auto &new_nbrs = workspace.new_nbrs;
+  auto &old_nbrs = workspace.old_nbrs;
+  new_nbrs.reset(0, graph.end(block) - begin);
+  old_nbrs.reset(0, graph.end(block) - begin);
+
+  auto worker = [&](std::size_t page_begin, std::size_t page_end) {
+    std::vector<PagedEdge<Out, Idx>> edges;
+    std::vector<uint8_t> has_new;
+    for (auto page = first_page + page_begin; page < first_page + page_end;
+         page++) {
+      const std::size_t rows_begin = graph.page_begin(page);
+      has_new.assign(graph.page_end(page) - rows_begin, 0);
+      workspace.new_candidates.take(page, edges);
+      for (const auto &edge : edges) {
+        has_new[edge.row - rows_begin] = 1;
+        new_nbrs.checked_push(edge.row - begin, edge.value, edge.nbr);
+      }
+      workspace.old_candidates.take(page, edges);
+      for (const auto &edge : edges) {
+        if (has_new[edge.row - rows_begin] == 1) {
+          old_nbrs.checked_push(edge.row - begin, edge.value, edge.nbr);
+        }
+      }
+    }
+  };
+  dispatch_work(worker, graph.pages_per_block, n_threads, executor);
+}
+
+// The local join for each block: candidate pairs whose distance is within the
+// bound of either row are put in the bucket of that row's page
+template <typename Out, typename Idx, typename Distance>
+auto paged_local_join(PagedHeap<Out, Idx> &graph, const Distance &distance,
+                      PagedNNDWorkspace<Out, Idx> &workspace,
+                      std::size_t n_threads, NNDProgressBase &progress,
+                      const Executor &executor) -> bool {
+  using Workspace = PagedNNDWorkspace<Out, Idx>;
+  const auto &bounds = workspace.bounds;
+  auto &join_updates = workspace.join_updates;
+
+  progress.set_n_batches(graph.n_blocks);
+  for (std::size_t block = 0; block < graph.n_blocks; block++) {
+    const std::size_t begin = graph.begin(block);
+    const std::size_t n_rows = graph.end(block) - begin;
+    push_candidates(graph, block, workspace, n_threads, executor);
+
+    graph.load(block, workspace.block_graph);
+    flag_retained_new_candidates(workspace.block_graph, workspace.new_nbrs, 0,
+                                 n_rows);
+    graph.store(block, workspace.block_graph);
+
+    auto worker = [&](std::size_t row_begin, std::size_t row_end) {
+      LocalJoinBlock<Out, Idx> join_block;
+      for (auto row = row_begin; row < row_end; row++) {
+        auto &row_updates = join_updates[row % Workspace::join_batch_size];
+        local_join_block(distance, workspace.new_nbrs, workspace.old_nbrs, row,
+                         join_block, [&](Idx idx_p, Idx idx_q, Out dist_pq) {
+                           if (dist_pq < bounds[idx_p]) {
+                             row_updates.push_back({idx_p, idx_q, dist_pq});
+                           }
+                           if (idx_p != idx_q && dist_pq < bounds[idx_q]) {
+                             row_updates.push_back({idx_q, idx_p, dist_pq});
+                           }
+                         });
+      }
+    };
+    auto after_worker = [&](std::size_t row_begin, std::size_t row_end) {
+      for (auto row = row_begin; row < row_end; row++) {
+        auto &row_updates = join_updates[row % Workspace::join_batch_size];
+        for (const auto &update : row_updates) {
+          workspace.updates.add(graph.page_of(update.row), update);
+        }
+        row_updates.clear();
+      }
+    };
+    NullProgress null_progress;
+    ExecutionParams exec_params{Workspace::join_batch_size};
+    dispatch_work(worker, after_worker, n_rows, n_threads, exec_params,
+                  null_progress, executor);
+
+    if (progress.check_interrupt()) {
+      return false;
+    }
+    progress.batch_finished();
+  }
+  workspace.new_candidates.clear();
+  workspace.old_candidates.clear();
+  return true;
+}
+
+// Push the updates for each block onto its heap, returning the number of
+// neighbors which changed
+template <typename Out, typename Idx>
+auto apply_updates(PagedHeap<Out, Idx> &graph,
+                   PagedNNDWorkspace<Out, Idx> &workspace,
+                   std::size_t n_threads, NNDProgressBase &progress,
+                   const Executor &executor) -> unsigned long {
+  auto &heap = workspace.block_graph;
+  std::vector<unsigned long> page_updates(graph.pages_per_block);
+  unsigned long num_updates = 0;
+
+  for (std::size_t block = 0; block < graph.n_blocks; block++) {
+    const std::size_t begin = graph.begin(block);
+    const std::size_t first_page = block * graph.pages_per_block;
+    graph.load(block, heap);
+
+    auto worker = [&](std::size_t page_begin, std::size_t page_end) {
+      std::vector<PagedEdge<Out, Idx>> edges;
+      for (auto page = page_begin; page < page_end; page++) {
+        workspace.updates.take(first_page + page, edges);
+        unsigned long n_updates = 0;
+        for (const auto &edge : edges) {
+          n_updates += heap.checked_push(edge.row - begin, edge.value, edge.nbr);
+        }
+        page_updates[page] = n_updates;
+      }
+    };
+    dispatch_work(worker, graph.pages_per_block, n_threads, executor);
+    for (const auto &n_updates : page_updates) {
+      num_updates += n_updates;
+    }
+
+    workspace.update_bounds(begin);
+    graph.store(block, heap);
+    if (progress.check_interrupt()) {
+      break;
+    }
+  }
+  workspace.updates.clear();
+  return num_updates;
+}
+
+// Nearest neighbor descent on a graph already filled with (e.g. random)
+// neighbors, with the candidate and update buckets spilled to scratch files in
+// directory dir
+template <typename Out, typename Idx, typename Distance>
+void nnd_build(PagedHeap<Out, Idx> &current_graph, const Distance &distance,
+               const std::string &dir, std::size_t max_candidates,
+               uint32_t n_iters, double delta, bool weight_by_degree,
+               NNDProgressBase &progress, ParallelRandomProvider &parallel_rand,
+               std::size_t n_threads, const Executor &executor) {
+  PagedNNDWorkspace<Out, Idx> workspace(dir, current_graph, max_candidates);
+
+  for (auto iter = 0U; iter < n_iters; iter++) {
+    if (!generate_candidates(current_graph, workspace, weight_by_degree,
+                             parallel_rand, n_threads, progress, executor)) {
+      break;
+    }
+    if (!paged_local_join(current_graph, distance, workspace, n_threads,
+                          progress, executor)) {
+      break;
+    }
+    auto num_updates =
+        apply_updates(current_graph, workspace, n_threads, progress, executor);
+
+    if (nnd_should_stop(progress, current_graph, num_updates, delta)) {
+      break;
+    }
+  }
+}
+
+} // namespace tdoann
+
+#endif // TDOANN_NNDPAGED_H
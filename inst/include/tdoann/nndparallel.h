@@ -27,8 +27,12 @@
 #ifndef TDOANN_NNDPARALLEL_H
 #define TDOANN_NNDPARALLEL_H
 
-#include <array>
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <utility>
 
 #include "distancebase.h"
 #include "heap.h"
@@ -39,48 +43,20 @@
 namespace tdoann {
 
 template <typename Out, typename Idx> class ParallelLocalJoin {
-  static constexpr auto npos = static_cast<Idx>(-1);
-
 public:
   using Update = std::tuple<Idx, Idx, Out>;
 
   virtual ~ParallelLocalJoin() = default;
 
-  virtual void generate(const NNDHeap<Out, Idx> &current_graph, Idx idx_p,
-                        Idx idx_q, std::size_t key) = 0;
-  virtual auto apply(NNDHeap<Out, Idx> &current_graph) -> unsigned long = 0;
-
-  auto execute(const NNDHeap<Out, Idx> &current_graph,
-               const NNHeap<Out, Idx> &new_nbrs, decltype(new_nbrs) &old_nbrs,
-               std::size_t max_candidates, std::size_t begin, std::size_t end) {
-    for (auto i = begin, i_begin = begin * max_candidates; i < end;
-         i++, i_begin += max_candidates) {
-      for (std::size_t j = 0; j < max_candidates; j++) {
-        auto new_j = new_nbrs.idx[i_begin + j];
-        if (new_j == npos) {
-          continue;
-        }
-
-        // (new, new) pairs: loop from j->max_candidates
-        for (auto k = j; k < max_candidates; k++) {
-          auto new_k = new_nbrs.idx[i_begin + k];
-          if (new_k == npos) {
-            continue;
-          }
-          this->generate(current_graph, new_j, new_k, i);
-        }
-
-        // (new, old) pairs loop from 0->max_candidates
-        for (std::size_t k = 0; k < max_candidates; k++) {
-          auto old_k = old_nbrs.idx[i_begin + k];
-          if (old_k == npos) {
-            continue;
-          }
-          this->generate(current_graph, new_j, old_k, i);
-        }
-      }
-    }
-  }
+  // generate the updates for items begin to end: called from multiple threads
+  virtual void generate_updates(const NNDHeap<Out, Idx> &current_graph,
+                                const NNHeap<Out, Idx> &new_nbrs,
+                                decltype(new_nbrs) &old_nbrs,
+                                std::size_t begin, std::size_t end) = 0;
+  // apply the generated updates to the graph: called from a single thread,
+  // which may use executor to run in parallel
+  virtual auto apply(NNDHeap<Out, Idx> &current_graph, std::size_t n_threads,
+                     const Executor &executor) -> unsigned long = 0;
 
   auto execute(NNDHeap<Out, Idx> &current_graph,
                const NNHeap<Out, Idx> &new_nbrs, decltype(new_nbrs) &old_nbrs,
@@ -88,11 +64,10 @@ public:
                const Executor &executor) -> std::size_t {
     std::size_t num_updates = 0;
     auto local_join_worker = [&](std::size_t begin, std::size_t end) {
-      this->execute(current_graph, new_nbrs, old_nbrs, new_nbrs.n_nbrs, begin,
-                    end);
+      this->generate_updates(current_graph, new_nbrs, old_nbrs, begin, end);
     };
     auto after_local_join = [&](std::size_t, std::size_t) {
-      num_updates += this->apply(current_graph);
+      num_updates += this->apply(current_graph, n_threads, executor);
     };
     ExecutionParams exec_params{16384};
     dispatch_work(local_join_worker, after_local_join, current_graph.n_points,
@@ -102,136 +77,504 @@ public:
   }
 };
 
-template <typename Out, typename Idx>
-class LowMemParallelLocalJoin : public ParallelLocalJoin<Out, Idx> {
+// Updates generated by multiple threads, grouped into shards by the row of
+// the graph they will be applied to. Row i belongs to shard i % n_shards, so
+// the shards can be applied in parallel with no locking. Each call to generate
+// updates fills its own set of shards and adds them here when it's done, keyed
+// by the first item of the block it worked on. The sets are applied in block
+// order, not the order the threads finished in, so the result doesn't depend
+// on the scheduling of the threads.
+template <typename Update> class ShardedUpdates {
+public:
+  using Shards = std::vector<std::vector<Update>>;
+
+  std::size_t n_shards;
+
+  explicit ShardedUpdates(std::size_t n_shards)
+      : n_shards(std::max(n_shards, std::size_t{1})) {}
+
+  // Shards are recycled: the vectors in them keep their capacity, so after the
+  // first few batches no more memory needs to be allocated
+  auto create() -> Shards {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (spare.empty()) {
+      return Shards(n_shards);
+    }
+    Shards shards = std::move(spare.back());
+    spare.pop_back();
+    return shards;
+  }
+
+  template <typename Idx> auto shard(Idx row) const -> std::size_t {
+    return row % n_shards;
+  }
+
+  void add(std::size_t begin, Shards &&shards) {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto pos = std::upper_bound(
+        generated.begin(), generated.end(), begin,
+        [](std::size_t b, const auto &block) { return b < block.first; });
+    generated.emplace(pos, begin, std::move(shards));
+  }
+
+  // call func on each update in shard, in block order
+  template <typename Func> void for_each(std::size_t shard, Func func) const {
+    for (const auto &[begin, shards] : generated) {
+      for (const auto &update : shards[shard]) {
+        func(update);
+      }
+    }
+  }
+
+  void clear() {
+    for (auto &[begin, shards] : generated) {
+      for (auto &shard : shards) {
+        shard.clear();
+      }
+      spare.push_back(std::move(shards));
+    }
+    generated.clear();
+  }
+
+private:
+  std::mutex mutex;
+  std::vector<std::pair<std::size_t, Shards>> generated;
+  std::vector<Shards> spare;
+};
+
+// Call apply_shard(shard) -> number of updates for each shard in parallel
+template <typename ApplyShard>
+auto apply_shards(std::size_t n_shards, ApplyShard apply_shard,
+                  std::size_t n_threads, const Executor &executor)
+    -> unsigned long {
+  std::atomic<unsigned long> num_updates{0UL};
+  auto worker = [&](std::size_t begin, std::size_t end) {
+    unsigned long local_updates = 0UL;
+    for (auto shard = begin; shard < end; shard++) {
+      local_updates += apply_shard(shard);
+    }
+    num_updates += local_updates;
+  };
+  executor.parallel_for(0, n_shards, worker, n_threads, 1);
+  return num_updates;
+}
+
+// The Distance template parameter can be a concrete (final) distance class, in
+// which case the distance calculation in the local join is not a virtual call.
+// Use one shard per thread.
+template <typename Out, typename Idx,
+          typename Distance = BaseDistance<Out, Idx>>
+class LowMemParallelLocalJoin final : public ParallelLocalJoin<Out, Idx> {
+  // (row, neighbor, distance)
   using EdgeUpdate = std::tuple<Idx, Idx, Out>;
 
 public:
-  const BaseDistance<Out, Idx> &distance;
-  std::vector<std::vector<EdgeUpdate>> edge_updates;
+  const Distance &distance;
+  ShardedUpdates<EdgeUpdate> edge_updates;
+
+  LowMemParallelLocalJoin(const Distance &distance, std::size_t n_shards)
+      : distance(distance), edge_updates(n_shards) {}
+
+  void generate_updates(const NNDHeap<Out, Idx> &current_graph,
+                        const NNHeap<Out, Idx> &new_nbrs,
+                        decltype(new_nbrs) &old_nbrs, std::size_t begin,
+                        std::size_t end) override {
+    LocalJoinBlock<Out, Idx> block;
+    auto shards = edge_updates.create();
+    for (auto i = begin; i < end; i++) {
+      local_join_block(
+          distance, new_nbrs, old_nbrs, i, block, [&](Idx p, Idx q, Out d_pq) {
+            if (current_graph.accepts(p, d_pq)) {
+              shards[edge_updates.shard(p)].emplace_back(p, q, d_pq);
+            }
+            if (p != q && current_graph.accepts(q, d_pq)) {
+              shards[edge_updates.shard(q)].emplace_back(q, p, d_pq);
+            }
+          });
+    }
+    edge_updates.add(begin, std::move(shards));
+  }
 
-  LowMemParallelLocalJoin(const BaseDistance<Out, Idx> &distance)
-      : distance(distance), edge_updates(distance.get_ny()) {}
+  unsigned long apply(NNDHeap<Out, Idx> &current_graph, std::size_t n_threads,
+                      const Executor &executor) override {
+    auto apply_shard = [&](std::size_t shard) {
+      unsigned long num_updates = 0UL;
+      edge_updates.for_each(shard, [&](const EdgeUpdate &update) {
+        const auto &[row, idx, dist] = update;
+        num_updates += current_graph.checked_push(row, dist, idx);
+      });
+      return num_updates;
+    };
+    auto num_updates = apply_shards(edge_updates.n_shards, apply_shard,
+                                    n_threads, executor);
+    edge_updates.clear();
+    return num_updates;
+  }
+};
+
+// An array of spinlocks. Only suitable for locks that are held very briefly.
+class SpinLocks {
+  std::unique_ptr<std::atomic<bool>[]> locks;
 
-  void generate(const NNDHeap<Out, Idx> &current_graph, Idx p, Idx q,
-                std::size_t key) override {
-    const auto d_pq = distance.calculate(p, q);
-    if (current_graph.accepts_either(p, q, d_pq)) {
-      edge_updates[key].emplace_back(p, q, d_pq);
+public:
+  explicit SpinLocks(std::size_t n) : locks(new std::atomic<bool>[n]) {
+    for (std::size_t i = 0; i < n; i++) {
+      locks[i].store(false, std::memory_order_relaxed);
     }
   }
 
-  unsigned long apply(NNDHeap<Out, Idx> &current_graph) override {
-    unsigned long num_updates = 0UL;
-    for (auto &edge_set : edge_updates) {
-      for (auto &[p, q, d_pq] : edge_set) {
-        num_updates += current_graph.checked_push_pair(p, d_pq, q);
+  void lock(std::size_t i) {
+    auto &lock_i = locks[i];
+    for (std::size_t n_spins = 0;
+         lock_i.exchange(true, std::memory_order_acquire); n_spins++) {
+      // wait for the lock to look free before trying again, and give up the
+      // CPU if it's taking a while, in case there are more threads than cores
+      while (lock_i.load(std::memory_order_relaxed)) {
+        if (++n_spins > 64) {
+          std::this_thread::yield();
+        }
       }
-      edge_set.clear();
+    }
+  }
+
+  void unlock(std::size_t i) {
+    locks[i].store(false, std::memory_order_release);
+  }
+};
+
+// Allows multiple threads to push neighbors into the same NNDHeap. Each row
+// has a spinlock, which is held while the row is updated. A copy of the
+// maximum distance in each row is kept as an atomic, so most candidates can be
+// rejected without taking the lock. The heap must not be modified except
+// through this class while it is in use (changing the flags is fine).
+template <typename Out, typename Idx> class ConcurrentHeapPusher {
+  NNDHeap<Out, Idx> &heap;
+  SpinLocks row_locks;
+  std::unique_ptr<std::atomic<Out>[]> thresholds;
+
+public:
+  explicit ConcurrentHeapPusher(NNDHeap<Out, Idx> &heap)
+      : heap(heap), row_locks(heap.n_points),
+        thresholds(new std::atomic<Out>[heap.n_points]) {
+    for (Idx i = 0; i < heap.n_points; i++) {
+      thresholds[i].store(heap.max_distance(i), std::memory_order_relaxed);
+    }
+  }
+
+  auto accepts(Idx row, const Out &dist) const -> bool {
+    return row < heap.n_points &&
+           dist < thresholds[row].load(std::memory_order_relaxed);
+  }
+
+  auto accepts_either(Idx idx_p, Idx idx_q, const Out &d_pq) const -> bool {
+    return accepts(idx_p, d_pq) || (idx_p != idx_q && accepts(idx_q, d_pq));
+  }
+
+  auto checked_push(Idx row, const Out &dist, Idx idx) -> uint32_t {
+    if (!accepts(row, dist)) {
+      return 0U;
+    }
+    row_locks.lock(row);
+    const uint32_t num_updates = heap.checked_push(row, dist, idx);
+    thresholds[row].store(heap.max_distance(row), std::memory_order_relaxed);
+    row_locks.unlock(row);
+    return num_updates;
+  }
+
+  auto checked_push_pair(Idx idx_p, const Out &d_pq, Idx idx_q) -> uint32_t {
+    uint32_t num_updates = checked_push(idx_p, d_pq, idx_q);
+    if (idx_p != idx_q) {
+      // NOLINTNEXTLINE(readability-suspicious-call-argument)
+      num_updates += checked_push(idx_q, d_pq, idx_p);
     }
     return num_updates;
   }
 };
 
-template <typename Out, typename Idx>
-class CacheParallelLocalJoin : public ParallelLocalJoin<Out, Idx> {
+// Low memory local join where each thread pushes its updates directly into
+// the graph as they are generated, rather than storing them to be applied by
+// a single thread at the end of each batch. The graph passed to the
+// constructor is the one that is updated: execute must be called with the
+// same graph.
+template <typename Out, typename Idx,
+          typename Distance = BaseDistance<Out, Idx>>
+class ConcurrentLowMemParallelLocalJoin final
+    : public ParallelLocalJoin<Out, Idx> {
+public:
+  const Distance &distance;
+  ConcurrentHeapPusher<Out, Idx> heap_pusher;
+  std::atomic<unsigned long> num_updates{0};
+
+  ConcurrentLowMemParallelLocalJoin(NNDHeap<Out, Idx> &current_graph,
+                                    const Distance &distance)
+      : distance(distance), heap_pusher(current_graph) {}
+
+  void generate_updates(const NNDHeap<Out, Idx> & /* current_graph */,
+                        const NNHeap<Out, Idx> &new_nbrs,
+                        decltype(new_nbrs) &old_nbrs, std::size_t begin,
+                        std::size_t end) override {
+    LocalJoinBlock<Out, Idx> block;
+    unsigned long local_updates = 0UL;
+    for (auto i = begin; i < end; i++) {
+      local_join_block(distance, new_nbrs, old_nbrs, i, block,
+                       [&](Idx p, Idx q, Out d_pq) {
+                         local_updates +=
+                             heap_pusher.checked_push_pair(p, d_pq, q);
+                       });
+    }
+    num_updates += local_updates;
+  }
+
+  // the updates have already been applied: just report how many there were
+  unsigned long apply(NNDHeap<Out, Idx> & /* current_graph */,
+                      std::size_t /* n_threads */,
+                      const Executor & /* executor */) override {
+    return num_updates.exchange(0UL);
+  }
+};
+
+// An EdgeCache that can be used from multiple threads. The rows of the cache
+// are divided between a fixed number of spinlocks. The rows that have had
+// pairs claimed since the last call to clear are recorded, so the cache can
+// be emptied in time proportional to the number of those rows. A cache that
+// is never cleared should use insert instead, which doesn't record them.
+template <typename Idx> class ConcurrentEdgeCache {
+  static constexpr std::size_t n_stripes = 4096;
+
+  EdgeCache<Idx> cache;
+  SpinLocks stripe_locks;
+  // touched[s]: the rows in stripe s with at least one pair
+  std::vector<std::vector<Idx>> touched;
+
+public:
+  explicit ConcurrentEdgeCache(EdgeCache<Idx> &&cache)
+      : cache(std::move(cache)), stripe_locks(n_stripes), touched(n_stripes) {}
+
+  // Add (idx_p, idx_q) to the cache. Returns true if it wasn't already there,
+  // i.e. the calling thread is the first (and only) one to claim it
+  auto claim(Idx idx_p, Idx idx_q) -> bool {
+    const std::size_t stripe = idx_p % n_stripes;
+    stripe_locks.lock(stripe);
+    if (cache.size(idx_p) == 0) {
+      touched[stripe].push_back(idx_p);
+    }
+    const bool found = cache.insert(idx_p, idx_q);
+    stripe_locks.unlock(stripe);
+    return !found;
+  }
+
+  // Add (idx_p, idx_q) to the cache, without recording the row for clear.
+  // Returns true if it wasn't already there
+  auto insert(Idx idx_p, Idx idx_q) -> bool {
+    const std::size_t stripe = idx_p % n_stripes;
+    stripe_locks.lock(stripe);
+    const bool found = cache.insert(idx_p, idx_q);
+    stripe_locks.unlock(stripe);
+    return !found;
+  }
+
+  // Not locked: only safe while no thread is calling claim or insert
+  auto contains(Idx idx_p, Idx idx_q) const -> bool {
+    return cache.contains(idx_p, idx_q);
+  }
+
+  // Remove the pairs added with claim since the last clear
+  void clear(std::size_t n_threads, const Executor &executor) {
+    auto worker = [&](std::size_t begin, std::size_t end) {
+      for (auto stripe = begin; stripe < end; stripe++) {
+        for (const auto &idx_p : touched[stripe]) {
+          cache.clear(idx_p);
+        }
+        touched[stripe].clear();
+      }
+    };
+    executor.parallel_for(0, n_stripes, worker, n_threads, 64);
+  }
+};
+
+// The cache holds the pairs that have been accepted by at least one row of
+// the graph, so they are never calculated again. Pairs are only added to it
+// when the updates are applied, so during generate it is only read. Within a
+// batch, the same pair can be generated by different threads. If claim_pairs
+// is true, then to avoid calculating its distance more than once, a thread
+// first claims the pair in a separate set of the pairs seen in the batch,
+// which is emptied after the updates are applied, so its size depends on the
+// size of the batch, not on the number of pairs seen over the whole run. Any
+// pair that reaches apply is then not already in either row, so the updates
+// can be pushed without checking for duplicates. Claiming a pair costs more
+// than calculating a cheap distance like the squared Euclidean, so it is only
+// worth it for expensive metrics: otherwise duplicates are removed when the
+// updates are pushed. As with the low memory join, updates are sharded by the
+// row they are applied to.
+template <typename Out, typename Idx,
+          typename Distance = BaseDistance<Out, Idx>>
+class CacheParallelLocalJoin final : public ParallelLocalJoin<Out, Idx> {
+  // (row, neighbor, distance)
   using EdgeUpdate = std::tuple<Idx, Idx, Out>;
 
 public:
-  const BaseDistance<Out, Idx> &distance;
-  EdgeCache<Idx> cache;
-  std::vector<std::vector<EdgeUpdate>> edge_updates;
+  const Distance &distance;
+  ConcurrentEdgeCache<Idx> cache;
+  ConcurrentEdgeCache<Idx> batch_pairs;
+  ShardedUpdates<EdgeUpdate> edge_updates;
+
+  bool claim_pairs;
 
   CacheParallelLocalJoin(const NNDHeap<Out, Idx> &current_graph,
-                         const BaseDistance<Out, Idx> &distance)
+                         const Distance &distance, std::size_t n_shards,
+                         bool claim_pairs)
       : distance(distance), cache(EdgeCache<Idx>::from_graph(current_graph)),
-        edge_updates(current_graph.n_points) {}
+        batch_pairs(EdgeCache<Idx>(claim_pairs ? current_graph.n_points : 0)),
+        edge_updates(n_shards), claim_pairs(claim_pairs) {}
 
   void generate(const NNDHeap<Out, Idx> &current_graph, Idx idx_p, Idx idx_q,
-                std::size_t key) override {
+                typename ShardedUpdates<EdgeUpdate>::Shards &shards) {
     auto [idx_pp, idx_qq] = std::minmax(idx_p, idx_q);
 
-    if (cache.contains(idx_pp, idx_qq)) {
+    if (cache.contains(idx_pp, idx_qq) ||
+        (claim_pairs && !batch_pairs.claim(idx_pp, idx_qq))) {
       return;
     }
 
     const auto dist_pq = distance.calculate(idx_pp, idx_qq);
-    if (current_graph.accepts_either(idx_pp, idx_qq, dist_pq)) {
-      edge_updates[key].emplace_back(idx_pp, idx_qq, dist_pq);
+    if (current_graph.accepts(idx_pp, dist_pq)) {
+      shards[edge_updates.shard(idx_pp)].emplace_back(idx_pp, idx_qq, dist_pq);
+    }
+    if (idx_pp != idx_qq && current_graph.accepts(idx_qq, dist_pq)) {
+      shards[edge_updates.shard(idx_qq)].emplace_back(idx_qq, idx_pp, dist_pq);
     }
   }
 
-  unsigned long apply(NNDHeap<Out, Idx> &current_graph) override {
-    unsigned long num_updates = 0;
-    for (auto &edge_set : edge_updates) {
-      for (const auto &[idx_p, idx_q, dist_pq] : edge_set) {
-
-        if (cache.contains(idx_p, idx_q)) {
-          continue;
-        }
-
-        const bool bad_pd = !current_graph.accepts(idx_p, dist_pq);
-        const bool bad_qd = !current_graph.accepts(idx_q, dist_pq);
-
-        if (bad_pd && bad_qd) {
-          continue;
-        }
+  void generate_updates(const NNDHeap<Out, Idx> &current_graph,
+                        const NNHeap<Out, Idx> &new_nbrs,
+                        decltype(new_nbrs) &old_nbrs, std::size_t begin,
+                        std::size_t end) override {
+    auto shards = edge_updates.create();
+    for (auto i = begin; i < end; i++) {
+      local_join_pairs(new_nbrs, old_nbrs, i, [&](Idx p, Idx q) {
+        this->generate(current_graph, p, q, shards);
+      });
+    }
+    edge_updates.add(begin, std::move(shards));
+  }
 
-        uint32_t local_c = 0;
-        if (!bad_pd) {
-          current_graph.unchecked_push(idx_p, dist_pq, idx_q);
-          local_c++;
+  unsigned long apply(NNDHeap<Out, Idx> &current_graph, std::size_t n_threads,
+                      const Executor &executor) override {
+    auto apply_shard = [&](std::size_t shard) {
+      unsigned long num_updates = 0UL;
+      edge_updates.for_each(shard, [&](const EdgeUpdate &update) {
+        const auto &[row, idx, dist] = update;
+        if (!current_graph.accepts(row, dist)) {
+          return;
         }
-
-        if (idx_p != idx_q && !bad_qd) {
-          current_graph.unchecked_push(idx_q, dist_pq, idx_p);
-          local_c++;
+        if (claim_pairs) {
+          current_graph.unchecked_push(row, dist, idx);
+        } else if (current_graph.checked_push(row, dist, idx) == 0) {
+          return;
         }
-
-        if (local_c > 0) {
-          cache.insert(idx_p, idx_q);
-          num_updates += local_c;
-        }
-      }
-      edge_set.clear();
+        // the other row may have accepted the pair too, so this can fail
+        const auto [idx_pp, idx_qq] = std::minmax(row, idx);
+        cache.insert(idx_pp, idx_qq);
+        num_updates++;
+      });
+      return num_updates;
+    };
+    auto num_updates = apply_shards(edge_updates.n_shards, apply_shard,
+                                    n_threads, executor);
+    edge_updates.clear();
+    if (claim_pairs) {
+      batch_pairs.clear(n_threads, executor);
     }
     return num_updates;
   }
 };
 
-template <typename Out, typename Idx> class LockingHeapAdder {
-private:
-  static constexpr std::size_t n_mutexes = 10;
-  std::array<std::mutex, n_mutexes> mutexes;
-
+// Candidate neighbors generated during build_candidates, stored in buckets by
+// the block of rows they were generated from and the partition (a contiguous
+// range of rows) of the candidate heap they will be pushed onto. Each block is
+// processed by one thread, and then each partition is filled by one thread, so
+// no locking is needed. Because the buckets of a partition are read back in
+// block order, each row of the candidate heap sees its candidates in the same
+// order as the serial build_candidates and the result doesn't depend on how
+// the work was split between threads. The buckets are kept between iterations
+// so their memory can be reused.
+template <typename Out, typename Idx> class CandidateBuckets {
 public:
-  LockingHeapAdder() = default;
-  LockingHeapAdder(LockingHeapAdder const &) = delete;
-  auto operator=(LockingHeapAdder const &) -> LockingHeapAdder & = delete;
-  LockingHeapAdder(LockingHeapAdder &&) = delete;
-  auto operator=(LockingHeapAdder &&) -> LockingHeapAdder & = delete;
-  ~LockingHeapAdder() = default;
-
-  void add(NNHeap<Out, Idx> &nbrs, Idx item_i, Idx item_j, Out dist_ij) {
-    {
-      std::lock_guard<std::mutex> guard(mutexes[item_i % n_mutexes]);
-      nbrs.checked_push(item_i, dist_ij, item_j);
-    }
-    if (item_i != item_j) {
-      std::lock_guard<std::mutex> guard(mutexes[item_j % n_mutexes]);
-      nbrs.checked_push(item_j, dist_ij, item_i);
-    }
+  struct Candidate {
+    Idx target;
+    Idx source;
+    Out weight;
+  };
+  using Bucket = std::vector<Candidate>;
+
+  // rows per block: fixed so that the random numbers used don't depend on the
+  // number of threads either
+  static constexpr std::size_t block_size = 1024;
+
+  std::size_t n_points{0};
+  std::size_t n_blocks{0};
+  std::size_t n_partitions{0};
+
+  void resize(std::size_t n_points, std::size_t n_threads) {
+    this->n_points = n_points;
+    n_blocks = (n_points + block_size - 1) / block_size;
+    // more partitions than threads to even out the load on hub rows
+    n_partitions = std::min(n_points, std::max(n_threads, std::size_t{1}) * 4);
+    new_buckets.resize(n_blocks * n_partitions);
+    old_buckets.resize(n_blocks * n_partitions);
+    has_new.resize(n_points);
   }
 
-  void add(NNHeap<Out, Idx> &nbrs, Idx item_i, Idx item_j, Out weight_i,
-           Out weight_j) {
-    {
-      std::lock_guard<std::mutex> guard(mutexes[item_i % n_mutexes]);
-      nbrs.checked_push(item_i, weight_j, item_j);
-    }
-    if (item_i != item_j) {
-      std::lock_guard<std::mutex> guard(mutexes[item_j % n_mutexes]);
-      nbrs.checked_push(item_j, weight_i, item_i);
+  auto partition(Idx target) const -> std::size_t {
+    return static_cast<uint64_t>(target) * n_partitions / n_points;
+  }
+
+  // first row in partition
+  auto partition_begin(std::size_t part) const -> std::size_t {
+    return (part * n_points + n_partitions - 1) / n_partitions;
+  }
+
+  void add(std::size_t block, bool is_new, Idx target, Out weight, Idx source) {
+    auto &buckets = is_new ? new_buckets : old_buckets;
+    buckets[block * n_partitions + partition(target)].push_back(
+        {target, source, weight});
+  }
+
+  // push everything in partition part onto the heaps in block order. Old
+  // candidates are only pushed for rows which got a new candidate (see
+  // find_items_with_new_candidates)
+  void drain(std::size_t part, NNHeap<Out, Idx> &new_nbrs,
+             NNHeap<Out, Idx> &old_nbrs) {
+    std::fill(has_new.begin() + partition_begin(part),
+              has_new.begin() + partition_begin(part + 1), 0);
+    for_each(part, new_buckets, [&](const Candidate &candidate) {
+      has_new[candidate.target] = 1;
+      new_nbrs.checked_push(candidate.target, candidate.weight,
+                            candidate.source);
+    });
+    for_each(part, old_buckets, [&](const Candidate &candidate) {
+      if (has_new[candidate.target]) {
+        old_nbrs.checked_push(candidate.target, candidate.weight,
+                              candidate.source);
+      }
+    });
+  }
+
+private:
+  std::vector<Bucket> new_buckets;
+  std::vector<Bucket> old_buckets;
+  // each partition only writes to its own range of rows
+  std::vector<uint8_t> has_new;
+
+  // call func on each candidate in partition part, emptying its buckets
+  template <typename Func>
+  void for_each(std::size_t part, std::vector<Bucket> &buckets, Func func) {
+    for (std::size_t block = 0; block < n_blocks; block++) {
+      auto &bucket = buckets[block * n_partitions + part];
+      for (const auto &candidate : bucket) {
+        func(candidate);
+      }
+      bucket.clear();
     }
   }
 };
@@ -241,36 +584,68 @@ void build_candidates(const NNDHeap<Out, Idx> &current_graph,
                       NNHeap<Out, Idx> &new_nbrs, decltype(new_nbrs) &old_nbrs,
                       bool weight_by_degree,
                       ParallelRandomProvider &parallel_rand,
-                      std::size_t n_threads, const Executor &executor) {
+                      std::size_t n_threads, const Executor &executor,
+                      CandidateBuckets<Out, Idx> &buckets) {
   constexpr auto npos = static_cast<Idx>(-1);
+  const std::size_t n_points = current_graph.n_points;
   const std::size_t n_nbrs = current_graph.n_nbrs;
-  LockingHeapAdder<Out, Idx> heap_adder;
+  buckets.resize(n_points, n_threads);
 
   auto k_occurrences = weight_by_degree ? count_reverse_neighbors(current_graph)
                                         : std::vector<std::size_t>();
   parallel_rand.initialize();
-  auto worker = [&](std::size_t begin, std::size_t end) {
-    auto rand = parallel_rand.get_parallel_instance(end);
-
-    for (auto i = begin, idx_offset = begin * n_nbrs; i < end;
-         i++, idx_offset += n_nbrs) {
-      for (auto idx_ij = idx_offset; idx_ij < idx_offset + n_nbrs; idx_ij++) {
-        const auto nbr = current_graph.idx[idx_ij];
-        if (nbr == npos) {
-          continue;
-        }
-        auto &nbrs = current_graph.flags[idx_ij] == 1 ? new_nbrs : old_nbrs;
-        auto rand_weight = rand->unif();
-        if (weight_by_degree) {
-          heap_adder.add(nbrs, i, nbr, rand_weight * k_occurrences[i],
-                         rand_weight * k_occurrences[nbr]);
-        } else {
-          heap_adder.add(nbrs, i, nbr, rand_weight);
+  auto generate_worker = [&](std::size_t block_begin, std::size_t block_end) {
+    for (auto block = block_begin; block < block_end; block++) {
+      const std::size_t begin = block * buckets.block_size;
+      const std::size_t end = std::min(begin + buckets.block_size, n_points);
+      auto rand = parallel_rand.get_parallel_instance(end);
+
+      for (auto i = begin, idx_offset = begin * n_nbrs; i < end;
+           i++, idx_offset += n_nbrs) {
+        for (auto idx_ij = idx_offset; idx_ij < idx_offset + n_nbrs;
+             idx_ij++) {
+          const auto nbr = current_graph.idx[idx_ij];
+          if (nbr == npos) {
+            continue;
+          }
+          const bool is_new = current_graph.flags[idx_ij] == 1;
+          auto rand_weight = rand->unif();
+          if (weight_by_degree) {
+            buckets.add(block, is_new, i, rand_weight * k_occurrences[nbr],
+                        nbr);
+            if (i != nbr) {
+              buckets.add(block, is_new, nbr, rand_weight * k_occurrences[i],
+                          i);
+            }
+          } else {
+            buckets.add(block, is_new, i, rand_weight, nbr);
+            if (i != nbr) {
+              buckets.add(block, is_new, nbr, rand_weight, i);
+            }
+          }
         }
       }
     }
   };
-  dispatch_work(worker, current_graph.n_points, n_threads, executor);
+  dispatch_work(generate_worker, buckets.n_blocks, n_threads, executor);
+
+  auto drain_worker = [&](std::size_t begin, std::size_t end) {
+    for (auto part = begin; part < end; part++) {
+      buckets.drain(part, new_nbrs, old_nbrs);
+    }
+  };
+  dispatch_work(drain_worker, buckets.n_partitions, n_threads, executor);
+}
+
+template <typename Out, typename Idx>
+void build_candidates(const NNDHeap<Out, Idx> &current_graph,
+                      NNHeap<Out, Idx> &new_nbrs, decltype(new_nbrs) &old_nbrs,
+                      bool weight_by_degree,
+                      ParallelRandomProvider &parallel_rand,
+                      std::size_t n_threads, const Executor &executor) {
+  CandidateBuckets<Out, Idx> buckets;
+  build_candidates(current_graph, new_nbrs, old_nbrs, weight_by_degree,
+                   parallel_rand, n_threads, executor, buckets);
 }
 
 template <typename Out, typename Idx>
@@ -290,14 +665,18 @@ void nnd_build(NNDHeap<Out, Idx> &current_graph,
                bool weight_by_degree, NNDProgressBase &progress,
                ParallelRandomProvider &parallel_rand, std::size_t n_threads,
                const Executor &executor) {
-  const std::size_t n_points = current_graph.n_points;
+  NNDWorkspace<Out, Idx> workspace(current_graph.n_points, max_candidates);
+  auto &new_nbrs = workspace.new_nbrs;
+  auto &old_nbrs = workspace.old_nbrs;
+  CandidateBuckets<Out, Idx> buckets;
 
   for (auto iter = 0U; iter < n_iters; iter++) {
-    NNHeap<Out, Idx> new_nbrs(n_points, max_candidates);
-    decltype(new_nbrs) old_nbrs(n_points, max_candidates);
+    if (iter > 0) {
+      workspace.reset(n_threads, executor);
+    }
 
     build_candidates(current_graph, new_nbrs, old_nbrs, weight_by_degree,
-                     parallel_rand, n_threads, executor);
+                     parallel_rand, n_threads, executor, buckets);
 
     flag_new_candidates(current_graph, new_nbrs, n_threads, executor);
 
@@ -28,6 +28,7 @@
 #define TDOANN_NNGRAPH_H
 
 #include <array>
+#include <cstdint>
 #include <mutex>
 #include <vector>
 
@@ -77,6 +78,21 @@ template <typename Out = float, typename Idx = uint32_t> struct SparseNNGraph {
   auto is_marked_for_deletion(Idx idx, Idx i) const -> bool {
     return distance(idx, i) == zero;
   }
+
+  // Point-level tombstones: a deleted item can still be traversed during a
+  // search but is never returned as a neighbor. Empty if nothing is deleted.
+  std::vector<uint8_t> deleted;
+
+  void mark_deleted(Idx idx) {
+    if (deleted.empty()) {
+      deleted.resize(n_points, 0);
+    }
+    deleted[idx] = 1;
+  }
+
+  auto is_deleted(Idx idx) const -> bool {
+    return !deleted.empty() && deleted[idx] != 0;
+  }
 };
 
 template <typename Out = float, typename Idx = uint32_t> struct NNGraph {
@@ -101,6 +117,20 @@ template <typename Out = float, typename Idx = uint32_t> struct NNGraph {
 
   using DistanceOut = Out;
   using Index = Idx;
+
+  // see SparseNNGraph
+  std::vector<uint8_t> deleted;
+
+  void mark_deleted(Idx i) {
+    if (deleted.empty()) {
+      deleted.resize(n_points, 0);
+    }
+    deleted[i] = 1;
+  }
+
+  auto is_deleted(Idx i) const -> bool {
+    return !deleted.empty() && deleted[i] != 0;
+  }
 };
 
 template <typename NbrHeap>
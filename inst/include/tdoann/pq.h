@@ -0,0 +1,349 @@
+// BSD 2-Clause License
+//
+// Copyright 2024 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_PQ_H
+#define TDOANN_PQ_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "distancebase.h"
+#include "parallel.h"
+#include "quantize.h"
+#include "random.h"
+
+// Product quantization (PQ) for querying a large reference set. The features
+// are split into n_subspaces contiguous groups, and in each group every item is
+// replaced by the index of the nearest of (up to) 256 centroids found by
+// k-means, so each reference item is stored in n_subspaces bytes. Distances
+// from a query to the reference items are asymmetric (ADC): the query is kept
+// at full precision, and the squared Euclidean distances (or inner products)
+// from each of its subvectors to each centroid are calculated once, after
+// which the distance to any reference item is a sum of n_subspaces table
+// lookups. The same metrics as the reduced precision storage in quantize.h are
+// supported, with the data normalized or centered before training and
+// encoding for the inner product metrics. The distances are approximate:
+// search for more neighbors than needed and use rerank (in quantize.h) with
+// the exact distances to keep the nearest.
+
+namespace tdoann {
+
+class ProductQuantizer {
+public:
+  static constexpr std::size_t max_centroids = 256;
+
+  std::size_t ndim{0};
+  std::size_t n_subspaces{0};
+  std::size_t n_centroids{0};
+  // subspace m is features offsets[m] to offsets[m + 1]
+  std::vector<std::size_t> offsets;
+  // the centroids of subspace m start at centroids[n_centroids * offsets[m]],
+  // each with the number of features in the subspace
+  std::vector<float> centroids;
+
+  ProductQuantizer() = default;
+
+  ProductQuantizer(std::size_t ndim, std::size_t n_subspaces,
+                   std::size_t n_centroids)
+      : ndim(ndim), n_subspaces(n_subspaces), n_centroids(n_centroids),
+        offsets(n_subspaces + 1), centroids(ndim * n_centroids) {
+    if (n_subspaces == 0 || n_subspaces > ndim) {
+      throw std::invalid_argument(
+          "Number of subspaces must be between 1 and the number of features");
+    }
+    if (n_centroids == 0 || n_centroids > max_centroids) {
+      throw std::invalid_argument("Number of centroids must be between 1 and " +
+                                  std::to_string(max_centroids));
+    }
+    for (std::size_t m = 0; m <= n_subspaces; m++) {
+      offsets[m] = m * ndim / n_subspaces;
+    }
+  }
+
+  auto subspace_ndim(std::size_t m) const -> std::size_t {
+    return offsets[m + 1] - offsets[m];
+  }
+
+  auto centroid(std::size_t m, std::size_t c) const -> const float * {
+    return centroids.data() + n_centroids * offsets[m] + c * subspace_ndim(m);
+  }
+
+  auto centroid(std::size_t m, std::size_t c) -> float * {
+    return centroids.data() + n_centroids * offsets[m] + c * subspace_ndim(m);
+  }
+
+  // index of the nearest centroid to the subvector x of subspace m
+  auto nearest(std::size_t m, const float *x) const -> uint8_t {
+    const std::size_t sub_ndim = subspace_ndim(m);
+    std::size_t best = 0;
+    float best_dist = std::numeric_limits<float>::max();
+    for (std::size_t c = 0; c < n_centroids; c++) {
+      const float *cm = centroid(m, c);
+      float dist = 0.0F;
+      for (std::size_t d = 0; d < sub_ndim; d++) {
+        const float diff = x[d] - cm[d];
+        dist += diff * diff;
+      }
+      if (dist < best_dist) {
+        best_dist = dist;
+        best = c;
+      }
+    }
+    return static_cast<uint8_t>(best);
+  }
+
+  void encode(const float *x, uint8_t *codes) const {
+    for (std::size_t m = 0; m < n_subspaces; m++) {
+      codes[m] = nearest(m, x + offsets[m]);
+    }
+  }
+
+  auto encode(const std::vector<float> &data, std::size_t n_threads,
+              const Executor &executor) const -> std::vector<uint8_t> {
+    const std::size_t n_items = data.size() / ndim;
+    std::vector<uint8_t> codes(n_items * n_subspaces);
+    auto worker = [&](std::size_t begin, std::size_t end) {
+      for (std::size_t i = begin; i < end; i++) {
+        encode(data.data() + i * ndim, codes.data() + i * n_subspaces);
+      }
+    };
+    dispatch_work(worker, n_items, n_threads, executor);
+    return codes;
+  }
+
+  // the n_subspaces x n_centroids table of squared Euclidean distances (or if
+  // inner_product is true, the inner products) between each subvector of the
+  // query x and each centroid
+  void distance_table(const float *x, bool inner_product, float *table) const {
+    for (std::size_t m = 0; m < n_subspaces; m++) {
+      const std::size_t sub_ndim = subspace_ndim(m);
+      const float *xm = x + offsets[m];
+      for (std::size_t c = 0; c < n_centroids; c++) {
+        const float *cm = centroid(m, c);
+        float sum = 0.0F;
+        if (inner_product) {
+          for (std::size_t d = 0; d < sub_ndim; d++) {
+            sum += xm[d] * cm[d];
+          }
+        } else {
+          for (std::size_t d = 0; d < sub_ndim; d++) {
+            const float diff = xm[d] - cm[d];
+            sum += diff * diff;
+          }
+        }
+        table[m * n_centroids + c] = sum;
+      }
+    }
+  }
+};
+
+// Find the centroids of each subspace with n_iters iterations of k-means on
+// data (row-major, ndim features per item), starting from randomly chosen
+// items. No more than max_points_per_centroid items per centroid are used,
+// chosen at random: more than that takes longer without improving the
+// centroids much. Empty clusters are given a new random item as their
+// centroid. The data should already be preprocessed for the metric, e.g.
+// normalized for cosine.
+inline auto train_pq(const std::vector<float> &data, std::size_t ndim,
+                     std::size_t n_subspaces, std::size_t n_iters,
+                     RandomGenerator &rand, std::size_t n_threads,
+                     const Executor &executor,
+                     std::size_t n_centroids = ProductQuantizer::max_centroids)
+    -> ProductQuantizer {
+  constexpr std::size_t max_points_per_centroid = 256;
+
+  const std::size_t n_items = data.size() / ndim;
+  n_centroids = std::min(n_centroids, n_items);
+  ProductQuantizer pq(ndim, n_subspaces, n_centroids);
+
+  auto rand_item = [&](std::size_t n) {
+    return std::min(static_cast<std::size_t>(rand.unif() * n), n - 1);
+  };
+
+  // a random sample of the items for training, of which the first
+  // n_centroids are the initial centroids in each subspace
+  const std::size_t n_train =
+      std::min(n_items, n_centroids * max_points_per_centroid);
+  std::vector<std::size_t> items(n_items);
+  std::iota(items.begin(), items.end(), 0);
+  for (std::size_t i = 0; i < n_train; i++) {
+    std::swap(items[i], items[i + rand_item(n_items - i)]);
+  }
+  std::vector<float> train(n_train * ndim);
+  for (std::size_t i = 0; i < n_train; i++) {
+    std::copy(data.begin() + items[i] * ndim,
+              data.begin() + (items[i] + 1) * ndim,
+              train.begin() + i * ndim);
+  }
+  for (std::size_t m = 0; m < n_subspaces; m++) {
+    const std::size_t sub_ndim = pq.subspace_ndim(m);
+    for (std::size_t c = 0; c < n_centroids; c++) {
+      const float *x = train.data() + c * ndim + pq.offsets[m];
+      std::copy(x, x + sub_ndim, pq.centroid(m, c));
+    }
+  }
+
+  std::vector<uint8_t> assignment(n_train);
+  std::vector<std::size_t> counts(n_centroids);
+  std::vector<double> sums;
+  for (std::size_t m = 0; m < n_subspaces; m++) {
+    const std::size_t sub_ndim = pq.subspace_ndim(m);
+    const std::size_t offset = pq.offsets[m];
+    for (std::size_t iter = 0; iter < n_iters; iter++) {
+      auto assign_worker = [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+          assignment[i] = pq.nearest(m, train.data() + i * ndim + offset);
+        }
+      };
+      dispatch_work(assign_worker, n_train, n_threads, executor);
+
+      std::fill(counts.begin(), counts.end(), 0);
+      sums.assign(n_centroids * sub_ndim, 0.0);
+      for (std::size_t i = 0; i < n_train; i++) {
+        const float *x = train.data() + i * ndim + offset;
+        double *sum = sums.data() + assignment[i] * sub_ndim;
+        for (std::size_t d = 0; d < sub_ndim; d++) {
+          sum[d] += x[d];
+        }
+        counts[assignment[i]]++;
+      }
+      for (std::size_t c = 0; c < n_centroids; c++) {
+        float *cm = pq.centroid(m, c);
+        if (counts[c] == 0) {
+          const float *x = train.data() + rand_item(n_train) * ndim + offset;
+          std::copy(x, x + sub_ndim, cm);
+          continue;
+        }
+        for (std::size_t d = 0; d < sub_ndim; d++) {
+          cm[d] = static_cast<float>(sums[c * sub_ndim + d] / counts[c]);
+        }
+      }
+    }
+  }
+  return pq;
+}
+
+// Approximate distances from PQ-encoded reference items (x) to full precision
+// query items (y), for use in graph search (nn_query). The query data is
+// preprocessed with preprocess_func, which should be the same preprocessing
+// that was applied to the reference data before it was encoded. The distance
+// table for a query is calculated the first time it's needed by each thread
+// and kept until the thread moves on to another query, which in a search is
+// after all the distances for that query are done.
+template <typename Out, typename Idx = uint32_t>
+class PQQueryDistanceCalculator : public BaseDistance<Out, Idx> {
+public:
+  PQQueryDistanceCalculator(ProductQuantizer pq, std::vector<uint8_t> codes,
+                            std::vector<float> ydata, QuantizedMetric metric,
+                            PreprocessFunc<float> preprocess_func = nullptr)
+      : pq(std::move(pq)), codes(std::move(codes)), y(std::move(ydata)),
+        nx(this->codes.size() / this->pq.n_subspaces),
+        ny(y.size() / this->pq.ndim), metric(metric) {
+    if (preprocess_func) {
+      preprocess_func(y, this->pq.ndim);
+    }
+  }
+
+  std::size_t get_nx() const override { return nx; }
+  std::size_t get_ny() const override { return ny; }
+
+  Out calculate(const Idx &i, const Idx &j) const override {
+    return adc(query_table(j), i);
+  }
+
+  void calculate_block(const Idx *rows, std::size_t n_rows, const Idx *cols,
+                       std::size_t n_cols, Out *out) const override {
+    for (std::size_t c = 0; c < n_cols; c++) {
+      const float *table = query_table(cols[c]);
+      for (std::size_t r = 0; r < n_rows; r++) {
+        out[r * n_cols + c] = adc(table, rows[r]);
+      }
+    }
+  }
+
+  void prefetch(const Idx &i) const override {
+    prefetch_bytes(codes.data() + i * pq.n_subspaces, pq.n_subspaces);
+  }
+
+  // bytes used to store the reference data
+  auto data_size() const -> std::size_t { return codes.size(); }
+
+private:
+  static constexpr auto npos = static_cast<Idx>(-1);
+
+  ProductQuantizer pq;
+  std::vector<uint8_t> codes;
+  std::vector<float> y;
+  std::size_t nx;
+  std::size_t ny;
+  QuantizedMetric metric;
+  // identifies this calculator in the per-thread table cache
+  uint64_t id{next_id()};
+
+  struct TableCache {
+    uint64_t owner{0};
+    Idx query{npos};
+    std::vector<float> table;
+  };
+
+  auto adc(const float *table, Idx i) const -> Out {
+    const uint8_t *code = codes.data() + i * pq.n_subspaces;
+    float sum = 0.0F;
+    for (std::size_t m = 0; m < pq.n_subspaces; m++) {
+      sum += table[code[m]];
+      table += pq.n_centroids;
+    }
+    return quantized_distance<Out>(metric, sum);
+  }
+
+  auto query_table(Idx j) const -> const float * {
+    thread_local TableCache cache;
+    if (cache.owner != id || cache.query != j) {
+      cache.owner = id;
+      cache.query = j;
+      cache.table.resize(pq.n_subspaces * pq.n_centroids);
+      pq.distance_table(y.data() + j * pq.ndim, is_inner_product(metric),
+                        cache.table.data());
+    }
+    return cache.table.data();
+  }
+
+  static auto next_id() -> uint64_t {
+    static std::atomic<uint64_t> counter{0};
+    return ++counter;
+  }
+};
+
+} // namespace tdoann
+
+#endif // TDOANN_PQ_H
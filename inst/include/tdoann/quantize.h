@@ -0,0 +1,606 @@
+// BSD 2-Clause License
+//
+// Copyright 2024 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_QUANTIZE_H
+#define TDOANN_QUANTIZE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "distancebase.h"
+#include "distancesimd.h"
+#include "parallel.h"
+#include "progressbase.h"
+
+#if defined(TDOANN_SIMD_X86)
+#define TDOANN_TARGET_AVX2_F16C __attribute__((target("avx2,fma,f16c")))
+#endif
+
+// Reduced precision storage for dense data. Each feature is stored as a 16-bit
+// float (IEEE half precision or bfloat16) or as an 8-bit code, which reduces
+// the memory needed for the data, and the memory bandwidth used when
+// calculating distances, by 2 or 4 times. The distance kernels work on the
+// codes directly, without decoding the items to float first. Only the metrics
+// which reduce to a sum of squared differences or an inner product (after
+// normalizing or centering the data) are supported. Distances are
+// approximate: use rerank with a full precision calculator afterwards to get
+// the exact distances and order of the neighbors that were found.
+
+// NOLINTBEGIN(readability-identifier-length)
+
+namespace tdoann {
+
+// Conversion between float and IEEE 754 half precision (binary16), rounding to
+// nearest even. Values too large for half precision become infinite.
+inline auto float_to_half(float value) -> uint16_t {
+  uint32_t bits = 0;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const auto sign = static_cast<uint16_t>((bits >> 16) & 0x8000U);
+  const uint32_t abs_bits = bits & 0x7fffffffU;
+
+  if (abs_bits >= 0x7f800000U) {
+    // infinity or NaN (keeping NaN a NaN)
+    return sign | (abs_bits > 0x7f800000U ? 0x7e00U : 0x7c00U);
+  }
+  if (abs_bits >= 0x477ff000U) {
+    // rounds to a value larger than the largest half (65504)
+    return sign | 0x7c00U;
+  }
+  if (abs_bits < 0x38800000U) {
+    // subnormal half (or zero): scale the value so the integer conversion
+    // rounds to the nearest multiple of the smallest subnormal (2^-24)
+    float abs_value = 0.0F;
+    std::memcpy(&abs_value, &abs_bits, sizeof(abs_value));
+    return sign | static_cast<uint16_t>(std::nearbyint(abs_value * 16777216.0F));
+  }
+  // normal: rebias the exponent from 127 to 15 and round the mantissa
+  const uint32_t mantissa_odd = (abs_bits >> 13) & 1U;
+  const uint32_t rounded = abs_bits + 0xfffU + mantissa_odd;
+  return sign | static_cast<uint16_t>((rounded - 0x38000000U) >> 13);
+}
+
+inline auto half_to_float(uint16_t half) -> float {
+  const uint32_t sign = static_cast<uint32_t>(half & 0x8000U) << 16;
+  const uint32_t exponent = (half >> 10) & 0x1fU;
+  const uint32_t mantissa = half & 0x3ffU;
+
+  uint32_t bits = 0;
+  if (exponent == 0x1fU) {
+    bits = sign | 0x7f800000U | (mantissa << 13);
+  } else if (exponent == 0) {
+    // zero or subnormal
+    const float value = static_cast<float>(mantissa) / 16777216.0F;
+    std::memcpy(&bits, &value, sizeof(bits));
+    bits |= sign;
+  } else {
+    bits = sign | ((exponent + 112U) << 23) | (mantissa << 13);
+  }
+  float result = 0.0F;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+// bfloat16 is the upper 16 bits of a float: the same range, but only 8 bits of
+// mantissa
+inline auto float_to_bfloat16(float value) -> uint16_t {
+  uint32_t bits = 0;
+  std::memcpy(&bits, &value, sizeof(bits));
+  if ((bits & 0x7fffffffU) > 0x7f800000U) {
+    // NaN: make sure rounding doesn't turn it into infinity
+    return static_cast<uint16_t>((bits >> 16) | 0x40U);
+  }
+  const uint32_t lsb = (bits >> 16) & 1U;
+  return static_cast<uint16_t>((bits + 0x7fffU + lsb) >> 16);
+}
+
+inline auto bfloat16_to_float(uint16_t value) -> float {
+  const uint32_t bits = static_cast<uint32_t>(value) << 16;
+  float result = 0.0F;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+#if defined(TDOANN_SIMD_X86)
+
+// The kernels are compiled for AVX2 + FMA, and F16C for the half precision
+// conversion. CPU detection is only carried out once.
+inline auto has_avx2_f16c() -> bool {
+  static const bool supported = []() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+           __builtin_cpu_supports("f16c");
+  }();
+  return supported;
+}
+
+// Each of the loaders converts the 8 codes starting at p to float
+
+struct HalfLoader {
+  TDOANN_TARGET_AVX2_F16C static auto load(const uint16_t *p) -> __m256 {
+    return _mm256_cvtph_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+  }
+};
+
+struct BFloat16Loader {
+  TDOANN_TARGET_AVX2 static auto load(const uint16_t *p) -> __m256 {
+    const __m256i wide = _mm256_cvtepu16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16));
+  }
+};
+
+struct Int8Loader {
+  TDOANN_TARGET_AVX2 static auto load(const int8_t *p) -> __m256 {
+    return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p))));
+  }
+};
+
+// sum of w * (x - y)^2, with w = 1 if weights is null
+template <typename Loader, typename Code>
+TDOANN_TARGET_AVX2_F16C inline auto
+quantized_sum_squared_diff_avx2(const Code *x, const Code *y,
+                                const float *weights, std::size_t n,
+                                std::size_t &done) -> float {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256 d0 = _mm256_sub_ps(Loader::load(x + i), Loader::load(y + i));
+    __m256 d1 =
+        _mm256_sub_ps(Loader::load(x + i + 8), Loader::load(y + i + 8));
+    const __m256 wd0 =
+        weights != nullptr ? _mm256_mul_ps(_mm256_loadu_ps(weights + i), d0)
+                           : d0;
+    const __m256 wd1 =
+        weights != nullptr
+            ? _mm256_mul_ps(_mm256_loadu_ps(weights + i + 8), d1)
+            : d1;
+    acc0 = _mm256_fmadd_ps(wd0, d0, acc0);
+    acc1 = _mm256_fmadd_ps(wd1, d1, acc1);
+  }
+  for (; i + 8 <= n; i += 8) {
+    __m256 d0 = _mm256_sub_ps(Loader::load(x + i), Loader::load(y + i));
+    const __m256 wd0 =
+        weights != nullptr ? _mm256_mul_ps(_mm256_loadu_ps(weights + i), d0)
+                           : d0;
+    acc0 = _mm256_fmadd_ps(wd0, d0, acc0);
+  }
+  done = i;
+  return hsum_avx2(_mm256_add_ps(acc0, acc1));
+}
+
+// sum of w * x * y, with w = 1 if weights is null
+template <typename Loader, typename Code>
+TDOANN_TARGET_AVX2_F16C inline auto
+quantized_sum_product_avx2(const Code *x, const Code *y, const float *weights,
+                           std::size_t n, std::size_t &done) -> float {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256 x0 = Loader::load(x + i);
+    __m256 x1 = Loader::load(x + i + 8);
+    if (weights != nullptr) {
+      x0 = _mm256_mul_ps(_mm256_loadu_ps(weights + i), x0);
+      x1 = _mm256_mul_ps(_mm256_loadu_ps(weights + i + 8), x1);
+    }
+    acc0 = _mm256_fmadd_ps(x0, Loader::load(y + i), acc0);
+    acc1 = _mm256_fmadd_ps(x1, Loader::load(y + i + 8), acc1);
+  }
+  for (; i + 8 <= n; i += 8) {
+    __m256 x0 = Loader::load(x + i);
+    if (weights != nullptr) {
+      x0 = _mm256_mul_ps(_mm256_loadu_ps(weights + i), x0);
+    }
+    acc0 = _mm256_fmadd_ps(x0, Loader::load(y + i), acc0);
+  }
+  done = i;
+  return hsum_avx2(_mm256_add_ps(acc0, acc1));
+}
+
+#endif // TDOANN_SIMD_X86
+
+// Codecs convert float data to codes, and calculate the sum of squared
+// differences and the inner product of two encoded items. fit creates a codec
+// for a dataset: only Int8Codec needs to look at the data.
+
+struct Float16Codec {
+  using Code = uint16_t;
+
+  static auto fit(const std::vector<float> & /* data */,
+                  std::size_t /* ndim */, bool /* symmetric */)
+      -> Float16Codec {
+    return {};
+  }
+
+  static auto encode(float x, std::size_t /* d */) -> Code {
+    return float_to_half(x);
+  }
+
+  auto sum_squared_diff(const Code *x, const Code *y, std::size_t n) const
+      -> float {
+    float sum = 0.0F;
+    std::size_t i = 0;
+#if defined(TDOANN_SIMD_X86)
+    if (has_avx2_f16c()) {
+      sum = quantized_sum_squared_diff_avx2<HalfLoader>(x, y, nullptr, n, i);
+    }
+#endif
+    for (; i < n; i++) {
+      const float diff = half_to_float(x[i]) - half_to_float(y[i]);
+      sum += diff * diff;
+    }
+    return sum;
+  }
+
+  auto sum_product(const Code *x, const Code *y, std::size_t n) const
+      -> float {
+    float sum = 0.0F;
+    std::size_t i = 0;
+#if defined(TDOANN_SIMD_X86)
+    if (has_avx2_f16c()) {
+      sum = quantized_sum_product_avx2<HalfLoader>(x, y, nullptr, n, i);
+    }
+#endif
+    for (; i < n; i++) {
+      sum += half_to_float(x[i]) * half_to_float(y[i]);
+    }
+    return sum;
+  }
+};
+
+struct BFloat16Codec {
+  using Code = uint16_t;
+
+  static auto fit(const std::vector<float> & /* data */,
+                  std::size_t /* ndim */, bool /* symmetric */)
+      -> BFloat16Codec {
+    return {};
+  }
+
+  static auto encode(float x, std::size_t /* d */) -> Code {
+    return float_to_bfloat16(x);
+  }
+
+  auto sum_squared_diff(const Code *x, const Code *y, std::size_t n) const
+      -> float {
+    float sum = 0.0F;
+    std::size_t i = 0;
+#if defined(TDOANN_SIMD_X86)
+    if (has_avx2_f16c()) {
+      sum =
+          quantized_sum_squared_diff_avx2<BFloat16Loader>(x, y, nullptr, n, i);
+    }
+#endif
+    for (; i < n; i++) {
+      const float diff = bfloat16_to_float(x[i]) - bfloat16_to_float(y[i]);
+      sum += diff * diff;
+    }
+    return sum;
+  }
+
+  auto sum_product(const Code *x, const Code *y, std::size_t n) const
+      -> float {
+    float sum = 0.0F;
+    std::size_t i = 0;
+#if defined(TDOANN_SIMD_X86)
+    if (has_avx2_f16c()) {
+      sum = quantized_sum_product_avx2<BFloat16Loader>(x, y, nullptr, n, i);
+    }
+#endif
+    for (; i < n; i++) {
+      sum += bfloat16_to_float(x[i]) * bfloat16_to_float(y[i]);
+    }
+    return sum;
+  }
+};
+
+// Scalar quantization: feature d is stored as a signed code c in [-127, 127],
+// standing for offset[d] + scale[d] * c, using the range of that feature in
+// the data the codec was fit on. Values outside that range (e.g. in query
+// data) are clamped. The offset cancels out of a difference, and is zero when
+// fit for an inner product (symmetric = true), so both kernels only need the
+// codes and the squared scale of each feature.
+struct Int8Codec {
+  using Code = int8_t;
+
+  std::vector<float> offset;
+  std::vector<float> scale;
+  std::vector<float> weights;
+
+  static auto fit(const std::vector<float> &data, std::size_t ndim,
+                  bool symmetric) -> Int8Codec {
+    constexpr float max_code = 127.0F;
+    std::vector<float> min_value(ndim, 0.0F);
+    std::vector<float> max_value(ndim, 0.0F);
+    if (!data.empty()) {
+      std::copy(data.begin(), data.begin() + ndim, min_value.begin());
+      std::copy(data.begin(), data.begin() + ndim, max_value.begin());
+    }
+    for (std::size_t i = 0; i < data.size(); i += ndim) {
+      for (std::size_t d = 0; d < ndim; d++) {
+        min_value[d] = std::min(min_value[d], data[i + d]);
+        max_value[d] = std::max(max_value[d], data[i + d]);
+      }
+    }
+
+    Int8Codec codec;
+    codec.offset.resize(ndim);
+    codec.scale.resize(ndim);
+    codec.weights.resize(ndim);
+    for (std::size_t d = 0; d < ndim; d++) {
+      if (symmetric) {
+        codec.offset[d] = 0.0F;
+        codec.scale[d] =
+            std::max(std::abs(min_value[d]), std::abs(max_value[d])) /
+            max_code;
+      } else {
+        codec.offset[d] = 0.5F * (min_value[d] + max_value[d]);
+        codec.scale[d] = 0.5F * (max_value[d] - min_value[d]) / max_code;
+      }
+      codec.weights[d] = codec.scale[d] * codec.scale[d];
+    }
+    return codec;
+  }
+
+  auto encode(float x, std::size_t d) const -> Code {
+    if (scale[d] == 0.0F) {
+      return 0;
+    }
+    const float code = std::nearbyint((x - offset[d]) / scale[d]);
+    return static_cast<Code>(std::clamp(code, -127.0F, 127.0F));
+  }
+
+  auto sum_squared_diff(const Code *x, const Code *y, std::size_t n) const
+      -> float {
+    float sum = 0.0F;
+    std::size_t i = 0;
+#if defined(TDOANN_SIMD_X86)
+    if (has_avx2_f16c()) {
+      sum = quantized_sum_squared_diff_avx2<Int8Loader>(x, y, weights.data(),
+                                                        n, i);
+    }
+#endif
+    for (; i < n; i++) {
+      const auto diff = static_cast<float>(x[i] - y[i]);
+      sum += weights[i] * diff * diff;
+    }
+    return sum;
+  }
+
+  auto sum_product(const Code *x, const Code *y, std::size_t n) const
+      -> float {
+    float sum = 0.0F;
+    std::size_t i = 0;
+#if defined(TDOANN_SIMD_X86)
+    if (has_avx2_f16c()) {
+      sum = quantized_sum_product_avx2<Int8Loader>(x, y, weights.data(), n, i);
+    }
+#endif
+    for (; i < n; i++) {
+      sum += weights[i] * static_cast<float>(x[i]) * static_cast<float>(y[i]);
+    }
+    return sum;
+  }
+};
+
+// How the distance is calculated from the codes. The inner product metrics
+// assume the data has been normalized (and centered for correlation) before
+// encoding.
+enum class QuantizedMetric {
+  SquaredEuclidean,
+  Euclidean,
+  // 1 - inner product: cosine, correlation and dot
+  InnerProduct,
+  // -log2(inner product): alternative-cosine and alternative-dot
+  AlternativeInnerProduct
+};
+
+inline auto is_inner_product(QuantizedMetric metric) -> bool {
+  return metric == QuantizedMetric::InnerProduct ||
+         metric == QuantizedMetric::AlternativeInnerProduct;
+}
+
+// The distance for metric from sum, which is the sum of squared differences
+// for the Euclidean metrics and the inner product for the others
+template <typename Out>
+auto quantized_distance(QuantizedMetric metric, float sum) -> Out {
+  switch (metric) {
+  case QuantizedMetric::SquaredEuclidean:
+    return sum;
+  case QuantizedMetric::Euclidean:
+    return std::sqrt(sum);
+  case QuantizedMetric::InnerProduct:
+    return std::max(Out{1} - sum, Out{0});
+  case QuantizedMetric::AlternativeInnerProduct:
+    if (sum <= 0) {
+      return std::numeric_limits<Out>::max();
+    }
+    return -std::log2(sum);
+  }
+  return Out{0};
+}
+
+template <typename Codec>
+auto quantize(const std::vector<float> &data, std::size_t ndim,
+              const Codec &codec) -> std::vector<typename Codec::Code> {
+  std::vector<typename Codec::Code> codes(data.size());
+  for (std::size_t i = 0; i < data.size(); i += ndim) {
+    for (std::size_t d = 0; d < ndim; d++) {
+      codes[i + d] = codec.encode(data[i + d], d);
+    }
+  }
+  return codes;
+}
+
+// Distance calculator which stores the data with reduced precision. The data
+// passed to the constructor is preprocessed (if needed) and encoded, and only
+// the codes are kept. For query distances, the codec is fit on the reference
+// data and used for both.
+template <typename Codec, typename Out, typename Idx = uint32_t>
+class QuantizedDistanceCalculator : public BaseDistance<Out, Idx> {
+public:
+  using Code = typename Codec::Code;
+
+  // self-distance
+  QuantizedDistanceCalculator(std::vector<float> data, std::size_t ndim,
+                              QuantizedMetric metric,
+                              PreprocessFunc<float> preprocess_func = nullptr)
+      : ndim(ndim), metric(metric),
+        codec(prepare(data, ndim, metric, preprocess_func)),
+        x(quantize(data, ndim, codec)), nx(x.size() / ndim), ny(nx),
+        self(true) {}
+
+  QuantizedDistanceCalculator(std::vector<float> xdata,
+                              std::vector<float> ydata, std::size_t ndim,
+                              QuantizedMetric metric,
+                              PreprocessFunc<float> preprocess_func = nullptr)
+      : ndim(ndim), metric(metric),
+        codec(prepare(xdata, ndim, metric, preprocess_func)),
+        x(quantize(xdata, ndim, codec)), nx(x.size() / ndim),
+        y(quantize(prepare_query(ydata, ndim, preprocess_func), ndim, codec)),
+        ny(y.size() / ndim), self(false) {}
+
+  std::size_t get_nx() const override { return nx; }
+  std::size_t get_ny() const override { return ny; }
+
+  Out calculate(const Idx &i, const Idx &j) const override {
+    const Code *xi = x.data() + ndim * i;
+    const Code *yj = (self ? x.data() : y.data()) + ndim * j;
+    const float sum = is_inner_product(metric)
+                          ? codec.sum_product(xi, yj, ndim)
+                          : codec.sum_squared_diff(xi, yj, ndim);
+    return quantized_distance<Out>(metric, sum);
+  }
+
+  void prefetch(const Idx &i) const override {
+    prefetch_bytes(x.data() + ndim * i, ndim * sizeof(Code));
+  }
+
+  // bytes used to store the data
+  auto data_size() const -> std::size_t {
+    return (x.size() + y.size()) * sizeof(Code);
+  }
+
+private:
+  std::size_t ndim;
+  QuantizedMetric metric;
+  Codec codec;
+  std::vector<Code> x;
+  std::size_t nx;
+  std::vector<Code> y;
+  std::size_t ny;
+  bool self;
+
+  static auto prepare(std::vector<float> &data, std::size_t ndim,
+                      QuantizedMetric metric,
+                      PreprocessFunc<float> preprocess_func) -> Codec {
+    if (preprocess_func) {
+      preprocess_func(data, ndim);
+    }
+    return Codec::fit(data, ndim, is_inner_product(metric));
+  }
+
+  static auto prepare_query(std::vector<float> &data, std::size_t ndim,
+                            PreprocessFunc<float> preprocess_func)
+      -> const std::vector<float> & {
+    if (preprocess_func) {
+      preprocess_func(data, ndim);
+    }
+    return data;
+  }
+};
+
+// true if NbrHeap has a vector of flags (like NNDHeap)
+template <typename NbrHeap, typename = void>
+struct HasFlags : std::false_type {};
+
+template <typename NbrHeap>
+struct HasFlags<NbrHeap, std::void_t<decltype(std::declval<NbrHeap>().flags)>>
+    : std::true_type {};
+
+// Recalculate the distances to the neighbors of each item in heap with
+// distance, and reorder each row so it is still a heap. Use this with a full
+// precision calculator to correct the distances found with reduced precision
+// data: the more neighbors there are in heap, the more chance that the true
+// nearest neighbors are among them. As in graph search, the neighbor is the
+// first argument to distance.calculate and the item the second. Any flags are
+// moved with their neighbors.
+template <typename NbrHeap, typename Out = typename NbrHeap::DistanceOut,
+          typename Idx = typename NbrHeap::Index>
+void rerank(NbrHeap &heap, const BaseDistance<Out, Idx> &distance,
+            std::size_t n_threads, ProgressBase &progress,
+            const Executor &executor) {
+  struct Entry {
+    Out dist{0};
+    Idx idx{0};
+    uint8_t flag{0};
+  };
+  const std::size_t n_nbrs = heap.n_nbrs;
+  auto worker = [&](std::size_t begin, std::size_t end) {
+    std::vector<Entry> row(n_nbrs);
+    for (std::size_t i = begin; i < end; i++) {
+      const std::size_t start = i * n_nbrs;
+      for (std::size_t j = 0; j < n_nbrs; j++) {
+        auto &entry = row[j];
+        entry.idx = heap.idx[start + j];
+        entry.dist = entry.idx == heap.npos()
+                         ? heap.dist[start + j]
+                         : distance.calculate(entry.idx, static_cast<Idx>(i));
+        if constexpr (HasFlags<NbrHeap>::value) {
+          entry.flag = heap.flags[start + j];
+        }
+      }
+      // in decreasing order of distance is a valid max heap (missing neighbors
+      // first)
+      std::sort(row.begin(), row.end(), [](const Entry &a, const Entry &b) {
+        return a.dist > b.dist;
+      });
+      for (std::size_t j = 0; j < n_nbrs; j++) {
+        heap.dist[start + j] = row[j].dist;
+        heap.idx[start + j] = row[j].idx;
+        if constexpr (HasFlags<NbrHeap>::value) {
+          heap.flags[start + j] = row[j].flag;
+        }
+      }
+    }
+  };
+  dispatch_work(worker, heap.n_points, n_threads, progress, executor);
+}
+
+} // namespace tdoann
+
+// NOLINTEND(readability-identifier-length)
+
+#endif // TDOANN_QUANTIZE_H
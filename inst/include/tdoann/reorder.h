@@ -0,0 +1,260 @@
+// BSD 2-Clause License
+//
+// Copyright 2024 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_REORDER_H
+#define TDOANN_REORDER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include "nngraph.h"
+#include "rptree.h"
+#include "rptreeimplicit.h"
+
+namespace tdoann {
+
+// Relabel the items of a graph (and the rows of the data it was built from)
+// so that neighbors have nearby ids. Items are then close together in memory
+// when they are close together in the graph, so a graph search or a local join
+// touches fewer cache lines and pages. Ids in results found with the
+// reordered graph and data must be mapped back with Permutation::to_old (or
+// restore_ids). A saved index file is reordered like this (see
+// rnn_index_save), with the order saved alongside it.
+
+// order[new_id] = old_id and rank[old_id] = new_id
+template <typename Idx> struct Permutation {
+  std::vector<Idx> order;
+  std::vector<Idx> rank;
+
+  explicit Permutation(std::vector<Idx> order)
+      : order(std::move(order)), rank(this->order.size()) {
+    for (std::size_t i = 0; i < this->order.size(); i++) {
+      rank[this->order[i]] = static_cast<Idx>(i);
+    }
+  }
+
+  auto size() const -> std::size_t { return order.size(); }
+  auto to_old(Idx new_id) const -> Idx { return order[new_id]; }
+  auto to_new(Idx old_id) const -> Idx { return rank[old_id]; }
+};
+
+template <typename Out, typename Idx, typename Func>
+void for_each_edge(const SparseNNGraph<Out, Idx> &graph, Func func) {
+  for (std::size_t i = 0; i < graph.n_points; i++) {
+    for (std::size_t j = graph.row_ptr[i]; j < graph.row_ptr[i + 1]; j++) {
+      func(static_cast<Idx>(i), graph.col_idx[j]);
+    }
+  }
+}
+
+template <typename Out, typename Idx, typename Func>
+void for_each_edge(const NNGraph<Out, Idx> &graph, Func func) {
+  for (std::size_t i = 0, ij = 0; i < graph.n_points; i++) {
+    for (std::size_t j = 0; j < graph.n_nbrs; j++, ij++) {
+      func(static_cast<Idx>(i), graph.idx[ij]);
+    }
+  }
+}
+
+// Reverse Cuthill-McKee ordering of the graph, treating its edges as
+// undirected: a breadth-first search from a vertex of lowest degree, visiting
+// the neighbors of each vertex in order of increasing degree, repeated for
+// each connected component, with the final order reversed. This keeps the ids
+// of each item's neighbors in a narrow band around its own id.
+template <typename Graph, typename Idx = typename Graph::Index>
+auto rcm_order(const Graph &graph) -> Permutation<Idx> {
+  constexpr auto npos = static_cast<Idx>(-1);
+  const std::size_t n_points = graph.n_points;
+
+  // undirected adjacency lists in CSR form
+  std::vector<std::size_t> adj_ptr(n_points + 1, 0);
+  for_each_edge(graph, [&](Idx i, Idx j) {
+    if (j != npos && j != i) {
+      adj_ptr[i + 1]++;
+      adj_ptr[j + 1]++;
+    }
+  });
+  std::partial_sum(adj_ptr.begin(), adj_ptr.end(), adj_ptr.begin());
+  std::vector<Idx> adj(adj_ptr.back());
+  std::vector<std::size_t> fill(adj_ptr.begin(), adj_ptr.end() - 1);
+  for_each_edge(graph, [&](Idx i, Idx j) {
+    if (j != npos && j != i) {
+      adj[fill[i]++] = j;
+      adj[fill[j]++] = i;
+    }
+  });
+  auto degree = [&](Idx i) { return adj_ptr[i + 1] - adj_ptr[i]; };
+
+  std::vector<Idx> by_degree(n_points);
+  std::iota(by_degree.begin(), by_degree.end(), 0);
+  std::stable_sort(by_degree.begin(), by_degree.end(),
+                   [&](Idx a, Idx b) { return degree(a) < degree(b); });
+
+  std::vector<Idx> order;
+  order.reserve(n_points);
+  std::vector<uint8_t> visited(n_points, 0);
+  for (auto start : by_degree) {
+    if (visited[start] != 0) {
+      continue;
+    }
+    visited[start] = 1;
+    // order doubles as the breadth-first search queue
+    std::size_t head = order.size();
+    order.push_back(start);
+    while (head < order.size()) {
+      const Idx vertex = order[head++];
+      const std::size_t first_nbr = order.size();
+      for (auto k = adj_ptr[vertex]; k < adj_ptr[vertex + 1]; k++) {
+        const Idx nbr = adj[k];
+        if (visited[nbr] == 0) {
+          visited[nbr] = 1;
+          order.push_back(nbr);
+        }
+      }
+      std::stable_sort(order.begin() + first_nbr, order.end(),
+                       [&](Idx a, Idx b) { return degree(a) < degree(b); });
+    }
+  }
+  std::reverse(order.begin(), order.end());
+  return Permutation<Idx>(std::move(order));
+}
+
+// Move the rows of row-major data (ndim values per item) into the new order
+template <typename T, typename Idx>
+auto permute_rows(const std::vector<T> &data, std::size_t ndim,
+                  const Permutation<Idx> &perm) -> std::vector<T> {
+  std::vector<T> result(data.size());
+  for (std::size_t i = 0; i < perm.size(); i++) {
+    const auto old_begin =
+        data.begin() + perm.to_old(static_cast<Idx>(i)) * ndim;
+    std::copy(old_begin, old_begin + ndim, result.begin() + i * ndim);
+  }
+  return result;
+}
+
+// The graph with item i relabelled perm.to_new(i): rows are moved and the
+// neighbor ids in them are updated
+template <typename Out, typename Idx>
+auto permute(const SparseNNGraph<Out, Idx> &graph,
+             const Permutation<Idx> &perm) -> SparseNNGraph<Out, Idx> {
+  constexpr auto npos = static_cast<Idx>(-1);
+  std::vector<std::size_t> row_ptr(graph.n_points + 1, 0);
+  std::vector<Idx> col_idx(graph.col_idx.size());
+  std::vector<Out> dist(graph.dist.size());
+  for (std::size_t i = 0; i < graph.n_points; i++) {
+    const Idx old_i = perm.to_old(static_cast<Idx>(i));
+    const auto begin = graph.row_ptr[old_i];
+    const auto end = graph.row_ptr[old_i + 1];
+    row_ptr[i + 1] = row_ptr[i] + (end - begin);
+    for (auto j = begin, k = row_ptr[i]; j < end; j++, k++) {
+      const Idx nbr = graph.col_idx[j];
+      col_idx[k] = nbr == npos ? npos : perm.to_new(nbr);
+      dist[k] = graph.dist[j];
+    }
+  }
+  SparseNNGraph<Out, Idx> result(row_ptr, col_idx, dist);
+  if (!graph.deleted.empty()) {
+    result.deleted = permute_rows(graph.deleted, 1, perm);
+  }
+  return result;
+}
+
+template <typename Out, typename Idx>
+auto permute(const NNGraph<Out, Idx> &graph, const Permutation<Idx> &perm)
+    -> NNGraph<Out, Idx> {
+  constexpr auto npos = static_cast<Idx>(-1);
+  NNGraph<Out, Idx> result(graph.n_points, graph.n_nbrs);
+  for (std::size_t i = 0; i < graph.n_points; i++) {
+    const std::size_t old_ij = perm.to_old(static_cast<Idx>(i)) * graph.n_nbrs;
+    const std::size_t ij = i * graph.n_nbrs;
+    for (std::size_t j = 0; j < graph.n_nbrs; j++) {
+      const Idx nbr = graph.idx[old_ij + j];
+      result.idx[ij + j] = nbr == npos ? npos : perm.to_new(nbr);
+      result.dist[ij + j] = graph.dist[old_ij + j];
+    }
+  }
+  if (!graph.deleted.empty()) {
+    result.deleted = permute_rows(graph.deleted, 1, perm);
+  }
+  return result;
+}
+
+// Relabel the items in the leaves of a search tree. Ids which are out of range
+// for perm are left as they are, so that they are still rejected when the
+// tree is checked later.
+template <typename Tree, typename Idx>
+void permute_leaves(Tree &tree, const Permutation<Idx> &perm) {
+  for (auto &idx : tree.indices) {
+    if (static_cast<std::size_t>(idx) < perm.size()) {
+      idx = perm.to_new(idx);
+    }
+  }
+}
+
+template <typename In, typename Idx>
+void permute(std::vector<SearchTree<In, Idx>> &forest,
+             const Permutation<Idx> &perm) {
+  for (auto &tree : forest) {
+    permute_leaves(tree, perm);
+  }
+}
+
+// the hyperplanes of implicit trees are defined by pairs of items, which must
+// also be relabelled
+template <typename Idx>
+void permute(std::vector<SearchTreeImplicit<Idx>> &forest,
+             const Permutation<Idx> &perm) {
+  for (auto &tree : forest) {
+    permute_leaves(tree, perm);
+    for (auto &[left, right] : tree.normal_indices) {
+      if (static_cast<std::size_t>(left) < perm.size()) {
+        left = perm.to_new(left);
+      }
+      if (static_cast<std::size_t>(right) < perm.size()) {
+        right = perm.to_new(right);
+      }
+    }
+  }
+}
+
+// Map neighbor ids found with the reordered graph back to the original ids,
+// where order[new_id] = old_id (e.g. Permutation::order)
+template <typename Idx, typename Order>
+void restore_ids(std::vector<Idx> &idx, const Order &order) {
+  constexpr auto npos = static_cast<Idx>(-1);
+  for (auto &id : idx) {
+    if (id != npos) {
+      id = order[id];
+    }
+  }
+}
+
+} // namespace tdoann
+
+#endif // TDOANN_REORDER_H
@@ -32,6 +32,7 @@
 #include <limits>
 #include <numeric>
 #include <tuple>
+#include <unordered_set>
 #include <vector>
 
 #include "distancebase.h"
@@ -662,7 +663,7 @@ std::vector<Idx> search_indices(const SearchTree<In, Idx> &tree,
 
 template <typename In, typename Out, typename Idx>
 void search_tree_heap_cache(const SearchTree<In, Idx> &tree,
-                            const VectorDistance<In, Out, Idx> &distance, Idx i,
+                            const QueryVectorDistance<In, Out, Idx> &distance, Idx i,
                             RandomIntGenerator<Idx> &rng,
                             NNHeap<Out, Idx> &current_graph,
                             std::unordered_set<Idx> &seen) {
@@ -679,7 +680,7 @@ void search_tree_heap_cache(const SearchTree<In, Idx> &tree,
 
 template <typename In, typename Out, typename Idx>
 void search_tree_heap(const SearchTree<In, Idx> &tree,
-                      const VectorDistance<In, Out, Idx> &distance, Idx i,
+                      const QueryVectorDistance<In, Out, Idx> &distance, Idx i,
                       RandomIntGenerator<Idx> &rng,
                       NNHeap<Out, Idx> &current_graph) {
   std::vector<Idx> leaf_indices = search_indices(tree, distance.get_y(i), rng);
@@ -692,7 +693,7 @@ void search_tree_heap(const SearchTree<In, Idx> &tree,
 
 template <typename In, typename Out, typename Idx>
 void search_forest_cache(const std::vector<SearchTree<In, Idx>> &forest,
-                         const VectorDistance<In, Out, Idx> &distance, Idx i,
+                         const QueryVectorDistance<In, Out, Idx> &distance, Idx i,
                          RandomIntGenerator<Idx> &rng,
                          NNHeap<Out, Idx> &current_graph) {
   std::unordered_set<Idx> seen;
@@ -704,7 +705,7 @@ void search_forest_cache(const std::vector<SearchTree<In, Idx>> &forest,
 
 template <typename In, typename Out, typename Idx>
 void search_forest(const std::vector<SearchTree<In, Idx>> &forest,
-                   const VectorDistance<In, Out, Idx> &distance, Idx i,
+                   const QueryVectorDistance<In, Out, Idx> &distance, Idx i,
                    RandomIntGenerator<Idx> &rng,
                    NNHeap<Out, Idx> &current_graph) {
   for (const auto &tree : forest) {
@@ -715,7 +716,7 @@ void search_forest(const std::vector<SearchTree<In, Idx>> &forest,
 template <typename In, typename Out, typename Idx>
 NNHeap<Out, Idx>
 search_forest(const std::vector<SearchTree<In, Idx>> &forest,
-              const VectorDistance<In, Out, Idx> &distance, uint32_t n_nbrs,
+              const QueryVectorDistance<In, Out, Idx> &distance, uint32_t n_nbrs,
               ParallelRandomIntProvider<Idx> &rng_provider, bool cache,
               std::size_t n_threads, ProgressBase &progress,
               const Executor &executor) {
@@ -845,6 +846,39 @@ std::vector<Tree> filter_top_n_trees(const std::vector<Tree> &forest,
   return top_n_trees;
 }
 
+// remove deleted items from the leaves of a search tree so they are never
+// returned by a search. The leaf ranges in children are updated to point into
+// the compacted indices: this works for any tree with a leaf range in children
+// and an is_leaf method, i.e. explicit, implicit and sparse search trees.
+template <typename Tree>
+void remove_deleted(Tree &tree, const std::vector<uint8_t> &deleted) {
+  std::vector<typename Tree::Index> retained;
+  retained.reserve(tree.indices.size());
+  for (std::size_t i = 0; i < tree.children.size(); ++i) {
+    if (!tree.is_leaf(i)) {
+      continue;
+    }
+    auto [start, end] = tree.children[i];
+    const std::size_t leaf_start = retained.size();
+    for (auto j = start; j < end; ++j) {
+      const auto idx = tree.indices[j];
+      if (deleted[idx] == 0) {
+        retained.push_back(idx);
+      }
+    }
+    tree.children[i] = std::make_pair(leaf_start, retained.size());
+  }
+  tree.indices = std::move(retained);
+}
+
+template <typename Tree>
+void remove_deleted(std::vector<Tree> &forest,
+                    const std::vector<uint8_t> &deleted) {
+  for (auto &tree : forest) {
+    remove_deleted(tree, deleted);
+  }
+}
+
 } // namespace tdoann
 
 #endif // TDOANN_RPTREE_H
@@ -32,6 +32,7 @@
 #include <limits>
 #include <numeric>
 #include <tuple>
+#include <unordered_set>
 #include <vector>
 
 #include "distancebase.h"
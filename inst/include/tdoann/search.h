@@ -27,6 +27,9 @@
 #ifndef TDOANN_SEARCH_H
 #define TDOANN_SEARCH_H
 
+#include <utility>
+#include <vector>
+
 #include "bvset.h"
 #include "distancebase.h"
 #include "nbrqueue.h"
@@ -36,15 +39,22 @@
 
 namespace tdoann {
 
-template <typename Out, typename Idx>
-void nn_query(const SparseNNGraph<Out, Idx> &search_graph,
+// Search the graph for the neighbors of each query item. Graph is a
+// SparseNNGraph, or anything with the same read-only interface, e.g. a
+// SparseNNGraphView of a mapped index file.
+template <typename Out, typename Idx, typename Graph>
+void nn_query(const Graph &search_graph,
               NNHeap<Out, Idx> &nn_heap, const BaseDistance<Out, Idx> &distance,
               double epsilon, std::size_t max_distance_calculations,
               std::vector<std::size_t> &distance_counts, std::size_t n_threads,
               ProgressBase &progress, const Executor &executor) {
+  EpochSetPool<> visited_sets;
   auto worker = [&](std::size_t begin, std::size_t end) {
+    auto visited = visited_sets.acquire();
     non_search_query(nn_heap, distance, search_graph, epsilon,
-                     max_distance_calculations, distance_counts, begin, end);
+                     max_distance_calculations, distance_counts, begin, end,
+                     *visited);
+    visited_sets.release(std::move(visited));
   };
   progress.set_n_iters(1);
   ExecutionParams exec_params{100 * n_threads};
@@ -59,21 +69,51 @@ auto pop(std::priority_queue<T, Container, Compare> &queue) -> T {
   return result;
 }
 
-template <typename Out, typename Idx>
+// remove any items which are deleted in search_graph from the neighbors of i
+template <typename Out, typename Idx, typename Graph>
+void remove_deleted(NNHeap<Out, Idx> &current_graph, std::size_t i,
+                    const Graph &search_graph) {
+  constexpr auto npos = static_cast<Idx>(-1);
+
+  std::vector<std::pair<Out, Idx>> retained;
+  retained.reserve(current_graph.n_nbrs);
+  for (std::size_t j = 0; j < current_graph.n_nbrs; j++) {
+    auto nbr = current_graph.index(i, j);
+    if (nbr != npos && !search_graph.is_deleted(nbr)) {
+      retained.emplace_back(current_graph.distance(i, j), nbr);
+    }
+  }
+  current_graph.reset(i, i + 1);
+  for (const auto &[dist, nbr] : retained) {
+    current_graph.checked_push(i, dist, nbr);
+  }
+}
+
+// Search for the neighbors of queries begin to end - 1. visited is cleared
+// for each query, so one set can be reused for any number of queries (see
+// EpochSetPool), rather than set up for each.
+template <typename Out, typename Idx, typename Graph>
 void non_search_query(NNHeap<Out, Idx> &current_graph,
                       const BaseDistance<Out, Idx> &distance,
-                      const SparseNNGraph<Out, Idx> &search_graph,
+                      const Graph &search_graph,
                       double epsilon, std::size_t max_distance_calculations,
                       std::vector<std::size_t> &distance_counts,
-                      std::size_t begin, std::size_t end) {
+                      std::size_t begin, std::size_t end,
+                      EpochSet<> &visited) {
   constexpr auto npos = static_cast<Idx>(-1);
 
   const std::size_t n_nbrs = current_graph.n_nbrs;
   const double distance_scale = 1.0 + epsilon;
 
+  // the unvisited neighbors of a vertex and their distances to the query
+  std::vector<Idx> candidates;
+  std::vector<Out> candidate_dists;
+
   for (std::size_t query_idx = begin; query_idx < end; query_idx++) {
-    auto visited = create_set(search_graph.n_points);
+    const auto query = static_cast<Idx>(query_idx);
+    visited.clear(search_graph.n_points);
     NbrQueue<Out, Idx> seed_set;
+    bool has_deleted_seed = false;
     for (std::size_t j = 0; j < n_nbrs; j++) {
       Idx candidate_idx = current_graph.index(query_idx, j);
       if (candidate_idx == npos) {
@@ -81,6 +121,12 @@ void non_search_query(NNHeap<Out, Idx> &current_graph,
       }
       seed_set.emplace(current_graph.distance(query_idx, j), candidate_idx);
       mark_visited(visited, candidate_idx);
+      has_deleted_seed =
+          has_deleted_seed || search_graph.is_deleted(candidate_idx);
+    }
+    // deleted items are still used as seeds but can't be returned
+    if (has_deleted_seed) {
+      remove_deleted(current_graph, query_idx, search_graph);
     }
 
     double distance_bound =
@@ -96,14 +142,34 @@ void non_search_query(NNHeap<Out, Idx> &current_graph,
         break;
       }
       auto vertex_idx = vertex.second;
+
+      // Gather the unvisited neighbors first (no more than the remaining
+      // distance calculations allow), so their data can be prefetched and
+      // their distances calculated together, rather than waiting on memory
+      // for each neighbor in turn.
       const std::size_t max_candidates = search_graph.n_nbrs(vertex_idx);
-      for (std::size_t k = 0; k < max_candidates; k++) {
+      const std::size_t max_batch =
+          max_distance_calculations - n_searches_for_query;
+      candidates.clear();
+      for (std::size_t k = 0;
+           k < max_candidates && candidates.size() < max_batch; k++) {
         auto candidate_idx = search_graph.index(vertex_idx, k);
         if (candidate_idx == npos ||
             has_been_and_mark_visited(visited, candidate_idx)) {
           continue;
         }
-        auto dist = distance.calculate(candidate_idx, query_idx);
+        candidates.push_back(candidate_idx);
+      }
+      for (const auto &candidate_idx : candidates) {
+        distance.prefetch(candidate_idx);
+      }
+      candidate_dists.resize(candidates.size());
+      distance.calculate_block(candidates.data(), candidates.size(), &query, 1,
+                               candidate_dists.data());
+
+      for (std::size_t c = 0; c < candidates.size(); c++) {
+        auto candidate_idx = candidates[c];
+        auto dist = candidate_dists[c];
         n_searches_for_query++;
         if (n_searches_for_query >= max_distance_calculations) {
           break;
@@ -111,8 +177,11 @@ void non_search_query(NNHeap<Out, Idx> &current_graph,
         if (static_cast<double>(dist) >= distance_bound) {
           continue;
         }
-        current_graph.checked_push(query_idx, dist, candidate_idx);
         seed_set.emplace(dist, candidate_idx);
+        if (search_graph.is_deleted(candidate_idx)) {
+          continue;
+        }
+        current_graph.checked_push(query_idx, dist, candidate_idx);
         distance_bound =
             distance_scale *
             static_cast<double>(current_graph.max_distance(query_idx));
@@ -122,6 +191,19 @@ void non_search_query(NNHeap<Out, Idx> &current_graph,
   }
 }
 
+template <typename Out, typename Idx, typename Graph>
+void non_search_query(NNHeap<Out, Idx> &current_graph,
+                      const BaseDistance<Out, Idx> &distance,
+                      const Graph &search_graph,
+                      double epsilon, std::size_t max_distance_calculations,
+                      std::vector<std::size_t> &distance_counts,
+                      std::size_t begin, std::size_t end) {
+  EpochSet<> visited;
+  non_search_query(current_graph, distance, search_graph, epsilon,
+                   max_distance_calculations, distance_counts, begin, end,
+                   visited);
+}
+
 } // namespace tdoann
 
 #endif // TDOANN_SEARCH_H
@@ -0,0 +1,221 @@
+// BSD 2-Clause License
+//
+// Copyright 2024 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_TOMBSTONE_H
+#define TDOANN_TOMBSTONE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "distancebase.h"
+#include "heap.h"
+#include "nngraph.h"
+#include "parallel.h"
+#include "progressbase.h"
+
+namespace tdoann {
+
+// Repair a graph after items have been deleted (see NNGraph::mark_deleted and
+// SparseNNGraph::mark_deleted). An item which is not deleted but has a deleted
+// neighbor d loses that edge and instead is connected to the nearest of the
+// neighbors of d (the 2-hop neighbors of the item through d) which are not
+// themselves deleted. The neighbors of deleted items are left as they are:
+// after the repair, no remaining item links to them.
+
+template <typename Out, typename Idx>
+void repair_knn_graph_impl(const NNGraph<Out, Idx> &graph,
+                           const BaseDistance<Out, Idx> &distance,
+                           NNHeap<Out, Idx> &heap, std::size_t begin,
+                           std::size_t end) {
+  constexpr auto npos = static_cast<Idx>(-1);
+  const std::size_t n_nbrs = graph.n_nbrs;
+
+  for (auto i = begin, innbrs = begin * n_nbrs; i < end;
+       i++, innbrs += n_nbrs) {
+    const auto idx_i = static_cast<Idx>(i);
+    const bool is_deleted = graph.is_deleted(idx_i);
+    for (auto idx_ij = innbrs; idx_ij < innbrs + n_nbrs; idx_ij++) {
+      const auto nbr = graph.idx[idx_ij];
+      if (nbr == npos) {
+        continue;
+      }
+      if (is_deleted || !graph.is_deleted(nbr)) {
+        heap.checked_push(idx_i, graph.dist[idx_ij], nbr);
+        continue;
+      }
+      const std::size_t nnbrs = static_cast<std::size_t>(nbr) * n_nbrs;
+      for (auto idx_nk = nnbrs; idx_nk < nnbrs + n_nbrs; idx_nk++) {
+        const auto nbr2 = graph.idx[idx_nk];
+        if (nbr2 == npos || nbr2 == idx_i || graph.is_deleted(nbr2) ||
+            heap.contains(idx_i, nbr2)) {
+          continue;
+        }
+        heap.checked_push(idx_i, distance.calculate(nbr2, idx_i), nbr2);
+      }
+    }
+  }
+}
+
+template <typename Out, typename Idx>
+auto repair_knn_graph(const NNGraph<Out, Idx> &graph,
+                      const BaseDistance<Out, Idx> &distance,
+                      std::size_t n_threads, ProgressBase &progress,
+                      const Executor &executor) -> NNGraph<Out, Idx> {
+  auto heap = init_heap(graph);
+  auto worker = [&](std::size_t begin, std::size_t end) {
+    repair_knn_graph_impl(graph, distance, heap, begin, end);
+  };
+  dispatch_work(worker, graph.n_points, n_threads, progress, executor);
+  sort_heap(heap, n_threads, progress, executor);
+
+  auto result = heap_to_graph(heap);
+  result.deleted = graph.deleted;
+  return result;
+}
+
+// The search graph has a variable number of neighbors per item so the repair
+// is done in place: each edge to a deleted item is replaced by one of the
+// 2-hop candidates. If there aren't enough candidates, the edge is left
+// pointing at the deleted item, to be removed by remove_deleted_edges.
+template <typename Out, typename Idx>
+void repair_search_graph_impl(const SparseNNGraph<Out, Idx> &graph,
+                              const BaseDistance<Out, Idx> &distance,
+                              SparseNNGraph<Out, Idx> &result,
+                              std::size_t begin, std::size_t end) {
+  // a zero distance is treated as a missing edge when the graph is returned to
+  // R, so a replacement can't have one
+  constexpr auto min_dist = (std::numeric_limits<Out>::min)();
+
+  std::vector<std::pair<Out, Idx>> candidates;
+  for (auto i = begin; i < end; i++) {
+    const auto idx_i = static_cast<Idx>(i);
+    if (graph.is_deleted(idx_i)) {
+      continue;
+    }
+    const auto nbrs_begin = graph.col_idx.begin() + graph.row_ptr[i];
+    const auto nbrs_end = graph.col_idx.begin() + graph.row_ptr[i + 1];
+
+    std::size_t n_deleted = 0;
+    candidates.clear();
+    for (auto nbr_it = nbrs_begin; nbr_it != nbrs_end; ++nbr_it) {
+      const auto nbr = *nbr_it;
+      if (!graph.is_deleted(nbr)) {
+        continue;
+      }
+      ++n_deleted;
+      for (auto k = graph.row_ptr[nbr]; k < graph.row_ptr[nbr + 1]; k++) {
+        const auto nbr2 = graph.col_idx[k];
+        if (nbr2 == idx_i || graph.is_deleted(nbr2) ||
+            std::find(nbrs_begin, nbrs_end, nbr2) != nbrs_end) {
+          continue;
+        }
+        candidates.emplace_back(Out{}, nbr2);
+      }
+    }
+    if (n_deleted == 0) {
+      continue;
+    }
+
+    // two deleted neighbors can share neighbors
+    std::sort(candidates.begin(), candidates.end(),
+              [](const auto &a, const auto &b) { return a.second < b.second; });
+    candidates.erase(std::unique(candidates.begin(), candidates.end(),
+                                 [](const auto &a, const auto &b) {
+                                   return a.second == b.second;
+                                 }),
+                     candidates.end());
+    for (auto &[dist, nbr2] : candidates) {
+      dist = (std::max)(distance.calculate(nbr2, idx_i), min_dist);
+    }
+    const auto n_replaced = (std::min)(n_deleted, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + n_replaced,
+                      candidates.end());
+
+    std::size_t n_used = 0;
+    for (auto ij = graph.row_ptr[i]; ij < graph.row_ptr[i + 1]; ij++) {
+      if (!graph.is_deleted(graph.col_idx[ij])) {
+        continue;
+      }
+      if (n_used == n_replaced) {
+        break;
+      }
+      result.dist[ij] = candidates[n_used].first;
+      result.col_idx[ij] = candidates[n_used].second;
+      ++n_used;
+    }
+  }
+}
+
+// Remove the edges from items which are not deleted to items which are
+template <typename Out, typename Idx>
+auto remove_deleted_edges(const SparseNNGraph<Out, Idx> &graph)
+    -> SparseNNGraph<Out, Idx> {
+  std::vector<std::size_t> row_ptr(graph.n_points + 1, 0);
+  std::vector<Idx> col_idx;
+  std::vector<Out> dist;
+  col_idx.reserve(graph.col_idx.size());
+  dist.reserve(graph.dist.size());
+  for (std::size_t i = 0; i < graph.n_points; i++) {
+    const bool is_deleted = graph.is_deleted(static_cast<Idx>(i));
+    for (auto ij = graph.row_ptr[i]; ij < graph.row_ptr[i + 1]; ij++) {
+      if (!is_deleted && graph.is_deleted(graph.col_idx[ij])) {
+        continue;
+      }
+      col_idx.push_back(graph.col_idx[ij]);
+      dist.push_back(graph.dist[ij]);
+    }
+    row_ptr[i + 1] = col_idx.size();
+  }
+  SparseNNGraph<Out, Idx> result(row_ptr, col_idx, dist);
+  result.deleted = graph.deleted;
+  return result;
+}
+
+// Each edge to a deleted item is replaced by a 2-hop candidate where possible
+// and removed otherwise, so the result has no edges from remaining items to
+// deleted items
+template <typename Out, typename Idx>
+auto repair_search_graph(const SparseNNGraph<Out, Idx> &graph,
+                         const BaseDistance<Out, Idx> &distance,
+                         std::size_t n_threads, ProgressBase &progress,
+                         const Executor &executor) -> SparseNNGraph<Out, Idx> {
+  SparseNNGraph<Out, Idx> result(graph.row_ptr, graph.col_idx, graph.dist);
+  result.deleted = graph.deleted;
+  auto worker = [&](std::size_t begin, std::size_t end) {
+    repair_search_graph_impl(graph, distance, result, begin, end);
+  };
+  ExecutionParams exec_params{100 * n_threads};
+  dispatch_work(worker, graph.n_points, n_threads, exec_params, progress,
+                executor);
+  return remove_deleted_edges(result);
+}
+
+} // namespace tdoann
+
+#endif // TDOANN_TOMBSTONE_H
@@ -111,6 +111,38 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// rnn_entry_layers_build
+List rnn_entry_layers_build(const NumericMatrix& data, const std::string& metric, std::size_t n_nbrs, std::size_t n_threads, bool verbose);
+RcppExport SEXP _rnndescent_rnn_entry_layers_build(SEXP dataSEXP, SEXP metricSEXP, SEXP n_nbrsSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const NumericMatrix& >::type data(dataSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_nbrs(n_nbrsSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_entry_layers_build(data, metric, n_nbrs, n_threads, verbose));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rnn_entry_layers_search
+List rnn_entry_layers_search(const NumericMatrix& reference, const NumericMatrix& query, const List& entry_layers, uint32_t n_nbrs, const std::string& metric, std::size_t n_threads, bool verbose);
+RcppExport SEXP _rnndescent_rnn_entry_layers_search(SEXP referenceSEXP, SEXP querySEXP, SEXP entry_layersSEXP, SEXP n_nbrsSEXP, SEXP metricSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const NumericMatrix& >::type reference(referenceSEXP);
+    Rcpp::traits::input_parameter< const NumericMatrix& >::type query(querySEXP);
+    Rcpp::traits::input_parameter< const List& >::type entry_layers(entry_layersSEXP);
+    Rcpp::traits::input_parameter< uint32_t >::type n_nbrs(n_nbrsSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_entry_layers_search(reference, query, entry_layers, n_nbrs, metric, n_threads, verbose));
+    return rcpp_result_gen;
+END_RCPP
+}
 // rnn_reverse_nbr_size
 IntegerVector rnn_reverse_nbr_size(const IntegerMatrix& nn_idx, std::size_t nnbrs, std::size_t len, bool include_self);
 RcppExport SEXP _rnndescent_rnn_reverse_nbr_size(SEXP nn_idxSEXP, SEXP nnbrsSEXP, SEXP lenSEXP, SEXP include_selfSEXP) {
@@ -125,6 +157,40 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// rnn_index_save
+void rnn_index_save(const std::string& filename, const NumericMatrix& data, const List& reference_graph_list, const List& search_forest, const std::string& metric, const std::string& actual_metric, bool use_alt_metric, bool reorder);
+RcppExport SEXP _rnndescent_rnn_index_save(SEXP filenameSEXP, SEXP dataSEXP, SEXP reference_graph_listSEXP, SEXP search_forestSEXP, SEXP metricSEXP, SEXP actual_metricSEXP, SEXP use_alt_metricSEXP, SEXP reorderSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string& >::type filename(filenameSEXP);
+    Rcpp::traits::input_parameter< const NumericMatrix& >::type data(dataSEXP);
+    Rcpp::traits::input_parameter< const List& >::type reference_graph_list(reference_graph_listSEXP);
+    Rcpp::traits::input_parameter< const List& >::type search_forest(search_forestSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type actual_metric(actual_metricSEXP);
+    Rcpp::traits::input_parameter< bool >::type use_alt_metric(use_alt_metricSEXP);
+    Rcpp::traits::input_parameter< bool >::type reorder(reorderSEXP);
+    rnn_index_save(filename, data, reference_graph_list, search_forest, metric, actual_metric, use_alt_metric, reorder);
+    return R_NilValue;
+END_RCPP
+}
+// rnn_index_query
+List rnn_index_query(const std::string& filename, const NumericMatrix& query, uint32_t n_nbrs, double epsilon, double max_search_fraction, std::size_t n_threads, bool verbose);
+RcppExport SEXP _rnndescent_rnn_index_query(SEXP filenameSEXP, SEXP querySEXP, SEXP n_nbrsSEXP, SEXP epsilonSEXP, SEXP max_search_fractionSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string& >::type filename(filenameSEXP);
+    Rcpp::traits::input_parameter< const NumericMatrix& >::type query(querySEXP);
+    Rcpp::traits::input_parameter< uint32_t >::type n_nbrs(n_nbrsSEXP);
+    Rcpp::traits::input_parameter< double >::type epsilon(epsilonSEXP);
+    Rcpp::traits::input_parameter< double >::type max_search_fraction(max_search_fractionSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_index_query(filename, query, n_nbrs, epsilon, max_search_fraction, n_threads, verbose));
+    return rcpp_result_gen;
+END_RCPP
+}
 // rnn_sparse_idx_to_graph_self
 List rnn_sparse_idx_to_graph_self(const IntegerVector& ind, const IntegerVector& ptr, const NumericVector& data, std::size_t ndim, const IntegerMatrix& idx, const std::string& metric, std::size_t n_threads, bool verbose);
 RcppExport SEXP _rnndescent_rnn_sparse_idx_to_graph_self(SEXP indSEXP, SEXP ptrSEXP, SEXP dataSEXP, SEXP ndimSEXP, SEXP idxSEXP, SEXP metricSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
@@ -241,52 +307,57 @@ BEGIN_RCPP
 END_RCPP
 }
 // rnn_descent
-List rnn_descent(const NumericMatrix& data, const IntegerMatrix& nn_idx, const NumericMatrix& nn_dist, const std::string& metric, std::size_t max_candidates, uint32_t n_iters, double delta, bool low_memory, bool weight_by_degree, std::size_t n_threads, bool verbose, const std::string& progress_type);
-RcppExport SEXP _rnndescent_rnn_descent(SEXP dataSEXP, SEXP nn_idxSEXP, SEXP nn_distSEXP, SEXP metricSEXP, SEXP max_candidatesSEXP, SEXP n_itersSEXP, SEXP deltaSEXP, SEXP low_memorySEXP, SEXP weight_by_degreeSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP, SEXP progress_typeSEXP) {
+List rnn_descent(const NumericMatrix& data, const IntegerMatrix& nn_idx, const NumericMatrix& nn_dist, std::size_t n_converged, const std::string& metric, const std::string& precision, std::size_t max_candidates, uint32_t n_iters, double delta, bool low_memory, bool concurrent_updates, bool weight_by_degree, std::size_t n_threads, bool verbose, const std::string& progress_type);
+RcppExport SEXP _rnndescent_rnn_descent(SEXP dataSEXP, SEXP nn_idxSEXP, SEXP nn_distSEXP, SEXP n_convergedSEXP, SEXP metricSEXP, SEXP precisionSEXP, SEXP max_candidatesSEXP, SEXP n_itersSEXP, SEXP deltaSEXP, SEXP low_memorySEXP, SEXP concurrent_updatesSEXP, SEXP weight_by_degreeSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP, SEXP progress_typeSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const NumericMatrix& >::type data(dataSEXP);
     Rcpp::traits::input_parameter< const IntegerMatrix& >::type nn_idx(nn_idxSEXP);
     Rcpp::traits::input_parameter< const NumericMatrix& >::type nn_dist(nn_distSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_converged(n_convergedSEXP);
     Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type precision(precisionSEXP);
     Rcpp::traits::input_parameter< std::size_t >::type max_candidates(max_candidatesSEXP);
     Rcpp::traits::input_parameter< uint32_t >::type n_iters(n_itersSEXP);
     Rcpp::traits::input_parameter< double >::type delta(deltaSEXP);
     Rcpp::traits::input_parameter< bool >::type low_memory(low_memorySEXP);
+    Rcpp::traits::input_parameter< bool >::type concurrent_updates(concurrent_updatesSEXP);
     Rcpp::traits::input_parameter< bool >::type weight_by_degree(weight_by_degreeSEXP);
     Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
     Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
     Rcpp::traits::input_parameter< const std::string& >::type progress_type(progress_typeSEXP);
-    rcpp_result_gen = Rcpp::wrap(rnn_descent(data, nn_idx, nn_dist, metric, max_candidates, n_iters, delta, low_memory, weight_by_degree, n_threads, verbose, progress_type));
+    rcpp_result_gen = Rcpp::wrap(rnn_descent(data, nn_idx, nn_dist, n_converged, metric, precision, max_candidates, n_iters, delta, low_memory, concurrent_updates, weight_by_degree, n_threads, verbose, progress_type));
     return rcpp_result_gen;
 END_RCPP
 }
 // rnn_logical_descent
-List rnn_logical_descent(const LogicalMatrix& data, const IntegerMatrix& nn_idx, const NumericMatrix& nn_dist, const std::string& metric, std::size_t max_candidates, uint32_t n_iters, double delta, bool low_memory, bool weight_by_degree, std::size_t n_threads, bool verbose, const std::string& progress_type);
-RcppExport SEXP _rnndescent_rnn_logical_descent(SEXP dataSEXP, SEXP nn_idxSEXP, SEXP nn_distSEXP, SEXP metricSEXP, SEXP max_candidatesSEXP, SEXP n_itersSEXP, SEXP deltaSEXP, SEXP low_memorySEXP, SEXP weight_by_degreeSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP, SEXP progress_typeSEXP) {
+List rnn_logical_descent(const LogicalMatrix& data, const IntegerMatrix& nn_idx, const NumericMatrix& nn_dist, std::size_t n_converged, const std::string& metric, std::size_t max_candidates, uint32_t n_iters, double delta, bool low_memory, bool concurrent_updates, bool weight_by_degree, std::size_t n_threads, bool verbose, const std::string& progress_type);
+RcppExport SEXP _rnndescent_rnn_logical_descent(SEXP dataSEXP, SEXP nn_idxSEXP, SEXP nn_distSEXP, SEXP n_convergedSEXP, SEXP metricSEXP, SEXP max_candidatesSEXP, SEXP n_itersSEXP, SEXP deltaSEXP, SEXP low_memorySEXP, SEXP concurrent_updatesSEXP, SEXP weight_by_degreeSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP, SEXP progress_typeSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const LogicalMatrix& >::type data(dataSEXP);
     Rcpp::traits::input_parameter< const IntegerMatrix& >::type nn_idx(nn_idxSEXP);
     Rcpp::traits::input_parameter< const NumericMatrix& >::type nn_dist(nn_distSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_converged(n_convergedSEXP);
     Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
     Rcpp::traits::input_parameter< std::size_t >::type max_candidates(max_candidatesSEXP);
     Rcpp::traits::input_parameter< uint32_t >::type n_iters(n_itersSEXP);
     Rcpp::traits::input_parameter< double >::type delta(deltaSEXP);
     Rcpp::traits::input_parameter< bool >::type low_memory(low_memorySEXP);
+    Rcpp::traits::input_parameter< bool >::type concurrent_updates(concurrent_updatesSEXP);
     Rcpp::traits::input_parameter< bool >::type weight_by_degree(weight_by_degreeSEXP);
     Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
     Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
     Rcpp::traits::input_parameter< const std::string& >::type progress_type(progress_typeSEXP);
-    rcpp_result_gen = Rcpp::wrap(rnn_logical_descent(data, nn_idx, nn_dist, metric, max_candidates, n_iters, delta, low_memory, weight_by_degree, n_threads, verbose, progress_type));
+    rcpp_result_gen = Rcpp::wrap(rnn_logical_descent(data, nn_idx, nn_dist, n_converged, metric, max_candidates, n_iters, delta, low_memory, concurrent_updates, weight_by_degree, n_threads, verbose, progress_type));
     return rcpp_result_gen;
 END_RCPP
 }
 // rnn_sparse_descent
-List rnn_sparse_descent(const IntegerVector& ind, const IntegerVector& ptr, const NumericVector& data, std::size_t ndim, const IntegerMatrix& nn_idx, const NumericMatrix& nn_dist, const std::string& metric, std::size_t max_candidates, uint32_t n_iters, double delta, bool low_memory, bool weight_by_degree, std::size_t n_threads, bool verbose, const std::string& progress_type);
-RcppExport SEXP _rnndescent_rnn_sparse_descent(SEXP indSEXP, SEXP ptrSEXP, SEXP dataSEXP, SEXP ndimSEXP, SEXP nn_idxSEXP, SEXP nn_distSEXP, SEXP metricSEXP, SEXP max_candidatesSEXP, SEXP n_itersSEXP, SEXP deltaSEXP, SEXP low_memorySEXP, SEXP weight_by_degreeSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP, SEXP progress_typeSEXP) {
+List rnn_sparse_descent(const IntegerVector& ind, const IntegerVector& ptr, const NumericVector& data, std::size_t ndim, const IntegerMatrix& nn_idx, const NumericMatrix& nn_dist, std::size_t n_converged, const std::string& metric, std::size_t max_candidates, uint32_t n_iters, double delta, bool low_memory, bool concurrent_updates, bool weight_by_degree, std::size_t n_threads, bool verbose, const std::string& progress_type);
+RcppExport SEXP _rnndescent_rnn_sparse_descent(SEXP indSEXP, SEXP ptrSEXP, SEXP dataSEXP, SEXP ndimSEXP, SEXP nn_idxSEXP, SEXP nn_distSEXP, SEXP n_convergedSEXP, SEXP metricSEXP, SEXP max_candidatesSEXP, SEXP n_itersSEXP, SEXP deltaSEXP, SEXP low_memorySEXP, SEXP concurrent_updatesSEXP, SEXP weight_by_degreeSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP, SEXP progress_typeSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -296,16 +367,69 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< std::size_t >::type ndim(ndimSEXP);
     Rcpp::traits::input_parameter< const IntegerMatrix& >::type nn_idx(nn_idxSEXP);
     Rcpp::traits::input_parameter< const NumericMatrix& >::type nn_dist(nn_distSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_converged(n_convergedSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type max_candidates(max_candidatesSEXP);
+    Rcpp::traits::input_parameter< uint32_t >::type n_iters(n_itersSEXP);
+    Rcpp::traits::input_parameter< double >::type delta(deltaSEXP);
+    Rcpp::traits::input_parameter< bool >::type low_memory(low_memorySEXP);
+    Rcpp::traits::input_parameter< bool >::type concurrent_updates(concurrent_updatesSEXP);
+    Rcpp::traits::input_parameter< bool >::type weight_by_degree(weight_by_degreeSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type progress_type(progress_typeSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_sparse_descent(ind, ptr, data, ndim, nn_idx, nn_dist, n_converged, metric, max_candidates, n_iters, delta, low_memory, concurrent_updates, weight_by_degree, n_threads, verbose, progress_type));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rnn_mmap_descent
+List rnn_mmap_descent(const std::string& filename, std::size_t ndim, uint32_t nnbrs, const std::string& metric, std::size_t max_candidates, uint32_t n_iters, double delta, bool low_memory, bool concurrent_updates, bool weight_by_degree, const std::string& scratch_dir, std::size_t block_size, std::size_t n_threads, bool verbose, const std::string& progress_type);
+RcppExport SEXP _rnndescent_rnn_mmap_descent(SEXP filenameSEXP, SEXP ndimSEXP, SEXP nnbrsSEXP, SEXP metricSEXP, SEXP max_candidatesSEXP, SEXP n_itersSEXP, SEXP deltaSEXP, SEXP low_memorySEXP, SEXP concurrent_updatesSEXP, SEXP weight_by_degreeSEXP, SEXP scratch_dirSEXP, SEXP block_sizeSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP, SEXP progress_typeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string& >::type filename(filenameSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type ndim(ndimSEXP);
+    Rcpp::traits::input_parameter< uint32_t >::type nnbrs(nnbrsSEXP);
     Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
     Rcpp::traits::input_parameter< std::size_t >::type max_candidates(max_candidatesSEXP);
     Rcpp::traits::input_parameter< uint32_t >::type n_iters(n_itersSEXP);
     Rcpp::traits::input_parameter< double >::type delta(deltaSEXP);
     Rcpp::traits::input_parameter< bool >::type low_memory(low_memorySEXP);
+    Rcpp::traits::input_parameter< bool >::type concurrent_updates(concurrent_updatesSEXP);
     Rcpp::traits::input_parameter< bool >::type weight_by_degree(weight_by_degreeSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type scratch_dir(scratch_dirSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type block_size(block_sizeSEXP);
     Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
     Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
     Rcpp::traits::input_parameter< const std::string& >::type progress_type(progress_typeSEXP);
-    rcpp_result_gen = Rcpp::wrap(rnn_sparse_descent(ind, ptr, data, ndim, nn_idx, nn_dist, metric, max_candidates, n_iters, delta, low_memory, weight_by_degree, n_threads, verbose, progress_type));
+    rcpp_result_gen = Rcpp::wrap(rnn_mmap_descent(filename, ndim, nnbrs, metric, max_candidates, n_iters, delta, low_memory, concurrent_updates, weight_by_degree, scratch_dir, block_size, n_threads, verbose, progress_type));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rnn_shutdown_thread_pool
+void rnn_shutdown_thread_pool();
+RcppExport SEXP _rnndescent_rnn_shutdown_thread_pool() {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rnn_shutdown_thread_pool();
+    return R_NilValue;
+END_RCPP
+}
+// rnn_pq_train
+List rnn_pq_train(const NumericMatrix& data, const std::string& metric, std::size_t n_subspaces, std::size_t n_centroids, std::size_t n_iters, std::size_t n_threads, bool verbose);
+RcppExport SEXP _rnndescent_rnn_pq_train(SEXP dataSEXP, SEXP metricSEXP, SEXP n_subspacesSEXP, SEXP n_centroidsSEXP, SEXP n_itersSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const NumericMatrix& >::type data(dataSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_subspaces(n_subspacesSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_centroids(n_centroidsSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_iters(n_itersSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_pq_train(data, metric, n_subspaces, n_centroids, n_iters, n_threads, verbose));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -385,6 +509,63 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// rnn_sparse_repair_deleted
+List rnn_sparse_repair_deleted(const IntegerVector& ind, const IntegerVector& ptr, const NumericVector& data, std::size_t ndim, const IntegerMatrix& idx, const NumericMatrix& dist, const List& search_graph_list, const LogicalVector& deleted, const std::string& metric, std::size_t n_threads, bool verbose);
+RcppExport SEXP _rnndescent_rnn_sparse_repair_deleted(SEXP indSEXP, SEXP ptrSEXP, SEXP dataSEXP, SEXP ndimSEXP, SEXP idxSEXP, SEXP distSEXP, SEXP search_graph_listSEXP, SEXP deletedSEXP, SEXP metricSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const IntegerVector& >::type ind(indSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector& >::type ptr(ptrSEXP);
+    Rcpp::traits::input_parameter< const NumericVector& >::type data(dataSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type ndim(ndimSEXP);
+    Rcpp::traits::input_parameter< const IntegerMatrix& >::type idx(idxSEXP);
+    Rcpp::traits::input_parameter< const NumericMatrix& >::type dist(distSEXP);
+    Rcpp::traits::input_parameter< const List& >::type search_graph_list(search_graph_listSEXP);
+    Rcpp::traits::input_parameter< const LogicalVector& >::type deleted(deletedSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_sparse_repair_deleted(ind, ptr, data, ndim, idx, dist, search_graph_list, deleted, metric, n_threads, verbose));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rnn_repair_deleted
+List rnn_repair_deleted(const NumericMatrix& data, const IntegerMatrix& idx, const NumericMatrix& dist, const List& search_graph_list, const LogicalVector& deleted, const std::string& metric, std::size_t n_threads, bool verbose);
+RcppExport SEXP _rnndescent_rnn_repair_deleted(SEXP dataSEXP, SEXP idxSEXP, SEXP distSEXP, SEXP search_graph_listSEXP, SEXP deletedSEXP, SEXP metricSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const NumericMatrix& >::type data(dataSEXP);
+    Rcpp::traits::input_parameter< const IntegerMatrix& >::type idx(idxSEXP);
+    Rcpp::traits::input_parameter< const NumericMatrix& >::type dist(distSEXP);
+    Rcpp::traits::input_parameter< const List& >::type search_graph_list(search_graph_listSEXP);
+    Rcpp::traits::input_parameter< const LogicalVector& >::type deleted(deletedSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_repair_deleted(data, idx, dist, search_graph_list, deleted, metric, n_threads, verbose));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rnn_logical_repair_deleted
+List rnn_logical_repair_deleted(const LogicalMatrix& data, const IntegerMatrix& idx, const NumericMatrix& dist, const List& search_graph_list, const LogicalVector& deleted, const std::string& metric, std::size_t n_threads, bool verbose);
+RcppExport SEXP _rnndescent_rnn_logical_repair_deleted(SEXP dataSEXP, SEXP idxSEXP, SEXP distSEXP, SEXP search_graph_listSEXP, SEXP deletedSEXP, SEXP metricSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const LogicalMatrix& >::type data(dataSEXP);
+    Rcpp::traits::input_parameter< const IntegerMatrix& >::type idx(idxSEXP);
+    Rcpp::traits::input_parameter< const NumericMatrix& >::type dist(distSEXP);
+    Rcpp::traits::input_parameter< const List& >::type search_graph_list(search_graph_listSEXP);
+    Rcpp::traits::input_parameter< const LogicalVector& >::type deleted(deletedSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_logical_repair_deleted(data, idx, dist, search_graph_list, deleted, metric, n_threads, verbose));
+    return rcpp_result_gen;
+END_RCPP
+}
 // rnn_sparse_random_knn
 List rnn_sparse_random_knn(const IntegerVector& ind, const IntegerVector& ptr, const NumericVector& data, std::size_t ndim, uint32_t nnbrs, const std::string& metric, bool order_by_distance, std::size_t n_threads, bool verbose);
 RcppExport SEXP _rnndescent_rnn_sparse_random_knn(SEXP indSEXP, SEXP ptrSEXP, SEXP dataSEXP, SEXP ndimSEXP, SEXP nnbrsSEXP, SEXP metricSEXP, SEXP order_by_distanceSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
@@ -753,6 +934,74 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// rnn_rp_forest_graph_query
+List rnn_rp_forest_graph_query(const NumericMatrix& reference, const List& reference_graph_list, const NumericMatrix& query, const List& search_forest, uint32_t n_nbrs, const std::string& metric, bool cache, double epsilon, double max_search_fraction, std::size_t n_threads, bool verbose);
+RcppExport SEXP _rnndescent_rnn_rp_forest_graph_query(SEXP referenceSEXP, SEXP reference_graph_listSEXP, SEXP querySEXP, SEXP search_forestSEXP, SEXP n_nbrsSEXP, SEXP metricSEXP, SEXP cacheSEXP, SEXP epsilonSEXP, SEXP max_search_fractionSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const NumericMatrix& >::type reference(referenceSEXP);
+    Rcpp::traits::input_parameter< const List& >::type reference_graph_list(reference_graph_listSEXP);
+    Rcpp::traits::input_parameter< const NumericMatrix& >::type query(querySEXP);
+    Rcpp::traits::input_parameter< const List& >::type search_forest(search_forestSEXP);
+    Rcpp::traits::input_parameter< uint32_t >::type n_nbrs(n_nbrsSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< bool >::type cache(cacheSEXP);
+    Rcpp::traits::input_parameter< double >::type epsilon(epsilonSEXP);
+    Rcpp::traits::input_parameter< double >::type max_search_fraction(max_search_fractionSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_rp_forest_graph_query(reference, reference_graph_list, query, search_forest, n_nbrs, metric, cache, epsilon, max_search_fraction, n_threads, verbose));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rnn_logical_rp_forest_graph_query
+List rnn_logical_rp_forest_graph_query(const LogicalMatrix& reference, const List& reference_graph_list, const LogicalMatrix& query, const List& search_forest, uint32_t n_nbrs, const std::string& metric, bool cache, double epsilon, double max_search_fraction, std::size_t n_threads, bool verbose);
+RcppExport SEXP _rnndescent_rnn_logical_rp_forest_graph_query(SEXP referenceSEXP, SEXP reference_graph_listSEXP, SEXP querySEXP, SEXP search_forestSEXP, SEXP n_nbrsSEXP, SEXP metricSEXP, SEXP cacheSEXP, SEXP epsilonSEXP, SEXP max_search_fractionSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const LogicalMatrix& >::type reference(referenceSEXP);
+    Rcpp::traits::input_parameter< const List& >::type reference_graph_list(reference_graph_listSEXP);
+    Rcpp::traits::input_parameter< const LogicalMatrix& >::type query(querySEXP);
+    Rcpp::traits::input_parameter< const List& >::type search_forest(search_forestSEXP);
+    Rcpp::traits::input_parameter< uint32_t >::type n_nbrs(n_nbrsSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< bool >::type cache(cacheSEXP);
+    Rcpp::traits::input_parameter< double >::type epsilon(epsilonSEXP);
+    Rcpp::traits::input_parameter< double >::type max_search_fraction(max_search_fractionSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_logical_rp_forest_graph_query(reference, reference_graph_list, query, search_forest, n_nbrs, metric, cache, epsilon, max_search_fraction, n_threads, verbose));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rnn_sparse_rp_forest_graph_query
+List rnn_sparse_rp_forest_graph_query(const IntegerVector& ref_ind, const IntegerVector& ref_ptr, const NumericVector& ref_data, const IntegerVector& query_ind, const IntegerVector& query_ptr, const NumericVector& query_data, std::size_t ndim, const List& reference_graph_list, const List& search_forest, uint32_t n_nbrs, const std::string& metric, bool cache, double epsilon, double max_search_fraction, std::size_t n_threads, bool verbose);
+RcppExport SEXP _rnndescent_rnn_sparse_rp_forest_graph_query(SEXP ref_indSEXP, SEXP ref_ptrSEXP, SEXP ref_dataSEXP, SEXP query_indSEXP, SEXP query_ptrSEXP, SEXP query_dataSEXP, SEXP ndimSEXP, SEXP reference_graph_listSEXP, SEXP search_forestSEXP, SEXP n_nbrsSEXP, SEXP metricSEXP, SEXP cacheSEXP, SEXP epsilonSEXP, SEXP max_search_fractionSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const IntegerVector& >::type ref_ind(ref_indSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector& >::type ref_ptr(ref_ptrSEXP);
+    Rcpp::traits::input_parameter< const NumericVector& >::type ref_data(ref_dataSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector& >::type query_ind(query_indSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector& >::type query_ptr(query_ptrSEXP);
+    Rcpp::traits::input_parameter< const NumericVector& >::type query_data(query_dataSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type ndim(ndimSEXP);
+    Rcpp::traits::input_parameter< const List& >::type reference_graph_list(reference_graph_listSEXP);
+    Rcpp::traits::input_parameter< const List& >::type search_forest(search_forestSEXP);
+    Rcpp::traits::input_parameter< uint32_t >::type n_nbrs(n_nbrsSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< bool >::type cache(cacheSEXP);
+    Rcpp::traits::input_parameter< double >::type epsilon(epsilonSEXP);
+    Rcpp::traits::input_parameter< double >::type max_search_fraction(max_search_fractionSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_sparse_rp_forest_graph_query(ref_ind, ref_ptr, ref_data, query_ind, query_ptr, query_data, ndim, reference_graph_list, search_forest, n_nbrs, metric, cache, epsilon, max_search_fraction, n_threads, verbose));
+    return rcpp_result_gen;
+END_RCPP
+}
 // rnn_score_forest
 List rnn_score_forest(const IntegerMatrix& idx, const List& search_forest, uint32_t n_trees, std::size_t n_threads, bool verbose);
 RcppExport SEXP _rnndescent_rnn_score_forest(SEXP idxSEXP, SEXP search_forestSEXP, SEXP n_treesSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
@@ -768,14 +1017,48 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// rnn_rp_forest_remove_deleted
+List rnn_rp_forest_remove_deleted(const List& search_forest, const LogicalVector& deleted);
+RcppExport SEXP _rnndescent_rnn_rp_forest_remove_deleted(SEXP search_forestSEXP, SEXP deletedSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const List& >::type search_forest(search_forestSEXP);
+    Rcpp::traits::input_parameter< const LogicalVector& >::type deleted(deletedSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_rp_forest_remove_deleted(search_forest, deleted));
+    return rcpp_result_gen;
+END_RCPP
+}
 // rnn_query
-List rnn_query(const NumericMatrix& reference, const List& reference_graph_list, const NumericMatrix& query, const IntegerMatrix& nn_idx, const NumericMatrix& nn_dist, const std::string& metric, double epsilon, double max_search_fraction, std::size_t n_threads, bool verbose);
-RcppExport SEXP _rnndescent_rnn_query(SEXP referenceSEXP, SEXP reference_graph_listSEXP, SEXP querySEXP, SEXP nn_idxSEXP, SEXP nn_distSEXP, SEXP metricSEXP, SEXP epsilonSEXP, SEXP max_search_fractionSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+List rnn_query(const NumericMatrix& reference, const List& reference_graph_list, const NumericMatrix& query, const IntegerMatrix& nn_idx, const NumericMatrix& nn_dist, const std::string& metric, const std::string& precision, double epsilon, double max_search_fraction, std::size_t n_threads, bool verbose);
+RcppExport SEXP _rnndescent_rnn_query(SEXP referenceSEXP, SEXP reference_graph_listSEXP, SEXP querySEXP, SEXP nn_idxSEXP, SEXP nn_distSEXP, SEXP metricSEXP, SEXP precisionSEXP, SEXP epsilonSEXP, SEXP max_search_fractionSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const NumericMatrix& >::type reference(referenceSEXP);
+    Rcpp::traits::input_parameter< const List& >::type reference_graph_list(reference_graph_listSEXP);
+    Rcpp::traits::input_parameter< const NumericMatrix& >::type query(querySEXP);
+    Rcpp::traits::input_parameter< const IntegerMatrix& >::type nn_idx(nn_idxSEXP);
+    Rcpp::traits::input_parameter< const NumericMatrix& >::type nn_dist(nn_distSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type precision(precisionSEXP);
+    Rcpp::traits::input_parameter< double >::type epsilon(epsilonSEXP);
+    Rcpp::traits::input_parameter< double >::type max_search_fraction(max_search_fractionSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_query(reference, reference_graph_list, query, nn_idx, nn_dist, metric, precision, epsilon, max_search_fraction, n_threads, verbose));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rnn_pq_query
+List rnn_pq_query(const NumericMatrix& reference, const List& reference_graph_list, const List& pq, const NumericMatrix& query, const IntegerMatrix& nn_idx, const NumericMatrix& nn_dist, const std::string& metric, double epsilon, double max_search_fraction, std::size_t n_threads, bool verbose);
+RcppExport SEXP _rnndescent_rnn_pq_query(SEXP referenceSEXP, SEXP reference_graph_listSEXP, SEXP pqSEXP, SEXP querySEXP, SEXP nn_idxSEXP, SEXP nn_distSEXP, SEXP metricSEXP, SEXP epsilonSEXP, SEXP max_search_fractionSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const NumericMatrix& >::type reference(referenceSEXP);
     Rcpp::traits::input_parameter< const List& >::type reference_graph_list(reference_graph_listSEXP);
+    Rcpp::traits::input_parameter< const List& >::type pq(pqSEXP);
     Rcpp::traits::input_parameter< const NumericMatrix& >::type query(querySEXP);
     Rcpp::traits::input_parameter< const IntegerMatrix& >::type nn_idx(nn_idxSEXP);
     Rcpp::traits::input_parameter< const NumericMatrix& >::type nn_dist(nn_distSEXP);
@@ -784,7 +1067,7 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< double >::type max_search_fraction(max_search_fractionSEXP);
     Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
     Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
-    rcpp_result_gen = Rcpp::wrap(rnn_query(reference, reference_graph_list, query, nn_idx, nn_dist, metric, epsilon, max_search_fraction, n_threads, verbose));
+    rcpp_result_gen = Rcpp::wrap(rnn_pq_query(reference, reference_graph_list, pq, query, nn_idx, nn_dist, metric, epsilon, max_search_fraction, n_threads, verbose));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -852,7 +1135,11 @@ static const R_CallMethodDef CallEntries[] = {
     {"_rnndescent_rnn_brute_force_query", (DL_FUNC) &_rnndescent_rnn_brute_force_query, 6},
     {"_rnndescent_rnn_logical_brute_force_query", (DL_FUNC) &_rnndescent_rnn_logical_brute_force_query, 6},
     {"_rnndescent_rnn_sparse_brute_force_query", (DL_FUNC) &_rnndescent_rnn_sparse_brute_force_query, 11},
+    {"_rnndescent_rnn_entry_layers_build", (DL_FUNC) &_rnndescent_rnn_entry_layers_build, 5},
+    {"_rnndescent_rnn_entry_layers_search", (DL_FUNC) &_rnndescent_rnn_entry_layers_search, 7},
     {"_rnndescent_rnn_reverse_nbr_size", (DL_FUNC) &_rnndescent_rnn_reverse_nbr_size, 4},
+    {"_rnndescent_rnn_index_save", (DL_FUNC) &_rnndescent_rnn_index_save, 8},
+    {"_rnndescent_rnn_index_query", (DL_FUNC) &_rnndescent_rnn_index_query, 7},
     {"_rnndescent_rnn_sparse_idx_to_graph_self", (DL_FUNC) &_rnndescent_rnn_sparse_idx_to_graph_self, 8},
     {"_rnndescent_rnn_idx_to_graph_self", (DL_FUNC) &_rnndescent_rnn_idx_to_graph_self, 5},
     {"_rnndescent_rnn_logical_idx_to_graph_self", (DL_FUNC) &_rnndescent_rnn_logical_idx_to_graph_self, 5},
@@ -860,14 +1147,20 @@ static const R_CallMethodDef CallEntries[] = {
     {"_rnndescent_rnn_logical_idx_to_graph_query", (DL_FUNC) &_rnndescent_rnn_logical_idx_to_graph_query, 6},
     {"_rnndescent_rnn_sparse_idx_to_graph_query", (DL_FUNC) &_rnndescent_rnn_sparse_idx_to_graph_query, 11},
     {"_rnndescent_rnn_merge_nn_all", (DL_FUNC) &_rnndescent_rnn_merge_nn_all, 4},
-    {"_rnndescent_rnn_descent", (DL_FUNC) &_rnndescent_rnn_descent, 12},
-    {"_rnndescent_rnn_logical_descent", (DL_FUNC) &_rnndescent_rnn_logical_descent, 12},
-    {"_rnndescent_rnn_sparse_descent", (DL_FUNC) &_rnndescent_rnn_sparse_descent, 15},
+    {"_rnndescent_rnn_descent", (DL_FUNC) &_rnndescent_rnn_descent, 15},
+    {"_rnndescent_rnn_logical_descent", (DL_FUNC) &_rnndescent_rnn_logical_descent, 14},
+    {"_rnndescent_rnn_sparse_descent", (DL_FUNC) &_rnndescent_rnn_sparse_descent, 17},
+    {"_rnndescent_rnn_mmap_descent", (DL_FUNC) &_rnndescent_rnn_mmap_descent, 15},
+    {"_rnndescent_rnn_shutdown_thread_pool", (DL_FUNC) &_rnndescent_rnn_shutdown_thread_pool, 0},
+    {"_rnndescent_rnn_pq_train", (DL_FUNC) &_rnndescent_rnn_pq_train, 7},
     {"_rnndescent_rnn_sparse_diversify", (DL_FUNC) &_rnndescent_rnn_sparse_diversify, 9},
     {"_rnndescent_rnn_diversify", (DL_FUNC) &_rnndescent_rnn_diversify, 6},
     {"_rnndescent_rnn_logical_diversify", (DL_FUNC) &_rnndescent_rnn_logical_diversify, 6},
     {"_rnndescent_rnn_merge_graph_lists", (DL_FUNC) &_rnndescent_rnn_merge_graph_lists, 2},
     {"_rnndescent_rnn_degree_prune", (DL_FUNC) &_rnndescent_rnn_degree_prune, 3},
+    {"_rnndescent_rnn_sparse_repair_deleted", (DL_FUNC) &_rnndescent_rnn_sparse_repair_deleted, 11},
+    {"_rnndescent_rnn_repair_deleted", (DL_FUNC) &_rnndescent_rnn_repair_deleted, 8},
+    {"_rnndescent_rnn_logical_repair_deleted", (DL_FUNC) &_rnndescent_rnn_logical_repair_deleted, 8},
     {"_rnndescent_rnn_sparse_random_knn", (DL_FUNC) &_rnndescent_rnn_sparse_random_knn, 9},
     {"_rnndescent_rnn_random_knn", (DL_FUNC) &_rnndescent_rnn_random_knn, 6},
     {"_rnndescent_rnn_logical_random_knn", (DL_FUNC) &_rnndescent_rnn_logical_random_knn, 6},
@@ -887,8 +1180,13 @@ static const R_CallMethodDef CallEntries[] = {
     {"_rnndescent_rnn_rp_forest_search", (DL_FUNC) &_rnndescent_rnn_rp_forest_search, 8},
     {"_rnndescent_rnn_logical_rp_forest_search", (DL_FUNC) &_rnndescent_rnn_logical_rp_forest_search, 8},
     {"_rnndescent_rnn_sparse_rp_forest_search", (DL_FUNC) &_rnndescent_rnn_sparse_rp_forest_search, 13},
+    {"_rnndescent_rnn_rp_forest_graph_query", (DL_FUNC) &_rnndescent_rnn_rp_forest_graph_query, 11},
+    {"_rnndescent_rnn_logical_rp_forest_graph_query", (DL_FUNC) &_rnndescent_rnn_logical_rp_forest_graph_query, 11},
+    {"_rnndescent_rnn_sparse_rp_forest_graph_query", (DL_FUNC) &_rnndescent_rnn_sparse_rp_forest_graph_query, 16},
     {"_rnndescent_rnn_score_forest", (DL_FUNC) &_rnndescent_rnn_score_forest, 5},
-    {"_rnndescent_rnn_query", (DL_FUNC) &_rnndescent_rnn_query, 10},
+    {"_rnndescent_rnn_rp_forest_remove_deleted", (DL_FUNC) &_rnndescent_rnn_rp_forest_remove_deleted, 2},
+    {"_rnndescent_rnn_query", (DL_FUNC) &_rnndescent_rnn_query, 11},
+    {"_rnndescent_rnn_pq_query", (DL_FUNC) &_rnndescent_rnn_pq_query, 11},
     {"_rnndescent_rnn_logical_query", (DL_FUNC) &_rnndescent_rnn_logical_query, 10},
     {"_rnndescent_rnn_sparse_query", (DL_FUNC) &_rnndescent_rnn_sparse_query, 15},
     {"_rnndescent_is_binary_metric", (DL_FUNC) &_rnndescent_is_binary_metric, 1},
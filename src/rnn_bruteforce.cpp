@@ -19,6 +19,8 @@
 
 // NOLINTBEGIN(modernize-use-trailing-return-type)
 
+#include <optional>
+
 #include <Rcpp.h>
 
 #include "tdoann/bruteforce.h"
@@ -34,6 +36,41 @@ using Rcpp::LogicalMatrix;
 using Rcpp::NumericMatrix;
 using Rcpp::NumericVector;
 
+// Metrics which can use the tiled inner product brute force search. The
+// pre-processed metrics calculate the inner product on normalized data.
+std::optional<tdoann::InnerProductMetric>
+get_inner_product_metric(const std::string &metric) {
+  using tdoann::InnerProductMetric;
+  const static std::unordered_map<std::string, InnerProductMetric> metric_map{
+      {"sqeuclidean", InnerProductMetric::SquaredEuclidean},
+      {"euclidean", InnerProductMetric::Euclidean},
+      {"cosine", InnerProductMetric::Cosine},
+      {"alternative-cosine", InnerProductMetric::AlternativeCosine},
+      {"cosine-preprocess", InnerProductMetric::InnerProduct},
+      {"correlation-preprocess", InnerProductMetric::InnerProduct},
+      {"dot", InnerProductMetric::Dot},
+      {"alternative-dot", InnerProductMetric::AlternativeDot}};
+  auto it = metric_map.find(metric);
+  if (it == metric_map.end()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+template <typename In, typename Out, typename Idx>
+List rnn_tiled_brute_force_impl(
+    const tdoann::VectorDistance<In, Out, Idx> &distance, std::size_t ndim,
+    tdoann::InnerProductMetric metric, uint32_t nnbrs, std::size_t n_threads,
+    bool verbose) {
+  RPProgress progress(verbose);
+  RParallelExecutor executor;
+
+  auto nn_graph = tdoann::tiled_brute_force_query(
+      distance, ndim, metric, nnbrs, n_threads, progress, executor);
+  constexpr bool unzero = false;
+  return graph_to_r(nn_graph, unzero);
+}
+
 template <typename Out, typename Idx>
 List rnn_brute_force_impl(const tdoann::BaseDistance<Out, Idx> &distance,
                           uint32_t nnbrs, std::size_t n_threads = 0,
@@ -51,6 +88,13 @@ List rnn_brute_force_impl(const tdoann::BaseDistance<Out, Idx> &distance,
 List rnn_brute_force(const NumericMatrix &data, uint32_t nnbrs,
                      const std::string &metric = "euclidean",
                      std::size_t n_threads = 0, bool verbose = false) {
+  if (auto ip_metric = get_inner_product_metric(metric)) {
+    const std::size_t ndim = data.nrow();
+    auto distance_ptr =
+        create_self_distance(r_to_vec<RNN_DEFAULT_IN>(data), ndim, metric);
+    return rnn_tiled_brute_force_impl(*distance_ptr, ndim, *ip_metric, nnbrs,
+                                      n_threads, verbose);
+  }
   auto distance_ptr = create_self_distance(data, metric);
   return rnn_brute_force_impl(*distance_ptr, nnbrs, n_threads, verbose);
 }
@@ -91,6 +135,11 @@ List rnn_brute_force_query(const NumericMatrix &reference,
                            const NumericMatrix &query, uint32_t nnbrs,
                            const std::string &metric = "euclidean",
                            std::size_t n_threads = 0, bool verbose = false) {
+  if (auto ip_metric = get_inner_product_metric(metric)) {
+    auto distance_ptr = create_query_vector_distance(reference, query, metric);
+    return rnn_tiled_brute_force_impl(*distance_ptr, reference.nrow(),
+                                      *ip_metric, nnbrs, n_threads, verbose);
+  }
   auto distance_ptr = create_query_distance(reference, query, metric);
   return rnn_brute_force_query_impl(*distance_ptr, nnbrs, n_threads, verbose);
 }
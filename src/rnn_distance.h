@@ -23,33 +23,41 @@
 #include <memory>
 #include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
 
 #include <Rcpp.h>
 
 #include "tdoann/distancebase.h"
 #include "tdoann/distancebin.h"
+#include "tdoann/distancesimd.h"
+#include "tdoann/indexfile.h"
+#include "tdoann/mmap.h"
+#include "tdoann/pq.h"
+#include "tdoann/quantize.h"
 #include "tdoann/sparse.h"
 
 #include "rnn_util.h"
 
-template <typename In, typename Out>
-const std::unordered_map<std::string, tdoann::DistanceFunc<In, Out>> &
-get_metric_map() {
-  using InIt = tdoann::DataIt<In>;
-  static const std::unordered_map<std::string, tdoann::DistanceFunc<In, Out>>
+// InIt is the iterator type the distance functions are instantiated with: a
+// std::vector iterator for the usual in-memory calculators, or a pointer for
+// data which is not held in a std::vector, such as a memory-mapped file
+template <typename Out, typename InIt>
+const std::unordered_map<std::string, Out (*)(InIt, InIt, InIt)> &
+get_iterator_metric_map() {
+  static const std::unordered_map<std::string, Out (*)(InIt, InIt, InIt)>
       metric_map = {
           {"braycurtis", tdoann::bray_curtis<Out, InIt>},
           {"canberra", tdoann::canberra<Out, InIt>},
           {"chebyshev", tdoann::chebyshev<Out, InIt>},
-          {"correlation", tdoann::correlation<Out, InIt>},
-          {"correlation-preprocess", tdoann::inner_product<Out, InIt>},
-          {"cosine", tdoann::cosine<Out, InIt>},
-          {"alternative-cosine", tdoann::alternative_cosine<Out, InIt>},
-          {"cosine-preprocess", tdoann::inner_product<Out, InIt>},
-          {"dot", tdoann::dot<Out, InIt>},
-          {"alternative-dot", tdoann::alternative_dot<Out, InIt>},
+          {"correlation", tdoann::simd_correlation<Out, InIt>},
+          {"correlation-preprocess", tdoann::simd_inner_product<Out, InIt>},
+          {"cosine", tdoann::simd_cosine<Out, InIt>},
+          {"alternative-cosine", tdoann::simd_alternative_cosine<Out, InIt>},
+          {"cosine-preprocess", tdoann::simd_inner_product<Out, InIt>},
+          {"dot", tdoann::simd_dot<Out, InIt>},
+          {"alternative-dot", tdoann::simd_alternative_dot<Out, InIt>},
           {"dice", tdoann::dice<Out, InIt>},
-          {"euclidean", tdoann::euclidean<Out, InIt>},
+          {"euclidean", tdoann::simd_euclidean<Out, InIt>},
           {"hamming", tdoann::hamming<Out, InIt>},
           {"hellinger", tdoann::hellinger<Out, InIt>},
           {"alternative-hellinger", tdoann::alternative_hellinger<Out, InIt>},
@@ -57,14 +65,14 @@ get_metric_map() {
           {"alternative-jaccard", tdoann::alternative_jaccard<Out, InIt>},
           {"jensenshannon", tdoann::jensen_shannon_divergence<Out, InIt>},
           {"kulsinski", tdoann::kulsinski<Out, InIt>},
-          {"manhattan", tdoann::manhattan<Out, InIt>},
+          {"manhattan", tdoann::simd_manhattan<Out, InIt>},
           {"matching", tdoann::matching<Out, InIt>},
           {"rogerstanimoto", tdoann::rogers_tanimoto<Out, InIt>},
           {"russellrao", tdoann::russell_rao<Out, InIt>},
           {"sokalmichener", tdoann::sokal_michener<Out, InIt>},
           {"sokalsneath", tdoann::sokal_sneath<Out, InIt>},
           {"spearmanr", tdoann::spearmanr<Out, InIt>},
-          {"sqeuclidean", tdoann::squared_euclidean<Out, InIt>},
+          {"sqeuclidean", tdoann::simd_squared_euclidean<Out, InIt>},
           {"symmetrickl", tdoann::symmetric_kl_divergence<Out, InIt>},
           {"trueangular", tdoann::true_angular<Out, InIt>},
           {"tsss", tdoann::tsss<Out, InIt>},
@@ -72,6 +80,12 @@ get_metric_map() {
   return metric_map;
 }
 
+template <typename In, typename Out>
+const std::unordered_map<std::string, tdoann::DistanceFunc<In, Out>> &
+get_metric_map() {
+  return get_iterator_metric_map<Out, tdoann::DataIt<In>>();
+}
+
 template <typename In>
 const std::unordered_map<std::string, tdoann::PreprocessFunc<In>> &
 get_preprocess_map() {
@@ -152,6 +166,17 @@ get_sparse_preprocess_map() {
   return map;
 }
 
+// Dense metrics which cost enough to calculate that, in the multi-threaded
+// cached local join, it's worth claiming a pair before calculating its
+// distance so that no two threads calculate it. For the other dense metrics,
+// claiming a pair costs more than calculating its distance.
+inline bool is_expensive_metric(const std::string &metric) {
+  static const std::unordered_set<std::string> expensive_metrics = {
+      "alternative-hellinger", "hellinger", "jensenshannon", "spearmanr",
+      "symmetrickl"};
+  return expensive_metrics.count(metric) > 0;
+}
+
 template <typename In, typename Out>
 std::pair<tdoann::DistanceFunc<In, Out>, tdoann::PreprocessFunc<In>>
 get_dense_distance_funcs(const std::string &metric) {
@@ -285,6 +310,37 @@ create_query_distance(const Rcpp::LogicalMatrix &reference,
       std::move(ref_vec), std::move(query_vec), ndim, metric);
 }
 
+// Non-owning view of data, with the observations in the columns
+inline auto r_to_view(const Rcpp::NumericMatrix &data)
+    -> tdoann::DataView<double> {
+  return tdoann::DataView<double>::row_major(&data[0], data.ncol(),
+                                             data.nrow());
+}
+
+// Like create_query_distance, but the reference and query data are read in
+// place rather than copied, with each item converted to float when it's used.
+// This is faster only when most of the reference items are never used, as in
+// a graph search. Metrics which preprocess the data still need the copy.
+template <typename Idx = RNN_DEFAULT_IDX>
+std::unique_ptr<tdoann::BaseDistance<RNN_DEFAULT_DIST, Idx>>
+create_query_view_distance(const Rcpp::NumericMatrix &reference,
+                           const Rcpp::NumericMatrix &query,
+                           const std::string &metric) {
+  using In = RNN_DEFAULT_IN;
+  using Out = RNN_DEFAULT_DIST;
+
+  if (get_preprocess_map<In>().count(metric) > 0) {
+    return create_query_distance<Idx>(reference, query, metric);
+  }
+  const auto &metric_map = get_iterator_metric_map<Out, const In *>();
+  if (metric_map.count(metric) == 0) {
+    Rcpp::stop("Bad metric");
+  }
+  return std::make_unique<
+      tdoann::ViewDistanceCalculator<double, In, Out, Idx>>(
+      r_to_view(reference), r_to_view(query), metric_map.at(metric));
+}
+
 template <typename Idx = RNN_DEFAULT_IDX>
 std::unique_ptr<tdoann::VectorDistance<RNN_DEFAULT_IN, RNN_DEFAULT_DIST, Idx>>
 create_query_vector_distance(const Rcpp::NumericMatrix &reference,
@@ -377,6 +433,275 @@ create_self_distance(std::vector<In> data_vec, std::size_t ndim,
                                                          ndim, metric);
 }
 
+// Self distance calculator with the distance function fixed at compile time:
+// metric is only needed to look up any preprocessing
+template <tdoann::DistanceFunc<RNN_DEFAULT_IN, RNN_DEFAULT_DIST> distance_func,
+          typename Idx = RNN_DEFAULT_IDX>
+std::unique_ptr<tdoann::StaticSelfDistanceCalculator<
+    RNN_DEFAULT_IN, RNN_DEFAULT_DIST, Idx, distance_func>>
+create_static_self_distance(const Rcpp::NumericMatrix &data,
+                            const std::string &metric) {
+  using In = RNN_DEFAULT_IN;
+  using Out = RNN_DEFAULT_DIST;
+
+  tdoann::PreprocessFunc<In> preprocess_func = nullptr;
+  const auto &preprocess_map = get_preprocess_map<In>();
+  if (preprocess_map.count(metric) > 0) {
+    preprocess_func = preprocess_map.at(metric);
+  }
+
+  const auto ndim = data.nrow();
+  auto data_vec = r_to_vec<In>(data);
+  return std::make_unique<
+      tdoann::StaticSelfDistanceCalculator<In, Out, Idx, distance_func>>(
+      std::move(data_vec), ndim, preprocess_func);
+}
+
+// Calls func with a self distance calculator for data and returns the result.
+// For the most commonly used metrics, the calculator passed to func has its
+// concrete type, so code templated on the distance type has no virtual calls
+// in its inner loops. Other metrics get a BaseDistance. Each specialization
+// here means another instantiation of func, so keep the list short.
+template <typename Func>
+auto with_self_distance(const Rcpp::NumericMatrix &data,
+                        const std::string &metric, Func &&func) {
+  using Out = RNN_DEFAULT_DIST;
+  using It = tdoann::DataIt<RNN_DEFAULT_IN>;
+
+  if (metric == "sqeuclidean") {
+    return func(*create_static_self_distance<
+                tdoann::simd_squared_euclidean<Out, It>>(data, metric));
+  }
+  if (metric == "euclidean") {
+    return func(
+        *create_static_self_distance<tdoann::simd_euclidean<Out, It>>(data,
+                                                                      metric));
+  }
+  if (metric == "alternative-cosine") {
+    return func(*create_static_self_distance<
+                tdoann::simd_alternative_cosine<Out, It>>(data, metric));
+  }
+  if (metric == "cosine") {
+    return func(
+        *create_static_self_distance<tdoann::simd_cosine<Out, It>>(data,
+                                                                   metric));
+  }
+  if (metric == "manhattan") {
+    return func(
+        *create_static_self_distance<tdoann::simd_manhattan<Out, It>>(data,
+                                                                      metric));
+  }
+  return func(*create_self_distance(data, metric));
+}
+
+// Self distance calculator for row-major float32 data in a memory-mapped file.
+// The data is read-only, so metrics which preprocess it aren't supported
+template <typename Idx = RNN_DEFAULT_IDX>
+std::unique_ptr<tdoann::BaseDistance<RNN_DEFAULT_DIST, Idx>>
+create_mapped_self_distance(const std::string &filename, std::size_t ndim,
+                            const std::string &metric) {
+  using In = float;
+  using Out = RNN_DEFAULT_DIST;
+
+  if (get_preprocess_map<In>().count(metric) > 0) {
+    Rcpp::stop("Metric '" + metric +
+               "' is not supported with memory-mapped data");
+  }
+  const auto &metric_map = get_iterator_metric_map<Out, const In *>();
+  if (metric_map.count(metric) == 0) {
+    Rcpp::stop("Bad metric");
+  }
+
+  tdoann::MappedFile<In> file(filename);
+  if (ndim == 0 || file.size() % ndim != 0) {
+    Rcpp::stop("Size of file '" + filename + "' is not a multiple of ndim");
+  }
+  return std::make_unique<tdoann::MappedSelfDistanceCalculator<In, Out, Idx>>(
+      std::move(file), ndim, metric_map.at(metric));
+}
+
+// Query distance for the reference data of an index file, which is read in
+// place. Metrics that preprocess the data are supported because the reference
+// data was preprocessed when the file was written: only the query data is
+// preprocessed here.
+template <typename Idx = RNN_DEFAULT_IDX>
+std::unique_ptr<tdoann::IndexQueryDistanceCalculator<float, RNN_DEFAULT_DIST,
+                                                     Idx>>
+create_index_query_distance(const tdoann::DataView<float> &reference,
+                            const Rcpp::NumericMatrix &query,
+                            const std::string &metric) {
+  using In = float;
+  using Out = RNN_DEFAULT_DIST;
+
+  const auto &metric_map = get_iterator_metric_map<Out, const In *>();
+  if (metric_map.count(metric) == 0) {
+    Rcpp::stop("Bad metric");
+  }
+  if (static_cast<std::size_t>(query.nrow()) != reference.ndim) {
+    Rcpp::stop("Query data has " + std::to_string(query.nrow()) +
+               " features but the index has " +
+               std::to_string(reference.ndim));
+  }
+  auto query_vec = r_to_vec<In>(query);
+  const auto &preprocess_map = get_preprocess_map<In>();
+  if (preprocess_map.count(metric) > 0) {
+    preprocess_map.at(metric)(query_vec, reference.ndim);
+  }
+  return std::make_unique<tdoann::IndexQueryDistanceCalculator<In, Out, Idx>>(
+      reference, std::move(query_vec), metric_map.at(metric));
+}
+
+// Reduced precision distances
+
+// The metrics which can be calculated from data stored with reduced precision,
+// with the preprocessing their data needs first
+inline const std::unordered_map<
+    std::string,
+    std::pair<tdoann::QuantizedMetric, tdoann::PreprocessFunc<float>>> &
+get_quantized_metric_map() {
+  using tdoann::QuantizedMetric;
+  static const std::unordered_map<
+      std::string,
+      std::pair<QuantizedMetric, tdoann::PreprocessFunc<float>>>
+      metric_map = {
+          {"sqeuclidean", {QuantizedMetric::SquaredEuclidean, nullptr}},
+          {"euclidean", {QuantizedMetric::Euclidean, nullptr}},
+          {"cosine", {QuantizedMetric::InnerProduct, tdoann::normalize<float>}},
+          {"cosine-preprocess",
+           {QuantizedMetric::InnerProduct, tdoann::normalize<float>}},
+          {"alternative-cosine",
+           {QuantizedMetric::AlternativeInnerProduct,
+            tdoann::normalize<float>}},
+          {"dot", {QuantizedMetric::InnerProduct, tdoann::normalize<float>}},
+          {"alternative-dot",
+           {QuantizedMetric::AlternativeInnerProduct,
+            tdoann::normalize<float>}},
+          {"correlation",
+           {QuantizedMetric::InnerProduct,
+            tdoann::mean_center_and_normalize<float>}},
+          {"correlation-preprocess",
+           {QuantizedMetric::InnerProduct,
+            tdoann::mean_center_and_normalize<float>}}};
+  return metric_map;
+}
+
+// Calls func with a default-constructed codec for precision, which is one of
+// "fp16", "bf16" or "int8"
+template <typename Func>
+auto with_codec(const std::string &precision, Func &&func) {
+  if (precision == "fp16") {
+    return func(tdoann::Float16Codec{});
+  }
+  if (precision == "bf16") {
+    return func(tdoann::BFloat16Codec{});
+  }
+  if (precision != "int8") {
+    Rcpp::stop("Unknown precision '" + precision + "'");
+  }
+  return func(tdoann::Int8Codec{});
+}
+
+// feature describes what needs the metric, for the error message if it isn't
+// supported
+inline auto get_quantized_metric(const std::string &metric,
+                                 const std::string &feature)
+    -> std::pair<tdoann::QuantizedMetric, tdoann::PreprocessFunc<float>> {
+  const auto &metric_map = get_quantized_metric_map();
+  if (metric_map.count(metric) == 0) {
+    Rcpp::stop(feature + " is not supported for metric '" + metric + "'");
+  }
+  return metric_map.at(metric);
+}
+
+inline auto get_quantized_metric_for_precision(const std::string &metric,
+                                               const std::string &precision)
+    -> std::pair<tdoann::QuantizedMetric, tdoann::PreprocessFunc<float>> {
+  return get_quantized_metric(metric, "precision = '" + precision + "'");
+}
+
+// Self distance calculator which stores the data with reduced precision: the
+// distances are approximate
+template <typename Idx = RNN_DEFAULT_IDX>
+std::unique_ptr<tdoann::BaseDistance<RNN_DEFAULT_DIST, Idx>>
+create_quantized_self_distance(const Rcpp::NumericMatrix &data,
+                               const std::string &metric,
+                               const std::string &precision) {
+  using Out = RNN_DEFAULT_DIST;
+  const auto quantized_metric =
+      get_quantized_metric_for_precision(metric, precision);
+
+  return with_codec(
+      precision,
+      [&](auto codec) -> std::unique_ptr<tdoann::BaseDistance<Out, Idx>> {
+        using Codec = decltype(codec);
+        return std::make_unique<
+            tdoann::QuantizedDistanceCalculator<Codec, Out, Idx>>(
+            r_to_vec<float>(data), data.nrow(), quantized_metric.first,
+            quantized_metric.second);
+      });
+}
+
+template <typename Idx = RNN_DEFAULT_IDX>
+std::unique_ptr<tdoann::BaseDistance<RNN_DEFAULT_DIST, Idx>>
+create_quantized_query_distance(const Rcpp::NumericMatrix &reference,
+                                const Rcpp::NumericMatrix &query,
+                                const std::string &metric,
+                                const std::string &precision) {
+  using Out = RNN_DEFAULT_DIST;
+  const auto quantized_metric =
+      get_quantized_metric_for_precision(metric, precision);
+
+  return with_codec(
+      precision,
+      [&](auto codec) -> std::unique_ptr<tdoann::BaseDistance<Out, Idx>> {
+        using Codec = decltype(codec);
+        return std::make_unique<
+            tdoann::QuantizedDistanceCalculator<Codec, Out, Idx>>(
+            r_to_vec<float>(reference), r_to_vec<float>(query),
+            reference.nrow(), quantized_metric.first, quantized_metric.second);
+      });
+}
+
+// Product quantized distances
+
+// The product quantizer created by rnn_pq_train
+inline auto r_to_pq(const Rcpp::List &pq) -> tdoann::ProductQuantizer {
+  int ndim = pq["ndim"];
+  int n_subspaces = pq["n_subspaces"];
+  int n_centroids = pq["n_centroids"];
+  tdoann::ProductQuantizer product_quantizer(ndim, n_subspaces, n_centroids);
+  Rcpp::NumericVector centroids = pq["centroids"];
+  if (centroids.size() != product_quantizer.centroids.size()) {
+    Rcpp::stop("Product quantizer has the wrong number of centroids");
+  }
+  std::copy(centroids.begin(), centroids.end(),
+            product_quantizer.centroids.begin());
+  return product_quantizer;
+}
+
+// Query distance calculator for reference data stored as the codes of a
+// product quantizer: the distances are approximate
+template <typename Idx = RNN_DEFAULT_IDX>
+std::unique_ptr<tdoann::BaseDistance<RNN_DEFAULT_DIST, Idx>>
+create_pq_query_distance(const Rcpp::List &pq, const Rcpp::NumericMatrix &query,
+                         const std::string &metric) {
+  using Out = RNN_DEFAULT_DIST;
+  const auto quantized_metric =
+      get_quantized_metric(metric, "Product quantization");
+
+  auto product_quantizer = r_to_pq(pq);
+  if (query.nrow() != product_quantizer.ndim) {
+    Rcpp::stop("Query data has " + std::to_string(query.nrow()) +
+               " features but the product quantizer has " +
+               std::to_string(product_quantizer.ndim));
+  }
+  Rcpp::RawMatrix codes = pq["codes"];
+  return std::make_unique<tdoann::PQQueryDistanceCalculator<Out, Idx>>(
+      std::move(product_quantizer),
+      std::vector<uint8_t>(codes.begin(), codes.end()), r_to_vec<float>(query),
+      quantized_metric.first, quantized_metric.second);
+}
+
 // Sparse distances
 
 template <typename... Args>
@@ -0,0 +1,123 @@
+//  rnndescent -- An R package for nearest neighbor descent
+//
+//  Copyright (C) 2021 James Melville
+//
+//  This file is part of rnndescent
+//
+//  rnndescent is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  rnndescent is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with rnndescent.  If not, see <http://www.gnu.org/licenses/>.
+
+// NOLINTBEGIN(modernize-use-trailing-return-type)
+
+#include <Rcpp.h>
+
+#include "rnndescent/random.h"
+#include "tdoann/entry.h"
+
+#include "rnn_distance.h"
+#include "rnn_heaptor.h"
+#include "rnn_init.h"
+#include "rnn_parallel.h"
+#include "rnn_progress.h"
+#include "rnn_util.h"
+
+using Rcpp::_;
+using Rcpp::IntegerVector;
+using Rcpp::List;
+using Rcpp::NumericMatrix;
+
+template <typename Out, typename Idx>
+List entry_layers_to_r(const tdoann::EntryLayers<Out, Idx> &layers) {
+  List graphs(layers.graphs.size());
+  for (std::size_t l = 0; l < layers.graphs.size(); l++) {
+    graphs[l] = sparse_graph_to_r(layers.graphs[l]);
+  }
+  return List::create(
+      _("ids") = IntegerVector(layers.ids.begin(), layers.ids.end()),
+      _("level_sizes") =
+          IntegerVector(layers.level_sizes.begin(), layers.level_sizes.end()),
+      _("graphs") = graphs);
+}
+
+template <typename Out, typename Idx>
+auto r_to_entry_layers(const List &entry_layers)
+    -> tdoann::EntryLayers<Out, Idx> {
+  tdoann::EntryLayers<Out, Idx> layers;
+  const IntegerVector ids = entry_layers["ids"];
+  const IntegerVector level_sizes = entry_layers["level_sizes"];
+  const List graphs = entry_layers["graphs"];
+  layers.ids.assign(ids.begin(), ids.end());
+  layers.level_sizes.assign(level_sizes.begin(), level_sizes.end());
+  for (R_xlen_t l = 0; l < graphs.size(); l++) {
+    const List graph = graphs[l];
+    layers.graphs.push_back(r_to_sparse_graph<Out, Idx>(graph));
+  }
+  if (!layers.level_sizes.empty() &&
+      (layers.level_sizes.front() != layers.ids.size() ||
+       layers.graphs.size() + 1 != layers.level_sizes.size())) {
+    Rcpp::stop("Bad entry layers");
+  }
+  return layers;
+}
+
+// Sample the (column-oriented) data into the levels of an EntryLayers, with a
+// brute force n_nbrs-nearest neighbor graph for each level but the top
+// [[Rcpp::export]]
+List rnn_entry_layers_build(const NumericMatrix &data,
+                            const std::string &metric, std::size_t n_nbrs,
+                            std::size_t n_threads, bool verbose) {
+  auto distance_ptr = create_self_distance(data, metric);
+  rnndescent::RRand rand;
+  RParallelExecutor executor;
+  RPProgress progress(verbose);
+  const auto layers = tdoann::build_entry_layers(*distance_ptr, n_nbrs, rand,
+                                                 n_threads, progress, executor);
+  return entry_layers_to_r(layers);
+}
+
+// Initial neighbors for a graph search: the entry points found by descending
+// through entry_layers (see rnn_entry_layers_build), filled up with random
+// neighbors if there aren't n_nbrs of them
+// [[Rcpp::export]]
+List rnn_entry_layers_search(const NumericMatrix &reference,
+                             const NumericMatrix &query,
+                             const List &entry_layers, uint32_t n_nbrs,
+                             const std::string &metric, std::size_t n_threads,
+                             bool verbose) {
+  using Out = RNN_DEFAULT_DIST;
+  using Idx = RNN_DEFAULT_IDX;
+
+  // only a few hundred reference items are used for each query
+  auto distance_ptr = create_query_view_distance(reference, query, metric);
+  const auto layers = r_to_entry_layers<Out, Idx>(entry_layers);
+  for (const auto id : layers.ids) {
+    if (id >= distance_ptr->get_nx()) {
+      Rcpp::stop("Entry layers don't match the reference data");
+    }
+  }
+
+  tdoann::NNHeap<Out, Idx> nn_heap(distance_ptr->get_ny(), n_nbrs);
+  std::vector<std::size_t> distance_counts(nn_heap.n_points, 0);
+  RParallelExecutor executor;
+  RPProgress progress(verbose);
+  tdoann::find_entry_points(layers, *distance_ptr, n_nbrs, nn_heap,
+                            distance_counts, n_threads, progress, executor);
+  if (verbose) {
+    print_distance_counts(distance_counts, reference.ncol());
+  }
+  fill_random(nn_heap, *distance_ptr, n_threads, verbose);
+
+  return heap_to_r(nn_heap, n_threads, progress, executor);
+}
+
+// NOLINTEND(modernize-use-trailing-return-type)
@@ -23,6 +23,7 @@
 #include <Rcpp.h>
 
 #include "tdoann/heap.h"
+#include "tdoann/nndpaged.h"
 #include "tdoann/parallel.h"
 #include "tdoann/progressbase.h"
 
@@ -76,6 +77,45 @@ auto heap_to_r(NbrHeap &heap, std::size_t n_threads,
   return heap_to_r_impl(heap, unzero);
 }
 
+// a paged heap is sorted and copied one block at a time, so only one block of
+// it is ever in memory alongside the R matrices
+template <typename Out, typename Idx>
+auto heap_to_r(tdoann::PagedHeap<Out, Idx> &paged_heap,
+               std::size_t n_threads, tdoann::ProgressBase &progress,
+               const tdoann::Executor &executor, bool unzero = true)
+    -> Rcpp::List {
+  const std::size_t n_points = paged_heap.n_points;
+  const std::size_t n_nbrs = paged_heap.n_nbrs;
+  int unz = unzero ? 1 : 0;
+  constexpr auto missing = static_cast<Idx>(-1);
+
+  Rcpp::IntegerMatrix nn_idx(n_points, n_nbrs);
+  Rcpp::NumericMatrix nn_dist(n_points, n_nbrs);
+
+  tdoann::NNDHeap<Out, Idx> heap(0, n_nbrs);
+  for (std::size_t block = 0; block < paged_heap.n_blocks; block++) {
+    paged_heap.load(block, heap);
+    tdoann::sort_heap(heap, n_threads, progress, executor);
+    const std::size_t begin = paged_heap.begin(block);
+    for (std::size_t r = 0; r < heap.n_points; r++) {
+      const std::size_t i = begin + r;
+      std::size_t rnnbrs = r * n_nbrs;
+      for (std::size_t j = 0; j < n_nbrs; j++) {
+        std::size_t rnnbrsj = rnnbrs + j;
+        if (heap.idx[rnnbrsj] == missing) {
+          nn_dist(i, j) = NA_REAL;
+        } else {
+          nn_dist(i, j) = heap.dist[rnnbrsj];
+        }
+        nn_idx(i, j) = heap.idx[rnnbrsj] + unz;
+      }
+    }
+  }
+
+  return Rcpp::List::create(Rcpp::Named("idx") = nn_idx,
+                            Rcpp::Named("dist") = nn_dist);
+}
+
 template <typename NbrHeap>
 auto heap_to_r(NbrHeap &heap, bool unzero = true) -> Rcpp::List {
   constexpr std::size_t n_threads = 0;
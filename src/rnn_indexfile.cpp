@@ -0,0 +1,200 @@
+//  rnndescent -- An R package for nearest neighbor descent
+//
+//  Copyright (C) 2024 James Melville
+//
+//  This file is part of rnndescent
+//
+//  rnndescent is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  rnndescent is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with rnndescent.  If not, see <http://www.gnu.org/licenses/>.
+
+// NOLINTBEGIN(modernize-use-trailing-return-type)
+
+#include <numeric>
+
+#include <Rcpp.h>
+
+#include "rnndescent/random.h"
+#include "tdoann/forestsearch.h"
+#include "tdoann/indexfile.h"
+#include "tdoann/randnbrs.h"
+#include "tdoann/reorder.h"
+#include "tdoann/search.h"
+
+#include "rnn_distance.h"
+#include "rnn_forest.h"
+#include "rnn_heaptor.h"
+#include "rnn_parallel.h"
+#include "rnn_progress.h"
+#include "rnn_util.h"
+
+using Rcpp::_;
+using Rcpp::List;
+using Rcpp::NumericMatrix;
+
+// Write the reference data, search graph and (if it isn't empty) search forest
+// of an index to filename. The data is column-oriented, i.e. one item per
+// column, which is the row-major layout of the file. If reorder is true, the
+// items are relabelled in reverse Cuthill-McKee order of the search graph
+// first, so that neighbors in the graph are close together in the file, and
+// the order is saved so that rnn_index_query can return the original ids.
+// [[Rcpp::export]]
+void rnn_index_save(const std::string &filename, const NumericMatrix &data,
+                    const List &reference_graph_list, const List &search_forest,
+                    const std::string &metric, const std::string &actual_metric,
+                    bool use_alt_metric, bool reorder) {
+  using In = RNN_DEFAULT_IN;
+  using Out = RNN_DEFAULT_DIST;
+  using Idx = RNN_DEFAULT_IDX;
+
+  const std::size_t ndim = data.nrow();
+  const std::size_t n_items = data.ncol();
+  auto data_vec = r_to_vec<In>(data);
+  // store the data ready to use, so it can be searched in place
+  const auto &preprocess_map = get_preprocess_map<In>();
+  if (preprocess_map.count(actual_metric) > 0) {
+    preprocess_map.at(actual_metric)(data_vec, ndim);
+  }
+  auto search_graph = r_to_sparse_graph<Out, Idx>(reference_graph_list);
+  if (search_graph.n_points != n_items) {
+    Rcpp::stop("Search graph and data have different numbers of items");
+  }
+
+  // the identity permutation if the items aren't reordered
+  std::vector<Idx> order(n_items);
+  std::iota(order.begin(), order.end(), 0);
+  tdoann::Permutation<Idx> perm(std::move(order));
+  if (reorder) {
+    // the graph is checked before any of its neighbor ids are used
+    tdoann::check_graph(search_graph, "graph");
+    perm = tdoann::rcm_order(search_graph);
+    search_graph = tdoann::permute(search_graph, perm);
+    data_vec = tdoann::permute_rows(data_vec, ndim, perm);
+  }
+
+  tdoann::IndexFileWriter writer(filename);
+  writer.write("metric", metric);
+  writer.write("actual_metric", actual_metric);
+  writer.write("use_alt_metric",
+               std::vector<uint8_t>{static_cast<uint8_t>(use_alt_metric)});
+  tdoann::save_data(writer, "data", data_vec.data(), n_items, ndim);
+  tdoann::save_graph(writer, "graph", search_graph);
+  if (reorder) {
+    writer.write("order", perm.order);
+  }
+
+  if (search_forest.size() > 0) {
+    const std::string margin_type = search_forest["margin"];
+    auto save_forest = [&](auto &&forest) {
+      if (reorder) {
+        tdoann::permute(forest, perm);
+      }
+      tdoann::save_forest(writer, "forest", forest);
+    };
+    if (margin_type == margin_type_to_string(MarginType::EXPLICIT)) {
+      save_forest(r_to_search_forest<In, Idx>(search_forest, 0));
+    } else if (margin_type == margin_type_to_string(MarginType::IMPLICIT)) {
+      save_forest(r_to_search_forest_implicit<Idx>(search_forest, 0));
+    } else {
+      Rcpp::stop("Bad search forest type ", margin_type);
+    }
+  }
+  writer.close();
+}
+
+// Query the index in filename. The data and search graph are read in place from
+// the mapped file, and each query is seeded from the search forest if there is
+// one, otherwise from random neighbors. As well as the neighbors, the metric
+// the index was built with is returned, so the file only has to be opened
+// once.
+// [[Rcpp::export]]
+List rnn_index_query(const std::string &filename, const NumericMatrix &query,
+                     uint32_t n_nbrs, double epsilon,
+                     double max_search_fraction, std::size_t n_threads,
+                     bool verbose) {
+  using In = RNN_DEFAULT_IN;
+  using Out = RNN_DEFAULT_DIST;
+  using Idx = RNN_DEFAULT_IDX;
+
+  const tdoann::IndexFile index(filename);
+  // a search only touches a small part of the data and the graph
+  index.advise(tdoann::MappedFile<char>::Advice::Random);
+  const auto data = tdoann::load_data<In>(index, "data");
+  const auto search_graph = tdoann::load_graph<Out, Idx>(index, "graph");
+  if (search_graph.n_points != data.n_items) {
+    Rcpp::stop("Search graph and data have different numbers of items");
+  }
+  if (n_nbrs > data.n_items) {
+    Rcpp::stop("k must be <= ", data.n_items);
+  }
+  const auto distance_ptr = create_index_query_distance(
+      data, query, index.get_string("actual_metric"));
+
+  const auto max_distance_calculations =
+      static_cast<std::size_t>(search_graph.n_points * max_search_fraction);
+  if (max_search_fraction < 1 && verbose) {
+    tsmessage() << "max distance calculation = " << max_distance_calculations
+                << "\n";
+  }
+  std::vector<std::size_t> distance_counts(distance_ptr->get_ny(), 0);
+
+  rnndescent::ParallelIntRNGAdapter<Idx, rnndescent::DQIntSampler> rng_provider;
+  RParallelExecutor executor;
+  RPProgress progress(verbose);
+  const std::string forest_type = index.contains("forest/type")
+                                      ? index.get_string("forest/type")
+                                      : std::string("none");
+
+  auto query_forest = [&](const auto &search_forest) {
+    return tdoann::forest_nn_query(search_forest, search_graph, *distance_ptr,
+                                   n_nbrs, true, epsilon,
+                                   max_distance_calculations, distance_counts,
+                                   rng_provider, n_threads, progress, executor);
+  };
+
+  tdoann::NNHeap<Out, Idx> nn_heap(0, 0);
+  if (forest_type == margin_type_to_string(MarginType::EXPLICIT)) {
+    std::vector<tdoann::SearchTree<In, Idx>> search_forest;
+    tdoann::load_forest(index, "forest", data.n_items, data.ndim,
+                        search_forest);
+    nn_heap = query_forest(search_forest);
+  } else if (forest_type == margin_type_to_string(MarginType::IMPLICIT)) {
+    std::vector<tdoann::SearchTreeImplicit<Idx>> search_forest;
+    tdoann::load_forest(index, "forest", data.n_items, data.ndim,
+                        search_forest);
+    nn_heap = query_forest(search_forest);
+  } else {
+    nn_heap = tdoann::NNHeap<Out, Idx>(distance_ptr->get_ny(), n_nbrs);
+    RPProgress init_progress(false);
+    tdoann::fill_random(nn_heap, *distance_ptr, rng_provider, n_threads,
+                        init_progress, executor);
+    tdoann::nn_query(search_graph, nn_heap, *distance_ptr, epsilon,
+                     max_distance_calculations, distance_counts, n_threads,
+                     progress, executor);
+  }
+
+  if (verbose) {
+    print_distance_counts(distance_counts, search_graph.n_points);
+  }
+  // map the ids back if the items were reordered when they were saved
+  const auto order = tdoann::load_order<Idx>(index, "order", data.n_items);
+  if (!order.empty()) {
+    tdoann::restore_ids(nn_heap.idx, order);
+  }
+
+  List result = heap_to_r(nn_heap, n_threads, progress, executor);
+  result["metric"] = index.get_string("metric");
+  result["use_alt_metric"] = index.get<uint8_t>("use_alt_metric")[0] != 0;
+  return result;
+}
+
+// NOLINTEND(modernize-use-trailing-return-type)
@@ -25,7 +25,9 @@
 #include "tdoann/distancebase.h"
 #include "tdoann/nndcommon.h"
 #include "tdoann/nndescent.h"
+#include "tdoann/nndpaged.h"
 #include "tdoann/nndparallel.h"
+#include "tdoann/quantize.h"
 
 #include "rnn_distance.h"
 #include "rnn_heaptor.h"
@@ -51,104 +53,292 @@ create_nnd_progress(const std::string &progress_type, uint32_t n_iters,
       std::make_unique<RIterProgress>(n_iters, verbose));
 }
 
-template <typename Out, typename Idx>
+template <typename Distance, typename Out = typename Distance::Output,
+          typename Idx = typename Distance::Index>
 std::unique_ptr<tdoann::ParallelLocalJoin<Out, Idx>>
-create_parallel_local_join(const tdoann::NNDHeap<Out, Idx> &nn_heap,
-                           const tdoann::BaseDistance<Out, Idx> &distance,
-                           bool low_memory) {
+create_parallel_local_join(tdoann::NNDHeap<Out, Idx> &nn_heap,
+                           const Distance &distance, bool low_memory,
+                           bool concurrent_updates, bool claim_pairs,
+                           std::size_t n_threads) {
   if (low_memory) {
-    return std::make_unique<tdoann::LowMemParallelLocalJoin<Out, Idx>>(
-        distance);
+    // pushing straight into the graph avoids storing the updates, but the
+    // number of updates counted then depends on the thread scheduling, so it's
+    // only used if asked for
+    if (concurrent_updates) {
+      return std::make_unique<
+          tdoann::ConcurrentLowMemParallelLocalJoin<Out, Idx, Distance>>(
+          nn_heap, distance);
+    }
+    return std::make_unique<
+        tdoann::LowMemParallelLocalJoin<Out, Idx, Distance>>(distance,
+                                                             n_threads);
   }
-  return std::make_unique<tdoann::CacheParallelLocalJoin<Out, Idx>>(nn_heap,
-                                                                    distance);
+  return std::make_unique<tdoann::CacheParallelLocalJoin<Out, Idx, Distance>>(
+      nn_heap, distance, n_threads, claim_pairs);
 }
 
-template <typename Out, typename Idx>
+template <typename Distance, typename Out = typename Distance::Output,
+          typename Idx = typename Distance::Index>
 std::unique_ptr<tdoann::SerialLocalJoin<Out, Idx>>
 create_serial_local_join(const tdoann::NNDHeap<Out, Idx> &nn_heap,
-                         const tdoann::BaseDistance<Out, Idx> &distance,
-                         bool low_memory) {
+                         const Distance &distance, bool low_memory) {
   if (low_memory) {
-    return std::make_unique<tdoann::LowMemSerialLocalJoin<Out, Idx>>(distance);
+    return std::make_unique<tdoann::LowMemSerialLocalJoin<Out, Idx, Distance>>(
+        distance);
   }
-  return std::make_unique<tdoann::CacheSerialLocalJoin<Out, Idx>>(nn_heap,
-                                                                  distance);
+  return std::make_unique<tdoann::CacheSerialLocalJoin<Out, Idx, Distance>>(
+      nn_heap, distance);
+}
+
+// Run nearest neighbor descent on an initialized heap
+template <typename Distance, typename Out = typename Distance::Output,
+          typename Idx = typename Distance::Index>
+void nnd_build_heap(tdoann::NNDHeap<Out, Idx> &nnd_heap,
+                    const Distance &distance, std::size_t max_candidates,
+                    uint32_t n_iters, double delta, bool low_memory,
+                    bool concurrent_updates, bool claim_pairs,
+                    bool weight_by_degree, std::size_t n_threads,
+                    tdoann::NNDProgressBase &nnd_progress,
+                    const tdoann::Executor &executor) {
+  if (n_threads > 0) {
+    auto local_join_ptr =
+        create_parallel_local_join(nnd_heap, distance, low_memory,
+                                   concurrent_updates, claim_pairs, n_threads);
+    rnndescent::ParallelRNGAdapter<rnndescent::PcgRand> parallel_rand;
+    tdoann::nnd_build(nnd_heap, *local_join_ptr, max_candidates, n_iters, delta,
+                      weight_by_degree, nnd_progress, parallel_rand, n_threads,
+                      executor);
+  } else {
+    auto local_join_ptr =
+        create_serial_local_join(nnd_heap, distance, low_memory);
+    rnndescent::RRand rand;
+    tdoann::nnd_build(nnd_heap, *local_join_ptr, max_candidates, n_iters, delta,
+                      weight_by_degree, rand, nnd_progress);
+  }
+}
+
+// Run nearest neighbor descent on an initialized heap and return the result
+template <typename Distance, typename Out = typename Distance::Output,
+          typename Idx = typename Distance::Index>
+List nnd_build_impl(tdoann::NNDHeap<Out, Idx> &nnd_heap,
+                    const Distance &distance, std::size_t max_candidates,
+                    uint32_t n_iters, double delta, bool low_memory,
+                    bool concurrent_updates, bool claim_pairs,
+                    bool weight_by_degree, std::size_t n_threads, bool verbose,
+                    const std::string &progress_type) {
+  auto nnd_progress_ptr = create_nnd_progress(progress_type, n_iters, verbose);
+  RParallelExecutor executor;
+
+  nnd_build_heap(nnd_heap, distance, max_candidates, n_iters, delta, low_memory,
+                 concurrent_updates, claim_pairs, weight_by_degree, n_threads,
+                 *nnd_progress_ptr, executor);
+
+  return heap_to_r(nnd_heap, n_threads, nnd_progress_ptr->get_base_progress(),
+                   executor);
 }
 
+// The neighbors of the first n_converged items are the result of an earlier
+// run of nearest neighbor descent, so pairs of them have already been tried:
+// marking them as old means only pairs involving the other items (and any
+// random neighbors added later) are tried
 template <typename Out, typename Idx>
-List nn_descent_impl(const tdoann::BaseDistance<Out, Idx> &distance,
-                     const IntegerMatrix &nn_idx, const NumericMatrix &nn_dist,
+void mark_converged(tdoann::NNDHeap<Out, Idx> &nnd_heap,
+                    std::size_t n_converged) {
+  n_converged =
+      std::min(n_converged, static_cast<std::size_t>(nnd_heap.n_points));
+  std::fill(nnd_heap.flags.begin(),
+            nnd_heap.flags.begin() + n_converged * nnd_heap.n_nbrs, 0);
+}
+
+// Distance can be BaseDistance or a concrete distance calculator type: in the
+// latter case the local join is specialized for that type
+template <typename Distance>
+List nn_descent_impl(const Distance &distance, const IntegerMatrix &nn_idx,
+                     const NumericMatrix &nn_dist, std::size_t n_converged,
                      std::size_t max_candidates, uint32_t n_iters, double delta,
-                     bool low_memory, bool weight_by_degree,
+                     bool low_memory, bool concurrent_updates,
+                     bool claim_pairs, bool weight_by_degree,
                      std::size_t n_threads, bool verbose,
                      const std::string &progress_type) {
+  using Out = typename Distance::Output;
+  using Idx = typename Distance::Index;
+
   auto nnd_heap =
       r_to_knn_heap<tdoann::NNDHeap<Out, Idx>>(nn_idx, nn_dist, n_threads);
 
+  mark_converged(nnd_heap, n_converged);
+
   // fill any space in the heap with random neighbors
   fill_random(nnd_heap, distance, n_threads, verbose);
 
+  return nnd_build_impl(nnd_heap, distance, max_candidates, n_iters, delta,
+                        low_memory, concurrent_updates, claim_pairs,
+                        weight_by_degree, n_threads, verbose, progress_type);
+}
+
+// Nearest neighbor descent with the data stored with reduced precision (see
+// create_quantized_self_distance). The neighbors found are then reranked with
+// the full precision distances, so the distances returned are exact. The
+// reduced precision data is freed before the full precision copy is made.
+List nn_descent_quantized(const NumericMatrix &data, const IntegerMatrix &nn_idx,
+                          const NumericMatrix &nn_dist,
+                          std::size_t n_converged, const std::string &metric,
+                          const std::string &precision,
+                          std::size_t max_candidates, uint32_t n_iters,
+                          double delta, bool low_memory,
+                          bool concurrent_updates, bool weight_by_degree,
+                          std::size_t n_threads, bool verbose,
+                          const std::string &progress_type) {
+  using Out = RNN_DEFAULT_DIST;
+  using Idx = RNN_DEFAULT_IDX;
+
+  auto nnd_heap =
+      r_to_knn_heap<tdoann::NNDHeap<Out, Idx>>(nn_idx, nn_dist, n_threads);
   auto nnd_progress_ptr = create_nnd_progress(progress_type, n_iters, verbose);
+  auto &progress = nnd_progress_ptr->get_base_progress();
   RParallelExecutor executor;
 
-  if (n_threads > 0) {
-    auto local_join_ptr =
-        create_parallel_local_join(nnd_heap, distance, low_memory);
-    rnndescent::ParallelRNGAdapter<rnndescent::PcgRand> parallel_rand;
-    tdoann::nnd_build(nnd_heap, *local_join_ptr, max_candidates, n_iters, delta,
-                      weight_by_degree, *nnd_progress_ptr, parallel_rand,
-                      n_threads, executor);
-  } else {
-    auto local_join_ptr =
-        create_serial_local_join(nnd_heap, distance, low_memory);
-    rnndescent::RRand rand;
-    tdoann::nnd_build(nnd_heap, *local_join_ptr, max_candidates, n_iters, delta,
-                      weight_by_degree, rand, *nnd_progress_ptr);
+  {
+    auto distance_ptr =
+        create_quantized_self_distance(data, metric, precision);
+    // the initial distances are exact: replace them so that they can be
+    // compared with those calculated during the build
+    tdoann::NullProgress init_progress;
+    tdoann::rerank(nnd_heap, *distance_ptr, n_threads, init_progress,
+                   executor);
+    mark_converged(nnd_heap, n_converged);
+    fill_random(nnd_heap, *distance_ptr, n_threads, verbose);
+
+    // the quantized kernels are cheaper than claiming a pair
+    const bool claim_pairs = false;
+    nnd_build_heap(nnd_heap, *distance_ptr, max_candidates, n_iters, delta,
+                   low_memory, concurrent_updates, claim_pairs,
+                   weight_by_degree, n_threads, *nnd_progress_ptr, executor);
   }
 
-  return heap_to_r(nnd_heap, n_threads, nnd_progress_ptr->get_base_progress(),
-                   executor);
+  if (verbose) {
+    tsmessage() << "Reranking neighbors with full precision distances\n";
+  }
+  auto distance_ptr = create_self_distance(data, metric);
+  tdoann::rerank(nnd_heap, *distance_ptr, n_threads, progress, executor);
+
+  return heap_to_r(nnd_heap, n_threads, progress, executor);
 }
 
 // [[Rcpp::export]]
 List rnn_descent(const NumericMatrix &data, const IntegerMatrix &nn_idx,
-                 const NumericMatrix &nn_dist, const std::string &metric,
+                 const NumericMatrix &nn_dist, std::size_t n_converged,
+                 const std::string &metric, const std::string &precision,
                  std::size_t max_candidates, uint32_t n_iters, double delta,
-                 bool low_memory, bool weight_by_degree, std::size_t n_threads,
-                 bool verbose, const std::string &progress_type) {
-  auto distance_ptr = create_self_distance(data, metric);
-  return nn_descent_impl(*distance_ptr, nn_idx, nn_dist, max_candidates,
-                         n_iters, delta, low_memory, weight_by_degree,
-                         n_threads, verbose, progress_type);
+                 bool low_memory, bool concurrent_updates,
+                 bool weight_by_degree, std::size_t n_threads, bool verbose,
+                 const std::string &progress_type) {
+  if (precision != "full") {
+    return nn_descent_quantized(data, nn_idx, nn_dist, n_converged, metric,
+                                precision, max_candidates, n_iters, delta,
+                                low_memory, concurrent_updates,
+                                weight_by_degree, n_threads, verbose,
+                                progress_type);
+  }
+  return with_self_distance(data, metric, [&](const auto &distance) {
+    return nn_descent_impl(distance, nn_idx, nn_dist, n_converged,
+                           max_candidates, n_iters, delta, low_memory,
+                           concurrent_updates, is_expensive_metric(metric),
+                           weight_by_degree, n_threads, verbose,
+                           progress_type);
+  });
 }
 
 // [[Rcpp::export]]
 List rnn_logical_descent(const LogicalMatrix &data, const IntegerMatrix &nn_idx,
-                         const NumericMatrix &nn_dist,
+                         const NumericMatrix &nn_dist, std::size_t n_converged,
                          const std::string &metric, std::size_t max_candidates,
                          uint32_t n_iters, double delta, bool low_memory,
-                         bool weight_by_degree, std::size_t n_threads,
-                         bool verbose, const std::string &progress_type) {
+                         bool concurrent_updates, bool weight_by_degree,
+                         std::size_t n_threads, bool verbose,
+                         const std::string &progress_type) {
   auto distance_ptr = create_self_distance(data, metric);
-  return nn_descent_impl(*distance_ptr, nn_idx, nn_dist, max_candidates,
-                         n_iters, delta, low_memory, weight_by_degree,
-                         n_threads, verbose, progress_type);
+  return nn_descent_impl(*distance_ptr, nn_idx, nn_dist, n_converged,
+                         max_candidates, n_iters, delta, low_memory,
+                         concurrent_updates, is_expensive_metric(metric),
+                         weight_by_degree, n_threads, verbose, progress_type);
 }
 
 // [[Rcpp::export]]
 List rnn_sparse_descent(const IntegerVector &ind, const IntegerVector &ptr,
                         const NumericVector &data, std::size_t ndim,
                         const IntegerMatrix &nn_idx,
-                        const NumericMatrix &nn_dist, const std::string &metric,
-                        std::size_t max_candidates, uint32_t n_iters,
-                        double delta, bool low_memory, bool weight_by_degree,
+                        const NumericMatrix &nn_dist, std::size_t n_converged,
+                        const std::string &metric, std::size_t max_candidates,
+                        uint32_t n_iters, double delta, bool low_memory,
+                        bool concurrent_updates, bool weight_by_degree,
                         std::size_t n_threads, bool verbose,
                         const std::string &progress_type) {
   auto distance_ptr = create_sparse_self_distance(ind, ptr, data, ndim, metric);
-  return nn_descent_impl(*distance_ptr, nn_idx, nn_dist, max_candidates,
-                         n_iters, delta, low_memory, weight_by_degree,
+  // a sparse distance merges the non-zero indices of both items, which costs
+  // more than claiming the pair, whatever the metric
+  const bool claim_pairs = true;
+  return nn_descent_impl(*distance_ptr, nn_idx, nn_dist, n_converged,
+                         max_candidates, n_iters, delta, low_memory,
+                         concurrent_updates, claim_pairs, weight_by_degree,
                          n_threads, verbose, progress_type);
 }
 
+// Nearest neighbor descent on row-major float32 data in filename, which is
+// memory-mapped rather than read into R. The heap is initialized with random
+// neighbors here rather than from R, so the only other copy of the graph is the
+// one returned. If scratch_dir is not empty, the graph is kept in scratch files
+// in that directory during the build, with block_size rows of it in memory at
+// a time.
+// [[Rcpp::export]]
+List rnn_mmap_descent(const std::string &filename, std::size_t ndim,
+                      uint32_t nnbrs, const std::string &metric,
+                      std::size_t max_candidates, uint32_t n_iters,
+                      double delta, bool low_memory, bool concurrent_updates,
+                      bool weight_by_degree, const std::string &scratch_dir, std::size_t block_size,
+                      std::size_t n_threads, bool verbose,
+                      const std::string &progress_type) {
+  auto distance_ptr = create_mapped_self_distance(filename, ndim, metric);
+  using Out = typename decltype(distance_ptr)::element_type::Output;
+  using Idx = typename decltype(distance_ptr)::element_type::Index;
+
+  const auto n_points = distance_ptr->get_nx();
+  if (nnbrs > n_points) {
+    Rcpp::stop("k must be no larger than the number of items in the file");
+  }
+
+  if (verbose) {
+    tsmessage() << "Initializing " << n_points << " items with random "
+                << "neighbors\n";
+  }
+  rnndescent::ParallelIntRNGAdapter<Idx, rnndescent::DQIntSampler>
+      rng_provider;
+  RParallelExecutor executor;
+  RPProgress init_progress(false);
+
+  if (!scratch_dir.empty()) {
+    tdoann::PagedHeap<Out, Idx> paged_heap(scratch_dir, n_points, nnbrs,
+                                           block_size);
+    tdoann::fill_random(paged_heap, *distance_ptr, rng_provider, n_threads,
+                        init_progress, executor);
+
+    auto nnd_progress_ptr = create_nnd_progress(progress_type, n_iters, verbose);
+    rnndescent::ParallelRNGAdapter<rnndescent::PcgRand> parallel_rand;
+    tdoann::nnd_build(paged_heap, *distance_ptr, scratch_dir, max_candidates,
+                      n_iters, delta, weight_by_degree, *nnd_progress_ptr,
+                      parallel_rand, n_threads, executor);
+    return heap_to_r(paged_heap, n_threads,
+                     nnd_progress_ptr->get_base_progress(), executor);
+  }
+
+  tdoann::NNDHeap<Out, Idx> nnd_heap(n_points, nnbrs);
+  tdoann::fill_random(nnd_heap, *distance_ptr, rng_provider, n_threads,
+                      init_progress, executor);
+
+  return nnd_build_impl(nnd_heap, *distance_ptr, max_candidates, n_iters,
+                        delta, low_memory, concurrent_updates,
+                        is_expensive_metric(metric), weight_by_degree,
+                        n_threads, verbose, progress_type);
+}
+
 // NOLINTEND(modernize-use-trailing-return-type)
@@ -0,0 +1,61 @@
+//  rnndescent -- An R package for nearest neighbor descent
+//
+//  Copyright (C) 2019 James Melville
+//
+//  This file is part of rnndescent
+//
+//  rnndescent is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  rnndescent is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with rnndescent.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <memory>
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+#include <Rcpp.h>
+
+#include "rnn_parallel.h"
+
+// NOLINTBEGIN(modernize-use-trailing-return-type)
+
+namespace {
+std::unique_ptr<pforr::ThreadPool> thread_pool;
+
+#if !defined(_WIN32)
+pid_t thread_pool_pid = 0;
+#endif
+} // namespace
+
+pforr::ThreadPool &get_thread_pool() {
+#if !defined(_WIN32)
+  // A forked child (e.g. from parallel::mclapply) has a copy of the pool but
+  // none of its threads. It can't be shut down safely, so leak it and start a
+  // new one
+  if (thread_pool && thread_pool_pid != getpid()) {
+    static_cast<void>(thread_pool.release());
+  }
+  if (!thread_pool) {
+    thread_pool_pid = getpid();
+  }
+#endif
+  if (!thread_pool) {
+    thread_pool = std::make_unique<pforr::ThreadPool>();
+  }
+  return *thread_pool;
+}
+
+// [[Rcpp::export]]
+void rnn_shutdown_thread_pool() { thread_pool.reset(); }
+
+// NOLINTEND(modernize-use-trailing-return-type)
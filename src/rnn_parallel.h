@@ -25,13 +25,17 @@
 #include "pforr.h"
 #include "tdoann/parallel.h"
 
+// The thread pool shared by all the parallel code in the package. It is
+// created on first use and shut down when the package is unloaded.
+pforr::ThreadPool &get_thread_pool();
+
 class RParallelExecutor : public tdoann::Executor {
 public:
   void parallel_for(std::size_t begin, std::size_t end,
                     std::function<void(std::size_t, std::size_t)> worker,
                     std::size_t n_threads,
                     std::size_t grain_size) const override {
-    pforr::parallel_for(begin, end, worker, n_threads, grain_size);
+    get_thread_pool().parallel_for(begin, end, worker, n_threads, grain_size);
   }
 };
 
@@ -0,0 +1,78 @@
+//  rnndescent -- An R package for nearest neighbor descent
+//
+//  Copyright (C) 2021 James Melville
+//
+//  This file is part of rnndescent
+//
+//  rnndescent is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  rnndescent is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with rnndescent.  If not, see <http://www.gnu.org/licenses/>.
+
+// NOLINTBEGIN(modernize-use-trailing-return-type)
+
+#include <Rcpp.h>
+
+#include "rnndescent/random.h"
+#include "tdoann/pq.h"
+
+#include "rnn_distance.h"
+#include "rnn_parallel.h"
+#include "rnn_util.h"
+
+using Rcpp::_;
+using Rcpp::List;
+using Rcpp::NumericMatrix;
+using Rcpp::NumericVector;
+using Rcpp::RawMatrix;
+
+// Train a product quantizer on the (column-oriented) data and encode it. The
+// data is preprocessed for metric first, so the same preprocessing must be
+// applied to the queries (see create_pq_query_distance)
+// [[Rcpp::export]]
+List rnn_pq_train(const NumericMatrix &data, const std::string &metric,
+                  std::size_t n_subspaces, std::size_t n_centroids,
+                  std::size_t n_iters, std::size_t n_threads, bool verbose) {
+  const auto quantized_metric =
+      get_quantized_metric(metric, "Product quantization");
+  const std::size_t ndim = data.nrow();
+  const std::size_t n_items = data.ncol();
+
+  auto data_vec = r_to_vec<float>(data);
+  if (quantized_metric.second != nullptr) {
+    quantized_metric.second(data_vec, ndim);
+  }
+
+  if (verbose) {
+    tsmessage() << "Training product quantizer with " << n_subspaces
+                << " subspaces\n";
+  }
+  rnndescent::RRand rand;
+  RParallelExecutor executor;
+  const auto pq = tdoann::train_pq(data_vec, ndim, n_subspaces, n_iters, rand,
+                                   n_threads, executor, n_centroids);
+
+  if (verbose) {
+    tsmessage() << "Encoding data\n";
+  }
+  const auto codes = pq.encode(data_vec, n_threads, executor);
+  RawMatrix codes_matrix(n_subspaces, n_items);
+  std::copy(codes.begin(), codes.end(), codes_matrix.begin());
+
+  return List::create(
+      _("ndim") = static_cast<int>(ndim),
+      _("n_subspaces") = static_cast<int>(n_subspaces),
+      _("n_centroids") = static_cast<int>(pq.n_centroids),
+      _("centroids") = NumericVector(pq.centroids.begin(), pq.centroids.end()),
+      _("codes") = codes_matrix, _("metric") = metric);
+}
+
+// NOLINTEND(modernize-use-trailing-return-type)
@@ -22,6 +22,7 @@
 #include "rnndescent/random.h"
 #include "tdoann/nngraph.h"
 #include "tdoann/prepare.h"
+#include "tdoann/tombstone.h"
 
 #include <Rcpp.h>
 
@@ -29,9 +30,11 @@
 #include "rnn_parallel.h"
 #include "rnn_progress.h"
 
+using Rcpp::IntegerMatrix;
 using Rcpp::IntegerVector;
 using Rcpp::List;
 using Rcpp::LogicalMatrix;
+using Rcpp::LogicalVector;
 using Rcpp::NumericMatrix;
 using Rcpp::NumericVector;
 
@@ -108,4 +111,70 @@ List rnn_degree_prune(const List &graph_list, std::size_t max_degree,
   return sparse_graph_to_r(pruned);
 }
 
+template <typename Out, typename Idx>
+List repair_deleted_impl(const tdoann::BaseDistance<Out, Idx> &distance,
+                         const IntegerMatrix &idx, const NumericMatrix &dist,
+                         const List &search_graph_list,
+                         const LogicalVector &deleted, std::size_t n_threads,
+                         bool verbose) {
+  const auto deleted_vec = r_to_deleted(deleted);
+
+  tdoann::NNGraph<Out, Idx> graph(r_to_idxt<Idx>(idx), r_to_vect<Out>(dist),
+                                  idx.nrow());
+  graph.deleted = deleted_vec;
+  auto search_graph = r_to_sparse_graph<Out, Idx>(search_graph_list);
+  search_graph.deleted = deleted_vec;
+
+  RParallelExecutor executor;
+  RPProgress progress(verbose);
+  const auto repaired_graph =
+      tdoann::repair_knn_graph(graph, distance, n_threads, progress, executor);
+  const auto repaired_search_graph = tdoann::repair_search_graph(
+      search_graph, distance, n_threads, progress, executor);
+
+  constexpr bool unzero = true;
+  return List::create(
+      Rcpp::_("graph") = graph_to_r(repaired_graph, unzero),
+      Rcpp::_("search_graph") = sparse_graph_to_r(repaired_search_graph));
+}
+
+// [[Rcpp::export]]
+List rnn_sparse_repair_deleted(const IntegerVector &ind,
+                               const IntegerVector &ptr,
+                               const NumericVector &data, std::size_t ndim,
+                               const IntegerMatrix &idx,
+                               const NumericMatrix &dist,
+                               const List &search_graph_list,
+                               const LogicalVector &deleted,
+                               const std::string &metric, std::size_t n_threads,
+                               bool verbose) {
+  auto distance_ptr = create_sparse_self_distance(ind, ptr, data, ndim, metric);
+  return repair_deleted_impl(*distance_ptr, idx, dist, search_graph_list,
+                             deleted, n_threads, verbose);
+}
+
+// [[Rcpp::export]]
+List rnn_repair_deleted(const NumericMatrix &data, const IntegerMatrix &idx,
+                        const NumericMatrix &dist,
+                        const List &search_graph_list,
+                        const LogicalVector &deleted, const std::string &metric,
+                        std::size_t n_threads, bool verbose) {
+  auto distance_ptr = create_self_distance(data, metric);
+  return repair_deleted_impl(*distance_ptr, idx, dist, search_graph_list,
+                             deleted, n_threads, verbose);
+}
+
+// [[Rcpp::export]]
+List rnn_logical_repair_deleted(const LogicalMatrix &data,
+                                const IntegerMatrix &idx,
+                                const NumericMatrix &dist,
+                                const List &search_graph_list,
+                                const LogicalVector &deleted,
+                                const std::string &metric,
+                                std::size_t n_threads, bool verbose) {
+  auto distance_ptr = create_self_distance(data, metric);
+  return repair_deleted_impl(*distance_ptr, idx, dist, search_graph_list,
+                             deleted, n_threads, verbose);
+}
+
 // NOLINTEND(modernize-use-trailing-return-type)
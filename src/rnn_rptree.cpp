@@ -22,11 +22,13 @@
 #include <Rcpp.h>
 
 #include "rnndescent/random.h"
+#include "tdoann/forestsearch.h"
 #include "tdoann/rptree.h"
 #include "tdoann/rptreeimplicit.h"
 #include "tdoann/rptreesparse.h"
 
 #include "rnn_distance.h"
+#include "rnn_forest.h"
 #include "rnn_heaptor.h"
 #include "rnn_parallel.h"
 #include "rnn_progress.h"
@@ -37,6 +39,7 @@ using Rcpp::IntegerMatrix;
 using Rcpp::IntegerVector;
 using Rcpp::List;
 using Rcpp::LogicalMatrix;
+using Rcpp::LogicalVector;
 using Rcpp::NumericMatrix;
 using Rcpp::NumericVector;
 using Rcpp::Rcerr;
@@ -65,8 +68,6 @@ bool is_angular_metric(const std::string &metric) {
   return false;
 }
 
-enum class MarginType { EXPLICIT, IMPLICIT };
-
 template <typename Tree>
 std::size_t check_leaf_size(const std::vector<Tree> &rp_forest,
                             std::size_t leaf_size, bool verbose) {
@@ -84,17 +85,6 @@ std::size_t check_leaf_size(const std::vector<Tree> &rp_forest,
   return max_leaf_size;
 }
 
-// Function to convert MarginType to a string
-std::string margin_type_to_string(MarginType margin_type) {
-  switch (margin_type) {
-  case MarginType::EXPLICIT:
-    return "explicit";
-  case MarginType::IMPLICIT:
-    return "implicit";
-  }
-  return "";
-}
-
 template <typename In, typename Idx>
 void print_rp_forest(const std::vector<tdoann::RPTree<In, Idx>> &rp_forest) {
   for (const auto &tree : rp_forest) {
@@ -285,173 +275,6 @@ List sparse_search_forest_to_r(
                       _("actual_metric") = metric, _("version") = "0.0.12");
 }
 
-template <typename In, typename Idx>
-tdoann::SearchTree<In, Idx> r_to_search_tree(List tree_list) {
-  // n_nodes x ndim
-  NumericMatrix hyperplanes = tree_list["hyperplanes"];
-  // n_nodes
-  NumericVector offsets = tree_list["offsets"];
-  // n_nodes x 2
-  IntegerMatrix children = tree_list["children"];
-  // n_obs
-  IntegerVector indices = tree_list["indices"];
-  int leaf_size = tree_list["leaf_size"];
-
-  const std::size_t ndim = hyperplanes.ncol();
-  const std::size_t n_nodes = hyperplanes.nrow();
-  std::vector<std::vector<In>> cpp_hyperplanes(n_nodes, std::vector<In>(ndim));
-  std::vector<In> cpp_offsets(n_nodes);
-  std::vector<std::pair<std::size_t, std::size_t>> cpp_children(n_nodes);
-
-  for (std::size_t i = 0; i < n_nodes; ++i) {
-    for (std::size_t j = 0; j < ndim; ++j) {
-      cpp_hyperplanes[i][j] = hyperplanes(i, j);
-    }
-    cpp_offsets[i] = offsets[i];
-    cpp_children[i] = std::make_pair(children(i, 0), children(i, 1));
-  }
-
-  auto cpp_indices = r0_to_idx<Idx>(indices);
-
-  return tdoann::SearchTree<In, Idx>(
-      std::move(cpp_hyperplanes), std::move(cpp_offsets),
-      std::move(cpp_children), std::move(cpp_indices), leaf_size);
-}
-
-template <typename Idx>
-tdoann::SearchTreeImplicit<Idx> r_to_search_tree_implicit(List tree_list) {
-  // n_nodes x 2
-  IntegerMatrix normal_indices = tree_list["normal_indices"];
-  // n_nodes x 2
-  IntegerMatrix children = tree_list["children"];
-  // n_obs
-  IntegerVector indices = tree_list["indices"];
-  Idx leaf_size = tree_list["leaf_size"];
-
-  const std::size_t n_nodes = children.nrow();
-
-  std::vector<std::pair<Idx, Idx>> cpp_normal_indices(n_nodes);
-  std::vector<std::pair<std::size_t, std::size_t>> cpp_children(n_nodes);
-
-  for (std::size_t i = 0; i < n_nodes; ++i) {
-    cpp_normal_indices[i] =
-        std::make_pair(normal_indices(i, 0), normal_indices(i, 1));
-    cpp_children[i] = std::make_pair(children(i, 0), children(i, 1));
-  }
-
-  auto cpp_indices = r0_to_idx<Idx>(indices);
-
-  return tdoann::SearchTreeImplicit<Idx>(std::move(cpp_normal_indices),
-                                         std::move(cpp_children),
-                                         std::move(cpp_indices), leaf_size);
-}
-
-template <typename In, typename Idx>
-std::vector<tdoann::SearchTree<In, Idx>>
-r_to_search_forest(List forest_list, std::size_t n_threads) {
-  if (not forest_list.containsElementNamed("margin")) {
-    Rcpp::stop("Bad forest object passed");
-  }
-  const std::string &margin_type = forest_list["margin"];
-  if (margin_type != margin_type_to_string(MarginType::EXPLICIT)) {
-    Rcpp::stop("Unsupported margin type: ", margin_type);
-  }
-
-  const List &trees = forest_list["trees"];
-  const std::size_t n_trees = trees.size();
-  std::vector<tdoann::SearchTree<In, Idx>> search_forest(n_trees);
-
-  for (std::size_t i = 0; i < n_trees; ++i) {
-    search_forest[i] = r_to_search_tree<In, Idx>(trees[i]);
-  }
-
-  return search_forest;
-}
-
-template <typename Idx>
-std::vector<tdoann::SearchTreeImplicit<Idx>>
-r_to_search_forest_implicit(List forest_list, std::size_t n_threads) {
-  if (not forest_list.containsElementNamed("margin")) {
-    Rcpp::stop("Bad forest object passed");
-  }
-  const std::string margin_type = forest_list["margin"];
-  if (margin_type != margin_type_to_string(MarginType::IMPLICIT)) {
-    Rcpp::stop("Unsupported forest type: ", margin_type);
-  }
-
-  const List &trees = forest_list["trees"];
-  const std::size_t n_trees = trees.size();
-  std::vector<tdoann::SearchTreeImplicit<Idx>> search_forest(n_trees);
-  for (std::size_t i = 0; i < n_trees; ++i) {
-    search_forest[i] = r_to_search_tree_implicit<Idx>(trees[i]);
-  }
-
-  return search_forest;
-}
-
-template <typename In, typename Idx>
-tdoann::SparseSearchTree<In, Idx> r_to_sparse_search_tree(List tree_list) {
-  NumericVector hyperplanes_data = tree_list["hyperplanes_data"];
-  IntegerVector hyperplanes_ind = tree_list["hyperplanes_ind"];
-  IntegerVector hyperplanes_ptr = tree_list["hyperplanes_ptr"];
-  NumericVector offsets = tree_list["offsets"];
-  IntegerMatrix children = tree_list["children"];
-  IntegerVector indices = tree_list["indices"];
-  int leaf_size = tree_list["leaf_size"];
-
-  const std::size_t n_nodes = offsets.size();
-
-  std::vector<In> hyperplanes_data_cpp(hyperplanes_data.begin(),
-                                       hyperplanes_data.end());
-  std::vector<std::size_t> hyperplanes_ind_cpp(hyperplanes_ind.begin(),
-                                               hyperplanes_ind.end());
-  std::vector<std::size_t> hyperplanes_ptr_cpp(hyperplanes_ptr.begin(),
-                                               hyperplanes_ptr.end());
-  std::vector<In> offsets_cpp(offsets.begin(), offsets.end());
-  std::vector<std::pair<std::size_t, std::size_t>> children_cpp(n_nodes);
-  for (std::size_t i = 0; i < n_nodes; ++i) {
-    children_cpp[i] = {static_cast<std::size_t>(children(i, 0)),
-                       static_cast<std::size_t>(children(i, 1))};
-  }
-  std::vector<Idx> indices_cpp(indices.begin(), indices.end());
-
-  std::vector<std::vector<std::size_t>> hyperplanes_ind_nested(n_nodes);
-  std::vector<std::vector<In>> hyperplanes_data_nested(n_nodes);
-  for (std::size_t i = 0; i < n_nodes; ++i) {
-    auto start_idx = hyperplanes_ptr_cpp[i];
-    auto end_idx = hyperplanes_ptr_cpp[i + 1];
-    hyperplanes_ind_nested[i].assign(hyperplanes_ind_cpp.begin() + start_idx,
-                                     hyperplanes_ind_cpp.begin() + end_idx);
-    hyperplanes_data_nested[i].assign(hyperplanes_data_cpp.begin() + start_idx,
-                                      hyperplanes_data_cpp.begin() + end_idx);
-  }
-
-  return tdoann::SparseSearchTree<In, Idx>(
-      std::move(hyperplanes_ind_nested), std::move(hyperplanes_data_nested),
-      std::move(offsets_cpp), std::move(children_cpp), std::move(indices_cpp),
-      leaf_size);
-}
-
-template <typename In, typename Idx>
-std::vector<tdoann::SparseSearchTree<In, Idx>>
-r_to_sparse_search_forest(List forest_list, std::size_t n_threads) {
-  if (not forest_list.containsElementNamed("margin")) {
-    Rcpp::stop("Bad forest object passed");
-  }
-  const std::string &margin_type = forest_list["margin"];
-  if (margin_type != margin_type_to_string(MarginType::EXPLICIT)) {
-    Rcpp::stop("Unsupported margin type: ", margin_type);
-  }
-
-  const List &trees = forest_list["trees"];
-  const std::size_t n_trees = trees.size();
-  std::vector<tdoann::SparseSearchTree<In, Idx>> search_forest(n_trees);
-  for (std::size_t i = 0; i < n_trees; ++i) {
-    search_forest[i] = r_to_sparse_search_tree<In, Idx>(trees[i]);
-  }
-  return search_forest;
-}
-
 template <typename Idx>
 List init_rp_tree_binary(const NumericMatrix &data, uint32_t nnbrs,
                          const std::string &metric, bool include_self,
@@ -911,6 +734,156 @@ List rnn_sparse_rp_forest_search(
   }
 }
 
+// Seed each query from the forest and then search the graph, without going
+// back to R in between
+template <typename Forest, typename Distance>
+List rp_forest_graph_query_impl(const Forest &search_forest,
+                                const Distance &distance,
+                                const List &reference_graph_list,
+                                uint32_t n_nbrs, bool cache, double epsilon,
+                                double max_search_fraction,
+                                std::size_t n_threads, bool verbose) {
+  using Out = typename Distance::Output;
+  using Idx = typename Distance::Index;
+
+  const auto search_graph = r_to_sparse_graph<Out, Idx>(reference_graph_list);
+  auto max_distance_calculations =
+      static_cast<std::size_t>(search_graph.n_points * max_search_fraction);
+  if (max_search_fraction < 1 && verbose) {
+    tsmessage() << "max distance calculation = " << max_distance_calculations
+                << "\n";
+  }
+  std::vector<std::size_t> distance_counts(distance.get_ny(), 0);
+
+  rnndescent::ParallelIntRNGAdapter<Idx, rnndescent::DQIntSampler> rng_provider;
+  RParallelExecutor executor;
+  RPProgress progress(verbose);
+  auto nn_heap = tdoann::forest_nn_query(
+      search_forest, search_graph, distance, n_nbrs, cache, epsilon,
+      max_distance_calculations, distance_counts, rng_provider, n_threads,
+      progress, executor);
+
+  if (verbose) {
+    print_distance_counts(distance_counts, search_graph.n_points);
+  }
+
+  return heap_to_r(nn_heap, n_threads, progress, executor);
+}
+
+// [[Rcpp::export]]
+List rnn_rp_forest_graph_query(const NumericMatrix &reference,
+                               const List &reference_graph_list,
+                               const NumericMatrix &query,
+                               const List &search_forest, uint32_t n_nbrs,
+                               const std::string &metric, bool cache,
+                               double epsilon, double max_search_fraction,
+                               std::size_t n_threads, bool verbose = false) {
+  std::string margin_type = search_forest["margin"];
+
+  if (margin_type == margin_type_to_string(MarginType::EXPLICIT)) {
+    // the explicit margin needs the data as vectors: the one copy is shared by
+    // the forest and the graph search
+    auto distance_ptr = create_query_vector_distance(reference, query, metric);
+    using In = typename tdoann::DistanceTraits<decltype(distance_ptr)>::Input;
+    using Idx = typename tdoann::DistanceTraits<decltype(distance_ptr)>::Index;
+
+    auto search_forest_cpp =
+        r_to_search_forest<In, Idx>(search_forest, n_threads);
+    return rp_forest_graph_query_impl(search_forest_cpp, *distance_ptr,
+                                      reference_graph_list, n_nbrs, cache,
+                                      epsilon, max_search_fraction, n_threads,
+                                      verbose);
+  } else if (margin_type == margin_type_to_string(MarginType::IMPLICIT)) {
+    // implicit margins only need distances, so the data can be read in place
+    auto distance_ptr = create_query_view_distance(reference, query, metric);
+    using Idx = typename tdoann::DistanceTraits<decltype(distance_ptr)>::Index;
+
+    auto search_forest_cpp =
+        r_to_search_forest_implicit<Idx>(search_forest, n_threads);
+    return rp_forest_graph_query_impl(search_forest_cpp, *distance_ptr,
+                                      reference_graph_list, n_nbrs, cache,
+                                      epsilon, max_search_fraction, n_threads,
+                                      verbose);
+  } else {
+    Rcpp::stop("Bad search forest type ", margin_type);
+  }
+}
+
+// [[Rcpp::export]]
+List rnn_logical_rp_forest_graph_query(
+    const LogicalMatrix &reference, const List &reference_graph_list,
+    const LogicalMatrix &query, const List &search_forest, uint32_t n_nbrs,
+    const std::string &metric, bool cache, double epsilon,
+    double max_search_fraction, std::size_t n_threads, bool verbose = false) {
+  std::string margin_type = search_forest["margin"];
+
+  if (margin_type == margin_type_to_string(MarginType::EXPLICIT)) {
+    auto distance_ptr = create_query_vector_distance(reference, query, metric);
+    using In = typename tdoann::DistanceTraits<decltype(distance_ptr)>::Input;
+    using Idx = typename tdoann::DistanceTraits<decltype(distance_ptr)>::Index;
+
+    auto search_forest_cpp =
+        r_to_search_forest<In, Idx>(search_forest, n_threads);
+    return rp_forest_graph_query_impl(search_forest_cpp, *distance_ptr,
+                                      reference_graph_list, n_nbrs, cache,
+                                      epsilon, max_search_fraction, n_threads,
+                                      verbose);
+  } else if (margin_type == margin_type_to_string(MarginType::IMPLICIT)) {
+    auto distance_ptr = create_query_distance(reference, query, metric);
+    using Idx = typename tdoann::DistanceTraits<decltype(distance_ptr)>::Index;
+
+    auto search_forest_cpp =
+        r_to_search_forest_implicit<Idx>(search_forest, n_threads);
+    return rp_forest_graph_query_impl(search_forest_cpp, *distance_ptr,
+                                      reference_graph_list, n_nbrs, cache,
+                                      epsilon, max_search_fraction, n_threads,
+                                      verbose);
+  } else {
+    Rcpp::stop("Bad search forest type ", margin_type);
+  }
+}
+
+// [[Rcpp::export]]
+List rnn_sparse_rp_forest_graph_query(
+    const IntegerVector &ref_ind, const IntegerVector &ref_ptr,
+    const NumericVector &ref_data, const IntegerVector &query_ind,
+    const IntegerVector &query_ptr, const NumericVector &query_data,
+    std::size_t ndim, const List &reference_graph_list,
+    const List &search_forest, uint32_t n_nbrs, const std::string &metric,
+    bool cache, double epsilon, double max_search_fraction,
+    std::size_t n_threads, bool verbose = false) {
+  std::string margin_type = search_forest["margin"];
+
+  if (margin_type == margin_type_to_string(MarginType::EXPLICIT)) {
+    auto distance_ptr = create_sparse_query_vector_distance(
+        ref_ind, ref_ptr, ref_data, query_ind, query_ptr, query_data, ndim,
+        metric);
+    using In = typename tdoann::DistanceTraits<decltype(distance_ptr)>::Input;
+    using Idx = typename tdoann::DistanceTraits<decltype(distance_ptr)>::Index;
+
+    auto search_forest_cpp =
+        r_to_sparse_search_forest<In, Idx>(search_forest, n_threads);
+    return rp_forest_graph_query_impl(search_forest_cpp, *distance_ptr,
+                                      reference_graph_list, n_nbrs, cache,
+                                      epsilon, max_search_fraction, n_threads,
+                                      verbose);
+  } else if (margin_type == margin_type_to_string(MarginType::IMPLICIT)) {
+    auto distance_ptr =
+        create_sparse_query_distance(ref_ind, ref_ptr, ref_data, query_ind,
+                                     query_ptr, query_data, ndim, metric);
+    using Idx = typename tdoann::DistanceTraits<decltype(distance_ptr)>::Index;
+
+    auto search_forest_cpp =
+        r_to_search_forest_implicit<Idx>(search_forest, n_threads);
+    return rp_forest_graph_query_impl(search_forest_cpp, *distance_ptr,
+                                      reference_graph_list, n_nbrs, cache,
+                                      epsilon, max_search_fraction, n_threads,
+                                      verbose);
+  } else {
+    Rcpp::stop("Bad search forest type ", margin_type);
+  }
+}
+
 template <typename Tree>
 std::vector<Tree> rnn_score_forest_impl(const IntegerMatrix &idx,
                                         const std::vector<Tree> &search_forest,
@@ -982,3 +955,40 @@ List rnn_score_forest(const IntegerMatrix &idx, const List &search_forest,
     Rcpp::stop("Unknown forest type: ", margin_type);
   }
 }
+
+// [[Rcpp::export]]
+List rnn_rp_forest_remove_deleted(const List &search_forest,
+                                  const LogicalVector &deleted) {
+  using Idx = RNN_DEFAULT_IDX;
+  using In = RNN_DEFAULT_IN;
+
+  if (not search_forest.containsElementNamed("margin")) {
+    Rcpp::stop("Bad forest object passed");
+  }
+  const std::string margin_type = search_forest["margin"];
+  const std::string actual_metric = search_forest["actual_metric"];
+  const auto deleted_vec = r_to_deleted(deleted);
+  constexpr std::size_t n_threads = 0;
+
+  if (margin_type == margin_type_to_string(MarginType::EXPLICIT)) {
+    const bool is_sparse = search_forest["sparse"];
+    if (is_sparse) {
+      auto search_forest_cpp =
+          r_to_sparse_search_forest<In, Idx>(search_forest, n_threads);
+      tdoann::remove_deleted(search_forest_cpp, deleted_vec);
+      return sparse_search_forest_to_r(search_forest_cpp, actual_metric);
+    }
+
+    auto search_forest_cpp =
+        r_to_search_forest<In, Idx>(search_forest, n_threads);
+    tdoann::remove_deleted(search_forest_cpp, deleted_vec);
+    return search_forest_to_r(search_forest_cpp, actual_metric);
+  } else if (margin_type == margin_type_to_string(MarginType::IMPLICIT)) {
+    auto search_forest_cpp =
+        r_to_search_forest_implicit<Idx>(search_forest, n_threads);
+    tdoann::remove_deleted(search_forest_cpp, deleted_vec);
+    return search_forest_implicit_to_r(search_forest_cpp, actual_metric);
+  } else {
+    Rcpp::stop("Unknown forest type: ", margin_type);
+  }
+}
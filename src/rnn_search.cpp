@@ -19,12 +19,9 @@
 
 // NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers,modernize-use-trailing-return-type,readability-magic-numbers)
 
-#include <cmath>
-#include <iomanip>
-#include <sstream>
-
 #include <Rcpp.h>
 
+#include "tdoann/quantize.h"
 #include "tdoann/search.h"
 
 #include "rnn_distance.h"
@@ -33,6 +30,7 @@
 #include "rnn_parallel.h"
 #include "rnn_progress.h"
 #include "rnn_rtoheap.h"
+#include "rnn_util.h"
 
 using Rcpp::IntegerMatrix;
 using Rcpp::IntegerVector;
@@ -41,22 +39,28 @@ using Rcpp::LogicalMatrix;
 using Rcpp::NumericMatrix;
 using Rcpp::NumericVector;
 
-std::string fmt_double(double d, int precision = 2) {
-  std::ostringstream oss;
-  oss << std::fixed << std::setprecision(precision) << d;
-  return oss.str();
-}
-
+// If exact_distance is not null, distance is approximate (e.g. it uses reduced
+// precision or product quantized data): the initial distances are recalculated
+// with distance before the search, and the neighbors found are reranked with
+// exact_distance after
 template <typename Out, typename Idx>
 List nn_query_impl(const tdoann::BaseDistance<Out, Idx> &distance,
                    const List &reference_graph_list,
                    const IntegerMatrix &nn_idx, const NumericMatrix &nn_dist,
                    const std::string &metric, double epsilon,
                    double max_search_fraction, std::size_t n_threads,
-                   bool verbose) {
+                   bool verbose,
+                   const tdoann::BaseDistance<Out, Idx> *exact_distance =
+                       nullptr) {
   const auto search_graph = r_to_sparse_graph<Out, Idx>(reference_graph_list);
   auto nn_heap = r_to_query_heap<tdoann::NNHeap<Out, Idx>>(nn_idx, nn_dist);
 
+  RParallelExecutor executor;
+  if (exact_distance != nullptr) {
+    tdoann::NullProgress init_progress;
+    tdoann::rerank(nn_heap, distance, n_threads, init_progress, executor);
+  }
+
   auto max_distance_calculations =
       static_cast<std::size_t>(search_graph.n_points * max_search_fraction);
 
@@ -70,37 +74,20 @@ List nn_query_impl(const tdoann::BaseDistance<Out, Idx> &distance,
 
   std::vector<std::size_t> distance_counts(nn_heap.n_points, 0);
 
-  RParallelExecutor executor;
   RPProgress progress(verbose);
   tdoann::nn_query(search_graph, nn_heap, distance, epsilon,
                    max_distance_calculations, distance_counts, n_threads,
                    progress, executor);
 
   if (verbose) {
-    std::size_t min_count = 0UL;
-    std::size_t max_count = 0UL;
-    std::size_t sum_counts = 0UL;
-    double n_points = static_cast<double>(search_graph.n_points);
-    for (auto count : distance_counts) {
-      if (count > max_count) {
-        max_count = count;
-      }
-      if (count < min_count) {
-        min_count = count;
-      }
-      sum_counts += count;
+    print_distance_counts(distance_counts, search_graph.n_points);
+  }
+
+  if (exact_distance != nullptr) {
+    if (verbose) {
+      tsmessage() << "Reranking neighbors with exact distances\n";
     }
-    double avg_count = sum_counts / distance_counts.size();
-
-    tsmessage() << "min distance calculation = " << min_count << " ("
-                << fmt_double(100.0 * min_count / n_points)
-                << "%) of reference data\n";
-    tsmessage() << "max distance calculation = " << max_count << " ("
-                << fmt_double(100.0 * max_count / n_points)
-                << "%) of reference data\n";
-    tsmessage() << "avg distance calculation = " << std::lround(avg_count)
-                << " (" << fmt_double(100.0 * avg_count / n_points)
-                << "%) of reference data\n";
+    tdoann::rerank(nn_heap, *exact_distance, n_threads, progress, executor);
   }
 
   return heap_to_r(nn_heap, n_threads, progress, executor);
@@ -110,14 +97,40 @@ List nn_query_impl(const tdoann::BaseDistance<Out, Idx> &distance,
 List rnn_query(const NumericMatrix &reference, const List &reference_graph_list,
                const NumericMatrix &query, const IntegerMatrix &nn_idx,
                const NumericMatrix &nn_dist, const std::string &metric,
-               double epsilon, double max_search_fraction,
-               std::size_t n_threads, bool verbose) {
-  auto distance_ptr = create_query_distance(reference, query, metric);
+               const std::string &precision, double epsilon,
+               double max_search_fraction, std::size_t n_threads,
+               bool verbose) {
+  // the search only uses a small part of the reference data, so it's faster to
+  // read it in place than to copy all of it
+  auto distance_ptr = create_query_view_distance(reference, query, metric);
+  if (precision != "full") {
+    auto quantized_distance_ptr =
+        create_quantized_query_distance(reference, query, metric, precision);
+    return nn_query_impl(*quantized_distance_ptr, reference_graph_list, nn_idx,
+                         nn_dist, metric, epsilon, max_search_fraction,
+                         n_threads, verbose, distance_ptr.get());
+  }
   return nn_query_impl(*distance_ptr, reference_graph_list, nn_idx, nn_dist,
                        metric, epsilon, max_search_fraction, n_threads,
                        verbose);
 }
 
+// Search with approximate distances to the product quantized reference data in
+// pq (see rnn_pq_train), then rerank the neighbors with the exact distances
+// [[Rcpp::export]]
+List rnn_pq_query(const NumericMatrix &reference,
+                  const List &reference_graph_list, const List &pq,
+                  const NumericMatrix &query, const IntegerMatrix &nn_idx,
+                  const NumericMatrix &nn_dist, const std::string &metric,
+                  double epsilon, double max_search_fraction,
+                  std::size_t n_threads, bool verbose) {
+  auto distance_ptr = create_query_view_distance(reference, query, metric);
+  auto pq_distance_ptr = create_pq_query_distance(pq, query, metric);
+  return nn_query_impl(*pq_distance_ptr, reference_graph_list, nn_idx, nn_dist,
+                       metric, epsilon, max_search_fraction, n_threads,
+                       verbose, distance_ptr.get());
+}
+
 // [[Rcpp::export]]
 List rnn_logical_query(const LogicalMatrix &reference,
                        const List &reference_graph_list,
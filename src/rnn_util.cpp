@@ -19,6 +19,8 @@
 
 #include <chrono>
 #include <cmath>
+#include <iomanip>
+#include <sstream>
 #include <thread>
 
 #include <Rcpp.h>
@@ -72,6 +74,40 @@ std::ostream &tsmessage() {
   return Rcerr;
 }
 
+std::string fmt_double(double d, int precision = 2) {
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(precision) << d;
+  return oss.str();
+}
+
+void print_distance_counts(const std::vector<std::size_t> &distance_counts,
+                           std::size_t n_ref_points) {
+  std::size_t min_count = 0UL;
+  std::size_t max_count = 0UL;
+  std::size_t sum_counts = 0UL;
+  double n_points = static_cast<double>(n_ref_points);
+  for (auto count : distance_counts) {
+    if (count > max_count) {
+      max_count = count;
+    }
+    if (count < min_count) {
+      min_count = count;
+    }
+    sum_counts += count;
+  }
+  double avg_count = sum_counts / distance_counts.size();
+
+  tsmessage() << "min distance calculation = " << min_count << " ("
+              << fmt_double(100.0 * min_count / n_points)
+              << "%) of reference data\n";
+  tsmessage() << "max distance calculation = " << max_count << " ("
+              << fmt_double(100.0 * max_count / n_points)
+              << "%) of reference data\n";
+  tsmessage() << "avg distance calculation = " << std::lround(avg_count)
+              << " (" << fmt_double(100.0 * avg_count / n_points)
+              << "%) of reference data\n";
+}
+
 void zero_index(IntegerMatrix &matrix, int max_idx, bool missing_ok) {
   const int min_idx = missing_ok ? -1 : 0;
   for (auto j = 0; j < matrix.ncol(); j++) {
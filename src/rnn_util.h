@@ -39,6 +39,9 @@ std::ostream &tsmessage();
 void ts(const std::string &);
 void zero_index(Rcpp::IntegerMatrix &, int max_idx = RNND_MAX_IDX,
                 bool missing_ok = false);
+// log the min, max and mean number of distance calculations per query
+void print_distance_counts(const std::vector<std::size_t> &distance_counts,
+                           std::size_t n_ref_points);
 
 // by default we do NOT unzero unlike heap_to_r
 template <typename Out>
@@ -135,6 +138,18 @@ inline auto r_to_idxt(const Rcpp::IntegerMatrix &nn_idx,
   return idx_vec;
 }
 
+// logical vector of deleted items to the tombstones used by the graphs
+inline auto r_to_deleted(const Rcpp::LogicalVector &deleted)
+    -> std::vector<uint8_t> {
+  const std::size_t n = deleted.size();
+  std::vector<uint8_t> deleted_vec(n, 0);
+  for (std::size_t i = 0; i < n; ++i) {
+    deleted_vec[i] =
+        deleted[i] == NA_LOGICAL ? 0 : static_cast<uint8_t>(deleted[i]);
+  }
+  return deleted_vec;
+}
+
 template <typename Out = RNN_DEFAULT_DIST, typename Idx = RNN_DEFAULT_IDX>
 auto r_to_sparse_graph(const Rcpp::IntegerMatrix &idx,
                        const Rcpp::NumericMatrix &dist)
@@ -156,9 +171,13 @@ auto r_to_sparse_graph(const Rcpp::IntegerMatrix &idx,
 template <typename Out = RNN_DEFAULT_DIST, typename Idx = RNN_DEFAULT_IDX>
 auto r_to_sparse_graph(const Rcpp::List &reference_graph)
     -> tdoann::SparseNNGraph<Out, Idx> {
-  return tdoann::SparseNNGraph<Out, Idx>(reference_graph["row_ptr"],
-                                         reference_graph["col_idx"],
-                                         reference_graph["dist"]);
+  tdoann::SparseNNGraph<Out, Idx> graph(reference_graph["row_ptr"],
+                                        reference_graph["col_idx"],
+                                        reference_graph["dist"]);
+  if (reference_graph.containsElementNamed("deleted")) {
+    graph.deleted = r_to_deleted(reference_graph["deleted"]);
+  }
+  return graph;
 }
 
 template <typename SparseNNGraph>